@@ -0,0 +1,954 @@
+#define GLFW_EXPOSE_NATIVE_WIN32
+#define GLFW_EXPOSE_NATIVE_WGL
+#include <GLFW/glfw3.h>
+#include <GLFW/glfw3native.h>
+
+#if defined(_WIN32)
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <random>
+#include <thread>
+#include <glm/glm.hpp>
+
+#include "enginecore/AsyncDataUploader.hpp"
+#include "enginecore/BakedModel.hpp"
+#include "enginecore/Camera.hpp"
+#include "enginecore/GLBLoader.hpp"
+#include "enginecore/GLFWUtils.hpp"
+#include "enginecore/MipGenerator.hpp"
+#include "enginecore/Model.hpp"
+#include "enginecore/RingBuffer.hpp"
+#include "enginecore/VertexKernels.hpp"
+#include "vulkancore/Buffer.hpp"
+#include "vulkancore/CommandQueueManager.hpp"
+#include "vulkancore/Context.hpp"
+#include "vulkancore/Framebuffer.hpp"
+#include "vulkancore/ParallelCommandRecorder.hpp"
+#include "vulkancore/Pipeline.hpp"
+#include "vulkancore/RenderPass.hpp"
+#include "vulkancore/Sampler.hpp"
+#include "vulkancore/Texture.hpp"
+
+GLFWwindow* window_ = nullptr;
+EngineCore::Camera camera(glm::vec3(-9.f, 2.f, 2.f));
+
+namespace {
+
+constexpr uint32_t CAMERA_SET = 0;
+constexpr uint32_t TEXTURES_SET = 1;
+constexpr uint32_t SAMPLER_SET = 2;
+constexpr uint32_t STORAGE_BUFFER_SET = 3;
+constexpr uint32_t FEEDBACK_SET = 4;
+constexpr uint32_t BINDING_0 = 0;
+
+constexpr VkFormat swapChainFormat = VK_FORMAT_B8G8R8A8_UNORM;
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                   start)
+      .count();
+}
+
+// Private memory committed by the process, file mappings aren't included
+size_t privateBytes() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS_EX counters = {};
+  GetProcessMemoryInfo(GetCurrentProcess(),
+                       reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+                       sizeof(counters));
+  return counters.PrivateUsage;
+#else
+  std::ifstream statm("/proc/self/statm");
+  size_t size = 0, resident = 0, shared = 0;
+  statm >> size >> resident >> shared;
+  return (resident - shared) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Polls privateBytes() on a thread from construction until stop(), to catch the peak of
+// allocations that are freed before the measured work returns
+class PeakMemorySampler {
+ public:
+  PeakMemorySampler() : baseline_(privateBytes()), peak_(baseline_) {
+    thread_ = std::thread([this]() {
+      while (!done_) {
+        peak_ = std::max(peak_, privateBytes());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+
+  ~PeakMemorySampler() {
+    if (thread_.joinable()) {
+      stop();
+    }
+  }
+
+  // Returns the peak above the memory in use at construction
+  size_t stop() {
+    done_ = true;
+    thread_.join();
+    peak_ = std::max(peak_, privateBytes());
+    return peak_ > baseline_ ? peak_ - baseline_ : 0;
+  }
+
+ private:
+  size_t baseline_;
+  size_t peak_;
+  std::atomic_bool done_ = false;
+  std::thread thread_;
+};
+
+// Submits commandBuffer and waits for it, so each benchmark starts with an idle queue
+void submitAndWait(VulkanCore::Context& context,
+                   VulkanCore::CommandQueueManager& queueMgr,
+                   VkCommandBuffer commandBuffer, VkPipelineStageFlags flags) {
+  queueMgr.endCmdBuffer(commandBuffer);
+  const auto submitInfo =
+      context.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
+  queueMgr.submit(&submitInfo);
+  queueMgr.goToNextCmdBuffer();
+  queueMgr.waitUntilAllSubmitsAreComplete();
+}
+
+// The Bistro scene of the MultiDrawIndirect recipe, uploaded from its baked version with
+// placeholder textures, and everything needed to create its pipeline
+struct Scene {
+  Scene(VulkanCore::Context& context, VulkanCore::CommandQueueManager& commandMgr)
+      : context(context),
+        cameraBuffer(context.swapchain()->numberImages(), context,
+                     sizeof(UniformTransforms)) {
+    emptyTexture = context.createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VkExtent3D{.width = 1, .height = 1, .depth = 1}, 1, 1,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, VK_SAMPLE_COUNT_1_BIT,
+        "Empty Texture");
+
+    const auto bakedBistro = EngineCore::BakedModel::loadOrBake(
+        "resources/assets/Bistro.glb", "resources/cache");
+    ASSERT(bakedBistro, "Unable to load or bake Bistro.glb");
+    numMeshes = static_cast<uint32_t>(bakedBistro->meshes().size());
+
+    const auto commandBuffer = commandMgr.getCmdBufferToBegin();
+    emptyTexture->transitionImageLayout(commandBuffer,
+                                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    samplers.emplace_back(context.createSampler(
+        VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, 10.0f,
+        "default sampler"));
+    EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer, *bakedBistro,
+                                       buffers, samplers);
+    textures.resize(bakedBistro->textures().size(), emptyTexture);
+    submitAndWait(context, commandMgr, commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    feedbackBuffer = context.createBuffer(
+        sizeof(uint32_t) * std::max<size_t>(textures.size(), 1),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+        "Unused texture feedback");
+
+    depthTexture = context.createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_D24_UNORM_S8_UINT, 0,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        {
+            .width = context.swapchain()->extent().width,
+            .height = context.swapchain()->extent().height,
+            .depth = 1,
+        },
+        1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, VK_SAMPLE_COUNT_1_BIT,
+        "depth buffer");
+
+    const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
+    VulkanCore::ShaderModule::setSpirvCacheDirectory("resources/cache/spirv");
+    const auto shaders = context.createShaderModules({
+        {
+            .filePath = (resourcesFolder / "indirectdraw.vert").string(),
+            .stages = VK_SHADER_STAGE_VERTEX_BIT,
+            .name = "main vertex",
+        },
+        {
+            .filePath = (resourcesFolder / "indirectdraw.frag").string(),
+            .stages = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .name = "main fragment",
+        },
+    });
+
+    const auto& limits = context.physicalDevice().properties().properties.limits;
+    bindlessTextureCount =
+        context.isDescriptorBufferEnabled()
+            ? std::min({limits.maxPerStageDescriptorSampledImages,
+                        limits.maxDescriptorSetSampledImages, 1u << 16})
+            : VulkanCore::MAX_DESC_BINDLESS;
+
+    const VkShaderStageFlags allStages =
+        VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    gpDesc = {
+        .sets_ =
+            {
+                {
+                    .set_ = CAMERA_SET,
+                    .bindings_ = {VkDescriptorSetLayoutBinding(
+                        0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, allStages)},
+                },
+                {
+                    .set_ = TEXTURES_SET,
+                    .bindings_ = {VkDescriptorSetLayoutBinding(
+                        0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, bindlessTextureCount,
+                        allStages)},
+                },
+                {
+                    .set_ = SAMPLER_SET,
+                    .bindings_ = {VkDescriptorSetLayoutBinding(
+                        0, VK_DESCRIPTOR_TYPE_SAMPLER, 1000, allStages)},
+                },
+                {
+                    .set_ = STORAGE_BUFFER_SET,
+                    .bindings_ = {VkDescriptorSetLayoutBinding(
+                        0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, allStages)},
+                },
+                {
+                    .set_ = FEEDBACK_SET,
+                    .bindings_ = {VkDescriptorSetLayoutBinding(
+                        0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                        VK_SHADER_STAGE_FRAGMENT_BIT)},
+                },
+            },
+        .vertexShader_ = shaders[0],
+        .fragmentShader_ = shaders[1],
+        .dynamicStates_ = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
+                           VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE},
+        .colorTextureFormats = {swapChainFormat},
+        .depthTextureFormat = depthTexture->vkFormat(),
+        .sampleCount = VK_SAMPLE_COUNT_1_BIT,
+        .cullMode = VK_CULL_MODE_NONE,
+        .viewport = context.swapchain()->extent(),
+        .depthTestEnable = true,
+        .depthWriteEnable = true,
+        .depthCompareOperation = VK_COMPARE_OP_LESS,
+        .useDescriptorBuffer_ = true,
+    };
+
+    renderPass = context.createRenderPass(
+        {context.swapchain()->texture(0), depthTexture},
+        {VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR},
+        {VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_STORE_OP_DONT_CARE},
+        {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL},
+        VK_PIPELINE_BIND_POINT_GRAPHICS, {}, "benchmark render pass");
+  }
+
+  // Creates the pipeline of the MultiDrawIndirect recipe and binds the scene to it
+  std::shared_ptr<VulkanCore::Pipeline> createPipeline() {
+    auto pipeline =
+        context.createGraphicsPipeline(gpDesc, renderPass->vkRenderPass(), "main");
+    pipeline->allocateDescriptors({
+        {.set_ = CAMERA_SET, .count_ = 1},
+        {.set_ = TEXTURES_SET, .count_ = 1},
+        {.set_ = SAMPLER_SET, .count_ = 1},
+        {.set_ = STORAGE_BUFFER_SET, .count_ = 1},
+        {.set_ = FEEDBACK_SET, .count_ = 1},
+    });
+    pipeline->bindResource(CAMERA_SET, BINDING_0, 0, cameraBuffer.buffer(0), 0,
+                           sizeof(UniformTransforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    pipeline->bindResource(STORAGE_BUFFER_SET, BINDING_0, 0,
+                           {buffers[0], buffers[1], buffers[3],
+                            buffers[2]},  // vertex, index, indirect, material
+                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    pipeline->bindResource(TEXTURES_SET, BINDING_0, 0,
+                           {textures.begin(), textures.end()});
+    pipeline->bindResource(SAMPLER_SET, BINDING_0, 0, {samplers.begin(), 1});
+    pipeline->bindResource(FEEDBACK_SET, BINDING_0, 0, feedbackBuffer, 0,
+                           static_cast<uint32_t>(feedbackBuffer->size()),
+                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    return pipeline;
+  }
+
+  VulkanCore::Context& context;
+  std::shared_ptr<VulkanCore::Texture> emptyTexture;
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> buffers;
+  std::vector<std::shared_ptr<VulkanCore::Texture>> textures;
+  std::vector<std::shared_ptr<VulkanCore::Sampler>> samplers;
+  EngineCore::RingBuffer cameraBuffer;
+  std::shared_ptr<VulkanCore::Buffer> feedbackBuffer;
+  std::shared_ptr<VulkanCore::Texture> depthTexture;
+  uint32_t numMeshes = 0;
+  uint32_t bindlessTextureCount = 0;
+  VulkanCore::Pipeline::GraphicsPipelineDescriptor gpDesc;
+  std::shared_ptr<VulkanCore::RenderPass> renderPass;
+};
+
+// Compares the per-vertex ingestion path (Vertex::applyTransform, to16bitVertex and a
+// per-vertex AABB update) with the batched kernels on each supported instruction set
+void benchmarkVertexKernels() {
+  constexpr size_t vertexCount = 1 << 20;
+  constexpr int iterations = 10;
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  std::vector<EngineCore::Vertex> vertices(vertexCount);
+  for (auto& vertex : vertices) {
+    vertex.pos = glm::vec3(distribution(generator), distribution(generator),
+                           distribution(generator));
+    vertex.normal = glm::normalize(glm::vec3(distribution(generator), 1.0f, 0.0f));
+    vertex.tangent = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+    vertex.texCoord = glm::vec2(distribution(generator), distribution(generator));
+    vertex.material = 0;
+  }
+  const glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 2.0f, 3.0f)) *
+                      glm::mat4_cast(glm::quat(glm::vec3(0.3f, 0.2f, 0.1f))) *
+                      glm::scale(glm::mat4(1.0f), glm::vec3(2.0f));
+
+  auto timeMs = [](auto&& work) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      work();
+    }
+    return elapsedMs(start) / iterations;
+  };
+
+  std::vector<EngineCore::Vertex> transformed;
+  std::vector<EngineCore::Vertex16Bit> packed(vertexCount);
+  const double perVertexMs = timeMs([&]() {
+    transformed = vertices;
+    glm::vec3 minAABB(999999.0f), maxAABB(-999999.0f);
+    for (size_t i = 0; i < vertexCount; ++i) {
+      transformed[i].applyTransform(m);
+      packed[i] = EngineCore::to16bitVertex(transformed[i]);
+      minAABB = glm::min(minAABB, transformed[i].pos);
+      maxAABB = glm::max(maxAABB, transformed[i].pos);
+    }
+  });
+  std::cerr << "Per vertex: " << perVertexMs << " ms" << std::endl;
+
+  std::vector<float> source(vertexCount * 14);
+  for (size_t i = 0; i < vertexCount; ++i) {
+    const auto& v = vertices[i];
+    const float components[] = {
+        v.pos.x,     v.pos.y,     v.pos.z,      v.normal.x,   v.normal.y,
+        v.normal.z,  v.tangent.x, v.tangent.y,  v.tangent.z,  v.tangent.w,
+        v.texCoord.x, v.texCoord.y, v.texCoord1.x, v.texCoord1.y};
+    for (size_t c = 0; c < 14; ++c) {
+      source[c * vertexCount + i] = components[c];
+    }
+  }
+  std::vector<float> scratch(source.size());
+  const EngineCore::VertexStreams streams{
+      .posX = scratch.data(),
+      .posY = scratch.data() + vertexCount,
+      .posZ = scratch.data() + vertexCount * 2,
+      .normalX = scratch.data() + vertexCount * 3,
+      .normalY = scratch.data() + vertexCount * 4,
+      .normalZ = scratch.data() + vertexCount * 5,
+      .tangentX = scratch.data() + vertexCount * 6,
+      .tangentY = scratch.data() + vertexCount * 7,
+      .tangentZ = scratch.data() + vertexCount * 8,
+      .tangentW = scratch.data() + vertexCount * 9,
+      .texCoordU = scratch.data() + vertexCount * 10,
+      .texCoordV = scratch.data() + vertexCount * 11,
+      .texCoord1U = scratch.data() + vertexCount * 12,
+      .texCoord1V = scratch.data() + vertexCount * 13,
+      .count = vertexCount,
+  };
+
+  using EngineCore::VertexKernels::InstructionSet;
+  const auto defaultSet = EngineCore::VertexKernels::instructionSet();
+  for (auto set : {InstructionSet::Scalar, InstructionSet::SSE, InstructionSet::AVX2}) {
+    if (set > EngineCore::VertexKernels::supportedInstructionSet()) {
+      break;
+    }
+    EngineCore::VertexKernels::setInstructionSet(set);
+    const double batchedMs = timeMs([&]() {
+      scratch = source;
+      glm::vec3 minAABB(999999.0f), maxAABB(-999999.0f);
+      const glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(m));
+      EngineCore::VertexKernels::transform(m, normalMatrix, streams, minAABB, maxAABB);
+      EngineCore::VertexKernels::packHalf(streams, 0, packed.data());
+    });
+    std::cerr << "Batched " << EngineCore::VertexKernels::instructionSetName(set) << ": "
+              << batchedMs << " ms (" << perVertexMs / batchedMs << "x)" << std::endl;
+  }
+  EngineCore::VertexKernels::setInstructionSet(defaultSet);
+}
+
+// Decodes the model with 1..N threads and reports the timings of each load phase
+void benchmarkLoadThreads() {
+  const uint32_t maxThreads = std::thread::hardware_concurrency();
+  for (uint32_t threads = 1; threads <= maxThreads; ++threads) {
+    BS::thread_pool benchmarkPool(threads);
+    EngineCore::GLBLoader loader;
+    const auto start = std::chrono::steady_clock::now();
+    auto model =
+        loader.loadMapped("resources/assets/Bistro.glb", benchmarkPool, [](int, int) {});
+    benchmarkPool.wait_for_tasks();
+    const double totalMs = elapsedMs(start);
+    const auto& loadStats = loader.lastLoadStats();
+    std::cerr << threads << " threads: document " << loadStats.documentParseMs
+              << " ms, mesh decode " << loadStats.meshDecodeMs << " ms, mesh assemble "
+              << loadStats.meshAssembleMs << " ms, total with textures " << totalMs
+              << " ms" << std::endl;
+  }
+}
+
+// Loads every GLB of the assets directory with load(path), load(bytes) and loadMapped,
+// textures included, and reports the time and peak private memory of each
+void benchmarkLoadFiles() {
+  std::vector<std::filesystem::path> glbFiles;
+  for (const auto& entry : std::filesystem::directory_iterator("resources/assets")) {
+    if (entry.is_regular_file() && entry.path().extension() == ".glb") {
+      glbFiles.push_back(entry.path());
+    }
+  }
+  std::sort(glbFiles.begin(), glbFiles.end());
+
+  for (const auto& path : glbFiles) {
+    std::cerr << path.filename().string() << " ("
+              << std::filesystem::file_size(path) / (1024 * 1024) << " MB)" << std::endl;
+
+    // The model is still alive when the peak is taken, so it is part of every number
+    const auto measure = [](const char* name, const auto& load) {
+      PeakMemorySampler sampler;
+      const auto start = std::chrono::steady_clock::now();
+      const auto model = load();
+      const double loadMs = elapsedMs(start);
+      const size_t peakBytes = sampler.stop();
+      std::cerr << "  " << name << ": " << loadMs << " ms, peak "
+                << peakBytes / (1024 * 1024) << " MB" << std::endl;
+    };
+
+    const std::string filePath = path.string();
+    EngineCore::GLBLoader loader;
+    measure("load(path)", [&]() { return loader.load(filePath); });
+    // Reading the file is part of the cost of this overload
+    measure("load(bytes)", [&]() {
+      std::vector<char> bytes(std::filesystem::file_size(path));
+      std::ifstream file(path, std::ios::binary);
+      file.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+      return loader.load(bytes);
+    });
+    measure("loadMapped", [&]() { return loader.loadMapped(filePath); });
+  }
+}
+
+// Uploads thousands of small textures through the AsyncDataUploader
+void benchmarkUploads(VulkanCore::Context& context, VulkanCore::CommandQueueManager&) {
+  constexpr uint32_t textureCount = 4096;
+  constexpr uint32_t textureSize = 256;
+  std::vector<uint8_t> textureData(textureSize * textureSize * 4);
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> distribution(0, 255);
+  for (auto& texel : textureData) {
+    texel = static_cast<uint8_t>(distribution(generator));
+  }
+
+  std::vector<std::shared_ptr<VulkanCore::Texture>> stressTextures(textureCount);
+  for (uint32_t i = 0; i < textureCount; ++i) {
+    stressTextures[i] = context.createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VkExtent3D{.width = textureSize, .height = textureSize, .depth = 1u}, 1, 1,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, VK_SAMPLE_COUNT_1_BIT,
+        "stress " + std::to_string(i));
+  }
+
+  std::atomic_uint32_t texturesReady = 0;
+  EngineCore::AsyncDataUploader stressUploader(
+      context, [&texturesReady](int, int) { ++texturesReady; });
+  stressUploader.startProcessing();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < textureCount; ++i) {
+    stressUploader.queueTextureUploadTasks({
+        .texture = stressTextures[i].get(),
+        .data = textureData.data(),
+        .index = static_cast<int>(i),
+        .modelIndex = 0,
+    });
+  }
+  stressUploader.waitUntilIdle();
+  const double totalMs = elapsedMs(start);
+
+  const auto uploadStats = stressUploader.stats();
+  std::cerr << texturesReady << " textures (" << uploadStats.bytesUploaded / (1024 * 1024)
+            << " MB) ready in " << totalMs << " ms, " << uploadStats.uploadSubmits
+            << " transfer submits, " << uploadStats.mipGenSubmits
+            << " mip generation submits (" << uploadStats.texturesMipsComputed
+            << " textures in compute), max queue depth "
+            << uploadStats.maxUploadQueueDepth << ", latency "
+            << uploadStats.averageLatencyMs << " ms average, "
+            << uploadStats.maxLatencyMs << " ms max" << std::endl;
+}
+
+// Times generating the mips of batches of textures with blits and with the MipGenerator,
+// on the graphics queue and on an async compute queue
+void benchmarkMips(VulkanCore::Context& context,
+                   VulkanCore::CommandQueueManager& commandMgr) {
+  constexpr uint32_t textureCount = 1024;
+  constexpr int rounds = 5;
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2,
+  };
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  VK_CHECK(vkCreateQueryPool(context.device(), &queryPoolInfo, nullptr, &queryPool));
+  const double timestampPeriodNs =
+      context.physicalDevice().properties().properties.limits.timestampPeriod;
+
+  std::optional<VulkanCore::CommandQueueManager> computeMgr;
+  if (context.physicalDevice().computeFamilyIndex().has_value()) {
+    computeMgr.emplace(context.createComputeCommandQueue(
+        1, 1, "mip benchmark compute command queue", -1, true));
+  }
+  std::unique_ptr<EngineCore::MipGenerator> mipGenerator;
+  if (EngineCore::MipGenerator::isSupported(context)) {
+    mipGenerator = std::make_unique<EngineCore::MipGenerator>(context);
+  }
+
+  // Average GPU and recording times of what record(queueMgr, commandBuffer) records
+  const auto measure = [&](VulkanCore::CommandQueueManager& queueMgr,
+                           const auto& record) {
+    double gpuMs = 0.0;
+    double cpuMs = 0.0;
+    for (int round = 0; round < rounds; ++round) {
+      const auto commandBuffer = queueMgr.getCmdBufferToBegin();
+      vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+      const auto start = std::chrono::steady_clock::now();
+      record(queueMgr, commandBuffer);
+      cpuMs += elapsedMs(start) / rounds;
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+                          1);
+      submitAndWait(context, queueMgr, commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+      std::array<uint64_t, 2> timestamps;
+      VK_CHECK(vkGetQueryPoolResults(
+          context.device(), queryPool, 0, 2, sizeof(timestamps), timestamps.data(),
+          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+      gpuMs += (timestamps[1] - timestamps[0]) * timestampPeriodNs / 1e6 / rounds;
+    }
+    return std::pair{gpuMs, cpuMs};
+  };
+
+  for (const uint32_t textureSize : {128u, 256u, 512u}) {
+    std::vector<std::shared_ptr<VulkanCore::Texture>> mipTextures(textureCount);
+    std::vector<VulkanCore::Texture*> texturePointers(textureCount);
+    for (uint32_t i = 0; i < textureCount; ++i) {
+      mipTextures[i] = context.createTexture(
+          VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
+          VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+              VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+          VkExtent3D{.width = textureSize, .height = textureSize, .depth = 1u}, 1, 1,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, VK_SAMPLE_COUNT_1_BIT,
+          "mip benchmark " + std::to_string(i));
+      texturePointers[i] = mipTextures[i].get();
+    }
+
+    // The timings don't depend on the texels, level 0 is only cleared
+    measure(commandMgr, [&](VulkanCore::CommandQueueManager&, VkCommandBuffer cmd) {
+      const VkClearColorValue color = {.float32 = {0.2f, 0.4f, 0.6f, 1.0f}};
+      const VkImageSubresourceRange range = {
+          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+          .levelCount = 1,
+          .layerCount = 1,
+      };
+      for (auto* texture : texturePointers) {
+        texture->transitionImageLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdClearColorImage(cmd, texture->vkImage(),
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+      }
+    });
+
+    const auto [blitGpuMs, blitCpuMs] =
+        measure(commandMgr, [&](VulkanCore::CommandQueueManager&, VkCommandBuffer cmd) {
+          for (auto* texture : texturePointers) {
+            texture->transitionImageLayout(cmd, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            texture->generateMips(cmd);
+          }
+        });
+    std::cerr << textureCount << " textures of " << textureSize << "x" << textureSize
+              << ": blits " << blitGpuMs << " ms on the GPU, " << blitCpuMs
+              << " ms to record" << std::endl;
+
+    if (!mipGenerator) {
+      std::cerr << "Subgroup quad operations aren't supported in compute shaders"
+                << std::endl;
+      continue;
+    }
+    const auto computeMips = [&](VulkanCore::CommandQueueManager& queueMgr,
+                                 VkCommandBuffer cmd) {
+      mipGenerator->generateMips(queueMgr, cmd, texturePointers);
+    };
+    const auto [spdGpuMs, spdCpuMs] = measure(commandMgr, computeMips);
+    std::cerr << "  single pass downsampler " << spdGpuMs << " ms on the GPU, "
+              << spdCpuMs << " ms to record, "
+              << (textureCount + mipGenerator->texturesPerDispatch() - 1) /
+                     mipGenerator->texturesPerDispatch()
+              << " dispatches" << std::endl;
+
+    if (computeMgr) {
+      // The textures aren't transferred to the compute queue's family, so their
+      // contents are undefined there, which doesn't matter for the timings
+      const double asyncGpuMs = measure(*computeMgr, computeMips).first;
+      std::cerr << "  single pass downsampler on the async compute queue " << asyncGpuMs
+                << " ms on the GPU" << std::endl;
+    }
+  }
+
+  vkDestroyQueryPool(context.device(), queryPool, nullptr);
+}
+
+// Times the creation of a batch of pipelines with a cold and a warm pipeline cache
+void benchmarkPipelines(VulkanCore::Context& context,
+                        VulkanCore::CommandQueueManager& commandMgr) {
+  // The cache on disk isn't loaded, so the context's pipeline cache is empty until the
+  // first batch. Drivers may still keep their own shader cache between runs
+  Scene scene(context, commandMgr);
+
+  // Variations of the main pipeline, so there is something to compile in parallel
+  std::vector<VulkanCore::Context::GraphicsPipelineRequest> requests;
+  for (const auto cullMode :
+       {VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_FRONT_BIT}) {
+    for (const auto topology :
+         {VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_LINE_LIST}) {
+      for (const bool blendEnable : {false, true}) {
+        auto desc = scene.gpDesc;
+        desc.cullMode = cullMode;
+        desc.primitiveTopology = topology;
+        desc.blendEnable = blendEnable;
+        requests.push_back({desc, scene.renderPass->vkRenderPass(),
+                            "benchmark " + std::to_string(requests.size())});
+      }
+    }
+  }
+
+  const auto createBatchMs = [&](uint32_t numThreads) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto pipelines = context.createGraphicsPipelines(requests, numThreads);
+    return elapsedMs(start);
+  };
+  const uint32_t numThreads = std::thread::hardware_concurrency();
+  const double coldMs = createBatchMs(numThreads);
+  const double warmMs = createBatchMs(numThreads);
+  const double warmSerialMs = createBatchMs(1);
+  std::cerr << requests.size() << " pipelines, cold pipeline cache: " << coldMs
+            << " ms on " << numThreads << " threads, warm: " << warmMs << " ms on "
+            << numThreads << " threads, " << warmSerialMs << " ms on 1 thread"
+            << std::endl;
+}
+
+// Times the recording of a large number of draws inline and on 1..N threads
+void benchmarkRecording(VulkanCore::Context& context,
+                        VulkanCore::CommandQueueManager& commandMgr) {
+  Scene scene(context, commandMgr);
+  const auto pipeline = scene.createPipeline();
+
+  // One indirect draw per mesh, repeated until there are drawCount of them, recorded
+  // into an offscreen framebuffer so no swapchain image needs to be acquired
+  constexpr uint32_t targetDrawCount = 200000;
+  constexpr int framesPerThreadCount = 20;
+  const uint32_t numMeshes = scene.numMeshes;
+  const uint32_t drawCount = (targetDrawCount + numMeshes - 1) / numMeshes * numMeshes;
+  const uint32_t stride = sizeof(EngineCore::IndirectDrawCommandAndMeshData);
+  const std::array<VkClearValue, 2> clearValues = {
+      VkClearValue{.color = {0.0f, 0.0f, 0.0f, 0.0f}},
+      VkClearValue{.depthStencil = {1.0f}}};
+
+  auto offscreenTexture = context.createTexture(
+      VK_IMAGE_TYPE_2D, swapChainFormat, 0, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+      {
+          .width = context.swapchain()->extent().width,
+          .height = context.swapchain()->extent().height,
+          .depth = 1,
+      },
+      1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, VK_SAMPLE_COUNT_1_BIT,
+      "recording benchmark color");
+  const auto offscreenFramebuffer = context.createFramebuffer(
+      scene.renderPass->vkRenderPass(), {offscreenTexture, scene.depthTexture}, nullptr,
+      nullptr, "recording benchmark framebuffer");
+
+  const auto recordDraws = [&](VkCommandBuffer cmdBuffer, uint32_t first,
+                               uint32_t count) {
+    const VkViewport viewport = {
+        .x = 0.0f,
+        .y = static_cast<float>(context.swapchain()->extent().height),
+        .width = static_cast<float>(context.swapchain()->extent().width),
+        .height = -static_cast<float>(context.swapchain()->extent().height),
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+    const VkRect2D scissor = {.extent = context.swapchain()->extent()};
+    vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+    vkCmdSetDepthTestEnable(cmdBuffer, VK_TRUE);
+    pipeline->bind(cmdBuffer);
+    pipeline->bindDescriptorSets(cmdBuffer,
+                                 {
+                                     {.set = CAMERA_SET, .bindIdx = 0},
+                                     {.set = TEXTURES_SET, .bindIdx = 0},
+                                     {.set = SAMPLER_SET, .bindIdx = 0},
+                                     {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+                                     {.set = FEEDBACK_SET, .bindIdx = 0},
+                                 });
+    vkCmdBindIndexBuffer(cmdBuffer, scene.buffers[1]->vkBuffer(), 0,
+                         VK_INDEX_TYPE_UINT32);
+    for (uint32_t draw = first; draw < first + count; ++draw) {
+      vkCmdDrawIndexedIndirect(cmdBuffer, scene.buffers[3]->vkBuffer(),
+                               VkDeviceSize(draw % numMeshes) * stride, 1, stride);
+    }
+  };
+
+  // Returns the average CPU time to record a frame, inline in the primary command
+  // buffer when recorder is null
+  const auto recordFramesMs = [&](VulkanCore::ParallelCommandRecorder* recorder,
+                                  BS::thread_pool* benchmarkPool, uint32_t threads) {
+    double totalMs = 0.0;
+    for (int frameIndex = 0; frameIndex < framesPerThreadCount; ++frameIndex) {
+      auto commandBuffer = commandMgr.getCmdBufferToBegin();
+      const auto start = std::chrono::steady_clock::now();
+      const VkRenderPassBeginInfo renderpassInfo = {
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = scene.renderPass->vkRenderPass(),
+          .framebuffer = offscreenFramebuffer->vkFramebuffer(),
+          .renderArea = {.extent = context.swapchain()->extent()},
+          .clearValueCount = static_cast<uint32_t>(clearValues.size()),
+          .pClearValues = clearValues.data(),
+      };
+      vkCmdBeginRenderPass(commandBuffer, &renderpassInfo,
+                           recorder ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                    : VK_SUBPASS_CONTENTS_INLINE);
+      if (recorder) {
+        recorder->record(commandMgr, commandBuffer,
+                         {
+                             .renderPass = scene.renderPass->vkRenderPass(),
+                             .framebuffer = offscreenFramebuffer->vkFramebuffer(),
+                         },
+                         drawCount, *benchmarkPool, recordDraws, threads);
+      } else {
+        recordDraws(commandBuffer, 0, drawCount);
+      }
+      vkCmdEndRenderPass(commandBuffer);
+      commandMgr.endCmdBuffer(commandBuffer);
+      totalMs += elapsedMs(start);
+
+      const VkPipelineStageFlags flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      const auto submitInfo =
+          context.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
+      commandMgr.submit(&submitInfo);
+      commandMgr.goToNextCmdBuffer();
+    }
+    return totalMs / framesPerThreadCount;
+  };
+
+  pipeline->updateDescriptorSets();
+  const uint32_t maxThreads = std::thread::hardware_concurrency();
+  VulkanCore::ParallelCommandRecorder recorder(context, commandMgr.queueFamilyIndex(),
+                                               maxThreads, "recording benchmark");
+
+  const double inlineMs = recordFramesMs(nullptr, nullptr, 1);
+  std::cerr << drawCount << " draws, inline: " << inlineMs << " ms" << std::endl;
+  for (uint32_t threads = 1; threads <= maxThreads; ++threads) {
+    // The calling thread records a chunk too
+    BS::thread_pool benchmarkPool(std::max(threads - 1, 1u));
+    const double frameMs = recordFramesMs(&recorder, &benchmarkPool, threads);
+    std::cerr << drawCount << " draws, " << threads << " threads: " << frameMs << " ms ("
+              << inlineMs / frameMs << "x)" << std::endl;
+  }
+
+  commandMgr.waitUntilAllSubmitsAreComplete();
+}
+
+// Compares the cost of writing and binding descriptors with descriptor sets and with a
+// descriptor buffer
+void benchmarkDescriptors(VulkanCore::Context& context,
+                          VulkanCore::CommandQueueManager& commandMgr) {
+  Scene scene(context, commandMgr);
+
+  constexpr int rounds = 100;
+  constexpr uint32_t bindCount = 10000;
+  // Descriptors are only written when they change, so each round swaps every texture of
+  // the bindless array with the other one
+  const std::array<std::shared_ptr<VulkanCore::Texture>, 2> benchmarkTextures = {
+      scene.emptyTexture,
+      context.createTexture(VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
+                            VK_IMAGE_USAGE_SAMPLED_BIT, {1, 1, 1}, 1, 1,
+                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                            VK_SAMPLE_COUNT_1_BIT, "descriptor benchmark texture"),
+  };
+
+  const auto runBenchmark = [&](bool useDescriptorBuffer) {
+    auto desc = scene.gpDesc;
+    desc.useDescriptorBuffer_ = useDescriptorBuffer;
+    // Same array size in both modes
+    desc.sets_[TEXTURES_SET].bindings_[0].descriptorCount = VulkanCore::MAX_DESC_BINDLESS;
+    auto benchmarkPipeline = context.createGraphicsPipeline(
+        desc, scene.renderPass->vkRenderPass(),
+        useDescriptorBuffer ? "descriptor buffer benchmark" : "descriptor set benchmark");
+    benchmarkPipeline->allocateDescriptors({
+        {.set_ = CAMERA_SET, .count_ = 1},
+        {.set_ = TEXTURES_SET, .count_ = 1},
+        {.set_ = SAMPLER_SET, .count_ = 1},
+        {.set_ = STORAGE_BUFFER_SET, .count_ = 1},
+    });
+    benchmarkPipeline->bindResource(CAMERA_SET, BINDING_0, 0,
+                                    scene.cameraBuffer.buffer(0), 0,
+                                    sizeof(UniformTransforms),
+                                    VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    benchmarkPipeline->bindResource(
+        STORAGE_BUFFER_SET, BINDING_0, 0,
+        {scene.buffers[0], scene.buffers[1], scene.buffers[3], scene.buffers[2]},
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    benchmarkPipeline->bindResource(SAMPLER_SET, BINDING_0, 0,
+                                    {scene.samplers.begin(), 1});
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+      for (uint32_t i = 0; i < VulkanCore::MAX_DESC_BINDLESS; ++i) {
+        auto texture = benchmarkTextures[(round + i) % 2];
+        benchmarkPipeline->bindResource(TEXTURES_SET, BINDING_0, 0, {&texture, 1},
+                                        nullptr, i);
+      }
+      benchmarkPipeline->updateDescriptorSets();
+    }
+    const double updateMs = elapsedMs(start) / rounds;
+
+    auto commandBuffer = commandMgr.getCmdBufferToBegin();
+    start = std::chrono::steady_clock::now();
+    benchmarkPipeline->bind(commandBuffer);
+    for (uint32_t i = 0; i < bindCount; ++i) {
+      benchmarkPipeline->bindDescriptorSets(commandBuffer,
+                                            {
+                                                {.set = CAMERA_SET, .bindIdx = 0},
+                                                {.set = TEXTURES_SET, .bindIdx = 0},
+                                                {.set = SAMPLER_SET, .bindIdx = 0},
+                                                {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+                                            });
+    }
+    const double bindMs = elapsedMs(start);
+    submitAndWait(context, commandMgr, commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+    const auto stats = benchmarkPipeline->descriptorStats();
+    std::cerr << (useDescriptorBuffer ? "Descriptor buffer: " : "Descriptor sets: ")
+              << "writing " << VulkanCore::MAX_DESC_BINDLESS << " textures " << updateMs
+              << " ms, " << bindCount << " binds of 4 sets " << bindMs << " ms, "
+              << stats.poolDescriptors << " pool descriptors, "
+              << stats.descriptorBufferBytes << " descriptor buffer bytes" << std::endl;
+  };
+
+  runBenchmark(false);
+  if (context.isDescriptorBufferEnabled()) {
+    runBenchmark(true);
+    std::cerr << "Bindless textures with a descriptor buffer: "
+              << scene.bindlessTextureCount << std::endl;
+  } else {
+    std::cerr << "VK_EXT_descriptor_buffer isn't supported" << std::endl;
+  }
+}
+
+using DeviceBenchmark = void (*)(VulkanCore::Context&, VulkanCore::CommandQueueManager&);
+
+// Creates a window, a context with the features of the MultiDrawIndirect recipe and a
+// graphics command queue, and runs benchmark on them
+void runOnDevice(DeviceBenchmark benchmark) {
+  initWindow(&window_, &camera);
+
+  const std::vector<std::string> instExtension = {
+      VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+      VK_KHR_SURFACE_EXTENSION_NAME,
+      VK_EXT_DEBUG_UTILS_EXTENSION_NAME,
+      VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+  };
+
+  const std::vector<std::string> deviceExtension = {
+    VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+#if defined(VK_EXT_descriptor_buffer)
+    VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME,
+#endif
+  };
+
+  std::vector<std::string> validationLayers;
+#ifdef _DEBUG
+  validationLayers.push_back("VK_LAYER_KHRONOS_validation");
+#endif
+
+  VulkanCore::Context::enableDefaultFeatures();
+  VulkanCore::Context::enableIndirectRenderingFeature();
+  VulkanCore::Context::enableSynchronization2Feature();
+  VulkanCore::Context::enableBufferDeviceAddressFeature();
+  VulkanCore::Context::enableDescriptorBufferFeature();
+
+  VulkanCore::Context context((void*)glfwGetWin32Window(window_),
+                              validationLayers,  // layers
+                              instExtension,     // instance extensions
+                              deviceExtension,   // device extensions
+                              VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT |
+                                  VK_QUEUE_COMPUTE_BIT,
+                              true);
+
+  context.createSwapchain(swapChainFormat, VK_COLORSPACE_SRGB_NONLINEAR_KHR,
+                          VK_PRESENT_MODE_MAILBOX_KHR,
+                          context.physicalDevice().surfaceCapabilities().minImageExtent);
+  const auto framesInFlight = static_cast<uint32_t>(context.swapchain()->numberImages());
+  auto commandMgr = context.createGraphicsCommandQueue(
+      framesInFlight, framesInFlight, "benchmark command", -1, true);
+
+  benchmark(context, commandMgr);
+
+  vkDeviceWaitIdle(context.device());
+}
+
+struct Benchmark {
+  std::string flag;
+  std::string description;
+  std::function<void()> run;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::vector<Benchmark> benchmarks = {
+      {"--kernels", "per vertex vs batched vertex kernels", benchmarkVertexKernels},
+      {"--load", "Bistro.glb load phases on 1..N threads", benchmarkLoadThreads},
+      {"--load-files", "load(path), load(bytes) and loadMapped of every asset GLB",
+       benchmarkLoadFiles},
+      {"--uploads", "4096 texture uploads through the AsyncDataUploader",
+       [] { runOnDevice(benchmarkUploads); }},
+      {"--mips", "mip generation with blits and the MipGenerator",
+       [] { runOnDevice(benchmarkMips); }},
+      {"--pipelines", "parallel pipeline creation, cold and warm cache",
+       [] { runOnDevice(benchmarkPipelines); }},
+      {"--recording", "recording 200000 draws inline and on 1..N threads",
+       [] { runOnDevice(benchmarkRecording); }},
+      {"--descriptors", "descriptor sets vs descriptor buffer",
+       [] { runOnDevice(benchmarkDescriptors); }},
+  };
+
+  const std::string flag = argc > 1 ? argv[1] : "";
+  const auto benchmark =
+      std::find_if(benchmarks.begin(), benchmarks.end(),
+                   [&flag](const Benchmark& b) { return b.flag == flag; });
+  if (benchmark == benchmarks.end()) {
+    std::cerr << "Usage: " << argv[0] << " <benchmark>" << std::endl;
+    for (const auto& b : benchmarks) {
+      std::cerr << "  " << b.flag << ": " << b.description << std::endl;
+    }
+    return 1;
+  }
+
+  benchmark->run();
+  return 0;
+}
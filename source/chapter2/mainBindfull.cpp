@@ -4,6 +4,7 @@
 #include <GLFW/glfw3native.h>
 #include <stb_image.h>
 
+#include <algorithm>
 #include <array>
 #include <filesystem>
 #include <gli/gli.hpp>
@@ -273,12 +274,10 @@ int main(int argc, char* argv[]) {
 
   pipelineWithTexture->allocateDescriptors({
       {.set_ = CAMERA_SET, .count_ = 3},
-      {.set_ = TEXTURES_AND_SAMPLER_SET, .count_ = uint32_t(textures.size() + 1)},
   });
 
   pipelineWithoutTexture->allocateDescriptors({
       {.set_ = CAMERA_SET, .count_ = 3},
-      {.set_ = TEXTURES_AND_SAMPLER_SET, .count_ = 1},
   });
 
   pipelineWithTexture->bindResource(CAMERA_SET, BINDING_0, 0, cameraBuffer.buffer(0), 0,
@@ -301,20 +300,31 @@ int main(int argc, char* argv[]) {
                                        0, sizeof(UniformTransforms),
                                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-  // just use any texture (could be a dummy texture)
-  pipelineWithoutTexture->bindResource(TEXTURES_AND_SAMPLER_SET, BINDING_0, 0,
-                                       {textures.begin(), 1});
-
-  pipelineWithoutTexture->bindResource(TEXTURES_AND_SAMPLER_SET, BINDING_1, 0,
-                                       {samplers.begin(), 1});
-
-  for (uint32_t i = 0; i < textures.size(); ++i) {
-    pipelineWithTexture->bindResource(TEXTURES_AND_SAMPLER_SET, BINDING_0, i,
-                                      {textures.begin() + i, 1});
-    pipelineWithTexture->bindResource(TEXTURES_AND_SAMPLER_SET, BINDING_1, i,
-                                      {samplers.begin(), 1});
+  // Meshes that use the same texture share a descriptor set, and textures no mesh uses
+  // don't get one
+  std::vector<uint32_t> meshTextureSets(numMeshes);
+  for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
+    const auto materialIdx = bistro->meshes[meshIdx].material;
+    const auto textureId =
+        materialIdx != -1 ? bistro->materials[materialIdx].basecolorTextureId : -1;
+
+    // Meshes without a texture just use any texture (could be a dummy texture)
+    auto pipeline = textureId == -1 ? pipelineWithoutTexture : pipelineWithTexture;
+    meshTextureSets[meshIdx] = pipeline->descriptorSetFor(
+        TEXTURES_AND_SAMPLER_SET,
+        {
+            {.binding_ = BINDING_0,
+             .textures_ = {textures.begin() + std::max(textureId, 0), 1}},
+            {.binding_ = BINDING_1, .samplers_ = {samplers.begin(), 1}},
+        });
   }
 
+  const auto withTextureStats = pipelineWithTexture->descriptorStats();
+  std::cerr << "Descriptor sets: " << withTextureStats.descriptorSets << " in "
+            << withTextureStats.descriptorPools << " pools with "
+            << withTextureStats.poolDescriptors << " descriptors ("
+            << withTextureStats.cachedSetHits << " meshes reused a set)" << std::endl;
+
 #pragma endregion
 
   float r = 0.6f, g = 0.6f, b = 1.f;
@@ -337,6 +347,17 @@ int main(int argc, char* argv[]) {
     if (delta > 1) {
       const auto fps = static_cast<double>(frame - previousFrame) / delta;
       std::cerr << "FPS: " << fps << std::endl;
+
+      uint64_t writesIssued = 0, writesSkipped = 0;
+      for (const auto& pipeline : {pipelineWithTexture, pipelineWithoutTexture}) {
+        const auto stats = pipeline->descriptorStats();
+        writesIssued += stats.writesIssued;
+        writesSkipped += stats.writesSkipped;
+        pipeline->resetDescriptorStats();
+      }
+      std::cerr << "Descriptor writes/frame: "
+                << static_cast<double>(writesIssued) / (frame - previousFrame)
+                << " (skipped: " << writesSkipped << ")" << std::endl;
       previousFrame = frame;
       time = now;
     }
@@ -426,13 +447,11 @@ int main(int argc, char* argv[]) {
       pipeline->bindIndexBuffer(commandBuffer, buffers[indexbufferIndex]->vkBuffer());
 
       pipeline->bindDescriptorSets(
-          commandBuffer,
-          {
-              {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
-              {.set = TEXTURES_AND_SAMPLER_SET,
-               .bindIdx =
-                   uint32_t(mat.basecolorTextureId == -1 ? 0 : mat.basecolorTextureId)},
-          });
+          commandBuffer, {
+                             {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
+                             {.set = TEXTURES_AND_SAMPLER_SET,
+                              .bindIdx = meshTextureSets[meshIdx]},
+                         });
 
       const auto vertexCount = buffers[indexbufferIndex]->size() / sizeof(uint32_t);
 
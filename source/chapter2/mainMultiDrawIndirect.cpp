@@ -4,19 +4,23 @@
 #include <GLFW/glfw3native.h>
 #include <stb_image.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <filesystem>
 #include <gli/gli.hpp>
 #include <glm/glm.hpp>
 #include <tracy/Tracy.hpp>
 
 #include "enginecore/AsyncDataUploader.hpp"
+#include "enginecore/BakedModel.hpp"
 #include "enginecore/Camera.hpp"
 #include "enginecore/GLBLoader.hpp"
 #include "enginecore/GLFWUtils.hpp"
 #include "enginecore/ImguiManager.hpp"
 #include "enginecore/Model.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "enginecore/TextureStreamer.hpp"
 #include "vulkancore/Buffer.hpp"
 #include "vulkancore/CommandQueueManager.hpp"
 #include "vulkancore/Context.hpp"
@@ -32,7 +36,19 @@
 
 GLFWwindow* window_ = nullptr;
 EngineCore::Camera camera(glm::vec3(-9.f, 2.f, 2.f));
+
 int main(int argc, char* argv[]) {
+  // Loads the model from its baked version (baking it on first run) instead of the GLB.
+  // --baked-compressed bakes the textures to BC formats, if the device supports them
+  const bool compressTextures = argc > 1 && std::string(argv[1]) == "--baked-compressed";
+
+  // Starts the baked textures at their mip tails and streams finer levels in as the
+  // frames sample them, within the VRAM budget
+  const bool streamTextures = argc > 1 && std::string(argv[1]) == "--stream";
+
+  const bool useBakedModel = compressTextures || streamTextures ||
+                             (argc > 1 && std::string(argv[1]) == "--baked");
+
   initWindow(&window_, &camera);
 
 #pragma region Context initialization
@@ -51,6 +67,9 @@ int main(int argc, char* argv[]) {
     VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
 #if defined(VK_EXT_fragment_density_map)
     VK_EXT_FRAGMENT_DENSITY_MAP_EXTENSION_NAME,
+#endif
+#if defined(VK_EXT_descriptor_buffer)
+    VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME,
 #endif
   };
 
@@ -65,13 +84,18 @@ int main(int argc, char* argv[]) {
                                                          // barriers
   VulkanCore::Context::enableBufferDeviceAddressFeature();
   VulkanCore::Context::enableFragmentDensityMapFeatures();
+  VulkanCore::Context::enableDescriptorBufferFeature();
+  VulkanCore::Context::enableTextureCompressionFeatures();
 
   VulkanCore::Context context((void*)glfwGetWin32Window(window_),
                               validationLayers,  // layers
                               instExtension,     // instance extensions
                               deviceExtension,   // device extensions
-                              VkQueueFlags(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT),
-                              true);
+                              VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT, true);
+
+  // Saved back when the context is destroyed, so the next run starts warm
+  std::filesystem::create_directories("resources/cache");
+  context.loadPipelineCache("resources/cache/pipelines.bin");
 #pragma endregion
 
 #pragma region Swapchain initialization
@@ -87,8 +111,10 @@ int main(int argc, char* argv[]) {
 #pragma endregion
 
   // Create command pools
+  // Frames are tracked by timeline value, so finished frames are retired without
+  // waiting on a fence
   auto commandMgr = context.createGraphicsCommandQueue(
-      context.swapchain()->numberImages(), framesInFlight, "main command");
+      context.swapchain()->numberImages(), framesInFlight, "main command", -1, true);
 
 #pragma region Tracy initialization
 #if defined(VK_EXT_calibrated_timestamps)
@@ -113,6 +139,7 @@ int main(int argc, char* argv[]) {
   constexpr uint32_t SAMPLER_SET = 2;
   constexpr uint32_t STORAGE_BUFFER_SET =
       3;  // storing vertex/index/indirect/material buffer in array
+  constexpr uint32_t FEEDBACK_SET = 4;  // written for the TextureStreamer
   constexpr uint32_t BINDING_0 = 0;
   constexpr uint32_t BINDING_1 = 1;
   constexpr uint32_t BINDING_2 = 2;
@@ -149,13 +176,24 @@ int main(int argc, char* argv[]) {
 
   EngineCore::AsyncDataUploader dataUploader(context, textureReadyCB);
 
+  std::unique_ptr<EngineCore::TextureStreamer> textureStreamer;
+
+  auto textureStreamedCB = [&pipeline, &textures](
+                               int textureIndex,
+                               std::shared_ptr<VulkanCore::Texture> texture) {
+    textures[textureIndex] = texture;
+    pipeline->bindResource(TEXTURES_SET, BINDING_0, 0,
+                           {textures.begin() + textureIndex, 1}, nullptr, textureIndex);
+  };
+
   auto glbTextureDataLoadedCB = [&context, &bistro, &textures, &dataUploader](
                                     int textureIndex, int modelId) {
     EngineCore::AsyncDataUploader::TextureLoadTask t;
+    // Storage, so the uploader's MipGenerator can generate the mips
     textures[textureIndex] = context.createTexture(
         VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
         VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-            VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
         VkExtent3D{
             .width = static_cast<uint32_t>(bistro->textures[textureIndex]->width),
             .height = static_cast<uint32_t>(bistro->textures[textureIndex]->height),
@@ -182,14 +220,58 @@ int main(int argc, char* argv[]) {
           "default sampler"));
 
       ZoneScopedN("Model load");
-      EngineCore::GLBLoader glbLoader;
-      bistro =
-          glbLoader.load("resources/assets/Bistro.glb", pool, glbTextureDataLoadedCB);
-      TracyVkZone(tracyCtx_, commandBuffer, "Model upload");
-      EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer,
-                                         *bistro.get(), buffers, samplers);
-      textures.resize(bistro->textures.size(), emptyTexture);
-      numMeshes = bistro->meshes.size();
+      if (useBakedModel) {
+        // Meshes, materials and mipmapped textures come straight from the baked file
+        const auto start = std::chrono::steady_clock::now();
+        if (compressTextures && !context.isTextureCompressionBCEnabled()) {
+          std::cerr << "BC textures aren't supported, baking them as RGBA8" << std::endl;
+        }
+        const auto bakedBistro = EngineCore::BakedModel::loadOrBake(
+            "resources/assets/Bistro.glb", "resources/cache",
+            compressTextures && context.isTextureCompressionBCEnabled());
+        ASSERT(bakedBistro, "Unable to load or bake Bistro.glb");
+        numMeshes = static_cast<uint32_t>(bakedBistro->meshes().size());
+        const auto& bakeStats = bakedBistro->bakeStats();
+        if (bakeStats.totalMs > 0.0) {
+          std::cerr << "Baked Bistro.glb in " << bakeStats.totalMs << " ms, "
+                    << (bakeStats.texturesCompressed ? "compressing " : "mipmapping ")
+                    << bakeStats.textureCount << " textures in " << bakeStats.textureMs
+                    << " ms" << std::endl;
+        }
+        std::cerr << "Baked Bistro loaded in "
+                  << std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count()
+                  << " ms" << std::endl;
+        std::cerr << "Textures: " << bakedBistro->textureMemory() / (1024 * 1024)
+                  << " MB, " << bakedBistro->uncompressedTextureMemory() / (1024 * 1024)
+                  << " MB as RGBA8" << std::endl;
+        TracyVkZone(tracyCtx_, commandBuffer, "Model upload");
+        if (streamTextures) {
+          EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer,
+                                             *bakedBistro, buffers, samplers);
+          textureStreamer = std::make_unique<EngineCore::TextureStreamer>(
+              context, bakedBistro, textureStreamedCB);
+          textureStreamer->init(commandMgr, commandBuffer, textures, framesInFlight);
+        } else {
+          EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer,
+                                             *bakedBistro, buffers, textures, samplers);
+        }
+      } else {
+        EngineCore::GLBLoader glbLoader;
+        bistro = glbLoader.loadMapped("resources/assets/Bistro.glb", pool,
+                                      glbTextureDataLoadedCB);
+        const auto& loadStats = glbLoader.lastLoadStats();
+        std::cerr << "Bistro.glb (" << loadStats.fileBytes / (1024 * 1024)
+                  << " MB): document " << loadStats.documentParseMs << " ms, meshes "
+                  << loadStats.meshDecodeMs << " ms on " << loadStats.meshDecodeThreads
+                  << " threads" << std::endl;
+        TracyVkZone(tracyCtx_, commandBuffer, "Model upload");
+        EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer,
+                                           *bistro.get(), buffers, samplers);
+        textures.resize(bistro->textures.size(), emptyTexture);
+        numMeshes = static_cast<uint32_t>(bistro->meshes.size());
+      }
     }
 
     TracyVkCollect(tracyCtx_, commandBuffer);
@@ -200,9 +282,25 @@ int main(int argc, char* argv[]) {
         context.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
     commandMgr.submit(&submitInfo);
     commandMgr.waitUntilSubmitIsComplete();
+
+    const auto stagingStats = context.stagingArena().stats();
+    std::cerr << "Staged " << stagingStats.bytesStaged / (1024 * 1024) << " MB in "
+              << stagingStats.allocations << " uploads ("
+              << stagingStats.dedicatedAllocations << " dedicated), high-water mark "
+              << stagingStats.highWaterMark / (1024 * 1024) << " MB, "
+              << stagingStats.blocksCreated << " blocks created, "
+              << stagingStats.stalls << " stalls" << std::endl;
   }
 #pragma endregion
 
+  // The fragment shader always writes its texture feedback, even if nothing reads it
+  const auto feedbackBuffer =
+      textureStreamer ? textureStreamer->feedbackBuffer()
+                      : context.createBuffer(
+                            sizeof(uint32_t) * std::max<size_t>(textures.size(), 1),
+                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+                            "Unused texture feedback");
+
 #pragma region DepthTexture
   auto depthTexture =
       context.createTexture(VK_IMAGE_TYPE_2D, VK_FORMAT_D24_UNORM_S8_UINT, 0,
@@ -285,12 +383,36 @@ int main(int argc, char* argv[]) {
 
   const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
 
-  const auto vertexShader =
-      context.createShaderModule((resourcesFolder / "indirectdraw.vert").string(),
-                                 VK_SHADER_STAGE_VERTEX_BIT, "main vertex");
-  const auto fragmentShader =
-      context.createShaderModule((resourcesFolder / "indirectdraw.frag").string(),
-                                 VK_SHADER_STAGE_FRAGMENT_BIT, "main fragment");
+  VulkanCore::ShaderModule::setSpirvCacheDirectory("resources/cache/spirv");
+  const auto shaders = context.createShaderModules({
+      {
+          .filePath = (resourcesFolder / "indirectdraw.vert").string(),
+          .stages = VK_SHADER_STAGE_VERTEX_BIT,
+          .name = "main vertex",
+      },
+      {
+          .filePath = (resourcesFolder / "indirectdraw.frag").string(),
+          .stages = VK_SHADER_STAGE_FRAGMENT_BIT,
+          .name = "main fragment",
+      },
+  });
+  const auto& vertexShader = shaders[0];
+  const auto& fragmentShader = shaders[1];
+
+  const auto compileStats = VulkanCore::ShaderModule::compileStats();
+  std::cerr << "Shaders: " << compileStats.cacheHits << " SPIR-V cache hits, "
+            << compileStats.cacheMisses << " misses, preprocessing "
+            << compileStats.preprocessMs << " ms, compiling " << compileStats.compileMs
+            << " ms" << std::endl;
+
+  // With a descriptor buffer a bigger bindless array only costs buffer memory, so it can
+  // be as large as the device allows
+  const auto& limits = context.physicalDevice().properties().properties.limits;
+  const uint32_t bindlessTextureCount =
+      context.isDescriptorBufferEnabled()
+          ? std::min({limits.maxPerStageDescriptorSampledImages,
+                      limits.maxDescriptorSetSampledImages, 1u << 16})
+          : VulkanCore::MAX_DESC_BINDLESS;
 
   const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
       {
@@ -309,7 +431,7 @@ int main(int argc, char* argv[]) {
               {
                   // vector of bindings
                   VkDescriptorSetLayoutBinding(
-                      0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000,
+                      0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, bindlessTextureCount,
                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
@@ -332,6 +454,14 @@ int main(int argc, char* argv[]) {
                       VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
+      {
+          .set_ = FEEDBACK_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_FRAGMENT_BIT),
+              },
+      },
   };
   const VulkanCore::Pipeline::GraphicsPipelineDescriptor gpDesc = {
       .sets_ = setLayout,
@@ -347,6 +477,7 @@ int main(int argc, char* argv[]) {
       .depthTestEnable = true,
       .depthWriteEnable = true,
       .depthCompareOperation = VK_COMPARE_OP_LESS,
+      .useDescriptorBuffer_ = true,
   };
 
   std::vector<std::unique_ptr<VulkanCore::Framebuffer>> swapchain_framebuffers(
@@ -377,6 +508,7 @@ int main(int argc, char* argv[]) {
       {.set_ = TEXTURES_SET, .count_ = 1},
       {.set_ = SAMPLER_SET, .count_ = 1},
       {.set_ = STORAGE_BUFFER_SET, .count_ = 1},
+      {.set_ = FEEDBACK_SET, .count_ = 1},
   });
   pipeline->bindResource(CAMERA_SET, BINDING_0, 0, cameraBuffer.buffer(0), 0,
                          sizeof(UniformTransforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
@@ -390,6 +522,9 @@ int main(int argc, char* argv[]) {
                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
   pipeline->bindResource(TEXTURES_SET, BINDING_0, 0, {textures.begin(), textures.end()});
   pipeline->bindResource(SAMPLER_SET, BINDING_0, 0, {samplers.begin(), 1});
+  pipeline->bindResource(FEEDBACK_SET, BINDING_0, 0, feedbackBuffer, 0,
+                         static_cast<uint32_t>(feedbackBuffer->size()),
+                         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 #pragma endregion
 
   float r = 0.6f, g = 0.6f, b = 1.f;
@@ -415,6 +550,20 @@ int main(int argc, char* argv[]) {
     if (delta > 1) {
       const auto fps = static_cast<double>(frame - previousFrame) / delta;
       std::cerr << "FPS: " << fps << std::endl;
+      if (textureStreamer) {
+        const auto streamStats = textureStreamer->stats();
+        std::cerr << "Textures: " << streamStats.texturesAtFullResolution << " of "
+                  << streamStats.textures << " at full resolution, "
+                  << streamStats.texturesAtMipTail << " at their mip tail, "
+                  << streamStats.texturesStreaming << " streaming, "
+                  << streamStats.residentBytes / (1024 * 1024) << " MB resident of "
+                  << streamStats.fullResolutionBytes / (1024 * 1024) << " MB, budget "
+                  << streamStats.budgetBytes / (1024 * 1024) << " MB, "
+                  << streamStats.streamedIn << " streamed in ("
+                  << streamStats.bytesStreamed / (1024 * 1024) << " MB), "
+                  << streamStats.evicted << " evicted ("
+                  << streamStats.evictedOverBudget << " over budget)" << std::endl;
+      }
       previousFrame = frame;
       time = now;
     }
@@ -450,6 +599,10 @@ int main(int argc, char* argv[]) {
           VK_SAMPLE_COUNT_1_BIT);
     }
 
+    if (textureStreamer) {
+      textureStreamer->update(commandMgr, commandBuffer, frame % framesInFlight);
+    }
+
     vkCmdBeginRenderPass(commandBuffer, &renderpassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
     if (imguiMgr) {
@@ -496,6 +649,7 @@ int main(int argc, char* argv[]) {
                                      {.set = TEXTURES_SET, .bindIdx = 0},
                                      {.set = SAMPLER_SET, .bindIdx = 0},
                                      {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+                                     {.set = FEEDBACK_SET, .bindIdx = 0},
                                  });
     pipeline->updateDescriptorSets();
 
@@ -9,7 +9,17 @@ layout(location = 2) in flat int inflatMaterialId;
 
 layout(location = 0) out vec4 outColor;
 
+// One uint per texture, cleared every frame by TextureStreamer: 1 + log2 of the finest
+// resolution sampled, 0 if the texture wasn't sampled
+layout(set = 4, binding = 0) buffer TextureFeedback {
+  uint requiredResolution[];
+};
+
 void main() {
+  // Derivatives are only defined in uniform control flow
+  vec2 dx = dFdx(inTexCoord);
+  vec2 dy = dFdy(inTexCoord);
+
   int basecolorIndex = -1;
   uint basecolorSamplerIndex = 0;
 
@@ -24,6 +34,15 @@ void main() {
     outColor = texture(sampler2D(BindlessImage2D[basecolorIndex],
                                  BindlessSampler[basecolorSamplerIndex]),
                        inTexCoord);
+
+    // A pixel steps 1 / resolution through the texture at the level it needs, whatever
+    // the size of the texture bound now. Only a pixel out of 16 reports it, neighbours
+    // would mostly repeat the same value
+    if (all(equal(ivec2(gl_FragCoord.xy) & 3, ivec2(0)))) {
+      float texelStep = max(max(length(dx), length(dy)), 1e-6);
+      uint resolution = uint(clamp(ceil(-log2(texelStep)), 0.0, 15.0));
+      atomicMax(requiredResolution[basecolorIndex], resolution + 1);
+    }
   } else {
     outColor = vec4(0.5, .5, 0.5, 1.0);
   }
@@ -4,8 +4,11 @@
 #include <GLFW/glfw3native.h>
 #include <stb_image.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <filesystem>
+#include <random>
 #include <gli/gli.hpp>
 #include <glm/glm.hpp>
 #include <tracy/Tracy.hpp>
@@ -17,7 +20,10 @@
 #include "enginecore/ImguiManager.hpp"
 #include "enginecore/Model.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "enginecore/passes/ClusterCullingComputePass.hpp"
 #include "enginecore/passes/CullingComputePass.hpp"
+#include "enginecore/passes/HierarchicalDepthBufferPass.hpp"
+#include "enginecore/passes/InstanceCullingComputePass.hpp"
 #include "vulkancore/Buffer.hpp"
 #include "vulkancore/CommandQueueManager.hpp"
 #include "vulkancore/Context.hpp"
@@ -33,7 +39,251 @@
 
 GLFWwindow* window_ = nullptr;
 EngineCore::Camera camera(glm::vec3(-9.f, 2.f, 2.f));
+
+// Culls instanceCount random instances with InstanceCullingComputePass, checks the draws
+// against the CPU reference and reports the timings of both. Runs without a window, so
+// it also works on a software implementation (lavapipe, SwiftShader) with
+// preferSoftwareDevice. Returns false if the GPU and CPU results differ
+bool testInstanceCulling(uint32_t instanceCount, bool preferSoftwareDevice) {
+  constexpr uint32_t drawCount = 1000;
+  constexpr int iterations = 10;
+
+  VulkanCore::Context::enableDefaultFeatures();
+  VulkanCore::Context context(
+      VkApplicationInfo{
+          .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+          .pApplicationName = "Culling test",
+          .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+          .apiVersion = VK_API_VERSION_1_3,
+      },
+      {}, {});
+
+  uint32_t physicalDeviceCount = 0;
+  vkEnumeratePhysicalDevices(context.instance(), &physicalDeviceCount, nullptr);
+  std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
+  vkEnumeratePhysicalDevices(context.instance(), &physicalDeviceCount,
+                             physicalDevices.data());
+  ASSERT(!physicalDevices.empty(), "No Vulkan device found");
+  auto physicalDevice = physicalDevices.front();
+  for (const auto device : physicalDevices) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    if ((properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) == preferSoftwareDevice) {
+      physicalDevice = device;
+      break;
+    }
+  }
+  context.createVkDevice(physicalDevice, {},
+                         VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT, "culling test");
+  std::cerr << "Device: " << context.physicalDevice().properties().properties.deviceName
+            << std::endl;
+
+  auto commandMgr = context.createGraphicsCommandQueue(1, 1, "culling test");
+  const auto submitAndWait = [&commandMgr](VkCommandBuffer commandBuffer) {
+    commandMgr.endCmdBuffer(commandBuffer);
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+    };
+    commandMgr.submit(&submitInfo);
+    commandMgr.waitUntilSubmitIsComplete();
+    commandMgr.goToNextCmdBuffer();
+  };
+
+#pragma region Random scene
+  // Instances are sorted by draw, as the pass expects
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> size(0.5f, 5.0f);
+  std::vector<InstanceCullingComputePass::InstanceBounds> instances(instanceCount);
+  for (uint32_t i = 0; i < instanceCount; ++i) {
+    instances[i] = {
+        .center =
+            glm::vec3(position(generator), position(generator), position(generator)),
+        .drawIndex = uint32_t(uint64_t(i) * drawCount / instanceCount),
+        .extents = glm::vec3(size(generator), size(generator), size(generator)),
+    };
+  }
+  std::vector<EngineCore::IndirectDrawCommandAndMeshData> draws(drawCount);
+  for (uint32_t i = 0; i < drawCount; ++i) {
+    draws[i].command = {.indexCount = 36, .instanceCount = 0, .firstInstance = 0};
+    draws[i].meshId = i;
+  }
+  for (uint32_t i = 0; i < instanceCount; ++i) {
+    ++draws[instances[i].drawIndex].command.instanceCount;
+  }
+  for (uint32_t i = 1; i < drawCount; ++i) {
+    draws[i].command.firstInstance =
+        draws[i - 1].command.firstInstance + draws[i - 1].command.instanceCount;
+  }
+
+  EngineCore::Camera testCamera(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.5f));
+  const auto frustumPlanes = testCamera.calculateFrustumPlanes();
+#pragma endregion
+
+  auto instanceBuffer = context.createBuffer(
+      sizeof(InstanceCullingComputePass::InstanceBounds) * instanceCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "test instances");
+  auto drawBuffer = context.createBuffer(
+      sizeof(EngineCore::IndirectDrawCommandAndMeshData) * drawCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "test draws");
+  {
+    const auto commandBuffer = commandMgr.getCmdBufferToBegin();
+    context.uploadToGPUBuffer(commandMgr, commandBuffer, instanceBuffer.get(),
+                              instances.data(), instanceBuffer->size());
+    context.uploadToGPUBuffer(commandMgr, commandBuffer, drawBuffer.get(), draws.data(),
+                              drawBuffer->size());
+    submitAndWait(commandBuffer);
+  }
+
+  InstanceCullingComputePass cullingPass;
+  cullingPass.init(&context, 1, instanceBuffer, instanceCount, drawBuffer, drawCount);
+
+#pragma region GPU culling
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2,
+  };
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  VK_CHECK(vkCreateQueryPool(context.device(), &queryPoolInfo, nullptr, &queryPool));
+  const double timestampPeriodNs =
+      context.physicalDevice().properties().properties.limits.timestampPeriod;
+
+  double gpuMs = 0.0;
+  for (int i = 0; i < iterations; ++i) {
+    const auto commandBuffer = commandMgr.getCmdBufferToBegin();
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+    cullingPass.cull(commandBuffer, 0, frustumPlanes);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+                        1);
+    submitAndWait(commandBuffer);
+
+    std::array<uint64_t, 2> timestamps;
+    VK_CHECK(vkGetQueryPoolResults(context.device(), queryPool, 0, 2,
+                                   sizeof(timestamps), timestamps.data(),
+                                   sizeof(uint64_t),
+                                   VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    gpuMs += (timestamps[1] - timestamps[0]) * timestampPeriodNs / 1e6 / iterations;
+  }
+  vkDestroyQueryPool(context.device(), queryPool, nullptr);
+
+  const auto culledDraws = cullingPass.culledIndirectDrawBuffer();
+  const auto visibleInstances = cullingPass.visibleInstanceBuffer();
+  auto readback = context.createBuffer(culledDraws->size() + visibleInstances->size(),
+                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VMA_MEMORY_USAGE_GPU_TO_CPU, "culling readback");
+  {
+    const auto commandBuffer = commandMgr.getCmdBufferToBegin();
+    const VkBufferCopy drawsRegion{.size = culledDraws->size()};
+    vkCmdCopyBuffer(commandBuffer, culledDraws->vkBuffer(), readback->vkBuffer(), 1,
+                    &drawsRegion);
+    const VkBufferCopy instancesRegion{.dstOffset = culledDraws->size(),
+                                       .size = visibleInstances->size()};
+    vkCmdCopyBuffer(commandBuffer, visibleInstances->vkBuffer(), readback->vkBuffer(), 1,
+                    &instancesRegion);
+    submitAndWait(commandBuffer);
+  }
+#pragma endregion
+
+#pragma region CPU reference
+  std::vector<std::vector<uint32_t>> expected;
+  const auto cpuStart = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    expected = InstanceCullingComputePass::cullOnCPU(instances, drawCount, frustumPlanes);
+  }
+  const double cpuMs = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - cpuStart)
+                           .count() /
+                       iterations;
+#pragma endregion
+
+  const auto* gpuDraws =
+      reinterpret_cast<const EngineCore::IndirectDrawCommandAndMeshData*>(
+          readback->mappedMemory());
+  const auto* gpuInstances = reinterpret_cast<const uint32_t*>(
+      static_cast<const uint8_t*>(readback->mappedMemory()) + culledDraws->size());
+  uint32_t mismatches = 0;
+  uint64_t visibleCount = 0;
+  for (uint32_t i = 0; i < drawCount; ++i) {
+    const auto& command = gpuDraws[i].command;
+    // The GPU writes the instances of a draw in any order
+    std::vector<uint32_t> visible(gpuInstances + command.firstInstance,
+                                  gpuInstances + command.firstInstance +
+                                      std::min(command.instanceCount,
+                                               draws[i].command.instanceCount));
+    std::sort(visible.begin(), visible.end());
+    if (command.firstInstance != draws[i].command.firstInstance ||
+        command.instanceCount != expected[i].size() || visible != expected[i]) {
+      ++mismatches;
+    }
+    visibleCount += expected[i].size();
+  }
+
+  std::cerr << instanceCount << " instances, " << visibleCount << " visible: GPU "
+            << gpuMs << " ms, CPU " << cpuMs << " ms, " << mismatches
+            << " draws differ" << std::endl;
+  return mismatches == 0;
+}
+
+// Loads Bistro with and without instancing and compares the sizes of what's uploaded
+void compareInstancingMemory() {
+  for (const bool instancing : {false, true}) {
+    EngineCore::GLBLoader loader;
+    loader.setInstancing(instancing);
+    const auto start = std::chrono::steady_clock::now();
+    const auto model = loader.load("resources/assets/Bistro.glb");
+    const double loadMs = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - start)
+                              .count();
+    const size_t instanceBytes =
+        sizeof(EngineCore::MeshInstance) * model->instances.size();
+    std::cerr << (instancing ? "Instanced: " : "Transforms baked: ")
+              << model->meshes.size() << " meshes, " << model->instances.size()
+              << " instances, vertices " << model->totalVertexSize / 1024
+              << " KB, indices " << model->totalIndexSize / 1024 << " KB, instances "
+              << instanceBytes / 1024 << " KB, total "
+              << (model->totalVertexSize + model->totalIndexSize + instanceBytes) / 1024
+              << " KB, loaded in " << loadMs << " ms" << std::endl;
+  }
+}
+
 int main(int argc, char* argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "--benchmark-instancing") {
+    compareInstancingMemory();
+    return 0;
+  }
+
+  // --test-culling [instance count] [--software]
+  if (argc > 1 && std::string(argv[1]) == "--test-culling") {
+    const uint32_t instanceCount = argc > 2 ? std::stoul(argv[2]) : 1'000'000;
+    const bool software = argc > 3 && std::string(argv[3]) == "--software";
+    return testInstanceCulling(instanceCount, software) ? 0 : 1;
+  }
+
+  // Loads the model with instancing and culls its instances, with frustum culling only
+  const bool instanced = argc > 1 && std::string(argv[1]) == "--instanced";
+
+  // --meshlets [--mesh-shaders]: splits the meshes into meshlets and culls those, with
+  // frustum and backface culling. They are drawn with mesh shaders if the device
+  // supports VK_EXT_mesh_shader and --mesh-shaders is given
+  const bool meshlets = argc > 1 && std::string(argv[1]) == "--meshlets";
+  const bool preferMeshShaders =
+      meshlets && argc > 2 && std::string(argv[2]) == "--mesh-shaders";
+
+  // --lods [threshold]: builds simplified LODs of the meshes, the culling pass picks the
+  // coarsest one whose error stays under threshold pixels on screen (1 by default)
+  const bool lods = argc > 1 && std::string(argv[1]) == "--lods";
+  const float lodErrorThreshold = lods && argc > 2 ? std::stof(argv[2]) : 1.0f;
+
+  // Occlusion culling is on by default, this compares it with frustum culling alone
+  const bool frustumCullingOnly =
+      instanced || meshlets || (argc > 1 && std::string(argv[1]) == "--frustum-only");
+
   initWindow(&window_, &camera);
 
 #pragma region Context initialization
@@ -44,13 +294,17 @@ int main(int argc, char* argv[]) {
       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
   };
 
-  const std::vector<std::string> deviceExtension = {
+  std::vector<std::string> deviceExtension = {
 #if defined(VK_EXT_calibrated_timestamps)
     VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME,
 #endif
     VK_KHR_SWAPCHAIN_EXTENSION_NAME,
     VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
   };
+  if (preferMeshShaders) {
+    deviceExtension.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+    VulkanCore::Context::enableMeshShaderFeature();
+  }
 
   std::vector<std::string> validationLayers;
 #ifdef _DEBUG
@@ -70,6 +324,13 @@ int main(int argc, char* argv[]) {
       deviceExtension,   // device extensions
       VkQueueFlags(VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT),
       true);
+
+  const bool useMeshShaders = preferMeshShaders && context.isMeshShaderEnabled();
+  if (preferMeshShaders && !useMeshShaders) {
+    std::cerr << "VK_EXT_mesh_shader isn't supported, drawing the meshlets with "
+                 "indexed draws"
+              << std::endl;
+  }
 #pragma endregion
 
 #pragma region Swapchain initialization
@@ -110,6 +371,8 @@ int main(int argc, char* argv[]) {
   constexpr uint32_t SAMPLER_SET = 2;
   constexpr uint32_t STORAGE_BUFFER_SET =
       3;  // storing vertex/index/indirect/material buffer in array
+  constexpr uint32_t INSTANCE_SET = 4;  // instanced only
+  constexpr uint32_t MESHLET_SET = 4;   // mesh shaders only
   constexpr uint32_t BINDING_0 = 0;
   constexpr uint32_t BINDING_1 = 1;
   constexpr uint32_t BINDING_2 = 2;
@@ -140,6 +403,11 @@ int main(int argc, char* argv[]) {
   std::shared_ptr<VulkanCore::Pipeline> pipeline;
 
   CullingComputePass cullingPass;
+  InstanceCullingComputePass instanceCullingPass;
+  std::shared_ptr<VulkanCore::Buffer> instanceBoundsBuffer;
+  ClusterCullingComputePass clusterCullingPass;
+  // See EngineCore::convertMeshlets2Buffers()
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> meshletBuffers;
 
   auto textureReadyCB = [&pipeline, &textures](int textureIndex, int modelId) {
     pipeline->bindResource(TEXTURES_SET, BINDING_0, 0,
@@ -182,13 +450,43 @@ int main(int argc, char* argv[]) {
 
       ZoneScopedN("Model load");
       EngineCore::GLBLoader glbLoader;
+      glbLoader.setInstancing(instanced);
       bistro =
           glbLoader.load("resources/assets/Bistro.glb", pool, glbTextureDataLoadedCB);
+      if (lods) {
+        ZoneScopedN("LOD generation");
+        const auto fullIndexSize = bistro->totalIndexSize;
+        const auto start = std::chrono::steady_clock::now();
+        EngineCore::buildLods(*bistro);
+        const std::chrono::duration<double, std::milli> duration =
+            std::chrono::steady_clock::now() - start;
+        std::cerr << "LODs built in " << duration.count() << " ms, indices grew by "
+                  << 100.0 * (bistro->totalIndexSize - fullIndexSize) / fullIndexSize
+                  << "%" << std::endl;
+      }
       TracyVkZone(tracyCtx_, commandBuffer, "Model upload");
       EngineCore::convertModel2OneBuffer(context, commandMgr, commandBuffer,
                                          *bistro.get(), buffers, samplers);
       textures.resize(bistro->textures.size(), emptyTexture);
       numMeshes = bistro->meshes.size();
+
+      if (instanced) {
+        const auto instanceBounds = InstanceCullingComputePass::instanceBounds(*bistro);
+        instanceBoundsBuffer = context.createBuffer(
+            sizeof(InstanceCullingComputePass::InstanceBounds) * instanceBounds.size(),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, "instance bounds");
+        context.uploadToGPUBuffer(commandMgr, commandBuffer, instanceBoundsBuffer.get(),
+                                  instanceBounds.data(), instanceBoundsBuffer->size());
+      }
+
+      if (meshlets) {
+        EngineCore::buildMeshlets(*bistro);
+        EngineCore::convertMeshlets2Buffers(context, commandMgr, commandBuffer, *bistro,
+                                            meshletBuffers);
+        std::cerr << numMeshes << " meshes split into " << bistro->meshlets.size()
+                  << " meshlets" << std::endl;
+      }
     }
 
     TracyVkCollect(tracyCtx_, commandBuffer);
@@ -203,9 +501,11 @@ int main(int argc, char* argv[]) {
 #pragma endregion
 
 #pragma region DepthTexture
+  // Sampled by the hierarchical depth buffer pass
   auto depthTexture =
-      context.createTexture(VK_IMAGE_TYPE_2D, VK_FORMAT_D24_UNORM_S8_UINT, 0,
-                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      context.createTexture(VK_IMAGE_TYPE_2D, VK_FORMAT_D32_SFLOAT, 0,
+                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                VK_IMAGE_USAGE_SAMPLED_BIT,
                             {
                                 .width = context.swapchain()->extent().width,
                                 .height = context.swapchain()->extent().height,
@@ -217,14 +517,24 @@ int main(int argc, char* argv[]) {
 
   const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
 
-  auto vertexShader =
-      context.createShaderModule((resourcesFolder / "indirectdraw.vert").string(),
-                                 VK_SHADER_STAGE_VERTEX_BIT, "main vertex");
+  auto vertexShader = context.createShaderModule(
+      (resourcesFolder / (instanced ? "indirectdrawinstanced.vert" : "indirectdraw.vert"))
+          .string(),
+      VK_SHADER_STAGE_VERTEX_BIT, "main vertex");
   auto fragmentShader =
       context.createShaderModule((resourcesFolder / "indirectdraw.frag").string(),
                                  VK_SHADER_STAGE_FRAGMENT_BIT, "main fragment");
+  std::shared_ptr<VulkanCore::ShaderModule> meshShader;
+  if (useMeshShaders) {
+    meshShader =
+        context.createShaderModule((resourcesFolder / "indirectdraw.mesh").string(),
+                                   VK_SHADER_STAGE_MESH_BIT_EXT, "main mesh");
+  }
+  // The stage that reads the vertices and transforms
+  const VkShaderStageFlags geometryStage =
+      useMeshShaders ? VK_SHADER_STAGE_MESH_BIT_EXT : VK_SHADER_STAGE_VERTEX_BIT;
 
-  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+  std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
       {
           .set_ = CAMERA_SET,  // set number
           .bindings_ =
@@ -232,7 +542,7 @@ int main(int argc, char* argv[]) {
                   // vector of bindings
                   VkDescriptorSetLayoutBinding(
                       0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
-                      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
+                      geometryStage | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
       {
@@ -242,7 +552,7 @@ int main(int argc, char* argv[]) {
                   // vector of bindings
                   VkDescriptorSetLayoutBinding(
                       0, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1000,
-                      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
+                      geometryStage | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
       {
@@ -252,7 +562,7 @@ int main(int argc, char* argv[]) {
                   // vector of bindings
                   VkDescriptorSetLayoutBinding(
                       0, VK_DESCRIPTOR_TYPE_SAMPLER, 1000,
-                      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
+                      geometryStage | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
       {
@@ -261,14 +571,35 @@ int main(int argc, char* argv[]) {
               {
                   VkDescriptorSetLayoutBinding(
                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4,
-                      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT),
+                      geometryStage | VK_SHADER_STAGE_FRAGMENT_BIT),
               },
       },
   };
+  if (instanced) {
+    setLayout.push_back({
+        .set_ = INSTANCE_SET,
+        .bindings_ =
+            {
+                VkDescriptorSetLayoutBinding(BINDING_0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                             1, VK_SHADER_STAGE_VERTEX_BIT),
+                VkDescriptorSetLayoutBinding(BINDING_1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                             1, VK_SHADER_STAGE_VERTEX_BIT),
+            },
+    });
+  }
+  if (useMeshShaders) {
+    std::vector<VkDescriptorSetLayoutBinding> meshletBindings;
+    for (uint32_t binding = 0; binding < 4; ++binding) {
+      meshletBindings.push_back(VkDescriptorSetLayoutBinding(
+          binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_MESH_BIT_EXT));
+    }
+    setLayout.push_back({.set_ = MESHLET_SET, .bindings_ = meshletBindings});
+  }
   const VulkanCore::Pipeline::GraphicsPipelineDescriptor gpDesc = {
       .sets_ = setLayout,
       .vertexShader_ = vertexShader,
       .fragmentShader_ = fragmentShader,
+      .meshShader_ = meshShader,
       .dynamicStates_ = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR},
       .colorTextureFormats = {swapChainFormat},
       .depthTextureFormat = depthTexture->vkFormat(),
@@ -284,12 +615,38 @@ int main(int argc, char* argv[]) {
       context.swapchain()->numberImages());
 
 #pragma region Render Pass Initialization
-  std::shared_ptr<VulkanCore::RenderPass> renderPass = context.createRenderPass(
-      {context.swapchain()->texture(0), depthTexture},
-      {VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR},
-      {VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_STORE_OP_DONT_CARE},
-      {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL},
-      VK_PIPELINE_BIND_POINT_GRAPHICS, {}, "swapchain render pass ");
+  std::shared_ptr<VulkanCore::RenderPass> renderPass;
+  // Draws the newly visible meshes on top of the ones drawn by renderPass, with occlusion
+  // culling
+  std::shared_ptr<VulkanCore::RenderPass> lateRenderPass;
+  if (frustumCullingOnly) {
+    renderPass = context.createRenderPass(
+        {context.swapchain()->texture(0), depthTexture},
+        {VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR},
+        {VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_STORE_OP_DONT_CARE},
+        {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL},
+        VK_PIPELINE_BIND_POINT_GRAPHICS, {}, "swapchain render pass ");
+  } else {
+    // The depth is left in GENERAL for the hierarchical depth buffer pass
+    renderPass = context.createRenderPass(
+        {context.swapchain()->texture(0), depthTexture},
+        {VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_LOAD_OP_CLEAR},
+        {VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_STORE_OP_STORE},
+        {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL},
+        VK_PIPELINE_BIND_POINT_GRAPHICS, {}, "early render pass ");
+
+    // The late render pass starts from the final layouts of the early one
+    context.swapchain()->texture(0)->setImageLayout(
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    depthTexture->setImageLayout(VK_IMAGE_LAYOUT_GENERAL);
+    lateRenderPass = context.createRenderPass(
+        {context.swapchain()->texture(0), depthTexture},
+        {VK_ATTACHMENT_LOAD_OP_LOAD, VK_ATTACHMENT_LOAD_OP_LOAD},
+        {VK_ATTACHMENT_STORE_OP_STORE, VK_ATTACHMENT_STORE_OP_DONT_CARE},
+        {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_GENERAL},
+        VK_PIPELINE_BIND_POINT_GRAPHICS, {}, "late render pass ");
+  }
 #pragma endregion
 
 #pragma region Swapchain Framebuffers Initialization
@@ -303,29 +660,76 @@ int main(int argc, char* argv[]) {
 
 #pragma region Pipeline initialization
 
-  cullingPass.init(&context, &camera, *bistro.get(), buffers[3]);
-  cullingPass.upload(commandMgr);
+  HierarchicalDepthBufferPass hierarchicalDepthBufferPass;
+  if (!frustumCullingOnly) {
+    hierarchicalDepthBufferPass.init(&context, depthTexture);
+  }
+
+  if (instanced) {
+    instanceCullingPass.init(&context, framesInFlight, instanceBoundsBuffer,
+                             uint32_t(bistro->instances.size()), buffers[3], numMeshes);
+  } else if (meshlets) {
+    clusterCullingPass.init(&context, &camera, framesInFlight, *bistro.get(),
+                            meshletBuffers[0], meshletBuffers[1]);
+  } else {
+    cullingPass.init(&context, &camera, *bistro.get(), buffers[3],
+                     frustumCullingOnly
+                         ? nullptr
+                         : hierarchicalDepthBufferPass.hierarchicalDepthTexture());
+    cullingPass.setLodErrorThreshold(lodErrorThreshold);
+    cullingPass.upload(commandMgr);
+  }
 
   pipeline = context.createGraphicsPipeline(gpDesc, renderPass->vkRenderPass(), "main");
 
-  pipeline->allocateDescriptors({
+  std::vector<VulkanCore::Pipeline::SetAndCount> descriptorCounts = {
       {.set_ = CAMERA_SET, .count_ = 3},
       {.set_ = TEXTURES_SET, .count_ = 1},
       {.set_ = SAMPLER_SET, .count_ = 1},
       {.set_ = STORAGE_BUFFER_SET, .count_ = 1},
-  });
+  };
+  if (instanced) {
+    descriptorCounts.push_back({.set_ = INSTANCE_SET, .count_ = 1});
+  }
+  if (useMeshShaders) {
+    descriptorCounts.push_back({.set_ = MESHLET_SET, .count_ = 1});
+  }
+  pipeline->allocateDescriptors(descriptorCounts);
   pipeline->bindResource(CAMERA_SET, BINDING_0, 0, cameraBuffer.buffer(0), 0,
                          sizeof(UniformTransforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
   pipeline->bindResource(CAMERA_SET, BINDING_0, 1, cameraBuffer.buffer(1), 0,
                          sizeof(UniformTransforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
   pipeline->bindResource(CAMERA_SET, BINDING_0, 2, cameraBuffer.buffer(2), 0,
                          sizeof(UniformTransforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  // The vertex shader reads the draw of gl_DrawID, which counts the visible meshlets
+  // when they are drawn with indexed draws. The mesh shader reads the draws by mesh
+  const auto drawBuffer = meshlets && !useMeshShaders
+                              ? clusterCullingPass.culledIndirectDrawBuffer()
+                              : buffers[3];
   pipeline->bindResource(STORAGE_BUFFER_SET, BINDING_0, 0,
-                         {buffers[0], buffers[1], buffers[3],
+                         {buffers[0], buffers[1], drawBuffer,
                           buffers[2]},  // vertex, index, indirect, material
                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
   pipeline->bindResource(TEXTURES_SET, BINDING_0, 0, {textures.begin(), textures.end()});
   pipeline->bindResource(SAMPLER_SET, BINDING_0, 0, {samplers.begin(), 1});
+  if (instanced) {
+    pipeline->bindResource(INSTANCE_SET, BINDING_0, 0, buffers[4], 0, buffers[4]->size(),
+                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    pipeline->bindResource(INSTANCE_SET, BINDING_1, 0,
+                           instanceCullingPass.visibleInstanceBuffer(), 0,
+                           instanceCullingPass.visibleInstanceBuffer()->size(),
+                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  }
+  if (useMeshShaders) {
+    // Meshlets, their vertices and triangles, then the visible meshlets
+    const std::array<std::shared_ptr<VulkanCore::Buffer>, 4> meshletSetBuffers = {
+        meshletBuffers[0], meshletBuffers[3], meshletBuffers[4],
+        clusterCullingPass.visibleMeshletBuffer()};
+    for (uint32_t binding = 0; const auto& buffer : meshletSetBuffers) {
+      pipeline->bindResource(MESHLET_SET, binding++, 0, buffer, 0, buffer->size(),
+                             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    }
+  }
 #pragma endregion
 
   float r = 0.6f, g = 0.6f, b = 1.f;
@@ -350,7 +754,27 @@ int main(int argc, char* argv[]) {
     const auto delta = now - time;
     if (delta > 1) {
       const auto fps = static_cast<double>(frame - previousFrame) / delta;
-      std::cerr << "FPS: " << fps << std::endl;
+      if (instanced) {
+        std::cerr << "FPS: " << fps << std::endl;
+      } else if (meshlets) {
+        const auto& stats = clusterCullingPass.stats();
+        std::cerr << "FPS: " << fps << " meshlets tested: " << stats.tested
+                  << " frustum culled: " << stats.frustumCulled
+                  << " backface culled: " << stats.backfaceCulled
+                  << " drawn: " << stats.drawn << std::endl;
+      } else {
+        const auto& stats = cullingPass.stats();
+        std::cerr << "FPS: " << fps << " tested: " << stats.tested
+                  << " frustum culled: " << stats.frustumCulled
+                  << " occlusion culled: " << stats.occlusionCulled
+                  << " drawn: " << stats.drawnFirstPhase << " + "
+                  << stats.drawnSecondPhase;
+        if (cullingPass.lodSelectionEnabled()) {
+          std::cerr << " triangles: " << stats.trianglesSubmitted << " / "
+                    << stats.trianglesFullDetail;
+        }
+        std::cerr << std::endl;
+      }
       previousFrame = frame;
       time = now;
     }
@@ -368,11 +792,29 @@ int main(int argc, char* argv[]) {
 
     auto commandBuffer = commandMgr.getCmdBufferToBegin();
 
-    cullingPass.cull(commandBuffer, index);
-    cullingPass.addBarrierForCulledBuffers(
-        commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-        context.physicalDevice().graphicsFamilyIndex().value(),
-        context.physicalDevice().graphicsFamilyIndex().value());
+    if (instanced) {
+      instanceCullingPass.cull(commandBuffer, index, camera.calculateFrustumPlanes());
+      instanceCullingPass.addBarrierForCulledBuffers(
+          commandBuffer,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+          context.physicalDevice().graphicsFamilyIndex().value(),
+          context.physicalDevice().graphicsFamilyIndex().value());
+    } else if (meshlets) {
+      clusterCullingPass.cull(commandBuffer, index);
+      clusterCullingPass.addBarrierForCulledBuffers(
+          commandBuffer,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+              (useMeshShaders ? VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT
+                              : VK_PIPELINE_STAGE_VERTEX_SHADER_BIT),
+          context.physicalDevice().graphicsFamilyIndex().value(),
+          context.physicalDevice().graphicsFamilyIndex().value());
+    } else {
+      cullingPass.cull(commandBuffer, index);
+      cullingPass.addBarrierForCulledBuffers(
+          commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+          context.physicalDevice().graphicsFamilyIndex().value(),
+          context.physicalDevice().graphicsFamilyIndex().value());
+    }
 
     const VkRenderPassBeginInfo renderpassInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -395,7 +837,7 @@ int main(int argc, char* argv[]) {
     if (!imguiMgr) {
       imguiMgr = std::make_unique<EngineCore::GUI::ImguiManager>(
           window_, context, commandBuffer,
-          renderPass ? renderPass->vkRenderPass() : VK_NULL_HANDLE,
+          (lateRenderPass ? lateRenderPass : renderPass)->vkRenderPass(),
           VK_SAMPLE_COUNT_1_BIT);
     }
 
@@ -408,46 +850,118 @@ int main(int argc, char* argv[]) {
       imguiMgr->frameEnd();
     }
 
+    // Both render passes draw with the same states and descriptor sets
+    const auto bindPipeline = [&]() {
 #pragma region Dynamic States
-    const VkViewport viewport = {
-        .x = 0.0f,
-        .y = static_cast<float>(context.swapchain()->extent().height),
-        .width = static_cast<float>(context.swapchain()->extent().width),
-        .height = -static_cast<float>(context.swapchain()->extent().height),
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-    const VkRect2D scissor = {
-        .offset =
-            {
-                0,
-                0,
-            },
-        .extent = context.swapchain()->extent(),
-    };
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+      const VkViewport viewport = {
+          .x = 0.0f,
+          .y = static_cast<float>(context.swapchain()->extent().height),
+          .width = static_cast<float>(context.swapchain()->extent().width),
+          .height = -static_cast<float>(context.swapchain()->extent().height),
+          .minDepth = 0.0f,
+          .maxDepth = 1.0f,
+      };
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+      const VkRect2D scissor = {
+          .offset =
+              {
+                  0,
+                  0,
+              },
+          .extent = context.swapchain()->extent(),
+      };
+      vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 #pragma endregion
 
-#pragma region Render
-
-    pipeline->bind(commandBuffer);
+      pipeline->bind(commandBuffer);
+
+      std::vector<VulkanCore::Pipeline::SetAndBindingIndex> sets = {
+          {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
+          {.set = TEXTURES_SET, .bindIdx = 0},
+          {.set = SAMPLER_SET, .bindIdx = 0},
+          {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+      };
+      if (instanced) {
+        sets.push_back({.set = INSTANCE_SET, .bindIdx = 0});
+      }
+      if (useMeshShaders) {
+        sets.push_back({.set = MESHLET_SET, .bindIdx = 0});
+      }
+      pipeline->bindDescriptorSets(commandBuffer, sets);
+      pipeline->updateDescriptorSets();
+
+      // The meshlet draws have their own indices
+      vkCmdBindIndexBuffer(commandBuffer,
+                           (meshlets ? meshletBuffers[2] : buffers[1])->vkBuffer(), 0,
+                           VK_INDEX_TYPE_UINT32);
+    };
 
-    pipeline->bindDescriptorSets(commandBuffer,
-                                 {
-                                     {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
-                                     {.set = TEXTURES_SET, .bindIdx = 0},
-                                     {.set = SAMPLER_SET, .bindIdx = 0},
-                                     {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
-                                 });
-    pipeline->updateDescriptorSets();
+#pragma region Render
 
-    vkCmdBindIndexBuffer(commandBuffer, buffers[1]->vkBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    bindPipeline();
+
+    if (instanced) {
+      // One draw per mesh, with the mesh's visible instances
+      vkCmdDrawIndexedIndirect(
+          commandBuffer, instanceCullingPass.culledIndirectDrawBuffer()->vkBuffer(), 0,
+          numMeshes, sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+    } else if (useMeshShaders) {
+      // One workgroup per visible meshlet
+      vkCmdDrawMeshTasksIndirectEXT(
+          commandBuffer, clusterCullingPass.culledIndirectDrawCountBuffer()->vkBuffer(),
+          0, 1, sizeof(VkDrawMeshTasksIndirectCommandEXT));
+    } else if (meshlets) {
+      vkCmdDrawIndexedIndirectCount(
+          commandBuffer, clusterCullingPass.culledIndirectDrawBuffer()->vkBuffer(), 0,
+          clusterCullingPass.culledIndirectDrawCountBuffer()->vkBuffer(), 0,
+          clusterCullingPass.meshletCount(),
+          sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+    } else {
+      vkCmdDrawIndexedIndirectCount(
+          commandBuffer, cullingPass.culledIndirectDrawBuffer()->vkBuffer(), 0,
+          cullingPass.culledIndirectDrawCountBuffer()->vkBuffer(), 0, numMeshes,
+          sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+    }
 
-    vkCmdDrawIndexedIndirectCount(
-        commandBuffer, cullingPass.culledIndirectDrawBuffer()->vkBuffer(), 0,
-        cullingPass.culledIndirectDrawCountBuffer()->vkBuffer(), 0, numMeshes,
-        sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+    if (lateRenderPass) {
+      vkCmdEndRenderPass(commandBuffer);
+
+      const VkMemoryBarrier depthBarrier = {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+      };
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &depthBarrier, 0,
+                           nullptr, 0, nullptr);
+
+      hierarchicalDepthBufferPass.generateHierarchicalDepthBuffer(commandBuffer);
+      cullingPass.cullOccluded(commandBuffer, index);
+      // The early fragment tests stage also keeps the late render pass from writing
+      // depth before the hierarchical depth buffer pass is done reading it
+      cullingPass.addBarrierForCulledBuffers(
+          commandBuffer,
+          VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+          context.physicalDevice().graphicsFamilyIndex().value(),
+          context.physicalDevice().graphicsFamilyIndex().value());
+
+      const VkRenderPassBeginInfo lateRenderpassInfo = {
+          .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+          .renderPass = lateRenderPass->vkRenderPass(),
+          .framebuffer = swapchain_framebuffers[index]->vkFramebuffer(),
+          .renderArea = renderpassInfo.renderArea,
+      };
+      vkCmdBeginRenderPass(commandBuffer, &lateRenderpassInfo,
+                           VK_SUBPASS_CONTENTS_INLINE);
+
+      bindPipeline();
+
+      vkCmdDrawIndexedIndirectCount(
+          commandBuffer, cullingPass.newlyVisibleIndirectDrawBuffer()->vkBuffer(), 0,
+          cullingPass.newlyVisibleIndirectDrawCountBuffer()->vkBuffer(), 0, numMeshes,
+          sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+    }
 
 #pragma endregion
 
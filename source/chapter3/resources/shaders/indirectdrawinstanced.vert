@@ -0,0 +1,34 @@
+#version 460
+#extension GL_EXT_nonuniform_qualifier : require
+
+#extension GL_GOOGLE_include_directive : require
+#include "CommonStructs.glsl"
+#include "IndirectCommon.glsl"
+
+layout(set = 4, binding = 0) readonly buffer InstanceBuffer {
+  InstanceData instances[];
+};
+
+// Written by the instance culling pass, gl_InstanceIndex starts at the draw's
+// firstInstance
+layout(set = 4, binding = 1) readonly buffer VisibleInstanceBuffer {
+  uint visibleInstances[];
+};
+
+layout(location = 0) out vec2 outTexCoord;
+layout(location = 1) out flat uint outflatMeshId;
+layout(location = 2) out flat int outflatMaterialId;
+
+void main() {
+  Vertex vertex = vertexAlias[VERTEX_INDEX].vertices[gl_VertexIndex];
+  InstanceData instance = instances[visibleInstances[gl_InstanceIndex]];
+
+  vec3 position = vec3(vertex.posX, vertex.posY, vertex.posZ);
+  vec2 uv = vec2(vertex.uvX, vertex.uvY);
+  gl_Position =
+      MVP.projection * MVP.view * instance.transform * vec4(position, 1.0);
+  outTexCoord = uv;
+  outflatMeshId = instance.meshId;
+  outflatMaterialId =
+      instance.materialIndex != -1 ? instance.materialIndex : vertex.material;
+}
@@ -8,6 +8,7 @@
 #include <filesystem>
 #include <gli/gli.hpp>
 #include <glm/glm.hpp>
+#include <limits>
 #include <memory>
 #include <tracy/Tracy.hpp>
 
@@ -17,11 +18,14 @@
 #include "enginecore/GLFWUtils.hpp"
 #include "enginecore/ImguiManager.hpp"
 #include "enginecore/Model.hpp"
+#include "enginecore/RenderGraph.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "enginecore/passes/CascadedShadowPass.hpp"
 #include "enginecore/passes/CullingComputePass.hpp"
 #include "enginecore/passes/FullScreenPass.hpp"
 #include "enginecore/passes/GBufferPass.hpp"
 #include "enginecore/passes/HierarchicalDepthBufferPass.hpp"
+#include "enginecore/passes/LightClusteringPass.hpp"
 #include "enginecore/passes/LightingPass.hpp"
 #include "enginecore/passes/NoisePass.hpp"
 #include "enginecore/passes/SSAOPass.hpp"
@@ -43,6 +47,30 @@
 GLFWwindow* window_ = nullptr;
 EngineCore::Camera camera(glm::vec3(-9.f, 2.f, 2.f));
 int main(int argc, char* argv[]) {
+  // --cascades: shadows of a directional light in cascades instead of the spot light
+  // shadow map
+  // --lights <count>: that many random point and spot lights, in light clusters
+  // --lights-benchmark: measures the lighting with 1 to 10000 random lights, then exits
+  bool cascades = false;
+  uint32_t clusteredLightCount = 0;
+  bool lightsBenchmark = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--cascades") {
+      cascades = true;
+    } else if (arg == "--lights" && i + 1 < argc) {
+      clusteredLightCount =
+          std::min<uint32_t>(std::stoul(argv[++i]), MAX_CLUSTERED_LIGHTS);
+    } else if (arg == "--lights-benchmark") {
+      lightsBenchmark = true;
+    }
+  }
+  const std::array<uint32_t, 5> benchmarkLightCounts = {1, 10, 100, 1000, 10000};
+  if (lightsBenchmark) {
+    clusteredLightCount = benchmarkLightCounts.front();
+  }
+  const bool clusteredLights = clusteredLightCount > 0;
+
   initWindow(&window_, &camera);
 
 #pragma region Context initialization
@@ -71,6 +99,9 @@ int main(int argc, char* argv[]) {
   VulkanCore::Context::enableSynchronization2Feature();  // needed for acquire/release
                                                          // barriers
   VulkanCore::Context::enableBufferDeviceAddressFeature();
+  if (cascades) {
+    VulkanCore::Context::enableShaderOutputLayerFeature();
+  }
 
   VulkanCore::Context context(
       (void*)glfwGetWin32Window(window_),
@@ -81,6 +112,13 @@ int main(int argc, char* argv[]) {
       true);
 #pragma endregion
 
+  const bool useCascades = cascades && context.isShaderOutputLayerEnabled();
+  if (cascades && !useCascades) {
+    std::cerr << "Shadow cascades need shaderOutputLayer, using the spot light shadow "
+                 "map instead"
+              << std::endl;
+  }
+
 #pragma region Swapchain initialization
   const VkExtent2D extents =
       context.physicalDevice().surfaceCapabilities().minImageExtent;
@@ -161,7 +199,8 @@ int main(int argc, char* argv[]) {
                    context.swapchain()->extent().height);
 
   ShadowPass shadowPass;
-  shadowPass.init(&context);
+
+  CascadedShadowPass cascadedShadowPass;
 
   NoisePass noisePass;
   noisePass.init(&context);
@@ -170,7 +209,12 @@ int main(int argc, char* argv[]) {
   hierarchicalDepthBufferPass.init(&context, gbufferPass.depthTexture());
 
   SSAOPass ssaoPass;
-  ssaoPass.init(&context, gbufferPass.depthTexture());
+
+  LightClusteringPass lightClusteringPass;
+
+  LightingPass lightPass;
+
+  SSRIntersectPass ssrPass;
 
   FullScreenPass fullscreenPass;
   fullscreenPass.init(&context, {swapChainFormat});
@@ -188,17 +232,242 @@ int main(int argc, char* argv[]) {
       .view = lightData.lightCam.viewMatrix(),
       .projection = lightData.lightCam.getProjectMatrix()};
 
-  LightingPass lightPass;
+  uint32_t index = 0;
+  std::unique_ptr<EngineCore::GUI::ImguiManager> imguiMgr = nullptr;
+
+#pragma region Render graph
+  // The shadow map, SSAO, lighting and SSR textures only live during a frame, so they
+  // belong to the graph, which lets the ones that are never used at the same time
+  // share memory
+  EngineCore::RenderGraph renderGraph(context, "deferred");
+  using Usage = EngineCore::RenderGraph::Usage;
+  constexpr auto fragmentStage = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+  constexpr auto computeStage = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
+  const auto gBufferNormal =
+      renderGraph.importTexture("GBuffer normal", gbufferPass.normalTexture());
+  const auto gBufferSpecular =
+      renderGraph.importTexture("GBuffer specular", gbufferPass.specularTexture());
+  const auto gBufferBaseColor =
+      renderGraph.importTexture("GBuffer base color", gbufferPass.baseColorTexture());
+  const auto gBufferPosition =
+      renderGraph.importTexture("GBuffer position", gbufferPass.positionTexture());
+  const auto gBufferDepth =
+      renderGraph.importTexture("GBuffer depth", gbufferPass.depthTexture());
+  const auto noise = renderGraph.importTexture("Noise", noisePass.noiseTexture());
+  const auto hierarchicalDepth = renderGraph.importTexture(
+      "Hierarchical depth", hierarchicalDepthBufferPass.hierarchicalDepthTexture());
+  // Owned by the pass, the graph only creates single layer textures
+  EngineCore::RenderGraph::Resource shadowCascades = 0;
+  if (useCascades) {
+    cascadedShadowPass.init(&context, &camera);
+    shadowCascades = renderGraph.importTexture("Shadow cascades",
+                                               cascadedShadowPass.shadowDepthTexture());
+  }
+
+  const VkExtent2D frameExtent = context.swapchain()->extent();
+  const auto shadowMap = renderGraph.createTexture(
+      "ShadowMap Depth buffer",
+      {
+          .format = VK_FORMAT_D24_UNORM_S8_UINT,
+          // 4x resolution for shadow maps
+          .extent = {frameExtent.width * 4, frameExtent.height * 4},
+          .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                   VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      });
+  const auto ssao = renderGraph.createTexture(
+      "SSAO texture",
+      {
+          .format = VK_FORMAT_R8G8B8A8_UNORM,
+          .extent = frameExtent,
+          .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+      });
+  const auto light = renderGraph.createTexture(
+      "Lighting Pass HDR Buffer",
+      {
+          .format = VK_FORMAT_B8G8R8A8_UNORM,
+          .extent = frameExtent,
+          .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                   VK_IMAGE_USAGE_STORAGE_BIT,
+      });
+  const auto ssr = renderGraph.createTexture(
+      "SSR IntersectTexture",
+      {
+          .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+          .extent = frameExtent,
+          .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+      });
+
+  renderGraph.addPass(
+      "Culling",
+      // Writes the indirect draw buffers, which the graph doesn't track
+      [](auto& builder) { builder.setSideEffects(); },
+      [&](VkCommandBuffer cmd) {
+        cullingPass.cull(cmd, index);
+        cullingPass.addBarrierForCulledBuffers(
+            cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            context.physicalDevice().graphicsFamilyIndex().value(),
+            context.physicalDevice().graphicsFamilyIndex().value());
+      });
+
+  renderGraph.addPass(
+      "GBuffer",
+      [&](auto& builder) {
+        for (const auto texture :
+             {gBufferNormal, gBufferSpecular, gBufferBaseColor, gBufferPosition}) {
+          builder.write(texture, Usage::ColorAttachment);
+        }
+        builder.write(gBufferDepth, Usage::DepthAttachment);
+      },
+      [&](VkCommandBuffer cmd) {
+        gbufferPass.render(cmd, index,
+                           {
+                               {.set = CAMERA_SET, .bindIdx = index},
+                               {.set = TEXTURES_SET, .bindIdx = 0},
+                               {.set = SAMPLER_SET, .bindIdx = 0},
+                               {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+                           },
+                           buffers[1]->vkBuffer(),
+                           cullingPass.culledIndirectDrawBuffer()->vkBuffer(),
+                           cullingPass.culledIndirectDrawCountBuffer()->vkBuffer(),
+                           numMeshes, sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+      });
+
+  if (useCascades) {
+    renderGraph.addPass(
+        "Shadow cascades culling",
+        // Writes the indirect draw buffers of the cascades
+        [](auto& builder) { builder.setSideEffects(); },
+        [&](VkCommandBuffer cmd) { cascadedShadowPass.cull(cmd, index); });
+
+    renderGraph.addPass(
+        "Shadow cascades",
+        [&](auto& builder) { builder.write(shadowCascades, Usage::DepthAttachment); },
+        [&](VkCommandBuffer cmd) { cascadedShadowPass.render(cmd, index); });
+  } else {
+    renderGraph.addPass(
+        "Shadow map",
+        [&](auto& builder) { builder.write(shadowMap, Usage::DepthAttachment); },
+        [&](VkCommandBuffer cmd) {
+          shadowPass.render(cmd, index,
+                            {
+                                {.set = CAMERA_SET, .bindIdx = index},
+                                {.set = TEXTURES_SET, .bindIdx = 0},
+                                {.set = SAMPLER_SET, .bindIdx = 0},
+                                {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
+                            },
+                            buffers[1]->vkBuffer(), buffers[3]->vkBuffer(), numMeshes,
+                            sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+          lightData.lightCam.setNotDirty();
+        });
+  }
+
+  renderGraph.addPass(
+      "Noise", [&](auto& builder) { builder.write(noise, Usage::StorageWrite); },
+      [&](VkCommandBuffer cmd) { noisePass.generateNoise(cmd); });
+
+  renderGraph.addPass(
+      "Hierarchical depth",
+      [&](auto& builder) {
+        builder.read(gBufferDepth, Usage::Sampled, computeStage);
+        builder.write(hierarchicalDepth, Usage::StorageWrite);
+      },
+      [&](VkCommandBuffer cmd) {
+        hierarchicalDepthBufferPass.generateHierarchicalDepthBuffer(cmd);
+      });
+
+  renderGraph.addPass(
+      "SSAO",
+      [&](auto& builder) {
+        builder.read(gBufferDepth, Usage::Sampled, computeStage);
+        builder.write(ssao, Usage::StorageWrite);
+      },
+      [&](VkCommandBuffer cmd) { ssaoPass.run(cmd); });
+
+  if (clusteredLights) {
+    renderGraph.addPass(
+        "Light clustering",
+        [&](auto& builder) {
+          // Writes the light lists of the clusters, which the graph doesn't track
+          builder.setSideEffects();
+          builder.read(gBufferPosition, Usage::Sampled, computeStage);
+        },
+        [&](VkCommandBuffer cmd) { lightClusteringPass.build(cmd, index); });
+  }
+
+  renderGraph.addPass(
+      "Lighting",
+      [&](auto& builder) {
+        for (const auto texture : {gBufferNormal, gBufferSpecular, gBufferBaseColor,
+                                   gBufferPosition, gBufferDepth, ssao,
+                                   useCascades ? shadowCascades : shadowMap}) {
+          builder.read(texture, Usage::Sampled, fragmentStage);
+        }
+        builder.write(light, Usage::ColorAttachment);
+      },
+      [&](VkCommandBuffer cmd) {
+        lightPass.render(cmd, index, lightData, camera.viewMatrix(),
+                         camera.getProjectMatrix());
+      });
+
+  renderGraph.addPass(
+      "SSR",
+      [&](auto& builder) {
+        for (const auto texture :
+             {gBufferNormal, gBufferSpecular, light, hierarchicalDepth, noise}) {
+          builder.read(texture, Usage::Sampled, computeStage);
+        }
+        builder.write(ssr, Usage::StorageWrite);
+      },
+      [&](VkCommandBuffer cmd) { ssrPass.run(cmd); });
+
+  renderGraph.addPass(
+      "Present",
+      [&](auto& builder) {
+        // Renders to the swapchain image, and the UI can show the shadow map instead
+        builder.setSideEffects();
+        builder.read(ssr, Usage::Sampled, fragmentStage);
+        if (!useCascades) {
+          builder.read(shadowMap, Usage::Sampled, fragmentStage);
+        }
+      },
+      [&](VkCommandBuffer cmd) {
+        fullscreenPass.render(cmd, index, imguiMgr.get(),
+                              imguiMgr->displayShadowMapTexture() ? true : false);
+      });
+
+  renderGraph.compile();
+  {
+    const auto& stats = renderGraph.stats();
+    std::cerr << "Render graph: " << stats.passes << " passes (" << stats.culledPasses
+              << " culled), " << stats.transientTextures << " transient textures in "
+              << stats.allocatedBytes / (1024 * 1024) << " MB instead of "
+              << stats.transientBytes / (1024 * 1024) << " MB ("
+              << (stats.transientBytes - stats.allocatedBytes) / (1024 * 1024)
+              << " MB saved by aliasing)" << std::endl;
+  }
+#pragma endregion
+
+  shadowPass.init(&context, renderGraph.texture(shadowMap));
+
+  ssaoPass.init(&context, gbufferPass.depthTexture(), renderGraph.texture(ssao));
+
+  if (clusteredLights) {
+    lightClusteringPass.init(&context, &camera, gbufferPass.positionTexture());
+  }
+
   lightPass.init(&context, gbufferPass.normalTexture(), gbufferPass.specularTexture(),
                  gbufferPass.baseColorTexture(), gbufferPass.positionTexture(),
                  gbufferPass.depthTexture(), ssaoPass.ssaoTexture(),
-                 shadowPass.shadowDepthTexture());
+                 useCascades ? nullptr : shadowPass.shadowDepthTexture(),
+                 renderGraph.texture(light),
+                 useCascades ? cascadedShadowPass.shadowDepthTexture() : nullptr,
+                 clusteredLights ? &lightClusteringPass : nullptr);
 
-  SSRIntersectPass ssrPass;
   ssrPass.init(&context, &camera, gbufferPass.normalTexture(),
                gbufferPass.specularTexture(), lightPass.lightTexture(),
                hierarchicalDepthBufferPass.hierarchicalDepthTexture(),
-               noisePass.noiseTexture());
+               noisePass.noiseTexture(), renderGraph.texture(ssr));
 
   auto textureToDisplay = ssrPass.insersectTexture();
 
@@ -273,6 +542,28 @@ int main(int argc, char* argv[]) {
   cullingPass.init(&context, &camera, *bistro.get(), buffers[3]);
   cullingPass.upload(commandMgr);
 
+  if (useCascades) {
+    cascadedShadowPass.setModel(*bistro.get(), buffers[0], buffers[1], buffers[3]);
+    cascadedShadowPass.upload(commandMgr);
+  }
+
+  // The benchmark sets the first lights of the list, so the ones frames in flight use
+  // don't change
+  std::vector<ClusteredLight> randomLights;
+  if (clusteredLights) {
+    glm::vec3 boundsMin(std::numeric_limits<float>::max());
+    glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+    for (const auto& mesh : bistro->meshes) {
+      boundsMin = glm::min(boundsMin, mesh.center - mesh.extents);
+      boundsMax = glm::max(boundsMax, mesh.center + mesh.extents);
+    }
+    randomLights = LightClusteringPass::randomLights(
+        lightsBenchmark ? benchmarkLightCounts.back() : clusteredLightCount, boundsMin,
+        boundsMax);
+    lightClusteringPass.setLights(
+        {randomLights.begin(), randomLights.begin() + clusteredLightCount});
+  }
+
   noisePass.upload(commandMgr);
 
   gbufferPipeline->bindResource(CAMERA_SET, BINDING_0, 0, cameraBuffer.buffer(0), 0,
@@ -314,14 +605,14 @@ int main(int argc, char* argv[]) {
   float r = 1.f, g = 0.3f, b = 0.3f;
   size_t frame = 0;
   size_t previousFrame = 0;
+  uint32_t benchmarkStep = 0;
+  uint32_t benchmarkSeconds = 0;
   const std::array<VkClearValue, 1> clearValues = {
       VkClearValue{.color = {r, g, b, 0.0f}}};
 
   const glm::mat4 view = glm::translate(glm::mat4(1.f), {0.f, 0.f, 0.5f});
   auto time = glfwGetTime();
 
-  std::unique_ptr<EngineCore::GUI::ImguiManager> imguiMgr = nullptr;
-
   TracyPlotConfig("Swapchain image index", tracy::PlotFormatType::Number, true, false,
                   tracy::Color::Aqua);
 
@@ -333,7 +624,35 @@ int main(int argc, char* argv[]) {
     const auto delta = now - time;
     if (delta > 1) {
       const auto fps = static_cast<double>(frame - previousFrame) / delta;
-      std::cerr << "FPS: " << fps << std::endl;
+      std::cerr << "FPS: " << fps;
+      if (useCascades) {
+        const auto& stats = cascadedShadowPass.stats();
+        std::cerr << " | shadow cascades culling " << stats.cullingTimeMs
+                  << " ms, rendering " << stats.renderTimeMs << " ms, draws";
+        for (uint32_t i = 0; i < cascadedShadowPass.cascades().size(); ++i) {
+          std::cerr << " " << stats.draws[i];
+        }
+      }
+      if (clusteredLights) {
+        const auto& stats = lightClusteringPass.stats();
+        std::cerr << " | " << lightClusteringPass.lightCount()
+                  << " lights: clustering " << stats.buildTimeMs << " ms, lighting "
+                  << lightPass.renderTimeMs() << " ms, "
+                  << float(stats.lightIndices) / stats.clusters << " lights per cluster";
+      }
+      std::cerr << std::endl;
+
+      // Each light count is measured for a few seconds
+      if (lightsBenchmark && ++benchmarkSeconds == 3) {
+        benchmarkSeconds = 0;
+        if (++benchmarkStep == benchmarkLightCounts.size()) {
+          glfwSetWindowShouldClose(window_, GLFW_TRUE);
+        } else {
+          lightClusteringPass.setLights(
+              {randomLights.begin(),
+               randomLights.begin() + benchmarkLightCounts[benchmarkStep]});
+        }
+      }
       previousFrame = frame;
       time = now;
     }
@@ -353,49 +672,11 @@ int main(int argc, char* argv[]) {
 
     commandMgr.waitUntilSubmitIsComplete();
     const auto texture = context.swapchain()->acquireImage();
-    const auto index = context.swapchain()->currentImageIndex();
+    index = context.swapchain()->currentImageIndex();
     TracyPlot("Swapchain image index", (int64_t)index);
 
     auto commandBuffer = commandMgr.getCmdBufferToBegin();
 
-    cullingPass.cull(commandBuffer, index);
-    cullingPass.addBarrierForCulledBuffers(
-        commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-        context.physicalDevice().graphicsFamilyIndex().value(),
-        context.physicalDevice().graphicsFamilyIndex().value());
-
-    gbufferPass.render(commandBuffer, index,
-                       {
-                           {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
-                           {.set = TEXTURES_SET, .bindIdx = 0},
-                           {.set = SAMPLER_SET, .bindIdx = 0},
-                           {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
-                       },
-                       buffers[1]->vkBuffer(),
-                       cullingPass.culledIndirectDrawBuffer()->vkBuffer(),
-                       cullingPass.culledIndirectDrawCountBuffer()->vkBuffer(), numMeshes,
-                       sizeof(EngineCore::IndirectDrawCommandAndMeshData));
-
-    shadowPass.render(commandBuffer, index,
-                      {
-                          {.set = CAMERA_SET, .bindIdx = (uint32_t)index},
-                          {.set = TEXTURES_SET, .bindIdx = 0},
-                          {.set = SAMPLER_SET, .bindIdx = 0},
-                          {.set = STORAGE_BUFFER_SET, .bindIdx = 0},
-                      },
-                      buffers[1]->vkBuffer(), buffers[3]->vkBuffer(), numMeshes,
-                      sizeof(EngineCore::IndirectDrawCommandAndMeshData));
-    lightData.lightCam.setNotDirty();
-
-    noisePass.generateNoise(commandBuffer);
-    hierarchicalDepthBufferPass.generateHierarchicalDepthBuffer(commandBuffer);
-
-    ssaoPass.run(commandBuffer);
-
-    lightPass.render(commandBuffer, index, lightData, camera.viewMatrix(),
-                     camera.getProjectMatrix());
-    ssrPass.run(commandBuffer);
-
     if (!imguiMgr) {
       imguiMgr = std::make_unique<EngineCore::GUI::ImguiManager>(
           window_, context, commandBuffer,
@@ -432,7 +713,9 @@ int main(int argc, char* argv[]) {
       imguiMgr->setDisplayShadowMapTexture(displayShadowMap);
       bool valueChanged = displayShadowMap != imguiMgr->displayShadowMapTexture();
       displayShadowMap = imguiMgr->displayShadowMapTexture();
-      if (valueChanged) {
+      // The cascades are layers of an array texture, which the full screen pass can't
+      // show
+      if (valueChanged && !useCascades) {
         if (displayShadowMap) {
           auto shadowTexture = shadowPass.shadowDepthTexture();
 
@@ -447,8 +730,19 @@ int main(int argc, char* argv[]) {
       imguiMgr->frameEnd();
     }
 
-    fullscreenPass.render(commandBuffer, index, imguiMgr.get(),
-                          imguiMgr->displayShadowMapTexture() ? true : false);
+    if (useCascades) {
+      // lightDir points towards the light
+      cascadedShadowPass.update(-glm::vec3(lightData.lightDir), lightData);
+    }
+
+    renderGraph.execute(commandBuffer);
+    // The first frame also moves every texture out of its initial layout
+    if (frame == 1) {
+      const auto& stats = renderGraph.stats();
+      std::cerr << "Render graph: " << stats.barriers << " image barriers in "
+                << stats.barrierBatches << " batches per frame, "
+                << stats.barriersSkipped << " accesses without a barrier" << std::endl;
+    }
 
     TracyVkCollect(tracyCtx_, commandBuffer);
 
@@ -49,6 +49,10 @@ const char* techniqueNames[] = {
 GLFWwindow* window_ = nullptr;
 EngineCore::Camera camera(glm::vec3(-9.f, 2.f, 2.f));
 int main(int argc, char* argv[]) {
+  // Moves that many meshes up and down every frame, to exercise the TLAS refits
+  const uint32_t animatedInstances =
+      argc > 2 && std::string(argv[1]) == "--animate-instances" ? std::stoul(argv[2]) : 0;
+
   initWindow(&window_, &camera);
 
 #pragma region Context initialization
@@ -166,6 +170,21 @@ int main(int argc, char* argv[]) {
 
   EngineCore::RayTracer raytracer;
   raytracer.init(&context, bistro, buffers, textures, samplers);
+  {
+    const auto& stats = raytracer.blasBuildStats();
+    std::cerr << "BLAS: " << stats.accelStructs << " structures in " << stats.buildCalls
+              << " build calls, " << stats.buildMs << " ms to build (scratch "
+              << stats.scratchBytes / (1024.0 * 1024.0) << " MB), " << stats.compactMs
+              << " ms to compact " << stats.builtBytes / (1024.0 * 1024.0) << " MB into "
+              << stats.compactedBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+  }
+
+  const uint32_t animatedStride =
+      animatedInstances > 0
+          ? std::max<uint32_t>(1, bistro->meshes.size() / animatedInstances)
+          : 1;
+  uint32_t tlasUpdates = 0, tlasRebuilds = 0;
+  double tlasRecordMs = 0.0;
 
   while (!glfwWindowShouldClose(window_)) {
     const auto now = glfwGetTime();
@@ -173,10 +192,27 @@ int main(int argc, char* argv[]) {
     if (delta > 1) {
       const auto fps = static_cast<double>(frame - previousFrame) / delta;
       std::cerr << "FPS: " << fps << std::endl;
+      if (tlasUpdates > 0) {
+        std::cerr << "TLAS: " << tlasUpdates << " updates (" << tlasRebuilds
+                  << " rebuilds), " << tlasRecordMs / tlasUpdates << " ms to record, "
+                  << raytracer.tlasUpdateStats().gpuMs << " ms on the GPU" << std::endl;
+      }
+      tlasUpdates = tlasRebuilds = 0;
+      tlasRecordMs = 0.0;
       previousFrame = frame;
       time = now;
     }
 
+    for (uint32_t i = 0; i < animatedInstances; ++i) {
+      const uint32_t meshIdx = i * animatedStride;
+      if (meshIdx >= bistro->meshes.size()) {
+        break;
+      }
+      const float offset = 0.25f * std::sin(2.0f * static_cast<float>(now) + i);
+      raytracer.setInstanceTransform(
+          meshIdx, glm::translate(glm::mat4(1.f), glm::vec3(0.f, offset, 0.f)));
+    }
+
     const auto texture = context.swapchain()->acquireImage();
     const auto index = context.swapchain()->currentImageIndex();
 
@@ -200,6 +236,12 @@ int main(int argc, char* argv[]) {
     raytracer.execute(commandBuffer, index, camera.viewMatrix(),
                       camera.getProjectMatrix(), showAOImage);
 
+    if (raytracer.tlasUpdateStats().instancesUpdated > 0) {
+      ++tlasUpdates;
+      tlasRebuilds += raytracer.tlasUpdateStats().rebuilt ? 1 : 0;
+      tlasRecordMs += raytracer.tlasUpdateStats().recordMs;
+    }
+
     raytracer.currentImage(index)->transitionImageLayout(
         commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
 
@@ -0,0 +1,541 @@
+#include "AccelerationStructures.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <tracy/Tracy.hpp>
+
+#include "vulkancore/CommandQueueManager.hpp"
+
+namespace EngineCore {
+
+namespace {
+// Acceleration structures must start at multiples of 256 bytes of their buffers
+constexpr VkDeviceSize kAccelStructAlignment = 256;
+// Largest buffer the structures are packed into, larger structures get their own
+constexpr VkDeviceSize kMaxBlockSize = 256 * 1024 * 1024;
+// Scratch memory of the builds of one vkCmdBuildAccelerationStructuresKHR call
+constexpr VkDeviceSize kMaxScratchPerBatch = 128 * 1024 * 1024;
+
+using Clock = std::chrono::steady_clock;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Creates bottom level structures of the given sizes, packed one after the other into
+// buffers of at most kMaxBlockSize. bufferBytes gets the size of the buffers
+std::vector<AccelerationStructure> createBottomLevelAccelStructs(
+    VulkanCore::Context& context, const std::vector<VkDeviceSize>& sizes,
+    const std::string& name, VkDeviceSize& bufferBytes) {
+  std::vector<VkDeviceSize> blockSizes;
+  std::vector<std::pair<uint32_t, VkDeviceSize>> placements(sizes.size());
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (blockSizes.empty() ||
+        (blockSizes.back() > 0 && blockSizes.back() + sizes[i] > kMaxBlockSize)) {
+      blockSizes.push_back(0);
+    }
+    placements[i] = {static_cast<uint32_t>(blockSizes.size() - 1), blockSizes.back()};
+    blockSizes.back() += alignUp(sizes[i], kAccelStructAlignment);
+  }
+
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> blocks;
+  bufferBytes = 0;
+  for (size_t i = 0; i < blockSizes.size(); ++i) {
+    blocks.push_back(context.createBuffer(
+        blockSizes[i],
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, name + " " + std::to_string(i)));
+    bufferBytes += blockSizes[i];
+  }
+
+  std::vector<AccelerationStructure> accelStructs(sizes.size());
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    const auto [block, offset] = placements[i];
+    accelStructs[i].buffer = blocks[block];
+
+    const VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .buffer = blocks[block]->vkBuffer(),
+        .offset = offset,
+        .size = sizes[i],
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+    };
+    VK_CHECK(vkCreateAccelerationStructureKHR(context.device(),
+                                              &accelerationStructureCreateInfo, nullptr,
+                                              &accelStructs[i].handle));
+
+    const VkAccelerationStructureDeviceAddressInfoKHR addressInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+        .accelerationStructure = accelStructs[i].handle,
+    };
+    accelStructs[i].deviceAddress =
+        vkGetAccelerationStructureDeviceAddressKHR(context.device(), &addressInfo);
+  }
+  return accelStructs;
+}
+
+constexpr VkBuildAccelerationStructureFlagsKHR kTopLevelBuildFlags =
+    VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+    VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+VkAccelerationStructureGeometryKHR instancesGeometry(VkDeviceAddress instanceData) {
+  return VkAccelerationStructureGeometryKHR{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry =
+          {
+              .instances =
+                  {
+                      .sType =
+                          VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                      .arrayOfPointers = VK_FALSE,
+                      .data = {.deviceAddress = instanceData},
+                  },
+          },
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+  };
+}
+}  // namespace
+
+std::vector<AccelerationStructure> buildBottomLevelAccelStructs(
+    VulkanCore::Context& context, const Model& model,
+    const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+    AccelStructBuildStats* stats) {
+  ZoneScopedN("buildBottomLevelAccelStructs");
+  const auto start = Clock::now();
+  const VkDevice device = context.device();
+  const VkDeviceSize scratchAlignment =
+      context.physicalDevice()
+          .accelerationStructureProperties()
+          .minAccelerationStructureScratchOffsetAlignment;
+
+  const uint32_t count = static_cast<uint32_t>(model.meshes.size());
+  AccelStructBuildStats buildStats{.accelStructs = count};
+  if (count == 0) {
+    if (stats) {
+      *stats = buildStats;
+    }
+    return {};
+  }
+
+  // buffers[0] - vertex, buffers[1] - index, buffers[3] - indirect, buffers[2] - material
+  std::vector<VkAccelerationStructureGeometryKHR> geometries(count);
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRanges(count);
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangePointers(count);
+  std::vector<VkDeviceSize> accelStructSizes(count);
+  std::vector<VkDeviceSize> scratchSizes(count);
+  for (uint32_t meshIdx = 0; meshIdx < count; ++meshIdx) {
+    const auto& mesh = model.meshes[meshIdx];
+    geometries[meshIdx] = VkAccelerationStructureGeometryKHR{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+        .geometry =
+            {
+                .triangles =
+                    {
+                        .sType =
+                            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                        .vertexData =
+                            {
+                                .deviceAddress =
+                                    buffers[0]->vkDeviceAddress() +
+                                    model.indirectDrawDataSet[meshIdx].vertexOffset *
+                                        sizeof(EngineCore::Vertex),
+                            },
+                        .vertexStride = sizeof(EngineCore::Vertex),
+                        .maxVertex = static_cast<uint32_t>(mesh.vertices.size()),
+                        .indexType = VK_INDEX_TYPE_UINT32,
+                        .indexData =
+                            {
+                                .deviceAddress =
+                                    buffers[1]->vkDeviceAddress() +
+                                    model.indirectDrawDataSet[meshIdx].firstIndex *
+                                        sizeof(uint32_t),
+                            },
+                    },
+            },
+    };
+    buildRanges[meshIdx] = VkAccelerationStructureBuildRangeInfoKHR{
+        .primitiveCount = static_cast<uint32_t>(mesh.indices.size() / 3),
+    };
+    buildRangePointers[meshIdx] = &buildRanges[meshIdx];
+    buildInfos[meshIdx] = VkAccelerationStructureBuildGeometryInfoKHR{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+                 VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        .geometryCount = 1,
+        .pGeometries = &geometries[meshIdx],
+    };
+
+    VkAccelerationStructureBuildSizesInfoKHR buildSizes{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+    };
+    vkGetAccelerationStructureBuildSizesKHR(
+        device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos[meshIdx],
+        &buildRanges[meshIdx].primitiveCount, &buildSizes);
+    accelStructSizes[meshIdx] = buildSizes.accelerationStructureSize;
+    scratchSizes[meshIdx] = alignUp(buildSizes.buildScratchSize, scratchAlignment);
+  }
+
+  auto built = createBottomLevelAccelStructs(context, accelStructSizes,
+                                             "Bottom level accel struct build buffer",
+                                             buildStats.builtBytes);
+
+  // Consecutive builds whose scratch memory fits in kMaxScratchPerBatch go in the same
+  // call, a build that needs more gets a call of its own
+  std::vector<uint32_t> batchStarts;
+  VkDeviceSize batchScratchSize = 0;
+  VkDeviceSize scratchSize = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (batchStarts.empty() ||
+        (batchScratchSize > 0 &&
+         batchScratchSize + scratchSizes[i] > kMaxScratchPerBatch)) {
+      batchStarts.push_back(i);
+      batchScratchSize = 0;
+    }
+    batchScratchSize += scratchSizes[i];
+    scratchSize = std::max(scratchSize, batchScratchSize);
+  }
+  batchStarts.push_back(count);
+
+  // The scratch addresses must be aligned, the buffer's address may not be
+  auto scratchBuffer = context.createBuffer(
+      scratchSize + scratchAlignment,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Scratch buffer for bLAS");
+  const VkDeviceAddress scratchAddress =
+      alignUp(scratchBuffer->vkDeviceAddress(), scratchAlignment);
+  buildStats.scratchBytes = scratchBuffer->size();
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+      .queryCount = count,
+  };
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool));
+
+  auto commandQueueMgr =
+      context.createGraphicsCommandQueue(1, 1, "BLAS acceleration struct build queue");
+  const auto submitAndWait = [&context, &commandQueueMgr](VkCommandBuffer commandBuffer) {
+    commandQueueMgr.endCmdBuffer(commandBuffer);
+    VkPipelineStageFlags flags = VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR;
+    const auto submitInfo =
+        context.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
+    commandQueueMgr.submit(&submitInfo);
+    commandQueueMgr.waitUntilSubmitIsComplete();
+  };
+
+  auto commandBuffer = commandQueueMgr.getCmdBufferToBegin();
+  vkCmdResetQueryPool(commandBuffer, queryPool, 0, count);
+
+  // Each batch reuses the scratch memory of the previous one, and the compacted sizes
+  // are queried once the last one is done
+  const VkMemoryBarrier buildBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                       VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+  };
+  std::vector<VkAccelerationStructureKHR> builtHandles(count);
+  for (size_t batch = 0; batch + 1 < batchStarts.size(); ++batch) {
+    const uint32_t first = batchStarts[batch];
+    const uint32_t last = batchStarts[batch + 1];
+    VkDeviceSize scratchOffset = 0;
+    for (uint32_t i = first; i < last; ++i) {
+      buildInfos[i].dstAccelerationStructure = built[i].handle;
+      buildInfos[i].scratchData.deviceAddress = scratchAddress + scratchOffset;
+      scratchOffset += scratchSizes[i];
+      builtHandles[i] = built[i].handle;
+    }
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, last - first, &buildInfos[first],
+                                        &buildRangePointers[first]);
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                         &buildBarrier, 0, nullptr, 0, nullptr);
+    ++buildStats.buildCalls;
+  }
+  vkCmdWriteAccelerationStructuresPropertiesKHR(
+      commandBuffer, count, builtHandles.data(),
+      VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, queryPool, 0);
+  submitAndWait(commandBuffer);
+
+  std::vector<VkDeviceSize> compactedSizes(count);
+  VK_CHECK(vkGetQueryPoolResults(device, queryPool, 0, count,
+                                 count * sizeof(VkDeviceSize), compactedSizes.data(),
+                                 sizeof(VkDeviceSize),
+                                 VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+  vkDestroyQueryPool(device, queryPool, nullptr);
+  scratchBuffer.reset();
+  buildStats.buildMs = elapsedMs(start);
+
+  const auto compactStart = Clock::now();
+  auto compacted =
+      createBottomLevelAccelStructs(context, compactedSizes,
+                                    "Bottom level accel struct buffer",
+                                    buildStats.compactedBytes);
+
+  commandBuffer = commandQueueMgr.getCmdBufferToBegin();
+  for (uint32_t i = 0; i < count; ++i) {
+    const VkCopyAccelerationStructureInfoKHR copyInfo = {
+        .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+        .src = built[i].handle,
+        .dst = compacted[i].handle,
+        .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+    };
+    vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+  }
+  submitAndWait(commandBuffer);
+
+  for (const auto& accelStruct : built) {
+    vkDestroyAccelerationStructureKHR(device, accelStruct.handle, nullptr);
+  }
+  buildStats.compactMs = elapsedMs(compactStart);
+
+  if (stats) {
+    *stats = buildStats;
+  }
+  return compacted;
+}
+
+TopLevelAccelStruct::TopLevelAccelStruct(
+    VulkanCore::Context& context,
+    std::vector<VkAccelerationStructureInstanceKHR> instances, uint32_t ringSize,
+    uint32_t maxRefits, const std::string& name)
+    : context_(context),
+      ringSize_(ringSize),
+      maxRefits_(maxRefits),
+      instances_(std::move(instances)),
+      dirty_(instances_.size()),
+      isDirty_(instances_.size(), true),
+      queriesWritten_(ringSize, false) {
+  ASSERT(!instances_.empty(), "A top level acceleration structure needs instances");
+  ASSERT(ringSize_ > 0, "ringSize must be at least 1");
+  std::iota(dirty_.begin(), dirty_.end(), 0u);
+
+  const VkDeviceSize instancesSize =
+      sizeof(VkAccelerationStructureInstanceKHR) * instances_.size();
+  stagingBuffer_ =
+      context_.createBuffer(instancesSize * ringSize_, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VMA_MEMORY_USAGE_CPU_ONLY, name + " staging buffer");
+  instanceBuffer_ = context_.createBuffer(
+      instancesSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+      VMA_MEMORY_USAGE_GPU_ONLY, name + " instance buffer");
+
+  const auto geometry = instancesGeometry(instanceBuffer_->vkDeviceAddress());
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+      .flags = kTopLevelBuildFlags,
+      .geometryCount = 1,
+      .pGeometries = &geometry,
+  };
+  const uint32_t primitiveCount = instanceCount();
+  VkAccelerationStructureBuildSizesInfoKHR buildSizes{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+  };
+  vkGetAccelerationStructureBuildSizesKHR(context_.device(),
+                                          VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                          &buildInfo, &primitiveCount, &buildSizes);
+
+  tLAS_.buffer = context_.createBuffer(
+      buildSizes.accelerationStructureSize,
+      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
+          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, name + " buffer");
+  const VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+      .buffer = tLAS_.buffer->vkBuffer(),
+      .size = buildSizes.accelerationStructureSize,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+  };
+  VK_CHECK(vkCreateAccelerationStructureKHR(
+      context_.device(), &accelerationStructureCreateInfo, nullptr, &tLAS_.handle));
+  const VkAccelerationStructureDeviceAddressInfoKHR addressInfo{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+      .accelerationStructure = tLAS_.handle,
+  };
+  tLAS_.deviceAddress =
+      vkGetAccelerationStructureDeviceAddressKHR(context_.device(), &addressInfo);
+
+  // Shared by builds and refits, whose scratch addresses must be aligned
+  const VkDeviceSize scratchAlignment =
+      context_.physicalDevice()
+          .accelerationStructureProperties()
+          .minAccelerationStructureScratchOffsetAlignment;
+  scratchBuffer_ = context_.createBuffer(
+      std::max(buildSizes.buildScratchSize, buildSizes.updateScratchSize) +
+          scratchAlignment,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, name + " scratch buffer");
+  scratchAddress_ = alignUp(scratchBuffer_->vkDeviceAddress(), scratchAlignment);
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2 * ringSize_,
+  };
+  VK_CHECK(vkCreateQueryPool(context_.device(), &queryPoolInfo, nullptr, &queryPool_));
+  timestampPeriodNs_ =
+      context_.physicalDevice().properties().properties.limits.timestampPeriod;
+}
+
+TopLevelAccelStruct::~TopLevelAccelStruct() {
+  vkDestroyQueryPool(context_.device(), queryPool_, nullptr);
+  vkDestroyAccelerationStructureKHR(context_.device(), tLAS_.handle, nullptr);
+}
+
+void TopLevelAccelStruct::setTransform(uint32_t instanceIndex,
+                                       const glm::mat4& transform) {
+  ASSERT(instanceIndex < instances_.size(), "Instance index out of range");
+  auto& instance = instances_[instanceIndex];
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      instance.transform.matrix[i][j] = transform[j][i];
+    }
+  }
+  if (!isDirty_[instanceIndex]) {
+    isDirty_[instanceIndex] = true;
+    dirty_.push_back(instanceIndex);
+  }
+}
+
+void TopLevelAccelStruct::update(VkCommandBuffer commandBuffer) {
+  ZoneScopedN("TopLevelAccelStruct::update");
+  const auto start = Clock::now();
+  const uint32_t slot = ringIndex_;
+  ringIndex_ = (ringIndex_ + 1) % ringSize_;
+
+  // This slot's command buffer has completed, so have its timestamps
+  if (queriesWritten_[slot]) {
+    uint64_t timestamps[2] = {};
+    if (vkGetQueryPoolResults(context_.device(), queryPool_, 2 * slot, 2,
+                              sizeof(timestamps), timestamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+      stats_.gpuMs = (timestamps[1] - timestamps[0]) * timestampPeriodNs_ / 1e6;
+    }
+  }
+  stats_.instancesUpdated = 0;
+  stats_.rebuilt = false;
+
+  if (!hasPendingChanges()) {
+    stats_.recordMs = elapsedMs(start);
+    return;
+  }
+
+  const bool rebuild = !built_ || rebuildRequested_ ||
+                       refitsSinceRebuild_ >= maxRefits_ ||
+                       dirty_.size() * 2 > instances_.size();
+
+  vkCmdResetQueryPool(commandBuffer, queryPool_, 2 * slot, 2);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_,
+                      2 * slot);
+
+  // Consecutive instances are copied with a single region
+  std::sort(dirty_.begin(), dirty_.end());
+  constexpr VkDeviceSize instanceSize = sizeof(VkAccelerationStructureInstanceKHR);
+  const VkDeviceSize sliceOffset = slot * instanceSize * instances_.size();
+  auto* staging = static_cast<uint8_t*>(stagingBuffer_->mappedMemory()) + sliceOffset;
+  std::vector<VkBufferCopy> regions;
+  for (const uint32_t instanceIndex : dirty_) {
+    const VkDeviceSize offset = instanceIndex * instanceSize;
+    memcpy(staging + offset, &instances_[instanceIndex], instanceSize);
+    isDirty_[instanceIndex] = false;
+    if (!regions.empty() && regions.back().dstOffset + regions.back().size == offset) {
+      regions.back().size += instanceSize;
+    } else {
+      regions.push_back({
+          .srcOffset = sliceOffset + offset,
+          .dstOffset = offset,
+          .size = instanceSize,
+      });
+    }
+  }
+  stagingBuffer_->upload(sliceOffset, instanceSize * instances_.size());
+
+  // The instance buffer and the structure may still be in use by the previous update and
+  // the rays traced after it
+  const VkMemoryBarrier inUseBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT |
+                       VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR |
+                       VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+  };
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR |
+                           VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT |
+                           VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       0, 1, &inUseBarrier, 0, nullptr, 0, nullptr);
+
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer_->vkBuffer(), instanceBuffer_->vkBuffer(),
+                  static_cast<uint32_t>(regions.size()), regions.data());
+
+  const VkMemoryBarrier copyBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1,
+                       &copyBarrier, 0, nullptr, 0, nullptr);
+
+  const auto geometry = instancesGeometry(instanceBuffer_->vkDeviceAddress());
+  const VkAccelerationStructureBuildGeometryInfoKHR buildInfo{
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+      .flags = kTopLevelBuildFlags,
+      .mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+                      : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+      .srcAccelerationStructure = rebuild ? VK_NULL_HANDLE : tLAS_.handle,
+      .dstAccelerationStructure = tLAS_.handle,
+      .geometryCount = 1,
+      .pGeometries = &geometry,
+      .scratchData = {.deviceAddress = scratchAddress_},
+  };
+  const VkAccelerationStructureBuildRangeInfoKHR buildRange{
+      .primitiveCount = instanceCount(),
+  };
+  const VkAccelerationStructureBuildRangeInfoKHR* buildRangePointer = &buildRange;
+  vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, &buildRangePointer);
+
+  const VkMemoryBarrier buildBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+      .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+  };
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, 0, 1, &buildBarrier,
+                       0, nullptr, 0, nullptr);
+
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+                      2 * slot + 1);
+  queriesWritten_[slot] = true;
+
+  stats_.instancesUpdated = static_cast<uint32_t>(dirty_.size());
+  stats_.rebuilt = rebuild;
+  refitsSinceRebuild_ = rebuild ? 0 : refitsSinceRebuild_ + 1;
+  stats_.refitsSinceRebuild = refitsSinceRebuild_;
+  dirty_.clear();
+  rebuildRequested_ = false;
+  built_ = true;
+  stats_.recordMs = elapsedMs(start);
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "enginecore/Model.hpp"
+#include "vulkancore/Buffer.hpp"
+#include "vulkancore/Context.hpp"
+
+namespace EngineCore {
+
+// Several structures may live in the same buffer, at different offsets
+struct AccelerationStructure {
+  std::shared_ptr<VulkanCore::Buffer> buffer;
+  VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
+  VkDeviceAddress deviceAddress = 0;  // what instances reference
+};
+
+struct AccelStructBuildStats {
+  uint32_t accelStructs = 0;
+  uint32_t buildCalls = 0;  // vkCmdBuildAccelerationStructuresKHR calls
+  VkDeviceSize scratchBytes = 0;
+  VkDeviceSize builtBytes = 0;  // before compaction
+  VkDeviceSize compactedBytes = 0;
+  double buildMs = 0.0;  // building and reading back the compacted sizes
+  double compactMs = 0.0;
+};
+
+// Builds the bottom level acceleration structure of each mesh of model, whose vertices
+// and indices are in buffers[0] and buffers[1] as laid out by convertModel2OneBuffer.
+// The builds are batched into a few vkCmdBuildAccelerationStructuresKHR calls that share
+// one scratch buffer, and the structures are then compacted into as few buffers as
+// possible. Blocks until they're done, returns them in mesh order
+std::vector<AccelerationStructure> buildBottomLevelAccelStructs(
+    VulkanCore::Context& context, const Model& model,
+    const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+    AccelStructBuildStats* stats = nullptr);
+
+// A top level acceleration structure over a fixed set of instances whose transforms may
+// change every frame. Changed instances are copied from a ring of host visible buffers
+// into a device local instance buffer and the structure is refit in place
+// (VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR). Refits are cheap but the structure
+// gets slower to trace as instances move away from where it was built, so it's rebuilt
+// after maxRefits refits, when more than half the instances change at once, or on
+// request
+class TopLevelAccelStruct {
+ public:
+  struct UpdateStats {
+    uint32_t instancesUpdated = 0;
+    bool rebuilt = false;
+    uint32_t refitsSinceRebuild = 0;
+    double recordMs = 0.0;
+    // GPU time of the copy and build recorded ringSize updates ago, the latest one known
+    // to be done. Negative until there is one
+    double gpuMs = -1.0;
+  };
+
+  // The structure is built by the first update(). ringSize is the number of command
+  // buffers update() is called with in turn, getting one back must wait for its previous
+  // submission (as CommandQueueManager::getCmdBufferToBegin does)
+  TopLevelAccelStruct(VulkanCore::Context& context,
+                      std::vector<VkAccelerationStructureInstanceKHR> instances,
+                      uint32_t ringSize, uint32_t maxRefits = 64,
+                      const std::string& name = "Top level accel struct");
+
+  ~TopLevelAccelStruct();
+
+  TopLevelAccelStruct(const TopLevelAccelStruct&) = delete;
+  TopLevelAccelStruct& operator=(const TopLevelAccelStruct&) = delete;
+
+  // Stays the same for the lifetime of the object, rebuilds happen in place
+  VkAccelerationStructureKHR* vkHandle() { return &tLAS_.handle; }
+
+  uint32_t instanceCount() const { return static_cast<uint32_t>(instances_.size()); }
+
+  // Takes effect on the next update()
+  void setTransform(uint32_t instanceIndex, const glm::mat4& transform);
+
+  void requestRebuild() { rebuildRequested_ = true; }
+
+  // Whether the next update() records anything
+  bool hasPendingChanges() const {
+    return !built_ || rebuildRequested_ || !dirty_.empty();
+  }
+
+  // Records the copy of the instances changed since the last call and the refit, or
+  // rebuild, of the structure into commandBuffer, which must be outside of a render pass.
+  // Waits for the ray tracing shaders and builds submitted before it, and makes the
+  // structure visible to the ray tracing shaders recorded after it
+  void update(VkCommandBuffer commandBuffer);
+
+  const UpdateStats& lastUpdateStats() const { return stats_; }
+
+ private:
+  VulkanCore::Context& context_;
+  uint32_t ringSize_ = 0;
+  uint32_t ringIndex_ = 0;
+  uint32_t maxRefits_ = 0;
+
+  std::vector<VkAccelerationStructureInstanceKHR> instances_;
+  std::vector<uint32_t> dirty_;
+  std::vector<bool> isDirty_;
+
+  std::shared_ptr<VulkanCore::Buffer> stagingBuffer_;  // ringSize_ copies of instances_
+  std::shared_ptr<VulkanCore::Buffer> instanceBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> scratchBuffer_;
+  VkDeviceAddress scratchAddress_ = 0;
+  AccelerationStructure tLAS_;
+
+  VkQueryPool queryPool_ = VK_NULL_HANDLE;  // two timestamps per ring entry
+  std::vector<bool> queriesWritten_;
+  double timestampPeriodNs_ = 0.0;
+
+  bool built_ = false;
+  bool rebuildRequested_ = false;
+  uint32_t refitsSinceRebuild_ = 0;
+  UpdateStats stats_;
+};
+
+}  // namespace EngineCore
@@ -1,105 +1,227 @@
 #include "AsyncDataUploader.hpp"
 
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
 #include "vulkancore/Texture.hpp"
 
 namespace EngineCore {
 
 AsyncDataUploader::AsyncDataUploader(VulkanCore::Context& context,
-                                     std::function<void(int, int)> textureReadyCallback)
+                                     std::function<void(int, int)> textureReadyCallback,
+                                     uint32_t maxTexturesPerBatch,
+                                     VkDeviceSize maxBytesPerBatch)
     : context_(context),
+      mipGenerator_(MipGenerator::isSupported(context)
+                        ? std::make_unique<MipGenerator>(context)
+                        : nullptr),
+      // Two command buffers each, so a batch is recorded while the previous one executes
       transferCommandQueueMgr_(context.createTransferCommandQueue(
-          1, 1, "secondary thread transfer command queue")),
+          2, 2, "secondary thread transfer command queue", -1, true)),
       graphicsCommandQueueMgr_(context.createGraphicsCommandQueue(
-          1, 1, "secondary thread graphics command queue", 1)),
+          2, 2, "secondary thread graphics command queue", 1, true)),
+      maxTexturesPerBatch_(std::max(maxTexturesPerBatch, 1u)),
+      maxBytesPerBatch_(maxBytesPerBatch),
       textureReadyCallback_(textureReadyCallback) {}
 
 AsyncDataUploader::~AsyncDataUploader() {
   closeThreads_ = true;
-  textureGPUDataUploadThread_.join();
-  textureMipGenThread_.join();
-
-  for (auto& semaphore : semaphores_) {
-    vkDestroySemaphore(context_.device(), semaphore, nullptr);
+  textureLoadTasks_.close();
+  textureMipGenerationTasks_.close();
+  if (textureGPUDataUploadThread_.joinable()) {
+    textureGPUDataUploadThread_.join();
+  }
+  if (textureMipGenThread_.joinable()) {
+    textureMipGenThread_.join();
   }
+  // The staging memory of the uploads is released once they complete, textures aren't
+  // reported anymore
+  transferCommandQueueMgr_.waitUntilAllSubmitsAreComplete();
+  graphicsCommandQueueMgr_.waitUntilAllSubmitsAreComplete();
 }
 
 void AsyncDataUploader::startProcessing() {
-  // should be able to replace this with BS_Thread_pool
-  textureGPUDataUploadThread_ = std::thread([this]() {
-    while (!closeThreads_) {
-      if (textureLoadTasks_.size() > 0) {
-        // pop &  do stuff
-        auto textureLoadTask = textureLoadTasks_.front();
-        textureLoadTasks_.pop_front();
-        auto textureUploadStagingBuffer = context_.createStagingBuffer(
-            textureLoadTask.texture->vkDeviceSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            "Async texture upload staging buffer");
-
-        const auto commandBuffer = transferCommandQueueMgr_.getCmdBufferToBegin();
-
-        textureLoadTask.texture->uploadOnly(
-            commandBuffer, textureUploadStagingBuffer.get(), textureLoadTask.data);
-
-        textureLoadTask.texture->addReleaseBarrier(
-            commandBuffer, transferCommandQueueMgr_.queueFamilyIndex(),
-            graphicsCommandQueueMgr_.queueFamilyIndex());
-
-        transferCommandQueueMgr_.endCmdBuffer(commandBuffer);
-
-        transferCommandQueueMgr_.disposeWhenSubmitCompletes(
-            std::move(textureUploadStagingBuffer));
-
-        VkSemaphore graphicsSemaphore;
-        const VkSemaphoreCreateInfo semaphoreInfo{
-            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-        };
-        VK_CHECK(vkCreateSemaphore(context_.device(), &semaphoreInfo, nullptr,
-                                   &graphicsSemaphore));
-
-        VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        auto submitInfo =
-            context_.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &graphicsSemaphore;
-        transferCommandQueueMgr_.submit(&submitInfo);
-
-        textureMipGenerationTasks_.push_back(
-            {textureLoadTask.texture, graphicsSemaphore, textureLoadTask.index});
+  textureGPUDataUploadThread_ = std::thread([this]() { uploadTextures(); });
+  textureMipGenThread_ = std::thread([this]() { generateMips(); });
+}
+
+void AsyncDataUploader::queueTextureUploadTasks(const TextureLoadTask& textureLoadTask) {
+  const auto extents = textureLoadTask.texture->vkExtents();
+  const VkDeviceSize size =
+      textureLoadTask.mipChain
+          ? textureLoadTask.texture->mipChainSizeInBytes()
+          : VulkanCore::imageSizeInBytes(textureLoadTask.texture->vkFormat(), extents);
+  {
+    std::lock_guard lock(statsMutex_);
+    ++stats_.texturesQueued;
+    ++pendingTextures_;
+  }
+  textureLoadTasks_.push_back({textureLoadTask, size, Clock::now()});
+
+  const auto depth = static_cast<uint32_t>(textureLoadTasks_.size());
+  std::lock_guard lock(statsMutex_);
+  stats_.maxUploadQueueDepth = std::max(stats_.maxUploadQueueDepth, depth);
+}
+
+void AsyncDataUploader::waitUntilIdle() {
+  std::unique_lock lock(statsMutex_);
+  idleCond_.wait(lock, [this]() { return pendingTextures_ == 0; });
+}
+
+AsyncDataUploader::Stats AsyncDataUploader::stats() {
+  const auto uploadQueueDepth = static_cast<uint32_t>(textureLoadTasks_.size());
+  const auto mipGenQueueDepth = static_cast<uint32_t>(textureMipGenerationTasks_.size());
+  std::lock_guard lock(statsMutex_);
+  auto stats = stats_;
+  stats.uploadQueueDepth = uploadQueueDepth;
+  stats.mipGenQueueDepth = mipGenQueueDepth;
+  return stats;
+}
+
+void AsyncDataUploader::resetStats() {
+  std::lock_guard lock(statsMutex_);
+  stats_ = Stats{};
+  totalLatencyMs_ = 0.0;
+}
+
+void AsyncDataUploader::uploadTextures() {
+  std::vector<TextureUploadTask> batch;
+  VkDeviceSize batchBytes = 0;
+  // Called after each texture is taken, except the last one
+  const auto takeMore = [this, &batch, &batchBytes](const TextureUploadTask& next) {
+    batchBytes += batch.back().size;
+    return batch.size() < maxTexturesPerBatch_ &&
+           batchBytes + next.size <= maxBytesPerBatch_;
+  };
+
+  while (textureLoadTasks_.waitAndPopBatch(batch, takeMore)) {
+    ZoneScopedN("AsyncDataUploader: upload batch");
+    const auto commandBuffer = transferCommandQueueMgr_.getCmdBufferToBegin();
+
+    VkDeviceSize bytesUploaded = 0;
+    for (const auto& upload : batch) {
+      if (upload.task.mipChain) {
+        upload.task.texture->uploadMipChainOnly(transferCommandQueueMgr_, commandBuffer,
+                                                upload.task.data);
+      } else {
+        upload.task.texture->uploadOnly(transferCommandQueueMgr_, commandBuffer,
+                                        upload.task.data);
       }
+
+      upload.task.texture->addReleaseBarrier(commandBuffer,
+                                             transferCommandQueueMgr_.queueFamilyIndex(),
+                                             graphicsCommandQueueMgr_.queueFamilyIndex());
+      bytesUploaded += upload.size;
     }
-  });
-
-  textureMipGenThread_ = std::thread([this]() {
-    while (!closeThreads_) {
-      if (textureMipGenerationTasks_.size() > 0) {
-        // pop &  do stuff
-        auto task = textureMipGenerationTasks_.front();
-        textureMipGenerationTasks_.pop_front();
-
-        auto commandBuffer = graphicsCommandQueueMgr_.getCmdBufferToBegin();
-        task.texture->addAcquireBarrier(commandBuffer,
-                                        transferCommandQueueMgr_.queueFamilyIndex(),
-                                        graphicsCommandQueueMgr_.queueFamilyIndex());
-        task.texture->generateMips(commandBuffer);
-
-        graphicsCommandQueueMgr_.endCmdBuffer(commandBuffer);
-        VkPipelineStageFlags flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        auto submitInfo =
-            context_.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
-        submitInfo.pWaitSemaphores = &task.graphicsSemaphore;
-        submitInfo.waitSemaphoreCount = 1;
-        graphicsCommandQueueMgr_.submit(&submitInfo);
-
-        semaphores_.push_back(task.graphicsSemaphore);
-
-        textureReadyCallback_(task.index, 0);
+
+    transferCommandQueueMgr_.endCmdBuffer(commandBuffer);
+
+    VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    const auto submitInfo =
+        context_.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
+    const uint64_t uploadValue = transferCommandQueueMgr_.submit(&submitInfo);
+    transferCommandQueueMgr_.goToNextCmdBuffer();
+
+    {
+      std::lock_guard lock(statsMutex_);
+      ++stats_.uploadSubmits;
+      stats_.bytesUploaded += bytesUploaded;
+    }
+
+    for (const auto& upload : batch) {
+      textureMipGenerationTasks_.push_back({upload.task.texture, uploadValue,
+                                            upload.task.index, upload.task.modelIndex,
+                                            upload.queuedAt, upload.task.mipFilter});
+    }
+    batch.clear();
+    batchBytes = 0;
+  }
+}
+
+void AsyncDataUploader::generateMips() {
+  std::vector<TextureMipGenTask> batch;
+  const auto takeMore = [this, &batch](const TextureMipGenTask&) {
+    return batch.size() < maxTexturesPerBatch_;
+  };
+
+  while (textureMipGenerationTasks_.waitAndPopBatch(batch, takeMore)) {
+    ZoneScopedN("AsyncDataUploader: mip generation batch");
+    auto commandBuffer = graphicsCommandQueueMgr_.getCmdBufferToBegin();
+
+    uint64_t uploadValue = 0;
+    std::vector<VulkanCore::Texture*> computeTextures;
+    std::vector<MipFilter> computeFilters;
+    for (const auto& task : batch) {
+      task.texture->addAcquireBarrier(commandBuffer,
+                                      transferCommandQueueMgr_.queueFamilyIndex(),
+                                      graphicsCommandQueueMgr_.queueFamilyIndex());
+      uploadValue = std::max(uploadValue, task.uploadValue);
+      if (mipGenerator_ && MipGenerator::canGenerateMips(*task.texture)) {
+        computeTextures.push_back(task.texture);
+        computeFilters.push_back(task.mipFilter);
+        continue;
+      }
+      task.texture->generateMips(commandBuffer);
+      // No-op when generating the mips already left it there
+      task.texture->transitionImageLayout(commandBuffer,
+                                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    if (!computeTextures.empty()) {
+      mipGenerator_->generateMips(graphicsCommandQueueMgr_, commandBuffer,
+                                  computeTextures, computeFilters);
+    }
+
+    graphicsCommandQueueMgr_.disposeWhenSubmitCompletes([this, batch]() {
+      for (const auto& task : batch) {
+        textureReady(task);
       }
+    });
+
+    graphicsCommandQueueMgr_.endCmdBuffer(commandBuffer);
+    VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    const auto submitInfo =
+        context_.swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
+    // The acquire barriers and the mip blits run once the last of the uploads is done,
+    // the transfer queue's timeline covers the earlier ones
+    graphicsCommandQueueMgr_.waitForSubmit(transferCommandQueueMgr_, uploadValue,
+                                           VK_PIPELINE_STAGE_TRANSFER_BIT);
+    graphicsCommandQueueMgr_.submit(&submitInfo);
+    graphicsCommandQueueMgr_.goToNextCmdBuffer();
+
+    {
+      std::lock_guard lock(statsMutex_);
+      ++stats_.mipGenSubmits;
+      stats_.texturesMipsComputed += computeTextures.size();
     }
-  });
+    batch.clear();
+
+    if (textureMipGenerationTasks_.size() == 0) {
+      // Nothing else to record, so the textures in flight are reported as soon as their
+      // mips are done instead of when the next batch needs a command buffer
+      ZoneScopedN("AsyncDataUploader: wait for mip generation");
+      graphicsCommandQueueMgr_.waitUntilAllSubmitsAreComplete();
+    }
+  }
 }
 
-void AsyncDataUploader::queueTextureUploadTasks(const TextureLoadTask& textureLoadTask) {
-  textureLoadTasks_.push_back(textureLoadTask);
+void AsyncDataUploader::textureReady(const TextureMipGenTask& task) {
+  if (closeThreads_) {
+    return;
+  }
+
+  textureReadyCallback_(task.index, task.modelIndex);
+
+  const double latencyMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - task.queuedAt).count();
+  {
+    std::lock_guard lock(statsMutex_);
+    ++stats_.texturesReady;
+    --pendingTextures_;
+    totalLatencyMs_ += latencyMs;
+    stats_.averageLatencyMs = totalLatencyMs_ / stats_.texturesReady;
+    stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latencyMs);
+  }
+  idleCond_.notify_all();
 }
 
 }  // namespace EngineCore
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
+#include "MipGenerator.hpp"
 #include "vulkancore/CommandQueueManager.hpp"
 #include "vulkancore/Context.hpp"
 
@@ -24,10 +30,20 @@ class SharedQueue {
 
   int size();
 
+  // Blocks until the queue has items or is closed, then moves items out of it for as
+  // long as takeMore(item) returns true (the first item is always taken). Returns false,
+  // with nothing popped, once the queue is closed
+  template <typename Predicate>
+  bool waitAndPopBatch(std::vector<T>& items, Predicate&& takeMore);
+
+  // Wakes up every waiting consumer, items pushed afterwards are never popped
+  void close();
+
  private:
   std::deque<T> queue_;
   std::mutex mutex_;
   std::condition_variable cond_;
+  bool closed_ = false;
 };
 
 template <typename T>
@@ -78,42 +94,128 @@ int SharedQueue<T>::size() {
   return size;
 }
 
+template <typename T>
+template <typename Predicate>
+bool SharedQueue<T>::waitAndPopBatch(std::vector<T>& items, Predicate&& takeMore) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+  cond_.wait(mlock, [this]() { return closed_ || !queue_.empty(); });
+  if (closed_) {
+    return false;
+  }
+  do {
+    items.push_back(std::move(queue_.front()));
+    queue_.pop_front();
+  } while (!queue_.empty() && takeMore(queue_.front()));
+  return true;
+}
+
+template <typename T>
+void SharedQueue<T>::close() {
+  std::unique_lock<std::mutex> mlock(mutex_);
+  closed_ = true;
+  mlock.unlock();
+  cond_.notify_all();
+}
+
 // currently mostly use to upload textures data using transfer queue, but can be
-// used to upload other data async as well
+// used to upload other data async as well.
+// Both worker threads sleep until there is work. The upload thread records every queued
+// texture (up to a batch limit) into one transfer submission, and the mip generation
+// thread does the same for the textures of the uploads that were submitted. A texture is
+// reported as ready, on the mip generation thread, once its mips are done on the GPU and
+// it's in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. The mips of the textures a
+// MipGenerator can handle are generated by it, in a few dispatches per batch, the others
+// are blitted
 class AsyncDataUploader {
  public:
   AsyncDataUploader(VulkanCore::Context& context,
-                    std::function<void(int, int)> textureReadyCallback);
+                    std::function<void(int, int)> textureReadyCallback,
+                    uint32_t maxTexturesPerBatch = 64,
+                    VkDeviceSize maxBytesPerBatch = 32 * 1024 * 1024);
   ~AsyncDataUploader();
   struct TextureLoadTask {
     VulkanCore::Texture* texture;
-    void* data;
+    const void* data;
     int index;
     int modelIndex;
+    // data holds every level, laid out like Texture::uploadMipChain expects, instead
+    // of level 0 only
+    bool mipChain = false;
+    // Used when the MipGenerator generates the mips
+    MipFilter mipFilter = MipFilter::Linear;
+  };
+
+  struct Stats {
+    uint64_t texturesQueued = 0;
+    uint64_t texturesReady = 0;
+    uint64_t bytesUploaded = 0;
+    uint64_t uploadSubmits = 0;
+    uint64_t mipGenSubmits = 0;
+    uint64_t texturesMipsComputed = 0;  // by the MipGenerator instead of blits
+    uint32_t uploadQueueDepth = 0;  // textures waiting to be uploaded right now
+    uint32_t mipGenQueueDepth = 0;  // uploaded textures waiting for their mips
+    uint32_t maxUploadQueueDepth = 0;
+    double averageLatencyMs = 0.0;  // from being queued to being ready
+    double maxLatencyMs = 0.0;
+  };
+
+  void startProcessing();
+
+  void queueTextureUploadTasks(const TextureLoadTask& textureLoadTask);
+
+  // Blocks until every queued texture is ready
+  void waitUntilIdle();
+
+  Stats stats();
+
+  void resetStats();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct TextureUploadTask {
+    TextureLoadTask task;
+    VkDeviceSize size;
+    Clock::time_point queuedAt;
   };
 
   struct TextureMipGenTask {
     VulkanCore::Texture* texture;
-    VkSemaphore graphicsSemaphore;
+    uint64_t uploadValue;  // on the transfer queue's timeline
     int index;
+    int modelIndex;
+    Clock::time_point queuedAt;
+    MipFilter mipFilter;
   };
 
-  void startProcessing();
+  void uploadTextures();
 
-  void queueTextureUploadTasks(const TextureLoadTask& textureLoadTask);
+  void generateMips();
+
+  void textureReady(const TextureMipGenTask& task);
 
  private:
   VulkanCore::Context& context_;
+  // Only used by the mip generation thread, null if the device doesn't support it.
+  // Outlives the queue managers, which release its descriptor sets
+  std::unique_ptr<MipGenerator> mipGenerator_;
   VulkanCore::CommandQueueManager transferCommandQueueMgr_;
   VulkanCore::CommandQueueManager graphicsCommandQueueMgr_;
+  uint32_t maxTexturesPerBatch_ = 64;
+  VkDeviceSize maxBytesPerBatch_ = 0;
 
-  SharedQueue<TextureLoadTask> textureLoadTasks_;
+  SharedQueue<TextureUploadTask> textureLoadTasks_;
   SharedQueue<TextureMipGenTask> textureMipGenerationTasks_;
 
   std::function<void(int, int)> textureReadyCallback_;
   std::thread textureGPUDataUploadThread_;
   std::thread textureMipGenThread_;
-  bool closeThreads_ = false;
-  std::vector<VkSemaphore> semaphores_;
+  std::atomic_bool closeThreads_ = false;
+
+  std::mutex statsMutex_;
+  std::condition_variable idleCond_;
+  Stats stats_;
+  double totalLatencyMs_ = 0.0;
+  uint64_t pendingTextures_ = 0;  // not affected by resetStats()
 };
 }  // namespace EngineCore
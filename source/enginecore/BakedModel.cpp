@@ -0,0 +1,464 @@
+#include "BakedModel.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "GLBLoader.hpp"
+#include "TextureCompression.hpp"
+
+namespace {
+constexpr uint32_t kBakedModelMagic = 0x444B4142;  // "BAKD"
+constexpr uint64_t kSectionAlignment = 16;
+
+uint64_t alignSection(uint64_t offset) {
+  return (offset + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+}
+
+// Box filters each level from the previous one, the same chain Texture::generateMips
+// produces with linear blits
+std::vector<uint8_t> buildMipChain(const EngineCore::stbImageData& image,
+                                   uint32_t& mipLevels) {
+  constexpr uint32_t channels = 4;  // stbImageData always decodes to RGBA
+  const uint32_t width = static_cast<uint32_t>(image.width);
+  const uint32_t height = static_cast<uint32_t>(image.height);
+  mipLevels =
+      static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+
+  size_t totalSize = 0;
+  for (uint32_t level = 0; level < mipLevels; ++level) {
+    totalSize += size_t(std::max(1u, width >> level)) * std::max(1u, height >> level) *
+                 channels;
+  }
+
+  std::vector<uint8_t> chain(totalSize);
+  memcpy(chain.data(), image.data, size_t(width) * height * channels);
+
+  size_t srcOffset = 0;
+  size_t dstOffset = size_t(width) * height * channels;
+  for (uint32_t level = 1; level < mipLevels; ++level) {
+    const uint32_t srcWidth = std::max(1u, width >> (level - 1));
+    const uint32_t srcHeight = std::max(1u, height >> (level - 1));
+    const uint32_t dstWidth = std::max(1u, width >> level);
+    const uint32_t dstHeight = std::max(1u, height >> level);
+    const uint8_t* src = chain.data() + srcOffset;
+    uint8_t* dst = chain.data() + dstOffset;
+
+    for (uint32_t y = 0; y < dstHeight; ++y) {
+      const uint32_t y0 = std::min(2 * y, srcHeight - 1);
+      const uint32_t y1 = std::min(2 * y + 1, srcHeight - 1);
+      for (uint32_t x = 0; x < dstWidth; ++x) {
+        const uint32_t x0 = std::min(2 * x, srcWidth - 1);
+        const uint32_t x1 = std::min(2 * x + 1, srcWidth - 1);
+        for (uint32_t c = 0; c < channels; ++c) {
+          const uint32_t sum = src[(y0 * srcWidth + x0) * channels + c] +
+                               src[(y0 * srcWidth + x1) * channels + c] +
+                               src[(y1 * srcWidth + x0) * channels + c] +
+                               src[(y1 * srcWidth + x1) * channels + c];
+          dst[(y * dstWidth + x) * channels + c] = static_cast<uint8_t>((sum + 2) / 4);
+        }
+      }
+    }
+
+    srcOffset = dstOffset;
+    dstOffset += size_t(dstWidth) * dstHeight * channels;
+  }
+
+  return chain;
+}
+}  // namespace
+
+namespace EngineCore {
+
+struct BakedModel::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+  // Catch changes to the layout of the structs stored as is
+  uint32_t vertexSize;
+  uint32_t vertex16BitSize;
+  uint32_t materialSize;
+  uint32_t meshCount;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t drawCount;
+  uint32_t materialCount;
+  uint32_t textureCount;
+  uint32_t padding;
+  uint64_t meshesOffset;
+  uint64_t verticesOffset;
+  uint64_t vertices16bitOffset;
+  uint64_t indicesOffset;
+  uint64_t drawsOffset;
+  uint64_t materialsOffset;
+  uint64_t texturesOffset;
+};
+
+BakedModel::BakedModel(std::unique_ptr<MappedFile> file) : file_(std::move(file)) {}
+
+const BakedModel::Header& BakedModel::header() const {
+  return *reinterpret_cast<const Header*>(file_->data());
+}
+
+template <typename T>
+std::span<const T> BakedModel::section(uint64_t offset, uint64_t count) const {
+  return {reinterpret_cast<const T*>(file_->data() + offset),
+          static_cast<size_t>(count)};
+}
+
+std::span<const BakedModel::MeshRecord> BakedModel::meshes() const {
+  return section<MeshRecord>(header().meshesOffset, header().meshCount);
+}
+
+std::span<const Vertex> BakedModel::vertices() const {
+  return section<Vertex>(header().verticesOffset, header().vertexCount);
+}
+
+std::span<const Vertex16Bit> BakedModel::vertices16bit() const {
+  return section<Vertex16Bit>(header().vertices16bitOffset, header().vertexCount);
+}
+
+std::span<const Mesh::Indices> BakedModel::indices() const {
+  return section<Mesh::Indices>(header().indicesOffset, header().indexCount);
+}
+
+std::span<const IndirectDrawDataAndMeshData> BakedModel::indirectDrawData() const {
+  return section<IndirectDrawDataAndMeshData>(header().drawsOffset, header().drawCount);
+}
+
+std::span<const Material> BakedModel::materials() const {
+  return section<Material>(header().materialsOffset, header().materialCount);
+}
+
+std::span<const BakedModel::TextureRecord> BakedModel::textures() const {
+  return section<TextureRecord>(header().texturesOffset, header().textureCount);
+}
+
+std::span<const uint8_t> BakedModel::textureData(const TextureRecord& texture) const {
+  return file_->bytes().subspan(texture.offset, texture.size);
+}
+
+uint64_t BakedModel::textureMemory() const {
+  uint64_t size = 0;
+  for (const auto& texture : textures()) {
+    size += texture.size;
+  }
+  return size;
+}
+
+uint64_t BakedModel::uncompressedTextureMemory() const {
+  uint64_t size = 0;
+  for (const auto& texture : textures()) {
+    size += mipChainSizeInBytes(VK_FORMAT_R8G8B8A8_UNORM, texture.width, texture.height,
+                                texture.mipLevels);
+  }
+  return size;
+}
+
+std::shared_ptr<BakedModel> BakedModel::open(const std::string& filePath,
+                                             uint64_t sourceHash) {
+  if (!std::filesystem::exists(filePath)) {
+    return nullptr;
+  }
+
+  auto file = std::make_unique<MappedFile>(filePath);
+  if (!file->valid() || file->size() < sizeof(Header)) {
+    return nullptr;
+  }
+
+  const Header& header = *reinterpret_cast<const Header*>(file->data());
+  if (header.magic != kBakedModelMagic || header.version != kVersion ||
+      header.sourceHash != sourceHash || header.vertexSize != sizeof(Vertex) ||
+      header.vertex16BitSize != sizeof(Vertex16Bit) ||
+      header.materialSize != sizeof(Material)) {
+    return nullptr;
+  }
+
+  const std::pair<uint64_t, uint64_t> sections[] = {
+      {header.meshesOffset, sizeof(MeshRecord) * header.meshCount},
+      {header.verticesOffset, sizeof(Vertex) * header.vertexCount},
+      {header.vertices16bitOffset, sizeof(Vertex16Bit) * header.vertexCount},
+      {header.indicesOffset, sizeof(Mesh::Indices) * header.indexCount},
+      {header.drawsOffset, sizeof(IndirectDrawDataAndMeshData) * header.drawCount},
+      {header.materialsOffset, sizeof(Material) * header.materialCount},
+      {header.texturesOffset, sizeof(TextureRecord) * header.textureCount},
+  };
+  for (const auto& [offset, size] : sections) {
+    if (offset + size > file->size()) {
+      std::cerr << "Baked model " << filePath << " is truncated" << std::endl;
+      return nullptr;
+    }
+  }
+
+  std::shared_ptr<BakedModel> baked(new BakedModel(std::move(file)));
+  for (const auto& texture : baked->textures()) {
+    if (texture.offset + texture.size > baked->file_->size()) {
+      std::cerr << "Baked model " << filePath << " is truncated" << std::endl;
+      return nullptr;
+    }
+  }
+  return baked;
+}
+
+bool BakedModel::bake(const Model& model, uint64_t sourceHash,
+                      const std::string& filePath, bool compressTextures,
+                      BakeStats* stats) {
+  // The baked format has no instances
+  if (!model.instances.empty()) {
+    return false;
+  }
+  Header header{
+      .magic = kBakedModelMagic,
+      .version = kVersion,
+      .sourceHash = sourceHash,
+      .vertexSize = sizeof(Vertex),
+      .vertex16BitSize = sizeof(Vertex16Bit),
+      .materialSize = sizeof(Material),
+      .meshCount = static_cast<uint32_t>(model.meshes.size()),
+      .drawCount = static_cast<uint32_t>(model.indirectDrawDataSet.size()),
+      .materialCount = static_cast<uint32_t>(model.materials.size()),
+      .textureCount = static_cast<uint32_t>(model.textures.size()),
+  };
+
+  std::vector<MeshRecord> meshes;
+  meshes.reserve(model.meshes.size());
+  for (const auto& mesh : model.meshes) {
+    meshes.push_back(MeshRecord{
+        .vertexOffset = header.vertexCount,
+        .vertexCount = static_cast<uint32_t>(mesh.vertices.size()),
+        .indexOffset = header.indexCount,
+        .indexCount = static_cast<uint32_t>(mesh.indices.size()),
+        .minAABB = mesh.minAABB,
+        .maxAABB = mesh.maxAABB,
+        .extents = mesh.extents,
+        .center = mesh.center,
+        .material = mesh.material,
+    });
+    header.vertexCount += meshes.back().vertexCount;
+    header.indexCount += meshes.back().indexCount;
+  }
+
+  uint64_t offset = alignSection(sizeof(Header));
+  auto reserveSection = [&offset](uint64_t& sectionOffset, uint64_t size) {
+    sectionOffset = offset;
+    offset = alignSection(offset + size);
+  };
+  reserveSection(header.meshesOffset, sizeof(MeshRecord) * header.meshCount);
+  reserveSection(header.verticesOffset, sizeof(Vertex) * header.vertexCount);
+  reserveSection(header.vertices16bitOffset, sizeof(Vertex16Bit) * header.vertexCount);
+  reserveSection(header.indicesOffset, sizeof(Mesh::Indices) * header.indexCount);
+  reserveSection(header.drawsOffset,
+                 sizeof(IndirectDrawDataAndMeshData) * header.drawCount);
+  reserveSection(header.materialsOffset, sizeof(Material) * header.materialCount);
+  reserveSection(header.texturesOffset, sizeof(TextureRecord) * header.textureCount);
+
+  for (const auto& texture : model.textures) {
+    if (!texture || texture->data == nullptr) {
+      std::cerr << "Baking requires decoded textures" << std::endl;
+      return false;
+    }
+  }
+
+  // Mipmapping and encoding dominate baking, each texture is done on its own thread
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<TextureUsage> usages = textureUsages(model);
+  std::vector<TextureRecord> textures(model.textures.size());
+  std::vector<std::vector<uint8_t>> mipChains(model.textures.size());
+  auto processTextures = [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      const auto& image = *model.textures[i];
+      TextureRecord& texture = textures[i];
+      texture.width = static_cast<uint32_t>(image.width);
+      texture.height = static_cast<uint32_t>(image.height);
+      texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+      mipChains[i] = buildMipChain(image, texture.mipLevels);
+      if (compressTextures) {
+        const auto format = chooseCompressedFormat(
+            usages[i], {static_cast<const uint8_t*>(image.data),
+                        size_t(texture.width) * texture.height * 4});
+        mipChains[i] = compressMipChain(mipChains[i], texture.width, texture.height,
+                                        texture.mipLevels, format);
+        texture.format = format;
+      }
+      texture.size = mipChains[i].size();
+    }
+  };
+  if (!model.textures.empty()) {
+    BS::thread_pool pool;
+    pool.parallelize_loop(size_t(0), model.textures.size(), processTextures).wait();
+  }
+  if (stats != nullptr) {
+    stats->textureCount = static_cast<uint32_t>(model.textures.size());
+    stats->texturesCompressed = compressTextures;
+    stats->textureMs = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  }
+  for (auto& texture : textures) {
+    reserveSection(texture.offset, texture.size);
+  }
+
+  // Written next to the destination and renamed, so a crash never leaves a partial file
+  // with a valid header behind
+  const std::string tempPath = filePath + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "Unable to write baked model " << filePath << std::endl;
+      return false;
+    }
+
+    uint64_t written = 0;
+    auto write = [&file, &written](uint64_t at, const void* data, uint64_t size) {
+      static const char zeros[kSectionAlignment] = {};
+      while (written < at) {
+        const auto padding = std::min<uint64_t>(at - written, kSectionAlignment);
+        file.write(zeros, padding);
+        written += padding;
+      }
+      file.write(reinterpret_cast<const char*>(data), size);
+      written += size;
+    };
+
+    write(0, &header, sizeof(header));
+    write(header.meshesOffset, meshes.data(), sizeof(MeshRecord) * meshes.size());
+    for (bool first = true; const auto& mesh : model.meshes) {
+      write(first ? header.verticesOffset : written, mesh.vertices.data(),
+            sizeof(Vertex) * mesh.vertices.size());
+      first = false;
+    }
+    for (bool first = true; const auto& mesh : model.meshes) {
+      write(first ? header.vertices16bitOffset : written, mesh.vertices16bit.data(),
+            sizeof(Vertex16Bit) * mesh.vertices16bit.size());
+      first = false;
+    }
+    for (bool first = true; const auto& mesh : model.meshes) {
+      write(first ? header.indicesOffset : written, mesh.indices.data(),
+            sizeof(Mesh::Indices) * mesh.indices.size());
+      first = false;
+    }
+    write(header.drawsOffset, model.indirectDrawDataSet.data(),
+          sizeof(IndirectDrawDataAndMeshData) * model.indirectDrawDataSet.size());
+    write(header.materialsOffset, model.materials.data(),
+          sizeof(Material) * model.materials.size());
+    write(header.texturesOffset, textures.data(),
+          sizeof(TextureRecord) * textures.size());
+    for (size_t i = 0; i < textures.size(); ++i) {
+      write(textures[i].offset, mipChains[i].data(), mipChains[i].size());
+    }
+
+    if (!file.good()) {
+      std::cerr << "Unable to write baked model " << filePath << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, filePath, error);
+  return !error;
+}
+
+std::shared_ptr<BakedModel> BakedModel::loadOrBake(const std::string& glbFilePath,
+                                                   const std::string& cacheDirectory,
+                                                   bool compressTextures) {
+  const auto glbPath = std::filesystem::current_path() / glbFilePath;
+
+  uint64_t sourceHash = 0;
+  {
+    const MappedFile glb(glbPath.string());
+    if (!glb.valid()) {
+      return nullptr;
+    }
+    sourceHash = hashContents(glb.bytes());
+  }
+
+  const auto cacheDirectoryPath = std::filesystem::current_path() / cacheDirectory;
+  std::filesystem::create_directories(cacheDirectoryPath);
+  const auto bakedName = glbPath.filename().replace_extension(
+      compressTextures ? ".compressed.baked" : ".baked");
+  const auto bakedPath = (cacheDirectoryPath / bakedName).string();
+
+  if (auto baked = open(bakedPath, sourceHash)) {
+    return baked;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  GLBLoader loader;
+  const auto model = loader.loadMapped(glbFilePath);
+  if (!model) {
+    return nullptr;
+  }
+  optimizeMeshes(*model);
+  BakeStats stats;
+  if (!bake(*model, sourceHash, bakedPath, compressTextures, &stats)) {
+    return nullptr;
+  }
+  stats.totalMs = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+  auto baked = open(bakedPath, sourceHash);
+  if (baked) {
+    baked->bakeStats_ = stats;
+  }
+  return baked;
+}
+
+std::shared_ptr<Model> BakedModel::createModel() const {
+  auto model = std::make_shared<Model>();
+  const auto allVertices = vertices();
+  const auto allVertices16bit = vertices16bit();
+  const auto allIndices = indices();
+
+  model->meshes.reserve(header().meshCount);
+  for (const auto& record : meshes()) {
+    const auto vertexBegin = record.vertexOffset;
+    const auto vertexEnd = record.vertexOffset + record.vertexCount;
+    Mesh mesh{
+        .vertices = std::vector<Vertex>(allVertices.begin() + vertexBegin,
+                                        allVertices.begin() + vertexEnd),
+        .vertices16bit = std::vector<Vertex16Bit>(allVertices16bit.begin() + vertexBegin,
+                                                  allVertices16bit.begin() + vertexEnd),
+        .indices = std::vector<Mesh::Indices>(
+            allIndices.begin() + record.indexOffset,
+            allIndices.begin() + record.indexOffset + record.indexCount),
+        .minAABB = record.minAABB,
+        .maxAABB = record.maxAABB,
+        .extents = record.extents,
+        .center = record.center,
+        .material = record.material,
+    };
+    model->meshes.emplace_back(std::move(mesh));
+  }
+
+  const auto draws = indirectDrawData();
+  model->indirectDrawDataSet.assign(draws.begin(), draws.end());
+  const auto bakedMaterials = materials();
+  model->materials.assign(bakedMaterials.begin(), bakedMaterials.end());
+  model->totalVertexSize = sizeof(Vertex) * header().vertexCount;
+  model->totalIndexSize = sizeof(Mesh::Indices) * header().indexCount;
+
+  return model;
+}
+
+uint64_t hashContents(std::span<const uint8_t> data) {
+  // FNV-1a over 64 bit words, with an extra shift so the high bits of each word also
+  // reach the low bits of the hash
+  constexpr uint64_t kPrime = 0x100000001b3ull;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+    hash ^= hash >> 32;
+  }
+  for (; i < data.size(); ++i) {
+    hash = (hash ^ data[i]) * kPrime;
+  }
+  return (hash ^ data.size()) * kPrime;
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+
+#include "MappedFile.hpp"
+#include "Model.hpp"
+
+namespace EngineCore {
+
+/// @brief Memory-mappable snapshot of a processed Model. Meshes are stored as one
+/// vertex blob (both the full and the 16 bit layout) and one index blob, next to the
+/// indirect draw data, the materials and textures with their whole mip chain, so
+/// nothing needs to be parsed, decoded or mipmapped when it's loaded. Textures are RGBA8,
+/// or block compressed with a format that depends on what the materials use them for
+/// (see TextureCompression.hpp). Files are keyed by a hash of the source GLB contents
+/// and rejected when it or the format changes.
+class BakedModel final {
+ public:
+  static constexpr uint32_t kVersion = 2;
+
+  struct MeshRecord {
+    uint32_t vertexOffset;  // in vertices
+    uint32_t vertexCount;
+    uint32_t indexOffset;  // in indices
+    uint32_t indexCount;
+    glm::vec3 minAABB;
+    glm::vec3 maxAABB;
+    glm::vec3 extents;
+    glm::vec3 center;
+    int32_t material;
+  };
+
+  struct TextureRecord {
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t format;  // VkFormat
+    uint64_t offset;  // from the start of the file
+    uint64_t size;    // of the whole mip chain
+  };
+
+  /// @brief Wall-clock timings of a bake. All zero when loadOrBake() opened an existing
+  /// file
+  struct BakeStats {
+    uint32_t textureCount = 0;
+    bool texturesCompressed = false;
+    double textureMs = 0.0;  // mipmapping, and encoding when compressed
+    double totalMs = 0.0;    // loading the GLB, optimizing, processing and writing
+  };
+
+  MOVABLE_ONLY(BakedModel);
+
+  /// @brief Returns nullptr when the file doesn't exist, was written by another version
+  /// or was baked from different source contents
+  static std::shared_ptr<BakedModel> open(const std::string& filePath,
+                                          uint64_t sourceHash);
+
+  /// @brief model must have its textures decoded (GLBLoader::load without a pool) and
+  /// no instances. compressTextures encodes the mip chains to BC formats, which the
+  /// device must support to load the file. stats, if provided, receives the texture
+  /// timings
+  static bool bake(const Model& model, uint64_t sourceHash, const std::string& filePath,
+                   bool compressTextures = false, BakeStats* stats = nullptr);
+
+  /// @brief Opens the baked version of glbFilePath from cacheDirectory, baking it first
+  /// if there is none for the current contents of the GLB. The meshes are run through
+  /// optimizeMeshes() before they are baked. Compressed and RGBA8 bakes are kept in
+  /// different files
+  static std::shared_ptr<BakedModel> loadOrBake(const std::string& glbFilePath,
+                                                const std::string& cacheDirectory,
+                                                bool compressTextures = false);
+
+  std::span<const MeshRecord> meshes() const;
+
+  std::span<const Vertex> vertices() const;
+
+  std::span<const Vertex16Bit> vertices16bit() const;
+
+  std::span<const Mesh::Indices> indices() const;
+
+  std::span<const IndirectDrawDataAndMeshData> indirectDrawData() const;
+
+  std::span<const Material> materials() const;
+
+  std::span<const TextureRecord> textures() const;
+
+  std::span<const uint8_t> textureData(const TextureRecord& texture) const;
+
+  /// @brief Sum of the mip chain sizes of all the textures as they are stored, and as
+  /// they would be in RGBA8
+  uint64_t textureMemory() const;
+
+  uint64_t uncompressedTextureMemory() const;
+
+  /// @brief What loadOrBake() spent baking the file, if it had to
+  const BakeStats& bakeStats() const { return bakeStats_; }
+
+  /// @brief Copies the meshes, materials and draw data into a Model, for code that
+  /// works with the CPU side meshes. Textures are left out
+  std::shared_ptr<Model> createModel() const;
+
+ private:
+  struct Header;
+
+  explicit BakedModel(std::unique_ptr<MappedFile> file);
+
+  template <typename T>
+  std::span<const T> section(uint64_t offset, uint64_t count) const;
+
+  const Header& header() const;
+
+  std::unique_ptr<MappedFile> file_;
+  BakeStats bakeStats_;
+};
+
+/// @brief 64 bit content hash used to key baked files, not meant to be cryptographic
+uint64_t hashContents(std::span<const uint8_t> data);
+
+}  // namespace EngineCore
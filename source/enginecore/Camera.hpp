@@ -47,6 +47,15 @@ class Camera final {
 
   glm::vec3 position() const;
 
+  float nearPlane() const { return nearP_; }
+
+  float farPlane() const { return farP_; }
+
+  // Vertical field of view in degrees
+  float fovY() const { return fov_; }
+
+  float aspectRatio() const { return aspect_; }
+
   bool isDirty() const;
 
   void setNotDirty();
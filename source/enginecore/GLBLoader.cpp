@@ -6,10 +6,16 @@
 #include <GLTFSDK/GLTFResourceReader.h>
 #include <meshoptimizer.h>
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
-#include <sstream>
+#include <optional>
+#include <unordered_map>
 
+#include "BakedModel.hpp"
+#include "MappedFile.hpp"
+#include "VertexKernels.hpp"
 #include "vulkancore/Buffer.hpp"
 #include "vulkancore/Context.hpp"
 #include "vulkancore/Sampler.hpp"
@@ -27,6 +33,157 @@ std::vector<uint8_t> imageData(Microsoft::glTF::GLBResourceReader* resourceReade
   auto imageData = resourceReader->ReadBinaryData<uint8_t>(document, imageBufferView);
   return imageData;
 }
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                   start)
+      .count();
+}
+
+// Reads an accessor through the glTF SDK, which de-interleaves it into a vector owned by
+// the returned view
+EngineCore::AccessorView readAccessor(const Microsoft::glTF::GLTFResourceReader& reader,
+                                      const Microsoft::glTF::Document& document,
+                                      const Microsoft::glTF::Accessor& accessor) {
+  const uint8_t numComponents = Microsoft::glTF::Accessor::GetTypeCount(accessor.type);
+  switch (accessor.componentType) {
+    case Microsoft::glTF::COMPONENT_FLOAT:
+      return EngineCore::AccessorView::fromVector(
+          reader.ReadBinaryData<float>(document, accessor), numComponents,
+          accessor.componentType);
+    case Microsoft::glTF::COMPONENT_UNSIGNED_BYTE:
+      return EngineCore::AccessorView::fromVector(
+          reader.ReadBinaryData<uint8_t>(document, accessor), numComponents,
+          accessor.componentType);
+    case Microsoft::glTF::COMPONENT_UNSIGNED_SHORT:
+      return EngineCore::AccessorView::fromVector(
+          reader.ReadBinaryData<uint16_t>(document, accessor), numComponents,
+          accessor.componentType);
+    case Microsoft::glTF::COMPONENT_UNSIGNED_INT:
+      return EngineCore::AccessorView::fromVector(
+          reader.ReadBinaryData<uint32_t>(document, accessor), numComponents,
+          accessor.componentType);
+    default:
+      return {};
+  }
+}
+
+glm::mat4 nodeTransform(const Microsoft::glTF::Node& node) {
+  glm::mat4 m(1.0);
+  if (node.matrix != Microsoft::glTF::Matrix4::IDENTITY) {
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        m[i][j] = node.matrix.values[i * 4 + j];
+      }
+    }
+  } else if (!node.HasIdentityTRS()) {
+    glm::mat4 matScale = glm::scale(
+        glm::mat4(1.0f), glm::vec3(node.scale.x, node.scale.y, node.scale.z));
+
+    glm::mat4 matRot = glm::mat4_cast(
+        glm::quat(node.rotation.w, node.rotation.x, node.rotation.y, node.rotation.z));
+
+    glm::mat4 matTranslate =
+        glm::translate(glm::mat4(1.0f), glm::vec3(node.translation.x, node.translation.y,
+                                                  node.translation.z));
+
+    m = matTranslate * matRot * matScale;
+  }
+  return m;
+}
+
+// Copies one component of an accessor into a tightly packed stream, missing attributes
+// (empty views) read as zeros
+void gatherComponent(const EngineCore::AccessorView& view, size_t component, size_t count,
+                     float* out) {
+  const size_t available =
+      component < view.numComponents ? std::min(count, view.count) : 0;
+  for (size_t i = 0; i < available; ++i) {
+    out[i] = view.floatAt(i, component);
+  }
+  std::fill(out + available, out + count, 0.0f);
+}
+
+void appendPrimitive(EngineCore::Mesh& mesh, const glm::mat4& transform,
+                     const glm::mat3& normalMatrix,
+                     const EngineCore::AccessorView& indices,
+                     const EngineCore::AccessorView& positions,
+                     const EngineCore::AccessorView& normals,
+                     const EngineCore::AccessorView& tangents,
+                     const EngineCore::AccessorView& uvs,
+                     const EngineCore::AccessorView& uvs2) {
+  // Indices are relative to the primitive, the mesh may already hold other primitives
+  const auto baseVertex = static_cast<uint32_t>(mesh.vertices.size());
+  mesh.indices.reserve(mesh.indices.size() + indices.count);
+  for (size_t i = 0; i < indices.count; ++i) {
+    mesh.indices.push_back(baseVertex + indices.indexAt(i));
+  }
+
+  // The attributes are gathered into one stream per component so the whole primitive
+  // goes through the batched transform and half packing kernels
+  const size_t vertexCount = positions.count;
+  thread_local std::vector<float> scratch;
+  scratch.resize(vertexCount * 14);
+  float* stream = scratch.data();
+  auto nextStream = [&]() {
+    float* current = stream;
+    stream += vertexCount;
+    return current;
+  };
+  const EngineCore::VertexStreams streams{
+      .posX = nextStream(),
+      .posY = nextStream(),
+      .posZ = nextStream(),
+      .normalX = nextStream(),
+      .normalY = nextStream(),
+      .normalZ = nextStream(),
+      .tangentX = nextStream(),
+      .tangentY = nextStream(),
+      .tangentZ = nextStream(),
+      .tangentW = nextStream(),
+      .texCoordU = nextStream(),
+      .texCoordV = nextStream(),
+      .texCoord1U = nextStream(),
+      .texCoord1V = nextStream(),
+      .count = vertexCount,
+  };
+
+  const std::pair<const EngineCore::AccessorView*, std::array<float*, 4>> attributes[] = {
+      {&positions, {streams.posX, streams.posY, streams.posZ}},
+      {&normals, {streams.normalX, streams.normalY, streams.normalZ}},
+      {&tangents,
+       {streams.tangentX, streams.tangentY, streams.tangentZ, streams.tangentW}},
+      {&uvs, {streams.texCoordU, streams.texCoordV}},
+      {&uvs2, {streams.texCoord1U, streams.texCoord1V}},
+  };
+  for (const auto& [view, components] : attributes) {
+    for (size_t c = 0; c < components.size() && components[c] != nullptr; ++c) {
+      gatherComponent(*view, c, vertexCount, components[c]);
+    }
+  }
+
+  EngineCore::VertexKernels::transform(transform, normalMatrix, streams, mesh.minAABB,
+                                       mesh.maxAABB);
+
+  const size_t firstVertex = mesh.vertices.size();
+  const auto material = uint32_t(mesh.material);
+  mesh.vertices16bit.resize(firstVertex + vertexCount);
+  EngineCore::VertexKernels::packHalf(streams, material,
+                                      mesh.vertices16bit.data() + firstVertex);
+
+  mesh.vertices.reserve(firstVertex + vertexCount);
+  for (size_t i = 0; i < vertexCount; ++i) {
+    mesh.vertices.emplace_back(EngineCore::Vertex{
+        .pos = glm::vec3(streams.posX[i], streams.posY[i], streams.posZ[i]),
+        .normal = glm::vec3(streams.normalX[i], streams.normalY[i], streams.normalZ[i]),
+        .tangent = glm::vec4(streams.tangentX[i], streams.tangentY[i],
+                             streams.tangentZ[i], streams.tangentW[i]),
+        .texCoord = glm::vec2(streams.texCoordU[i], streams.texCoordV[i]),
+        .texCoord1 = glm::vec2(streams.texCoord1U[i], streams.texCoord1V[i]),
+        .material = material,
+    });
+  }
+}
 }  // namespace
 
 namespace EngineCore {
@@ -50,18 +207,6 @@ class StreamReader : public Microsoft::glTF::IStreamReader {
   std::filesystem::path m_pathBase;
 };
 
-class InMemoryStream : public Microsoft::glTF::IStreamReader {
- public:
-  InMemoryStream(std::shared_ptr<std::stringstream> stream) : m_stream(stream) {}
-
-  std::shared_ptr<std::istream> GetInputStream(const std::string&) const override {
-    return m_stream;
-  }
-
- private:
-  std::shared_ptr<std::stringstream> m_stream;
-};
-
 int imageDataAsync(std::filesystem::path pathCurrent,
                    std::shared_ptr<Microsoft::glTF::Document> document, int index,
                    const std::string& imageId, std::shared_ptr<EngineCore::Model> model,
@@ -84,44 +229,23 @@ int imageDataAsync(std::filesystem::path pathCurrent,
 }
 
 std::shared_ptr<Model> GLBLoader::load(const std::vector<char>& buffer) {
-  std::shared_ptr<Model> outModel = std::make_shared<Model>();
-  Model& outputModel = *outModel.get();
-
-  std::shared_ptr<std::stringstream> sstream = std::make_shared<std::stringstream>();
-  for (const auto c : buffer) {
-    *sstream << c;
-  }
-
-  auto streamReader = std::make_shared<InMemoryStream>(sstream);
-  auto stream = streamReader->GetInputStream("");
-  auto resourceReader = std::make_shared<Microsoft::glTF::GLBResourceReader>(
-      std::move(streamReader), std::move(stream));
-
-  auto manifest = resourceReader->GetJson();
-
-  auto document =
-      std::make_shared<Microsoft::glTF::Document>(Microsoft::glTF::Deserialize(manifest));
-
-  updateMeshData(resourceReader, document, outputModel);
-
-  outputModel.textures.reserve(document->textures.Size());
-  for (int i = 0; i < document->textures.Size(); ++i) {
-    outputModel.textures.emplace_back(std::move(std::make_unique<stbImageData>(
-        imageData(resourceReader.get(), *document, document->textures[i].imageId))));
-  }
-
-  updateMaterials(document, outputModel);
-
-  return outModel;
+  // The buffer already holds the whole GLB, parse it in place
+  return loadFromMemory(
+      {reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size()}, nullptr, nullptr,
+      nullptr);
 }
 
 std::shared_ptr<Model> GLBLoader::load(const std::string& filePath, BS::thread_pool& pool,
                                        std::function<void(int, int)> callback) {
   std::shared_ptr<Model> outModel = std::make_shared<Model>();
   Model& outputModel = *outModel.get();
+  stats_ = {};
 
   auto pathCurrent = std::filesystem::current_path();
   pathCurrent /= filePath;
+  stats_.fileBytes = std::filesystem::file_size(pathCurrent);
+
+  auto start = std::chrono::steady_clock::now();
   auto streamReader = std::make_shared<StreamReader>(pathCurrent.parent_path());
   auto stream = streamReader->GetInputStream(pathCurrent.filename().string());
 
@@ -132,8 +256,15 @@ std::shared_ptr<Model> GLBLoader::load(const std::string& filePath, BS::thread_p
 
   auto document =
       std::make_shared<Microsoft::glTF::Document>(Microsoft::glTF::Deserialize(manifest));
+  stats_.documentParseMs = elapsedMs(start);
 
-  updateMeshData(resourceReader, document, outputModel);
+  // The resource reader shares one stream, so accessors are read on this thread only
+  updateMeshData(
+      *document,
+      [&](const Microsoft::glTF::Accessor& accessor) {
+        return readAccessor(*resourceReader, *document, accessor);
+      },
+      outputModel, nullptr);
 
   outputModel.textures.resize(document->textures.Size());
   for (int i = 0; i < document->textures.Size(); ++i) {
@@ -152,9 +283,13 @@ std::shared_ptr<Model> GLBLoader::load(const std::string& filePath, BS::thread_p
 std::shared_ptr<EngineCore::Model> GLBLoader::load(const std::string& filePath) {
   std::shared_ptr<Model> outModel = std::make_shared<Model>();
   Model& outputModel = *outModel.get();
+  stats_ = {};
 
   auto pathCurrent = std::filesystem::current_path();
   pathCurrent /= filePath;
+  stats_.fileBytes = std::filesystem::file_size(pathCurrent);
+
+  auto start = std::chrono::steady_clock::now();
   auto streamReader = std::make_shared<StreamReader>(pathCurrent.parent_path());
   auto stream = streamReader->GetInputStream(pathCurrent.filename().string());
 
@@ -165,212 +300,270 @@ std::shared_ptr<EngineCore::Model> GLBLoader::load(const std::string& filePath)
 
   auto document =
       std::make_shared<Microsoft::glTF::Document>(Microsoft::glTF::Deserialize(manifest));
+  stats_.documentParseMs = elapsedMs(start);
 
-  updateMeshData(resourceReader, document, outputModel);
+  // The resource reader shares one stream, so accessors are read on this thread only
+  updateMeshData(
+      *document,
+      [&](const Microsoft::glTF::Accessor& accessor) {
+        return readAccessor(*resourceReader, *document, accessor);
+      },
+      outputModel, nullptr);
 
+  start = std::chrono::steady_clock::now();
   for (int i = 0; i < document->textures.Size(); ++i) {
     outputModel.textures.emplace_back(std::move(std::make_unique<stbImageData>(
         imageData(resourceReader.get(), *document, document->textures[i].imageId))));
   }
+  stats_.textureDecodeMs = elapsedMs(start);
 
   updateMaterials(document, outputModel);
 
   return outModel;
 }
 
-void GLBLoader::updateMeshData(
-    std::shared_ptr<Microsoft::glTF::GLBResourceReader> resourceReader,
-    std::shared_ptr<Microsoft::glTF::Document> document, Model& outputModel) {
-  uint32_t firstIndex = 0;
-  uint32_t firstInstance = 0;
+std::shared_ptr<Model> GLBLoader::loadMapped(const std::string& filePath) {
+  auto file = std::make_shared<MappedFile>(
+      (std::filesystem::current_path() / filePath).string());
+  if (!file->valid()) {
+    return nullptr;
+  }
+  return loadFromMemory(file->bytes(), file, nullptr, nullptr);
+}
+
+std::shared_ptr<Model> GLBLoader::loadMapped(const std::string& filePath,
+                                             BS::thread_pool& pool,
+                                             std::function<void(int, int)> callback) {
+  auto file = std::make_shared<MappedFile>(
+      (std::filesystem::current_path() / filePath).string());
+  if (!file->valid()) {
+    return nullptr;
+  }
+  return loadFromMemory(file->bytes(), file, &pool, std::move(callback));
+}
+
+std::shared_ptr<Model> GLBLoader::loadFromMemory(std::span<const uint8_t> glb,
+                                                 std::shared_ptr<const void> keepAlive,
+                                                 BS::thread_pool* pool,
+                                                 std::function<void(int, int)> callback) {
+  stats_ = {.fileBytes = glb.size()};
+
+  auto start = std::chrono::steady_clock::now();
+  const GLBView view(glb);
+  if (!view.valid()) {
+    return nullptr;
+  }
+
+  auto document = std::make_shared<Microsoft::glTF::Document>(
+      Microsoft::glTF::Deserialize(std::string(view.json())));
+  stats_.documentParseMs = elapsedMs(start);
+
+  std::shared_ptr<Model> outModel = std::make_shared<Model>();
+  Model& outputModel = *outModel.get();
+
+  // Pools handed to the loader are usually paused until the renderer is ready for the
+  // texture callbacks, meshes are decoded on a temporary pool of the same size then
+  std::optional<BS::thread_pool> decodePool;
+  BS::thread_pool* meshPool = pool;
+  if (pool != nullptr && pool->is_paused()) {
+    decodePool.emplace(pool->get_thread_count());
+    meshPool = &decodePool.value();
+  }
+
+  // Sparse accessors aren't produced by the exporters used for the sample assets, their
+  // substitutions are not applied here. Reading from the view is thread safe.
+  updateMeshData(
+      *document,
+      [&](const Microsoft::glTF::Accessor& accessor) {
+        return view.accessor(*document, accessor);
+      },
+      outputModel, meshPool);
+
+  if (pool != nullptr) {
+    // Images are decoded straight from the mapping, which the tasks keep alive
+    outputModel.textures.resize(document->textures.Size());
+    for (int i = 0; i < document->textures.Size(); ++i) {
+      const auto image = view.image(*document, document->textures[i].imageId);
+      results_.emplace_back(
+          pool->submit([keepAlive, image, outModel, i, id = modelId, callback]() {
+            outModel->textures[i] = std::make_unique<stbImageData>(image);
+            callback(i, id);
+            return i;
+          }));
+    }
+    modelId++;
+  } else {
+    start = std::chrono::steady_clock::now();
+    outputModel.textures.reserve(document->textures.Size());
+    for (int i = 0; i < document->textures.Size(); ++i) {
+      outputModel.textures.emplace_back(std::make_unique<stbImageData>(
+          view.image(*document, document->textures[i].imageId)));
+    }
+    stats_.textureDecodeMs = elapsedMs(start);
+  }
+
+  updateMaterials(document, outputModel);
+
+  return outModel;
+}
 
-  for (size_t i = 0; i < document->nodes.Size(); ++i) {
-    if (document->nodes[i].meshId.empty()) {
+void GLBLoader::updateMeshData(const Microsoft::glTF::Document& document,
+                               const AccessorReader& readAccessor, Model& outputModel,
+                               BS::thread_pool* pool) {
+  // Without instancing each node gets its own copy of its mesh, transformed. With
+  // instancing each mesh is decoded once and the nodes become its instances
+  struct DecodeTask {
+    const Microsoft::glTF::Mesh* mesh;
+    glm::mat4 transform;
+  };
+  std::vector<DecodeTask> tasks;
+  std::vector<std::pair<size_t, glm::mat4>> nodeInstances;  // task, node transform
+  std::unordered_map<std::string, size_t> taskOfMesh;
+  for (const auto& node : document.nodes.Elements()) {
+    if (node.meshId.empty()) {
       continue;
     }
-    uint32_t meshId = std::stoul(document->nodes[i].meshId);
-    const Microsoft::glTF::Mesh& mesh = document->meshes[meshId];
-    Mesh currentMesh;
-
-    glm::mat4 m(1.0);
-    if (document->nodes[i].matrix != Microsoft::glTF::Matrix4::IDENTITY) {
-      for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-          m[i][j] = document->nodes[i].matrix.values[i * 4 + j];
-        }
-      }
-    } else if (!document->nodes[i].HasIdentityTRS()) {
-      glm::mat4 matScale =
-          glm::scale(glm::mat4(1.0f),
-                     glm::vec3(document->nodes[i].scale.x, document->nodes[i].scale.y,
-                               document->nodes[i].scale.z));
-
-      glm::mat4 matRot = glm::mat4_cast(
-          glm::quat(document->nodes[i].rotation.w, document->nodes[i].rotation.x,
-                    document->nodes[i].rotation.y, document->nodes[i].rotation.z));
-
-      glm::mat4 matTranslate =
-          glm::translate(glm::mat4(1.0f), glm::vec3(document->nodes[i].translation.x,
-                                                    document->nodes[i].translation.y,
-                                                    document->nodes[i].translation.z));
-
-      m = matTranslate * matScale;
+    const auto& mesh = document.meshes.Get(node.meshId);
+    if (!instancing_) {
+      tasks.push_back({&mesh, nodeTransform(node)});
+      continue;
+    }
+    auto [itr, inserted] = taskOfMesh.try_emplace(node.meshId, tasks.size());
+    if (inserted) {
+      tasks.push_back({&mesh, glm::mat4(1.0f)});
     }
+    nodeInstances.emplace_back(itr->second, nodeTransform(node));
+  }
 
-    for (auto& primitive : mesh.primitives) {
-      std::string positionAccessorID;
-      std::string normalAccessorID;
-      std::string tangentAccessorID;
-      std::string uvAccessorID;
-      std::string uvAccessorID2;
+  // Meshes are decoded independently
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Mesh> decodedMeshes(tasks.size());
+  auto decodeNodes = [&](size_t first, size_t last) {
+    for (size_t i = first; i < last; ++i) {
+      decodedMeshes[i] =
+          decodeMesh(document, *tasks[i].mesh, tasks[i].transform, readAccessor);
+    }
+  };
+  if (pool != nullptr && pool->get_thread_count() > 1) {
+    // Node sizes vary a lot, smaller blocks keep the threads evenly busy
+    const size_t numBlocks =
+        std::min<size_t>(tasks.size(), size_t(pool->get_thread_count()) * 8);
+    pool->parallelize_loop(size_t(0), tasks.size(), decodeNodes, numBlocks).wait();
+    stats_.meshDecodeThreads = pool->get_thread_count();
+  } else {
+    decodeNodes(0, tasks.size());
+    stats_.meshDecodeThreads = 1;
+  }
+  stats_.meshDecodeMs = elapsedMs(start);
 
-      if (primitive.materialId != "") {
-        currentMesh.material = document->materials.GetIndex(primitive.materialId);
-      }
+  // Offsets are assigned in node order, so the result does not depend on scheduling
+  start = std::chrono::steady_clock::now();
+  uint32_t firstIndex = 0;
+  uint32_t vertexOffset = 0;
+  std::vector<int32_t> meshIdOfTask(decodedMeshes.size(), -1);
+  outputModel.meshes.reserve(decodedMeshes.size());
+  outputModel.indirectDrawDataSet.reserve(decodedMeshes.size());
+  for (size_t task = 0; task < decodedMeshes.size(); ++task) {
+    auto& currentMesh = decodedMeshes[task];
+    if (currentMesh.indices.empty() || currentMesh.vertices.empty()) {
+      continue;
+    }
+    meshIdOfTask[task] = int32_t(outputModel.meshes.size());
+    IndirectDrawDataAndMeshData indirectDrawData{
+        .indexCount = uint32_t(currentMesh.indices.size()),
+        .instanceCount = instancing_ ? 0u : 1u,
+        .firstIndex = firstIndex,
+        .vertexOffset = vertexOffset,
+        .firstInstance = 0,
+        .meshId = uint32_t(outputModel.meshes.size()),
+        .materialIndex = static_cast<int>(currentMesh.material),
+    };
+
+    firstIndex += currentMesh.indices.size();
+    vertexOffset += currentMesh.vertices.size();
+
+    outputModel.meshes.emplace_back(std::move(currentMesh));
+    outputModel.indirectDrawDataSet.emplace_back(std::move(indirectDrawData));
+    outputModel.totalVertexSize +=
+        sizeof(Vertex) * outputModel.meshes.back().vertices.size();
+    outputModel.totalIndexSize +=
+        sizeof(Mesh::Indices) * outputModel.meshes.back().indices.size();
+  }
 
-      if (primitive.TryGetAttributeAccessorId(Microsoft::glTF::ACCESSOR_POSITION,
-                                              positionAccessorID) &&
-          primitive.TryGetAttributeAccessorId(Microsoft::glTF::ACCESSOR_NORMAL,
-                                              normalAccessorID)) {
-        bool hasTangent = primitive.TryGetAttributeAccessorId(
-            Microsoft::glTF::ACCESSOR_TANGENT, tangentAccessorID);
-        bool hasUV = primitive.TryGetAttributeAccessorId(
-            Microsoft::glTF::ACCESSOR_TEXCOORD_0, uvAccessorID);
-
-        bool hasUV2 = primitive.TryGetAttributeAccessorId(
-            Microsoft::glTF::ACCESSOR_TEXCOORD_1, uvAccessorID2);
-        if (document->accessors.Has(primitive.indicesAccessorId) &&
-            document->accessors.Has(positionAccessorID) &&
-            document->accessors.Has(normalAccessorID)) {
-          const Microsoft::glTF::Accessor& indicesAcc =
-              document->accessors[primitive.indicesAccessorId];
-          const Microsoft::glTF::Accessor& positionAcc =
-              document->accessors[positionAccessorID];
-          const Microsoft::glTF::Accessor& normalAcc =
-              document->accessors[normalAccessorID];
-
-          if (indicesAcc.componentType == Microsoft::glTF::COMPONENT_UNSIGNED_SHORT) {
-            std::vector<unsigned short> indices =
-                resourceReader->ReadBinaryData<unsigned short>(*document, indicesAcc);
-            for (auto& index : indices) {
-              currentMesh.indices.push_back(index);
-            }
-          } else if (indicesAcc.componentType ==
-                     Microsoft::glTF::COMPONENT_UNSIGNED_INT) {
-            std::vector<unsigned int> indices =
-                resourceReader->ReadBinaryData<unsigned int>(*document, indicesAcc);
-            for (auto& index : indices) {
-              currentMesh.indices.push_back(index);
-            }
-          }
-
-          if (positionAcc.componentType == Microsoft::glTF::COMPONENT_FLOAT &&
-              normalAcc.componentType == Microsoft::glTF::COMPONENT_FLOAT) {
-            std::vector<float> positions =
-                resourceReader->ReadBinaryData<float>(*document, positionAcc);
-            std::vector<float> normals =
-                resourceReader->ReadBinaryData<float>(*document, normalAcc);
-
-            auto vertexCount = positionAcc.count;
-
-            std::vector<float> tangents(vertexCount * 4, 0.0);
-            std::vector<float> uvs(vertexCount * 2, 0.0);
-            std::vector<float> uvs2(vertexCount * 2, 0.0);
-            if (hasUV) {
-              const Microsoft::glTF::Accessor& uvAcc = document->accessors[uvAccessorID];
-              uvs = resourceReader->ReadBinaryData<float>(*document, uvAcc);
-            }
-
-            if (hasUV2) {
-              const Microsoft::glTF::Accessor& uvAcc = document->accessors[uvAccessorID2];
-              uvs2 = resourceReader->ReadBinaryData<float>(*document, uvAcc);
-            }
-
-            if (hasTangent) {
-              const Microsoft::glTF::Accessor& tangentAcc =
-                  document->accessors[tangentAccessorID];
-              tangents = resourceReader->ReadBinaryData<float>(*document, tangentAcc);
-            }
-
-            for (uint64_t i = 0; i < vertexCount; i++) {
-              const std::array<uint64_t, 4> fourElementsProp = {4 * i, 4 * i + 1,
-                                                                4 * i + 2, 4 * i + 3};
-              const std::array<uint64_t, 3> threeElementsProp = {3 * i, 3 * i + 1,
-                                                                 3 * i + 2};
-              const std::array<uint64_t, 2> twoElementsProp = {2 * i, 2 * i + 1};
-
-              Vertex vertex{
-                  .pos = glm::vec3(positions[threeElementsProp[0]],
-                                   positions[threeElementsProp[1]],
-                                   positions[threeElementsProp[2]]),
-                  .normal = glm::vec3(normals[threeElementsProp[0]],
-                                      normals[threeElementsProp[1]],
-                                      normals[threeElementsProp[2]]),
-                  .tangent = glm::vec4(
-                      tangents[fourElementsProp[0]], tangents[fourElementsProp[1]],
-                      tangents[fourElementsProp[2]], tangents[fourElementsProp[3]]),
-                  .texCoord = glm::vec2(uvs[twoElementsProp[0]], uvs[twoElementsProp[1]]),
-                  .texCoord1 =
-                      glm::vec2(uvs2[twoElementsProp[0]], uvs2[twoElementsProp[1]]),
-                  .material = uint32_t(currentMesh.material),
-              };
-
-              vertex.applyTransform(m);
-
-              currentMesh.vertices.emplace_back(vertex);
-              currentMesh.vertices16bit.emplace_back(to16bitVertex(vertex));
-
-              if (vertex.pos.x < currentMesh.minAABB.x) {
-                currentMesh.minAABB.x = vertex.pos.x;
-              }
-              if (vertex.pos.y < currentMesh.minAABB.y) {
-                currentMesh.minAABB.y = vertex.pos.y;
-              }
-              if (vertex.pos.z < currentMesh.minAABB.z) {
-                currentMesh.minAABB.z = vertex.pos.z;
-              }
-
-              if (vertex.pos.x > currentMesh.maxAABB.x) {
-                currentMesh.maxAABB.x = vertex.pos.x;
-              }
-              if (vertex.pos.y > currentMesh.maxAABB.y) {
-                currentMesh.maxAABB.y = vertex.pos.y;
-              }
-              if (vertex.pos.z > currentMesh.maxAABB.z) {
-                currentMesh.maxAABB.z = vertex.pos.z;
-              }
-            }
-          }
-        }
-      }
-      if (primitive.materialId != "") {
-        currentMesh.material = document->materials.GetIndex(primitive.materialId);
-      }
+  // Instances are grouped by mesh, in node order within a mesh
+  for (const auto& [task, transform] : nodeInstances) {
+    if (meshIdOfTask[task] != -1) {
+      outputModel.instances.push_back({
+          .transform = transform,
+          .meshId = uint32_t(meshIdOfTask[task]),
+      });
+      ++outputModel.indirectDrawDataSet[meshIdOfTask[task]].instanceCount;
+    }
+  }
+  std::stable_sort(
+      outputModel.instances.begin(), outputModel.instances.end(),
+      [](const MeshInstance& a, const MeshInstance& b) { return a.meshId < b.meshId; });
+  for (uint32_t firstInstance = 0; auto& draw : outputModel.indirectDrawDataSet) {
+    draw.firstInstance = instancing_ ? firstInstance : 0;
+    firstInstance += draw.instanceCount;
+  }
+  stats_.meshAssembleMs = elapsedMs(start);
+}
+
+Mesh GLBLoader::decodeMesh(const Microsoft::glTF::Document& document,
+                           const Microsoft::glTF::Mesh& mesh, const glm::mat4& m,
+                           const AccessorReader& readAccessor) {
+  Mesh currentMesh;
+
+  const glm::mat3 normalMatrix = glm::inverseTranspose(glm::mat3(m));
+
+  for (auto& primitive : mesh.primitives) {
+    if (primitive.materialId != "") {
+      currentMesh.material = document.materials.GetIndex(primitive.materialId);
+    }
+
+    std::string positionAccessorID;
+    std::string normalAccessorID;
+    if (!primitive.TryGetAttributeAccessorId(Microsoft::glTF::ACCESSOR_POSITION,
+                                             positionAccessorID) ||
+        !primitive.TryGetAttributeAccessorId(Microsoft::glTF::ACCESSOR_NORMAL,
+                                             normalAccessorID) ||
+        !document.accessors.Has(primitive.indicesAccessorId) ||
+        !document.accessors.Has(positionAccessorID) ||
+        !document.accessors.Has(normalAccessorID)) {
+      continue;
     }
-    if (!currentMesh.indices.empty() && !currentMesh.vertices.empty()) {
-      IndirectDrawDataAndMeshData indirectDrawData{
-          .indexCount = uint32_t(currentMesh.indices.size()),
-          .instanceCount = 1,
-          .firstIndex = firstIndex,
-          .vertexOffset = firstInstance,
-          .firstInstance = 0,
-          .meshId = uint32_t(outputModel.meshes.size()),
-          .materialIndex = static_cast<int>(currentMesh.material),
-      };
-
-      firstIndex += currentMesh.indices.size();
-      firstInstance += currentMesh.vertices.size();
-
-      currentMesh.extents = (currentMesh.maxAABB - currentMesh.minAABB) * 0.5f;
-      currentMesh.center = currentMesh.minAABB + currentMesh.extents;
-      outputModel.meshes.emplace_back(std::move(currentMesh));
-      outputModel.indirectDrawDataSet.emplace_back(std::move(indirectDrawData));
-      outputModel.totalVertexSize +=
-          sizeof(Vertex) * outputModel.meshes.back().vertices.size();
-      outputModel.totalIndexSize +=
-          sizeof(Mesh::Indices) * outputModel.meshes.back().indices.size();
+
+    const auto& indicesAcc = document.accessors.Get(primitive.indicesAccessorId);
+    const auto& positionAcc = document.accessors.Get(positionAccessorID);
+    const auto& normalAcc = document.accessors.Get(normalAccessorID);
+    if (positionAcc.componentType != Microsoft::glTF::COMPONENT_FLOAT ||
+        normalAcc.componentType != Microsoft::glTF::COMPONENT_FLOAT) {
+      continue;
     }
+
+    auto optionalAttribute = [&](const char* attribute) -> AccessorView {
+      std::string accessorId;
+      if (primitive.TryGetAttributeAccessorId(attribute, accessorId) &&
+          document.accessors.Has(accessorId)) {
+        const auto& accessor = document.accessors.Get(accessorId);
+        if (accessor.componentType == Microsoft::glTF::COMPONENT_FLOAT) {
+          return readAccessor(accessor);
+        }
+      }
+      return {};
+    };
+
+    appendPrimitive(currentMesh, m, normalMatrix, readAccessor(indicesAcc),
+                    readAccessor(positionAcc), readAccessor(normalAcc),
+                    optionalAttribute(Microsoft::glTF::ACCESSOR_TANGENT),
+                    optionalAttribute(Microsoft::glTF::ACCESSOR_TEXCOORD_0),
+                    optionalAttribute(Microsoft::glTF::ACCESSOR_TEXCOORD_1));
   }
+
+  currentMesh.extents = (currentMesh.maxAABB - currentMesh.minAABB) * 0.5f;
+  currentMesh.center = currentMesh.minAABB + currentMesh.extents;
+  return currentMesh;
 }
 
 void GLBLoader::updateMaterials(std::shared_ptr<Microsoft::glTF::Document> document,
@@ -428,14 +621,7 @@ void convertModel2OneMeshPerBuffer(
         std::to_string(textureIndex)));
 
     // Upload texture to GPU
-    auto textureUploadStagingBuffer = context.createStagingBuffer(
-        textures.back()->vkDeviceSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        std::to_string(textureIndex));
-
-    textures.back()->uploadAndGenMips(commandBuffer, textureUploadStagingBuffer.get(),
-                                      texture->data);
-
-    queueMgr.disposeWhenSubmitCompletes(std::move(textureUploadStagingBuffer));
+    textures.back()->uploadAndGenMips(queueMgr, commandBuffer, texture->data);
 
     ++textureIndex;
   }
@@ -533,14 +719,7 @@ void convertModel2OneBuffer(const VulkanCore::Context& context,
         std::to_string(textureIndex)));
 
     // Upload texture to GPU
-    auto textureUploadStagingBuffer = context.createStagingBuffer(
-        textures.back()->vkDeviceSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        std::to_string(textureIndex));
-
-    textures.back()->uploadAndGenMips(commandBuffer, textureUploadStagingBuffer.get(),
-                                      texture->data);
-
-    queueMgr.disposeWhenSubmitCompletes(std::move(textureUploadStagingBuffer));
+    textures.back()->uploadAndGenMips(queueMgr, commandBuffer, texture->data);
 
     ++textureIndex;
   }
@@ -622,14 +801,27 @@ void convertModel2OneBuffer(const VulkanCore::Context& context,
 
     currentIndicesStartingIndex += indicesTotalSize;
 
+    // The simplified LODs follow the full mesh, see MeshLod::firstIndex
+    if (!mesh.lodIndices.empty()) {
+      const auto lodIndicesSize = sizeof(Mesh::Indices) * mesh.lodIndices.size();
+      context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers[1].get(),
+                                reinterpret_cast<const void*>(mesh.lodIndices.data()),
+                                lodIndicesSize, currentIndicesStartingIndex);
+      currentIndicesStartingIndex += lodIndicesSize;
+    }
+
+    // Instanced models draw each mesh once for all its instances
+    const bool instanced = !model.instances.empty();
     indirectDrawData.emplace_back(IndirectDrawCommandAndMeshData{
         .command =
             {
                 .indexCount = uint32_t(mesh.indices.size()),
-                .instanceCount = 1,
+                .instanceCount =
+                    instanced ? model.indirectDrawDataSet[meshId].instanceCount : 1,
                 .firstIndex = firstIndex,
                 .vertexOffset = static_cast<int>(firstInstance),  // 0,
-                .firstInstance = 0,                               // firstInstance,
+                .firstInstance =
+                    instanced ? model.indirectDrawDataSet[meshId].firstInstance : 0,
                                                                   //.vertexOffset = 0,
                                                                   //.firstInstance =
                                                                   // firstInstance,
@@ -638,7 +830,7 @@ void convertModel2OneBuffer(const VulkanCore::Context& context,
         .materialIndex = static_cast<uint32_t>(mesh.material),
     });
 
-    firstIndex += mesh.indices.size();
+    firstIndex += mesh.indices.size() + mesh.lodIndices.size();
     firstInstance += mesh.vertices.size();
 
     ++meshId;
@@ -682,6 +874,136 @@ void convertModel2OneBuffer(const VulkanCore::Context& context,
   context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers[3].get(),
                             reinterpret_cast<const void*>(indirectDrawData.data()),
                             totalIndirectBufferSize);
+
+  if (!model.instances.empty()) {
+    const auto totalInstanceSize = sizeof(MeshInstance) * model.instances.size();
+    buffers.emplace_back(context.createBuffer(
+        totalInstanceSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, "instances"));
+    context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers[4].get(),
+                              reinterpret_cast<const void*>(model.instances.data()),
+                              totalInstanceSize);
+  }
+}
+
+void convertModel2OneBuffer(const VulkanCore::Context& context,
+                            VulkanCore::CommandQueueManager& queueMgr,
+                            VkCommandBuffer commandBuffer, const BakedModel& model,
+                            std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                            std::vector<std::shared_ptr<VulkanCore::Sampler>>& samplers,
+                            bool useHalfFloatVertices,
+                            bool makeBuffersSuitableForAccelStruct) {
+  const VkBufferUsageFlags accelStructUsage =
+      makeBuffersSuitableForAccelStruct
+          ? VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+          : 0;
+
+  // Vertex buffer, the mesh vertices are already laid out back to back
+  const void* vertexData = useHalfFloatVertices
+                               ? static_cast<const void*>(model.vertices16bit().data())
+                               : static_cast<const void*>(model.vertices().data());
+  const auto vertexDataSize = useHalfFloatVertices ? model.vertices16bit().size_bytes()
+                                                   : model.vertices().size_bytes();
+  buffers.emplace_back(context.createBuffer(
+      vertexDataSize,
+#if defined(VK_KHR_buffer_device_address) && defined(_WIN32)
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+#endif
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT | accelStructUsage |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "vertex"));
+  context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers.back().get(), vertexData,
+                            vertexDataSize);
+
+  // Index buffer
+  buffers.emplace_back(context.createBuffer(
+      model.indices().size_bytes(),
+#if defined(VK_KHR_buffer_device_address) && defined(_WIN32)
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+#endif
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_INDEX_BUFFER_BIT | accelStructUsage |
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "index"));
+  context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers.back().get(),
+                            model.indices().data(), model.indices().size_bytes());
+
+  // Material buffer
+  buffers.emplace_back(context.createBuffer(
+      model.materials().size_bytes(),
+#if defined(VK_KHR_buffer_device_address) && defined(_WIN32)
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+#endif
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          accelStructUsage,
+      VMA_MEMORY_USAGE_GPU_ONLY, "materials"));
+  context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers.back().get(),
+                            model.materials().data(), model.materials().size_bytes());
+
+  // Indirect draw parameters buffer
+  std::vector<IndirectDrawCommandAndMeshData> indirectDrawData;
+  indirectDrawData.reserve(model.indirectDrawData().size());
+  for (const auto& draw : model.indirectDrawData()) {
+    indirectDrawData.emplace_back(IndirectDrawCommandAndMeshData{
+        .command =
+            {
+                .indexCount = draw.indexCount,
+                .instanceCount = draw.instanceCount,
+                .firstIndex = draw.firstIndex,
+                .vertexOffset = static_cast<int>(draw.vertexOffset),
+                .firstInstance = draw.firstInstance,
+            },
+        .meshId = draw.meshId,
+        .materialIndex = static_cast<uint32_t>(draw.materialIndex),
+    });
+  }
+  const auto totalIndirectBufferSize =
+      sizeof(IndirectDrawCommandAndMeshData) * indirectDrawData.size();
+  buffers.emplace_back(context.createBuffer(
+      totalIndirectBufferSize,
+#if defined(VK_KHR_buffer_device_address) && defined(_WIN32)
+      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+#endif
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          accelStructUsage | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "IndirectDraw"));
+  context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers.back().get(),
+                            indirectDrawData.data(), totalIndirectBufferSize);
+}
+
+void convertModel2OneBuffer(const VulkanCore::Context& context,
+                            VulkanCore::CommandQueueManager& queueMgr,
+                            VkCommandBuffer commandBuffer, const BakedModel& model,
+                            std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                            std::vector<std::shared_ptr<VulkanCore::Texture>>& textures,
+                            std::vector<std::shared_ptr<VulkanCore::Sampler>>& samplers,
+                            bool useHalfFloatVertices,
+                            bool makeBuffersSuitableForAccelStruct) {
+  convertModel2OneBuffer(context, queueMgr, commandBuffer, model, buffers, samplers,
+                         useHalfFloatVertices, makeBuffersSuitableForAccelStruct);
+
+  for (size_t textureIndex = 0; const auto& texture : model.textures()) {
+    ASSERT(!VulkanCore::isBlockCompressed(static_cast<VkFormat>(texture.format)) ||
+               context.isTextureCompressionBCEnabled(),
+           "The model was baked with block compressed textures, which the device "
+           "doesn't support");
+    textures.emplace_back(context.createTexture(
+        VK_IMAGE_TYPE_2D, static_cast<VkFormat>(texture.format), 0,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VkExtent3D{
+            .width = texture.width,
+            .height = texture.height,
+            .depth = 1u,
+        },
+        texture.mipLevels, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+        VK_SAMPLE_COUNT_1_BIT, std::to_string(textureIndex)));
+
+    textures.back()->uploadMipChain(queueMgr, commandBuffer,
+                                    model.textureData(texture).data());
+
+    ++textureIndex;
+  }
 }
 
 /// @brief Adds 3 buffers to 'buffers':
@@ -805,17 +1127,65 @@ void convertModel2OneBufferOptimized(
         std::to_string(textureIndex)));
 
     // Upload texture to GPU
-    auto textureUploadStagingBuffer = context.createStagingBuffer(
-        textures.back()->vkDeviceSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        std::to_string(textureIndex));
-
-    textures.back()->uploadAndGenMips(commandBuffer, textureUploadStagingBuffer.get(),
-                                      texture->data);
-
-    queueMgr.disposeWhenSubmitCompletes(std::move(textureUploadStagingBuffer));
+    textures.back()->uploadAndGenMips(queueMgr, commandBuffer, texture->data);
 
     ++textureIndex;
   }
 }
 
+void convertMeshlets2Buffers(const VulkanCore::Context& context,
+                             VulkanCore::CommandQueueManager& queueMgr,
+                             VkCommandBuffer commandBuffer, const Model& model,
+                             std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers) {
+  ASSERT(!model.meshlets.empty(), "Call buildMeshlets() before uploading the meshlets");
+  ASSERT(model.instances.empty(),
+         "Meshlet bounds are in the space of the meshes, which must be in world space");
+
+  std::vector<IndirectDrawCommandAndMeshData> draws;
+  std::vector<uint32_t> indices;
+  draws.reserve(model.meshlets.size());
+  indices.reserve(model.meshletTriangles.size() * 3);
+  for (const auto& meshlet : model.meshlets) {
+    draws.push_back({
+        .command =
+            {
+                .indexCount = meshlet.triangleCount * 3,
+                .instanceCount = 1,
+                .firstIndex = uint32_t(indices.size()),
+                .vertexOffset =
+                    int32_t(model.indirectDrawDataSet[meshlet.meshId].vertexOffset),
+                .firstInstance = 0,
+            },
+        .meshId = meshlet.meshId,
+        .materialIndex = uint32_t(model.meshes[meshlet.meshId].material),
+    });
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+      const auto triangle = model.meshletTriangles[meshlet.triangleOffset + t];
+      for (uint32_t corner = 0; corner < 3; ++corner) {
+        const auto vertex = (triangle >> (corner * 8)) & 0xff;
+        indices.push_back(model.meshletVertices[meshlet.vertexOffset + vertex]);
+      }
+    }
+  }
+
+  const auto upload = [&](const void* data, size_t size, VkBufferUsageFlags usage,
+                          const std::string& name) {
+    buffers.emplace_back(context.createBuffer(
+        size,
+        usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY, name));
+    context.uploadToGPUBuffer(queueMgr, commandBuffer, buffers.back().get(), data, size);
+  };
+
+  upload(model.meshlets.data(), sizeof(Meshlet) * model.meshlets.size(), 0, "meshlets");
+  upload(draws.data(), sizeof(IndirectDrawCommandAndMeshData) * draws.size(),
+         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, "meshlet IndirectDraw");
+  upload(indices.data(), sizeof(uint32_t) * indices.size(),
+         VK_BUFFER_USAGE_INDEX_BUFFER_BIT, "meshlet index");
+  upload(model.meshletVertices.data(), sizeof(uint32_t) * model.meshletVertices.size(),
+         0, "meshlet vertices");
+  upload(model.meshletTriangles.data(),
+         sizeof(uint32_t) * model.meshletTriangles.size(), 0, "meshlet triangles");
+}
+
 }  // namespace EngineCore
@@ -5,7 +5,10 @@
 #include <GLTFSDK/GLTF.h>
 #include <GLTFSDK/GLTFResourceReader.h>
 
+#include <span>
+
 #include "BS_thread_pool.hpp"
+#include "GLBView.hpp"
 #include "Model.hpp"
 #include "vulkancore/Common.hpp"
 
@@ -19,6 +22,8 @@ class CommandQueueManager;
 
 namespace EngineCore {
 
+class BakedModel;
+
 struct IndirectDrawCommandAndMeshData {
   VkDrawIndexedIndirectCommand command;
 
@@ -28,20 +33,61 @@ struct IndirectDrawCommandAndMeshData {
 
 class GLBLoader {
  public:
+  /// @brief Wall-clock timings of the last load, textures decoded on a thread pool are
+  /// not included in textureDecodeMs
+  struct LoadStats {
+    size_t fileBytes = 0;
+    uint32_t meshDecodeThreads = 1;
+    double documentParseMs = 0.0;
+    double meshDecodeMs = 0.0;
+    double meshAssembleMs = 0.0;
+    double textureDecodeMs = 0.0;
+  };
+
   std::shared_ptr<Model> load(const std::vector<char>& buffer);
   std::shared_ptr<Model> load(const std::string& filePath);
   std::shared_ptr<Model> load(const std::string& filePath, BS::thread_pool& pool,
                               std::function<void(int, int)> callback);
 
+  /// @brief Same as load() but memory maps the file and decodes accessors and images
+  /// directly from the mapping, without copying them through the glTF SDK streams.
+  /// Meshes are decoded in parallel on the pool (or on one of the same size while the
+  /// pool is paused)
+  std::shared_ptr<Model> loadMapped(const std::string& filePath);
+  std::shared_ptr<Model> loadMapped(const std::string& filePath, BS::thread_pool& pool,
+                                    std::function<void(int, int)> callback);
+
+  const LoadStats& lastLoadStats() const { return stats_; }
+
+  /// @brief Decodes each glTF mesh once, in object space, and adds an instance per node
+  /// that references it to Model::instances, instead of baking each node's transform into
+  /// its own copy of the mesh
+  void setInstancing(bool enabled) { instancing_ = enabled; }
+
  public:
   std::vector<std::future<int>> results_;
 
  private:
-  void updateMeshData(std::shared_ptr<Microsoft::glTF::GLBResourceReader> resourceReader,
-                      std::shared_ptr<Microsoft::glTF::Document> document,
-                      Model& outputModel);
+  using AccessorReader = std::function<AccessorView(const Microsoft::glTF::Accessor&)>;
+
+  /// @brief keepAlive owns the memory behind glb, textures are decoded on the pool when
+  /// one is provided
+  std::shared_ptr<Model> loadFromMemory(std::span<const uint8_t> glb,
+                                        std::shared_ptr<const void> keepAlive,
+                                        BS::thread_pool* pool,
+                                        std::function<void(int, int)> callback);
+  /// @brief readAccessor must be thread safe when a pool is provided
+  void updateMeshData(const Microsoft::glTF::Document& document,
+                      const AccessorReader& readAccessor, Model& outputModel,
+                      BS::thread_pool* pool);
+  static Mesh decodeMesh(const Microsoft::glTF::Document& document,
+                         const Microsoft::glTF::Mesh& mesh, const glm::mat4& m,
+                         const AccessorReader& readAccessor);
   void updateMaterials(std::shared_ptr<Microsoft::glTF::Document> document,
                        Model& outputModel);
+
+  LoadStats stats_;
+  bool instancing_ = false;
 };
 
 /// @brief Produces one vertex and one index buffer for each mesh plus a buffer for the
@@ -62,9 +108,11 @@ void convertModel2OneMeshPerBuffer(
 
 /// @brief Produces 4 buffers:
 ///   [0] vertex buffer
-///   [1] index buffer
+///   [1] index buffer, the LODs of a mesh follow its indices, see buildLods()
 ///   [2] material buffer
-///   [3] indirect draw command buffer
+///   [3] indirect draw command buffer, drawing LOD 0
+/// and for models loaded with instancing:
+///   [4] instance buffer (MeshInstance)
 void convertModel2OneBuffer(const VulkanCore::Context& context,
                             VulkanCore::CommandQueueManager& queueMgr,
                             VkCommandBuffer commandBuffer, const Model& model,
@@ -81,6 +129,28 @@ void convertModel2OneBuffer(const VulkanCore::Context& context,
                             bool useHalfFloatVertices = false,
                             bool makeBuffersSuitableForAccelStruct = false);
 
+/// @brief Produces the same 4 buffers as the overloads above, uploaded straight from the
+/// baked blobs. Textures are created with their baked mip chains instead of generating
+/// mips on the GPU
+void convertModel2OneBuffer(const VulkanCore::Context& context,
+                            VulkanCore::CommandQueueManager& queueMgr,
+                            VkCommandBuffer commandBuffer, const BakedModel& model,
+                            std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                            std::vector<std::shared_ptr<VulkanCore::Texture>>& textures,
+                            std::vector<std::shared_ptr<VulkanCore::Sampler>>& samplers,
+                            bool useHalfFloatVertices = false,
+                            bool makeBuffersSuitableForAccelStruct = false);
+
+/// @brief Same as above without the textures, for when something else creates them (see
+/// TextureStreamer)
+void convertModel2OneBuffer(const VulkanCore::Context& context,
+                            VulkanCore::CommandQueueManager& queueMgr,
+                            VkCommandBuffer commandBuffer, const BakedModel& model,
+                            std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                            std::vector<std::shared_ptr<VulkanCore::Sampler>>& samplers,
+                            bool useHalfFloatVertices = false,
+                            bool makeBuffersSuitableForAccelStruct = false);
+
 /// @brief Produces 3 buffers:
 ///   [0] (optimized) vertex buffer
 ///   [1] (optimized) index buffer
@@ -92,4 +162,16 @@ void convertModel2OneBufferOptimized(
     std::vector<std::shared_ptr<VulkanCore::Texture>>& textures,
     std::vector<std::shared_ptr<VulkanCore::Sampler>>& samplers,
     bool makeBuffersSuitableForAccelStruct = false);
+
+/// @brief Uploads the meshlets of a model, see buildMeshlets(), to draw them with the
+/// vertex buffer of convertModel2OneBuffer(). Produces 5 buffers:
+///   [0] meshlet buffer (Meshlet)
+///   [1] indirect draw command buffer, one indexed draw per meshlet
+///   [2] index buffer of the meshlet draws, with the same indices as the meshes
+///   [3] meshlet vertex buffer, for mesh shaders
+///   [4] meshlet triangle buffer, for mesh shaders
+void convertMeshlets2Buffers(const VulkanCore::Context& context,
+                             VulkanCore::CommandQueueManager& queueMgr,
+                             VkCommandBuffer commandBuffer, const Model& model,
+                             std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers);
 }  // namespace EngineCore
@@ -0,0 +1,105 @@
+#include "GLBView.hpp"
+
+namespace {
+constexpr uint32_t GLB_MAGIC = 0x46546C67;       // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;  // "JSON"
+constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;   // "BIN\0"
+constexpr size_t GLB_HEADER_SIZE = 12;
+constexpr size_t GLB_CHUNK_HEADER_SIZE = 8;
+
+uint32_t readUint32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+}  // namespace
+
+namespace EngineCore {
+
+GLBView::GLBView(std::span<const uint8_t> glb) {
+  if (glb.size() < GLB_HEADER_SIZE || readUint32(glb.data()) != GLB_MAGIC) {
+    std::cerr << "GLBView: data is not a binary glTF" << std::endl;
+    return;
+  }
+
+  const uint32_t version = readUint32(glb.data() + 4);
+  const size_t length = std::min<size_t>(readUint32(glb.data() + 8), glb.size());
+  if (version != 2) {
+    std::cerr << "GLBView: unsupported GLB version " << version << std::endl;
+    return;
+  }
+
+  for (size_t offset = GLB_HEADER_SIZE; offset + GLB_CHUNK_HEADER_SIZE <= length;) {
+    const uint32_t chunkLength = readUint32(glb.data() + offset);
+    const uint32_t chunkType = readUint32(glb.data() + offset + 4);
+    const size_t chunkStart = offset + GLB_CHUNK_HEADER_SIZE;
+    if (chunkStart + chunkLength > length) {
+      std::cerr << "GLBView: truncated chunk" << std::endl;
+      break;
+    }
+
+    if (chunkType == GLB_CHUNK_JSON && json_.empty()) {
+      json_ = std::string_view(reinterpret_cast<const char*>(glb.data() + chunkStart),
+                               chunkLength);
+    } else if (chunkType == GLB_CHUNK_BIN && binaryChunk_.empty()) {
+      binaryChunk_ = glb.subspan(chunkStart, chunkLength);
+    }
+
+    // chunks are padded to 4 bytes
+    offset = chunkStart + ((chunkLength + 3u) & ~3u);
+  }
+}
+
+std::span<const uint8_t> GLBView::bufferView(
+    const Microsoft::glTF::BufferView& bufferView) const {
+  ASSERT(bufferView.bufferId == "0" || bufferView.bufferId.empty(),
+         "Only the GLB embedded buffer is supported");
+  if (bufferView.byteOffset + bufferView.byteLength > binaryChunk_.size()) {
+    std::cerr << "GLBView: buffer view " << bufferView.id << " is out of range"
+              << std::endl;
+    return {};
+  }
+  return binaryChunk_.subspan(bufferView.byteOffset, bufferView.byteLength);
+}
+
+AccessorView GLBView::accessor(const Microsoft::glTF::Document& document,
+                               const Microsoft::glTF::Accessor& accessor) const {
+  // Accessors without a buffer view are all zeros, and sparse accessors need their
+  // substitutions applied; both are left to the caller
+  if (accessor.bufferViewId.empty()) {
+    return {};
+  }
+
+  const auto& view = document.bufferViews.Get(accessor.bufferViewId);
+  const auto viewData = bufferView(view);
+
+  const uint8_t numComponents = Microsoft::glTF::Accessor::GetTypeCount(accessor.type);
+  const size_t elementSize =
+      Microsoft::glTF::Accessor::GetComponentTypeSize(accessor.componentType) *
+      numComponents;
+  const size_t stride = view.byteStride.HasValue() && view.byteStride.Get() != 0
+                            ? view.byteStride.Get()
+                            : elementSize;
+
+  if (accessor.count == 0 ||
+      accessor.byteOffset + stride * (accessor.count - 1) + elementSize >
+          viewData.size()) {
+    return {};
+  }
+
+  return AccessorView{
+      .data = viewData.data() + accessor.byteOffset,
+      .count = accessor.count,
+      .stride = stride,
+      .numComponents = numComponents,
+      .componentType = accessor.componentType,
+  };
+}
+
+std::span<const uint8_t> GLBView::image(const Microsoft::glTF::Document& document,
+                                        const std::string& imageId) const {
+  const auto& image = document.images.Get(imageId);
+  return bufferView(document.bufferViews.Get(image.bufferViewId));
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <GLTFSDK/GLTF.h>
+
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "vulkancore/Utility.hpp"
+
+namespace EngineCore {
+
+/// @brief Strided view over the elements of a glTF accessor. The data either points
+/// straight into a GLB binary chunk (no copies) or into a tightly packed vector read
+/// through the glTF SDK, in which case the view keeps that vector alive.
+struct AccessorView {
+  const uint8_t* data = nullptr;
+  size_t count = 0;
+  size_t stride = 0;
+  uint8_t numComponents = 0;
+  Microsoft::glTF::ComponentType componentType = Microsoft::glTF::COMPONENT_UNKNOWN;
+  std::shared_ptr<const void> storage;
+
+  bool empty() const { return data == nullptr || count == 0; }
+
+  bool isTightlyPacked() const {
+    return stride ==
+           Microsoft::glTF::Accessor::GetComponentTypeSize(componentType) * numComponents;
+  }
+
+  float floatAt(size_t index, size_t component) const {
+    float value;
+    memcpy(&value, data + index * stride + component * sizeof(float), sizeof(float));
+    return value;
+  }
+
+  uint32_t indexAt(size_t index) const {
+    const uint8_t* element = data + index * stride;
+    switch (componentType) {
+      case Microsoft::glTF::COMPONENT_UNSIGNED_BYTE:
+        return *element;
+      case Microsoft::glTF::COMPONENT_UNSIGNED_SHORT: {
+        uint16_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+      }
+      case Microsoft::glTF::COMPONENT_UNSIGNED_INT: {
+        uint32_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+      }
+      default:
+        return 0;
+    }
+  }
+
+  /// @brief Only valid for tightly packed accessors whose data is suitably aligned
+  template <typename T>
+  std::span<const T> span() const {
+    const size_t componentSize =
+        Microsoft::glTF::Accessor::GetComponentTypeSize(componentType);
+    ASSERT(isTightlyPacked() && sizeof(T) == componentSize,
+           "Accessor is interleaved or has a different component type");
+    ASSERT(reinterpret_cast<uintptr_t>(data) % alignof(T) == 0,
+           "Accessor data is not aligned for the requested type");
+    return {reinterpret_cast<const T*>(data), count * numComponents};
+  }
+
+  template <typename T>
+  static AccessorView fromVector(std::vector<T>&& values, uint8_t numComponents,
+                                 Microsoft::glTF::ComponentType componentType) {
+    auto storage = std::make_shared<std::vector<T>>(std::move(values));
+    return AccessorView{
+        .data = reinterpret_cast<const uint8_t*>(storage->data()),
+        .count = storage->size() / numComponents,
+        .stride = sizeof(T) * numComponents,
+        .numComponents = numComponents,
+        .componentType = componentType,
+        .storage = std::move(storage),
+    };
+  }
+};
+
+/// @brief Parses the header and chunk table of a binary glTF (GLB) that lives in
+/// memory, typically a mapped file. The document JSON, buffer views, accessors and
+/// embedded images are exposed as views into that memory, so nothing is copied. Only
+/// the embedded binary chunk (buffer 0) is supported, which is what GLB exporters
+/// produce.
+class GLBView final {
+ public:
+  explicit GLBView(std::span<const uint8_t> glb);
+
+  bool valid() const { return !json_.empty(); }
+
+  std::string_view json() const { return json_; }
+
+  std::span<const uint8_t> binaryChunk() const { return binaryChunk_; }
+
+  std::span<const uint8_t> bufferView(
+      const Microsoft::glTF::BufferView& bufferView) const;
+
+  AccessorView accessor(const Microsoft::glTF::Document& document,
+                        const Microsoft::glTF::Accessor& accessor) const;
+
+  std::span<const uint8_t> image(const Microsoft::glTF::Document& document,
+                                 const std::string& imageId) const;
+
+ private:
+  std::string_view json_;
+  std::span<const uint8_t> binaryChunk_;
+};
+
+}  // namespace EngineCore
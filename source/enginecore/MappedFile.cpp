@@ -0,0 +1,95 @@
+#include "MappedFile.hpp"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <filesystem>
+
+namespace EngineCore {
+
+#if defined(_WIN32)
+MappedFile::MappedFile(const std::string& filePath) {
+  const std::wstring widePath = std::filesystem::u8path(filePath).wstring();
+  HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::cerr << "MappedFile: unable to open " << filePath << std::endl;
+    return;
+  }
+  fileHandle_ = file;
+
+  LARGE_INTEGER fileSize{};
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    return;
+  }
+
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    std::cerr << "MappedFile: unable to map " << filePath << std::endl;
+    return;
+  }
+  mappingHandle_ = mapping;
+
+  data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (data_ != nullptr) {
+    size_ = static_cast<size_t>(fileSize.QuadPart);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+  }
+  if (mappingHandle_ != nullptr) {
+    CloseHandle(mappingHandle_);
+  }
+  if (fileHandle_ != nullptr) {
+    CloseHandle(fileHandle_);
+  }
+}
+#else
+MappedFile::MappedFile(const std::string& filePath) {
+  fileDescriptor_ = open(filePath.c_str(), O_RDONLY);
+  if (fileDescriptor_ < 0) {
+    std::cerr << "MappedFile: unable to open " << filePath << std::endl;
+    return;
+  }
+
+  struct stat fileStat {};
+  if (fstat(fileDescriptor_, &fileStat) != 0 || fileStat.st_size == 0) {
+    return;
+  }
+
+  void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ,
+                      MAP_PRIVATE, fileDescriptor_, 0);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "MappedFile: unable to map " << filePath << std::endl;
+    return;
+  }
+  // The whole file is consumed front to back while decoding meshes
+  madvise(mapped, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t*>(mapped);
+  size_ = static_cast<size_t>(fileStat.st_size);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+  if (fileDescriptor_ >= 0) {
+    close(fileDescriptor_);
+  }
+}
+#endif
+
+}  // namespace EngineCore
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+#include "vulkancore/Utility.hpp"
+
+namespace EngineCore {
+
+// Read-only memory mapping of a whole file. The mapped view stays valid for the
+// lifetime of the object, so spans handed out by it must not outlive it.
+class MappedFile final {
+ public:
+  explicit MappedFile(const std::string& filePath);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool valid() const { return data_ != nullptr; }
+
+  const uint8_t* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+  std::span<const uint8_t> bytes() const { return {data_, size_}; }
+
+ private:
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+#if defined(_WIN32)
+  void* fileHandle_ = nullptr;
+  void* mappingHandle_ = nullptr;
+#else
+  int fileDescriptor_ = -1;
+#endif
+};
+
+}  // namespace EngineCore
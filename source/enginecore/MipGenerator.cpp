@@ -0,0 +1,267 @@
+#include "MipGenerator.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <glm/glm.hpp>
+#include <tracy/Tracy.hpp>
+
+namespace EngineCore {
+
+namespace {
+constexpr uint32_t MIPGEN_SET = 0;
+constexpr uint32_t BINDING_MIPS = 0;
+constexpr uint32_t BINDING_TEXTURES = 1;
+
+constexpr uint32_t kTileSize = 64;
+constexpr uint32_t kMaxTexturesPerDispatch = 64;
+constexpr uint32_t kMaxSize = 1u << (MipGenerator::kMaxMipLevels - 1);
+
+// Same layout as MipTexture in spdmipgen.comp
+struct MipTexture {
+  glm::uvec2 size;
+  uint32_t mipLevels;
+  uint32_t filterMode;
+  glm::uvec2 tiles;
+  uint32_t finishedTiles;
+  uint32_t padding;
+};
+
+uint32_t tileCount(uint32_t size) { return (size + kTileSize - 1) / kTileSize; }
+}  // namespace
+
+bool MipGenerator::isSupported(const VulkanCore::Context& context) {
+  const auto& limits = context.physicalDevice().properties().properties.limits;
+  return context.physicalDevice().supportsSubgroupOperations(
+             VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_QUAD_BIT) &&
+         limits.maxPerStageDescriptorStorageImages >= kMaxMipLevels &&
+         limits.maxDescriptorSetStorageImages >= kMaxMipLevels;
+}
+
+bool MipGenerator::canGenerateMips(const VulkanCore::Texture& texture) {
+  const auto extents = texture.vkExtents();
+  const bool formatSupported =
+      texture.vkFormat() == VK_FORMAT_R8G8B8A8_UNORM ||
+      (texture.vkFormat() == VK_FORMAT_R8G8B8A8_SRGB &&
+       (texture.vkCreateFlags() & VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT));
+  return formatSupported && (texture.vkUsageFlags() & VK_IMAGE_USAGE_STORAGE_BIT) &&
+         texture.generatesMips() && texture.numMipLevels() > 1 && extents.depth == 1 &&
+         extents.width <= kMaxSize && extents.height <= kMaxSize &&
+         texture.VkSampleCount() == VK_SAMPLE_COUNT_1_BIT;
+}
+
+MipGenerator::MipGenerator(VulkanCore::Context& context, uint32_t maxDispatchesInFlight)
+    : context_(context), maxDispatchesInFlight_(std::max(maxDispatchesInFlight, 1u)) {
+  ASSERT(isSupported(context), "Subgroup quad operations aren't supported in compute");
+
+  const auto& limits = context.physicalDevice().properties().properties.limits;
+  const uint32_t maxStorageImages = std::min(limits.maxPerStageDescriptorStorageImages,
+                                             limits.maxDescriptorSetStorageImages);
+  texturesPerDispatch_ =
+      std::clamp(maxStorageImages / kMaxMipLevels, 1u, kMaxTexturesPerDispatch);
+
+  // Each dispatch binds its own slice of the buffer
+  const VkDeviceSize alignment = limits.minStorageBufferOffsetAlignment;
+  infoSliceSize_ = texturesPerDispatch_ * sizeof(MipTexture);
+  infoSliceSize_ = (infoSliceSize_ + alignment - 1) / alignment * alignment;
+  infoBuffer_ = context.createBuffer(
+      infoSliceSize_ * maxDispatchesInFlight_, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VMA_MEMORY_USAGE_CPU_TO_GPU, "Mip generation textures");
+
+  const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
+  auto shader = context.createShaderModule((resourcesFolder / "spdmipgen.comp").string(),
+                                           VK_SHADER_STAGE_COMPUTE_BIT,
+                                           "single pass mip generation compute shader");
+
+  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+      {
+          .set_ = MIPGEN_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{BINDING_MIPS,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                               texturesPerDispatch_ * kMaxMipLevels,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_TEXTURES,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+  };
+
+  const VkSpecializationMapEntry specializationMap = {
+      .constantID = 0, .offset = 0, .size = sizeof(uint32_t)};
+
+  const VulkanCore::Pipeline::ComputePipelineDescriptor desc = {
+      .sets_ = setLayout,
+      .computeShader_ = shader,
+      .specializationConsts_ = {specializationMap},
+      .specializationData_ = &texturesPerDispatch_,
+  };
+  pipeline_ = context.createComputePipeline(desc, "single pass mip generation");
+
+  pipeline_->allocateDescriptors({
+      {.set_ = MIPGEN_SET, .count_ = maxDispatchesInFlight_},
+  });
+
+  freeSlots_.resize(maxDispatchesInFlight_);
+  for (uint32_t i = 0; i < maxDispatchesInFlight_; ++i) {
+    freeSlots_[i] = maxDispatchesInFlight_ - 1 - i;
+  }
+}
+
+MipGenerator::~MipGenerator() {}
+
+void MipGenerator::generateMips(VulkanCore::CommandQueueManager& queueMgr,
+                                VkCommandBuffer commandBuffer,
+                                std::span<VulkanCore::Texture* const> textures,
+                                std::span<const MipFilter> filters) {
+  ASSERT(filters.empty() || filters.size() == textures.size(),
+         "There must be one filter per texture");
+  if (textures.empty()) {
+    return;
+  }
+  ZoneScopedN("MipGenerator: generateMips");
+  context_.beginDebugUtilsLabel(commandBuffer, "Single pass mip generation",
+                                {0.5f, 0.0f, 0.5f, 1.0f});
+
+  const auto layoutBarriers = [&textures](VkImageLayout newLayout,
+                                          VkAccessFlags srcAccessMask,
+                                          VkAccessFlags dstAccessMask) {
+    std::vector<VkImageMemoryBarrier> barriers;
+    barriers.reserve(textures.size());
+    for (auto* texture : textures) {
+      barriers.push_back(VkImageMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = srcAccessMask,
+          .dstAccessMask = dstAccessMask,
+          .oldLayout = texture->vkLayout(),
+          .newLayout = newLayout,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = texture->vkImage(),
+          .subresourceRange =
+              {
+                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                  .baseMipLevel = 0,
+                  .levelCount = texture->numMipLevels(),
+                  .baseArrayLayer = 0,
+                  .layerCount = 1,
+              },
+      });
+      texture->setImageLayout(newLayout);
+    }
+    return barriers;
+  };
+
+  // Level 0 may have been written by a copy, a blit or a shader. Stages that aren't
+  // supported by the queue are fine in ALL_COMMANDS
+  const auto toGeneral =
+      layoutBarriers(VK_IMAGE_LAYOUT_GENERAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                       static_cast<uint32_t>(toGeneral.size()), toGeneral.data());
+
+  pipeline_->bind(commandBuffer);
+  // The dispatches write different textures, they don't need barriers in between
+  for (size_t first = 0; first < textures.size(); first += texturesPerDispatch_) {
+    const size_t count = std::min<size_t>(texturesPerDispatch_, textures.size() - first);
+    dispatch(queueMgr, commandBuffer, textures.subspan(first, count),
+             filters.empty() ? filters : filters.subspan(first, count));
+  }
+
+  const auto toShaderRead =
+      layoutBarriers(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_ACCESS_SHADER_READ_BIT);
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr,
+                       static_cast<uint32_t>(toShaderRead.size()), toShaderRead.data());
+
+  context_.endDebugUtilsLabel(commandBuffer);
+}
+
+uint32_t MipGenerator::acquireSlot(VulkanCore::CommandQueueManager& queueMgr) {
+  {
+    std::lock_guard lock(slotsMutex_);
+    if (!freeSlots_.empty()) {
+      const uint32_t slot = freeSlots_.back();
+      freeSlots_.pop_back();
+      return slot;
+    }
+  }
+  // Slots only come back once their submissions are retired
+  queueMgr.retireCompletedSubmits();
+  std::lock_guard lock(slotsMutex_);
+  ASSERT(!freeSlots_.empty(),
+         "Too many mip generation dispatches in flight, raise maxDispatchesInFlight");
+  const uint32_t slot = freeSlots_.back();
+  freeSlots_.pop_back();
+  return slot;
+}
+
+void MipGenerator::dispatch(VulkanCore::CommandQueueManager& queueMgr,
+                            VkCommandBuffer commandBuffer,
+                            std::span<VulkanCore::Texture* const> textures,
+                            std::span<const MipFilter> filters) {
+  const uint32_t slot = acquireSlot(queueMgr);
+  const VkDeviceSize infoOffset = slot * infoSliceSize_;
+  auto* infos = reinterpret_cast<MipTexture*>(
+      static_cast<uint8_t*>(infoBuffer_->mappedMemory()) + infoOffset);
+
+  // kMaxMipLevels views per texture, the levels it doesn't have repeat its last one
+  std::vector<std::shared_ptr<VkImageView>> views;
+  std::vector<std::shared_ptr<VkImageView>> boundViews;
+  boundViews.reserve(textures.size() * kMaxMipLevels);
+  glm::uvec2 maxTiles(1);
+  for (size_t i = 0; i < textures.size(); ++i) {
+    auto* texture = textures[i];
+    const auto extents = texture->vkExtents();
+    const bool srgb = texture->vkFormat() == VK_FORMAT_R8G8B8A8_SRGB;
+    const MipFilter filter =
+        filters.empty() ? (srgb ? MipFilter::Srgb : MipFilter::Linear) : filters[i];
+    infos[i] = MipTexture{
+        .size = glm::uvec2(extents.width, extents.height),
+        .mipLevels = std::min(texture->numMipLevels(), kMaxMipLevels),
+        .filterMode = static_cast<uint32_t>(filter),
+        .tiles = glm::uvec2(tileCount(extents.width), tileCount(extents.height)),
+        .finishedTiles = 0,
+    };
+    maxTiles = glm::max(maxTiles, infos[i].tiles);
+
+    // Storage images can't be sRGB, the shader encodes them itself
+    auto textureViews = texture->generateViewForEachMips(VK_FORMAT_R8G8B8A8_UNORM);
+    for (size_t level = 0; level < kMaxMipLevels; ++level) {
+      boundViews.push_back(textureViews[std::min(level, textureViews.size() - 1)]);
+    }
+    views.insert(views.end(), textureViews.begin(), textureViews.end());
+  }
+  const VkDeviceSize infoSize = textures.size() * sizeof(MipTexture);
+  infoBuffer_->upload(infoOffset, infoSize);
+
+  pipeline_->bindResource(MIPGEN_SET, BINDING_MIPS, slot,
+                          std::span<std::shared_ptr<VkImageView>>(boundViews),
+                          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+  pipeline_->bindResource(MIPGEN_SET, BINDING_TEXTURES, slot, infoBuffer_,
+                          static_cast<uint32_t>(infoOffset),
+                          static_cast<uint32_t>(infoSize),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  pipeline_->updateDescriptorSets();
+  pipeline_->bindDescriptorSets(commandBuffer, {{.set = MIPGEN_SET, .bindIdx = slot}});
+
+  // One workgroup per 64x64 tile of level 0, the ones past a smaller texture's tiles
+  // return right away
+  vkCmdDispatch(commandBuffer, maxTiles.x, maxTiles.y,
+                static_cast<uint32_t>(textures.size()));
+
+  queueMgr.disposeWhenSubmitCompletes(
+      [this, device = context_.device(), views = std::move(views), slot]() {
+        for (const auto& view : views) {
+          vkDestroyImageView(device, *view, nullptr);
+        }
+        std::lock_guard lock(slotsMutex_);
+        freeSlots_.push_back(slot);
+      });
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "vulkancore/Buffer.hpp"
+#include "vulkancore/CommandQueueManager.hpp"
+#include "vulkancore/Context.hpp"
+#include "vulkancore/Pipeline.hpp"
+#include "vulkancore/Texture.hpp"
+
+namespace EngineCore {
+
+// How the levels are averaged
+enum class MipFilter : uint32_t {
+  Linear = 0,
+  // Averaged in linear space, for color textures stored as sRGB
+  Srgb = 1,
+  // rgb holds a normal, the averages are renormalized
+  NormalMap = 2,
+};
+
+/// @brief Generates every mip level of a batch of textures from level 0 with a single
+/// pass downsampler compute shader (spdmipgen.comp), one dispatch per
+/// texturesPerDispatch() textures instead of a blit and a barrier per level and texture.
+/// It only needs a compute queue, so it runs on async compute queues too, and it works
+/// on formats that can't be blitted with a linear filter. Textures must pass
+/// canGenerateMips(), the others still need Texture::generateMips(). Not thread safe,
+/// use one per recording thread
+class MipGenerator {
+ public:
+  // spdmipgen.comp reduces the last 64x64 texels in a single workgroup, so it stops at
+  // 4096x4096
+  static constexpr uint32_t kMaxMipLevels = 13;
+
+  // Needs subgroup quad operations in compute shaders
+  static bool isSupported(const VulkanCore::Context& context);
+
+  // 2D VK_FORMAT_R8G8B8A8_UNORM textures, or VK_FORMAT_R8G8B8A8_SRGB ones created with
+  // VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT (and VK_IMAGE_CREATE_EXTENDED_USAGE_BIT), with
+  // VK_IMAGE_USAGE_STORAGE_BIT, up to 4096x4096 and created to generate their mips
+  static bool canGenerateMips(const VulkanCore::Texture& texture);
+
+  // maxDispatchesInFlight is the number of dispatches whose submissions may be pending
+  // at the same time, each one holds a descriptor set
+  explicit MipGenerator(VulkanCore::Context& context,
+                        uint32_t maxDispatchesInFlight = 32);
+
+  // The submissions it recorded must be complete, and retired by their queue managers
+  ~MipGenerator();
+
+  uint32_t texturesPerDispatch() const { return texturesPerDispatch_; }
+
+  // Records the mip generation of textures into commandBuffer, which gets submitted to
+  // queueMgr, whose family must support compute. Level 0 must be written, the other
+  // levels are overwritten, and the textures end up in
+  // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. filters are per texture, an empty span
+  // picks MipFilter::Srgb for sRGB formats and MipFilter::Linear for the others
+  void generateMips(VulkanCore::CommandQueueManager& queueMgr,
+                    VkCommandBuffer commandBuffer,
+                    std::span<VulkanCore::Texture* const> textures,
+                    std::span<const MipFilter> filters = {});
+
+ private:
+  // Gets a descriptor set and its slice of the info buffer, they're given back once the
+  // dispatch's submission completes
+  uint32_t acquireSlot(VulkanCore::CommandQueueManager& queueMgr);
+
+  void dispatch(VulkanCore::CommandQueueManager& queueMgr, VkCommandBuffer commandBuffer,
+                std::span<VulkanCore::Texture* const> textures,
+                std::span<const MipFilter> filters);
+
+ private:
+  VulkanCore::Context& context_;
+  uint32_t maxDispatchesInFlight_ = 0;
+  uint32_t texturesPerDispatch_ = 0;
+  VkDeviceSize infoSliceSize_ = 0;
+  std::shared_ptr<VulkanCore::Pipeline> pipeline_;
+  std::shared_ptr<VulkanCore::Buffer> infoBuffer_;
+
+  // Disposed slots come back from whichever thread retires the submissions
+  std::mutex slotsMutex_;
+  std::vector<uint32_t> freeSlots_;
+};
+
+}  // namespace EngineCore
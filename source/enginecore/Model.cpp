@@ -1,4 +1,9 @@
 #include "Model.hpp"
+
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+#include <meshoptimizer.h>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -29,7 +34,7 @@ Vertex16Bit to16bitVertex(const Vertex& v) {
   return out;
 }
 
-stbImageData::stbImageData(const std::vector<uint8_t>& imageData, bool useFloat) {
+stbImageData::stbImageData(std::span<const uint8_t> imageData, bool useFloat) {
   if (!useFloat) {
     data = stbi_load_from_memory(imageData.data(), imageData.size(), &width, &height,
                                  &channels, STBI_rgb_alpha);
@@ -53,4 +58,151 @@ stbImageData::stbImageData(const std::vector<char>& imageData, bool useFloat) {
 
 stbImageData::~stbImageData() { stbi_image_free(data); }
 
+void optimizeMeshes(Model& model) {
+  uint32_t vertexOffset = 0;
+  model.totalVertexSize = 0;
+
+  for (size_t meshId = 0; meshId < model.meshes.size(); ++meshId) {
+    auto& mesh = model.meshes[meshId];
+    const size_t indexCount = mesh.indices.size();
+
+    std::vector<unsigned int> remap(mesh.vertices.size());
+    const size_t vertexCount = meshopt_generateVertexRemap(
+        remap.data(), mesh.indices.data(), indexCount, mesh.vertices.data(),
+        mesh.vertices.size(), sizeof(Vertex));
+
+    std::vector<Vertex> vertices(vertexCount);
+    meshopt_remapIndexBuffer(mesh.indices.data(), mesh.indices.data(), indexCount,
+                             remap.data());
+    meshopt_remapVertexBuffer(vertices.data(), mesh.vertices.data(),
+                              mesh.vertices.size(), sizeof(Vertex), remap.data());
+
+    meshopt_optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), indexCount,
+                                vertexCount);
+    meshopt_optimizeOverdraw(mesh.indices.data(), mesh.indices.data(), indexCount,
+                             &vertices[0].pos.x, vertexCount, sizeof(Vertex), 1.05f);
+    meshopt_optimizeVertexFetch(vertices.data(), mesh.indices.data(), indexCount,
+                                vertices.data(), vertexCount, sizeof(Vertex));
+
+    mesh.vertices = std::move(vertices);
+    mesh.vertices16bit.resize(vertexCount);
+    std::transform(mesh.vertices.begin(), mesh.vertices.end(),
+                   mesh.vertices16bit.begin(), to16bitVertex);
+
+    if (meshId < model.indirectDrawDataSet.size()) {
+      model.indirectDrawDataSet[meshId].vertexOffset = vertexOffset;
+    }
+    vertexOffset += uint32_t(vertexCount);
+    model.totalVertexSize += sizeof(Vertex) * uint32_t(vertexCount);
+  }
+}
+
+void buildLods(Model& model, const LodSettings& settings) {
+  const auto maxLods = std::clamp(settings.maxLods, 1u, MAX_MESH_LODS);
+  uint32_t firstIndex = 0;
+  model.totalIndexSize = 0;
+
+  for (size_t meshId = 0; meshId < model.meshes.size(); ++meshId) {
+    auto& mesh = model.meshes[meshId];
+    const auto* positions = &mesh.vertices[0].pos.x;
+    // meshopt errors are relative to the size of the mesh
+    const float scale =
+        meshopt_simplifyScale(positions, mesh.vertices.size(), sizeof(Vertex));
+
+    mesh.lodIndices.clear();
+    mesh.lods = {{
+        .firstIndex = 0,
+        .indexCount = uint32_t(mesh.indices.size()),
+        .error = 0.0f,
+    }};
+
+    std::vector<Mesh::Indices> lod(mesh.indices.size());
+    while (mesh.lods.size() < maxLods &&
+           mesh.lods.back().indexCount >= settings.minIndexCount) {
+      const size_t targetIndexCount =
+          size_t(mesh.lods.back().indexCount * settings.reductionPerLod) / 3 * 3;
+      float relativeError = 0.0f;
+      // Always simplified from the full mesh, so errors don't accumulate
+      const auto indexCount = meshopt_simplify(
+          lod.data(), mesh.indices.data(), mesh.indices.size(), positions,
+          mesh.vertices.size(), sizeof(Vertex), targetIndexCount,
+          settings.maxRelativeError, 0, &relativeError);
+
+      // Stop once the error bound keeps the simplifier from making progress
+      if (indexCount == 0 || indexCount > mesh.lods.back().indexCount * 0.9f) {
+        break;
+      }
+      meshopt_optimizeVertexCache(lod.data(), lod.data(), indexCount,
+                                  mesh.vertices.size());
+
+      mesh.lods.push_back({
+          .firstIndex = uint32_t(mesh.indices.size() + mesh.lodIndices.size()),
+          .indexCount = uint32_t(indexCount),
+          // A coarser LOD is never picked before a finer one
+          .error = std::max(relativeError * scale, mesh.lods.back().error),
+      });
+      mesh.lodIndices.insert(mesh.lodIndices.end(), lod.begin(),
+                             lod.begin() + indexCount);
+    }
+
+    const auto meshIndexCount = uint32_t(mesh.indices.size() + mesh.lodIndices.size());
+    if (meshId < model.indirectDrawDataSet.size()) {
+      model.indirectDrawDataSet[meshId].firstIndex = firstIndex;
+    }
+    firstIndex += meshIndexCount;
+    model.totalIndexSize += sizeof(Mesh::Indices) * meshIndexCount;
+  }
+}
+
+void buildMeshlets(Model& model, float coneWeight) {
+  model.meshlets.clear();
+  model.meshletVertices.clear();
+  model.meshletTriangles.clear();
+
+  for (uint32_t meshId = 0; meshId < model.meshes.size(); ++meshId) {
+    const auto& mesh = model.meshes[meshId];
+    const auto maxMeshlets = meshopt_buildMeshletsBound(
+        mesh.indices.size(), MAX_MESHLET_VERTICES, MAX_MESHLET_TRIANGLES);
+    std::vector<meshopt_Meshlet> meshlets(maxMeshlets);
+    std::vector<unsigned int> vertices(maxMeshlets * MAX_MESHLET_VERTICES);
+    std::vector<unsigned char> triangles(maxMeshlets * MAX_MESHLET_TRIANGLES * 3);
+
+    const auto meshletCount = meshopt_buildMeshlets(
+        meshlets.data(), vertices.data(), triangles.data(), mesh.indices.data(),
+        mesh.indices.size(), &mesh.vertices[0].pos.x, mesh.vertices.size(),
+        sizeof(Vertex), MAX_MESHLET_VERTICES, MAX_MESHLET_TRIANGLES, coneWeight);
+
+    for (size_t i = 0; i < meshletCount; ++i) {
+      const auto& meshlet = meshlets[i];
+      const auto bounds = meshopt_computeMeshletBounds(
+          &vertices[meshlet.vertex_offset], &triangles[meshlet.triangle_offset],
+          meshlet.triangle_count, &mesh.vertices[0].pos.x, mesh.vertices.size(),
+          sizeof(Vertex));
+
+      model.meshlets.push_back({
+          .center = glm::make_vec3(bounds.center),
+          .radius = bounds.radius,
+          .coneApex = glm::make_vec3(bounds.cone_apex),
+          .coneCutoff = bounds.cone_cutoff,
+          .coneAxis = glm::make_vec3(bounds.cone_axis),
+          .meshId = meshId,
+          .vertexOffset = uint32_t(model.meshletVertices.size()),
+          .triangleOffset = uint32_t(model.meshletTriangles.size()),
+          .vertexCount = meshlet.vertex_count,
+          .triangleCount = meshlet.triangle_count,
+      });
+
+      model.meshletVertices.insert(
+          model.meshletVertices.end(), vertices.begin() + meshlet.vertex_offset,
+          vertices.begin() + meshlet.vertex_offset + meshlet.vertex_count);
+      for (uint32_t t = 0; t < meshlet.triangle_count; ++t) {
+        const auto* triangle = &triangles[meshlet.triangle_offset + t * 3];
+        model.meshletTriangles.push_back(uint32_t(triangle[0]) |
+                                         (uint32_t(triangle[1]) << 8) |
+                                         (uint32_t(triangle[2]) << 16));
+      }
+    }
+  }
+}
+
 }  // namespace EngineCore
@@ -5,6 +5,7 @@
 #include <glm/gtc/packing.hpp>
 #include <glm/gtx/type_aligned.hpp>
 #include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -49,11 +50,25 @@ struct Vertex16Bit {
 
 Vertex16Bit to16bitVertex(const Vertex& v);
 
+constexpr uint32_t MAX_MESH_LODS = 8;
+
+// A level of detail of a mesh. Matches MeshLod in CommonStructs.glsl
+struct MeshLod {
+  uint32_t firstIndex;  // from the first index of the mesh
+  uint32_t indexCount;
+  float error;  // in world units, how far the surface may be from the full mesh
+  uint32_t padding = 0;
+};
+
 struct Mesh {
   using Indices = uint32_t;
   std::vector<Vertex> vertices = {};
   std::vector<Vertex16Bit> vertices16bit = {};
   std::vector<Indices> indices = {};
+  // Filled by buildLods(). LOD 0 is indices, the simplified LODs follow it in lodIndices
+  // and are uploaded right after it
+  std::vector<Indices> lodIndices = {};
+  std::vector<MeshLod> lods = {};
   glm::vec3 minAABB = glm::vec3(999999, 999999, 999999);
   glm::vec3 maxAABB = glm::vec3(-999999, -999999, -999999);
   glm::vec3 extents;
@@ -80,7 +95,7 @@ struct Material {
 };
 
 struct stbImageData {
-  stbImageData(const std::vector<uint8_t>& imageData, bool useFloat = false);
+  stbImageData(std::span<const uint8_t> imageData, bool useFloat = false);
   stbImageData(const std::vector<char>& imageData, bool useFloat = false);
   ~stbImageData();
   void* data = nullptr;
@@ -101,6 +116,35 @@ struct IndirectDrawDataAndMeshData {
   // in future we can model mat etc, things specific to Mesh
 };
 
+// A placement of a mesh, for models loaded with instancing. Matches InstanceData in
+// CommonStructs.glsl
+struct MeshInstance {
+  glm::mat4 transform;
+  uint32_t meshId;
+  int32_t materialIndex = -1;  // -1 uses the material of the vertices
+  uint32_t padding[2] = {};
+};
+
+// Meshlet sizes used by buildMeshlets(), the mesh shaders are compiled for them
+constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// A small cluster of triangles of a mesh, culled on its own. Matches Meshlet in
+// CommonStructs.glsl
+struct Meshlet {
+  glm::vec3 center;  // bounding sphere
+  float radius;
+  // The meshlet is backfacing when dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+  glm::vec3 coneApex;
+  float coneCutoff;
+  glm::vec3 coneAxis;
+  uint32_t meshId;
+  uint32_t vertexOffset;    // in Model::meshletVertices
+  uint32_t triangleOffset;  // in Model::meshletTriangles
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+};
+
 struct Model {
   std::vector<Mesh> meshes;
   std::vector<Material> materials;
@@ -108,8 +152,44 @@ struct Model {
 
   std::vector<IndirectDrawDataAndMeshData> indirectDrawDataSet;
 
+  // Empty unless the model was loaded with instancing, meshes are then in object space
+  // and placed by their instances, which are sorted by mesh. The instances of a mesh
+  // start at the firstInstance of its draw
+  std::vector<MeshInstance> instances;
+
+  // Empty until buildMeshlets() is called. The vertices are indices in the mesh's
+  // vertices, each triangle is 3 indices in the meshlet's vertices packed in the low 24
+  // bits
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> meshletVertices;
+  std::vector<uint32_t> meshletTriangles;
+
   uint32_t totalVertexSize = 0;
   uint32_t totalIndexSize = 0;
   uint32_t indexCount = 0;
 };
+
+struct LodSettings {
+  uint32_t maxLods = 4;  // including the full mesh, at most MAX_MESH_LODS
+  // Each LOD aims for this fraction of the indices of the previous one
+  float reductionPerLod = 0.5f;
+  // Largest error of a LOD, relative to the size of the mesh
+  float maxRelativeError = 0.05f;
+  // Meshes and LODs with fewer indices aren't simplified further
+  uint32_t minIndexCount = 192;
+};
+
+// Welds the duplicate vertices of each mesh and reorders its triangles and vertices
+// for the vertex cache, overdraw and vertex fetch with meshoptimizer, the same pass as
+// convertModel2OneBufferOptimized() but per mesh. Updates the vertex offsets and sizes of
+// the model. Call it before buildLods() and buildMeshlets()
+void optimizeMeshes(Model& model);
+
+// Simplifies each mesh into a chain of LODs with meshoptimizer and updates the index
+// offsets and sizes of the model to account for them
+void buildLods(Model& model, const LodSettings& settings = {});
+
+// Splits the meshes of the model into meshlets with meshoptimizer, coneWeight trades
+// culling efficiency of the cones for tighter spheres
+void buildMeshlets(Model& model, float coneWeight = 0.25f);
 }  // namespace EngineCore
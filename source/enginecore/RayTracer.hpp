@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "enginecore/AccelerationStructures.hpp"
 #include "enginecore/Model.hpp"
 #include "vulkancore/Buffer.hpp"
 #include "vulkancore/CommandQueueManager.hpp"
@@ -37,6 +38,20 @@ class RayTracer {
 
   std::shared_ptr<VulkanCore::Texture> currentImage(int index) { return rayTracedImage_; }
 
+  // Moves the instance of the mesh, the top level acceleration structure is refit by the
+  // next execute(). The meshes' geometry must stay the same
+  void setInstanceTransform(uint32_t meshIdx, const glm::mat4& transform);
+
+  // Of the update recorded by the last execute()
+  const EngineCore::TopLevelAccelStruct::UpdateStats& tlasUpdateStats() const {
+    return tLAS_->lastUpdateStats();
+  }
+
+  // Of the last initBottomLevelAccelStruct call
+  const EngineCore::AccelStructBuildStats& blasBuildStats() const {
+    return blasBuildStats_;
+  }
+
  private:
   // Information about Shader binding table
   struct SBT {
@@ -44,12 +59,6 @@ class RayTracer {
     VkStridedDeviceAddressRegionKHR sbtAddress;
   };
 
-  // Holds information for a ray tracing acceleration structure
-  struct AccelerationStructure {
-    std::shared_ptr<VulkanCore::Buffer> buffer;
-    VkAccelerationStructureKHR handle;
-  };
-
   void createShaderBindingTable();
 
   void loadEnvMap();
@@ -66,9 +75,9 @@ class RayTracer {
   std::shared_ptr<VulkanCore::Texture> envMap_;
   std::shared_ptr<VulkanCore::Buffer> envMapAccelBuffer_;
 
-  std::unordered_map<uint32_t, AccelerationStructure> bLAS_;
-  std::vector<VkAccelerationStructureInstanceKHR> accelarationInstances_;
-  AccelerationStructure tLAS_;
+  std::unordered_map<uint32_t, EngineCore::AccelerationStructure> bLAS_;
+  EngineCore::AccelStructBuildStats blasBuildStats_;
+  std::unique_ptr<EngineCore::TopLevelAccelStruct> tLAS_;
 
   std::shared_ptr<VulkanCore::Texture> rayTracedImage_;
   std::shared_ptr<VulkanCore::Texture> rayTracedaccumImage_;
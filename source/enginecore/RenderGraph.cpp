@@ -0,0 +1,497 @@
+#include "RenderGraph.hpp"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "vulkancore/Context.hpp"
+#include "vulkancore/Texture.hpp"
+
+namespace EngineCore {
+
+namespace {
+constexpr VkAccessFlags2 kWriteAccess =
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+constexpr VkPipelineStageFlags2 kDepthStages =
+    VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+    VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+VkImageCreateInfo imageCreateInfo(const RenderGraph::TextureDesc& desc) {
+  return VkImageCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = desc.format,
+      .extent = {desc.extent.width, desc.extent.height, 1},
+      .mipLevels = desc.mipLevels,
+      .arrayLayers = desc.layerCount,
+      .samples = desc.samples,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = desc.usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+  };
+}
+}  // namespace
+
+void RenderGraph::PassBuilder::read(Resource resource, Usage usage,
+                                    VkPipelineStageFlags2 shaderStages) {
+  addAccess(resource, usage, shaderStages, false);
+}
+
+void RenderGraph::PassBuilder::write(Resource resource, Usage usage,
+                                     VkPipelineStageFlags2 shaderStages) {
+  ASSERT(usage != Usage::Sampled && usage != Usage::StorageRead &&
+             usage != Usage::DepthReadOnly && usage != Usage::TransferSrc &&
+             usage != Usage::Present,
+         "This usage can't write to a texture");
+  addAccess(resource, usage, shaderStages, true);
+}
+
+void RenderGraph::PassBuilder::addAccess(Resource resource, Usage usage,
+                                         VkPipelineStageFlags2 shaderStages, bool write) {
+  Access access{.resource = resource, .usage = usage, .write = write};
+  switch (usage) {
+    case Usage::ColorAttachment:
+      access.stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+      access.access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+                      (write ? VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_2_NONE);
+      access.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      break;
+    case Usage::DepthAttachment:
+      access.stages = kDepthStages;
+      access.access =
+          VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+          (write ? VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_2_NONE);
+      access.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      break;
+    case Usage::DepthReadOnly:
+      access.stages = kDepthStages | shaderStages;
+      access.access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+      access.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+      break;
+    case Usage::Sampled:
+      access.stages = shaderStages;
+      access.access = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+      access.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      break;
+    case Usage::StorageRead:
+      access.stages = shaderStages;
+      access.access = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+      access.layout = VK_IMAGE_LAYOUT_GENERAL;
+      break;
+    case Usage::StorageWrite:
+      access.stages = shaderStages;
+      access.access =
+          VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+      access.layout = VK_IMAGE_LAYOUT_GENERAL;
+      break;
+    case Usage::TransferSrc:
+      access.stages = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+      access.access = VK_ACCESS_2_TRANSFER_READ_BIT;
+      access.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      break;
+    case Usage::TransferDst:
+      access.stages = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+      access.access = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+      access.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      break;
+    case Usage::Present:
+      // vkQueuePresentKHR performs automatic visibility operations
+      access.stages = VK_PIPELINE_STAGE_2_NONE;
+      access.access = VK_ACCESS_2_NONE;
+      access.layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      break;
+  }
+
+  // A texture used twice by the same pass (read and written) gets a single access
+  auto it = std::find_if(accesses_.begin(), accesses_.end(),
+                         [resource](const Access& a) { return a.resource == resource; });
+  if (it == accesses_.end()) {
+    accesses_.push_back(access);
+    return;
+  }
+  ASSERT(it->layout == access.layout,
+         "A pass can't use a texture in two different layouts");
+  it->stages |= access.stages;
+  it->access |= access.access;
+  it->write = it->write || access.write;
+}
+
+RenderGraph::RenderGraph(const VulkanCore::Context& context, const std::string& name)
+    : context_(context), name_(name) {}
+
+RenderGraph::~RenderGraph() {
+  // The textures may still be referenced by the passes, but they can't be used anymore
+  for (auto& resource : resources_) {
+    if (!resource.imported) {
+      resource.texture.reset();
+    }
+  }
+  for (auto memoryBlock : memoryBlocks_) {
+    vmaFreeMemory(context_.memoryAllocator(), memoryBlock);
+  }
+}
+
+RenderGraph::Resource RenderGraph::createTexture(const std::string& name,
+                                                 const TextureDesc& desc) {
+  ASSERT(!compiled_, "Textures must be added before compiling the graph");
+  ASSERT(desc.extent.width > 0 && desc.extent.height > 0,
+         "Texture cannot have dimensions equal to 0");
+  resources_.push_back(ResourceNode{.name = name, .desc = desc});
+  return static_cast<Resource>(resources_.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importTexture(
+    const std::string& name, std::shared_ptr<VulkanCore::Texture> texture) {
+  ASSERT(!compiled_, "Textures must be added before compiling the graph");
+  ASSERT(texture != nullptr, "Imported texture can't be null");
+  resources_.push_back(
+      ResourceNode{.name = name, .texture = std::move(texture), .imported = true});
+  return static_cast<Resource>(resources_.size() - 1);
+}
+
+void RenderGraph::addPass(const std::string& name, const SetupFunction& setup,
+                          ExecuteFunction execute) {
+  ASSERT(!compiled_, "Passes must be added before compiling the graph");
+  PassBuilder builder;
+  setup(builder);
+  for (const auto& access : builder.accesses_) {
+    ASSERT(access.resource < resources_.size(), "Pass uses an unknown texture");
+  }
+  passes_.push_back(PassNode{
+      .name = name,
+      .accesses = std::move(builder.accesses_),
+      .execute = std::move(execute),
+      .sideEffects = builder.sideEffects_,
+  });
+}
+
+void RenderGraph::markOutput(Resource resource) {
+  ASSERT(resource < resources_.size(), "Unknown texture");
+  resources_[resource].output = true;
+}
+
+void RenderGraph::compile() {
+  ZoneScopedN("RenderGraph: compile");
+  ASSERT(!compiled_, "The graph has already been compiled");
+
+  cullPasses();
+  computeLifetimes();
+  createTransientTextures();
+  compiled_ = true;
+
+  stats_.passes = static_cast<uint32_t>(passes_.size());
+}
+
+std::shared_ptr<VulkanCore::Texture> RenderGraph::texture(Resource resource) const {
+  ASSERT(resource < resources_.size(), "Unknown texture");
+  return resources_[resource].texture;
+}
+
+void RenderGraph::execute(VkCommandBuffer cmdBuffer) {
+  ZoneScopedN("RenderGraph: execute");
+  ASSERT(compiled_, "The graph must be compiled before being executed");
+
+  stats_.barriers = 0;
+  stats_.barrierBatches = 0;
+  stats_.barriersSkipped = 0;
+
+  std::vector<VkImageMemoryBarrier2> barriers;
+  for (uint32_t passIndex = 0; passIndex < passes_.size(); ++passIndex) {
+    const auto& pass = passes_[passIndex];
+    if (pass.culled) {
+      continue;
+    }
+
+    barriers.clear();
+    addBarriers(passIndex, barriers);
+    if (!barriers.empty()) {
+      const VkDependencyInfo dependencyInfo = {
+          .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+          .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+          .pImageMemoryBarriers = barriers.data(),
+      };
+      vkCmdPipelineBarrier2(cmdBuffer, &dependencyInfo);
+      stats_.barriers += static_cast<uint32_t>(barriers.size());
+      ++stats_.barrierBatches;
+    }
+
+    pass.execute(cmdBuffer);
+  }
+}
+
+void RenderGraph::cullPasses() {
+  // Walks the passes backwards from the outputs: a pass is needed if it writes a texture
+  // a needed pass (or the frame) uses
+  std::vector<bool> needed(resources_.size());
+  for (size_t index = 0; index < resources_.size(); ++index) {
+    needed[index] = resources_[index].output;
+  }
+
+  stats_.culledPasses = 0;
+  for (auto pass = passes_.rbegin(); pass != passes_.rend(); ++pass) {
+    const bool contributes =
+        pass->sideEffects ||
+        std::any_of(pass->accesses.begin(), pass->accesses.end(),
+                    [&needed](const auto& access) {
+                      return access.write && needed[access.resource];
+                    });
+    pass->culled = !contributes;
+    if (pass->culled) {
+      ++stats_.culledPasses;
+      continue;
+    }
+    // Written textures stay needed too, the pass may only write parts of them
+    for (const auto& access : pass->accesses) {
+      needed[access.resource] = true;
+    }
+  }
+}
+
+void RenderGraph::computeLifetimes() {
+  for (uint32_t passIndex = 0; passIndex < passes_.size(); ++passIndex) {
+    if (passes_[passIndex].culled) {
+      continue;
+    }
+    for (const auto& access : passes_[passIndex].accesses) {
+      auto& resource = resources_[access.resource];
+      if (resource.firstPass == UINT32_MAX) {
+        ASSERT(resource.imported || access.write,
+               "A transient texture must be written before it's read");
+        resource.firstPass = passIndex;
+      }
+      resource.lastPass = passIndex;
+    }
+  }
+
+  // Outputs are used after the graph executes, so their memory can't be shared
+  for (auto& resource : resources_) {
+    if (resource.output && resource.firstPass != UINT32_MAX) {
+      resource.firstPass = 0;
+      resource.lastPass = static_cast<uint32_t>(passes_.size());
+    }
+  }
+}
+
+void RenderGraph::createTransientTextures() {
+  ZoneScopedN("RenderGraph: createTransientTextures");
+
+  std::vector<Resource> transients;
+  for (Resource index = 0; index < resources_.size(); ++index) {
+    auto& resource = resources_[index];
+    // Textures that no pass uses after culling aren't created at all
+    if (resource.imported || resource.firstPass == UINT32_MAX) {
+      continue;
+    }
+
+    const auto imageInfo = imageCreateInfo(resource.desc);
+    const VkDeviceImageMemoryRequirements imageRequirements = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+        .pCreateInfo = &imageInfo,
+    };
+    VkMemoryRequirements2 memoryRequirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+    };
+    vkGetDeviceImageMemoryRequirements(context_.device(), &imageRequirements,
+                                       &memoryRequirements);
+    resource.memoryRequirements = memoryRequirements.memoryRequirements;
+
+    transients.push_back(index);
+    ++stats_.transientTextures;
+    stats_.transientBytes += resource.memoryRequirements.size;
+  }
+
+  // Largest first, each texture goes to the lowest offset that doesn't overlap a texture
+  // alive at the same time. Textures that can't share memory types get their own block
+  std::sort(transients.begin(), transients.end(), [this](Resource a, Resource b) {
+    return resources_[a].memoryRequirements.size > resources_[b].memoryRequirements.size;
+  });
+
+  struct MemoryBlock {
+    uint32_t memoryTypeBits = 0;
+    VkDeviceSize alignment = 1;
+    VkDeviceSize size = 0;
+    std::vector<Resource> resources;
+  };
+  std::vector<MemoryBlock> blocks;
+
+  const auto lifetimesOverlap = [this](Resource a, Resource b) {
+    return resources_[a].firstPass <= resources_[b].lastPass &&
+           resources_[b].firstPass <= resources_[a].lastPass;
+  };
+  const auto memoryOverlaps = [this](Resource a, Resource b) {
+    const auto& ra = resources_[a];
+    const auto& rb = resources_[b];
+    return ra.memoryOffset < rb.memoryOffset + rb.memoryRequirements.size &&
+           rb.memoryOffset < ra.memoryOffset + ra.memoryRequirements.size;
+  };
+
+  for (const auto index : transients) {
+    auto& resource = resources_[index];
+    const auto& requirements = resource.memoryRequirements;
+
+    auto block = std::find_if(blocks.begin(), blocks.end(), [&](const auto& b) {
+      return (b.memoryTypeBits & requirements.memoryTypeBits) != 0;
+    });
+    if (block == blocks.end()) {
+      blocks.push_back(MemoryBlock{.memoryTypeBits = requirements.memoryTypeBits});
+      block = blocks.end() - 1;
+    }
+
+    std::vector<VkDeviceSize> candidates = {0};
+    for (const auto other : block->resources) {
+      if (lifetimesOverlap(index, other)) {
+        candidates.push_back(alignUp(resources_[other].memoryOffset +
+                                         resources_[other].memoryRequirements.size,
+                                     requirements.alignment));
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (const auto offset : candidates) {
+      resource.memoryOffset = offset;
+      const bool fits = std::none_of(
+          block->resources.begin(), block->resources.end(), [&](Resource other) {
+            return lifetimesOverlap(index, other) && memoryOverlaps(index, other);
+          });
+      if (fits) {
+        break;
+      }
+    }
+
+    resource.memoryBlock = static_cast<uint32_t>(block - blocks.begin());
+    block->memoryTypeBits &= requirements.memoryTypeBits;
+    block->alignment = std::max(block->alignment, requirements.alignment);
+    block->size = std::max(block->size, resource.memoryOffset + requirements.size);
+    block->resources.push_back(index);
+  }
+
+  for (const auto& block : blocks) {
+    const VkMemoryRequirements requirements = {
+        .size = block.size,
+        .alignment = block.alignment,
+        .memoryTypeBits = block.memoryTypeBits,
+    };
+    const VmaAllocationCreateInfo allocCreateInfo = {
+        .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .priority = 1.0f,
+    };
+    VmaAllocation allocation = nullptr;
+    VK_CHECK(vmaAllocateMemory(context_.memoryAllocator(), &requirements,
+                               &allocCreateInfo, &allocation, nullptr));
+    vmaSetAllocationName(context_.memoryAllocator(), allocation,
+                         ("Render graph " + name_ + " transient memory").c_str());
+    memoryBlocks_.push_back(allocation);
+    stats_.allocatedBytes += block.size;
+
+    for (const auto index : block.resources) {
+      for (const auto other : block.resources) {
+        if (index != other && memoryOverlaps(index, other)) {
+          resources_[index].aliases.push_back(other);
+        }
+      }
+    }
+  }
+
+  for (const auto index : transients) {
+    auto& resource = resources_[index];
+    resource.texture = std::make_shared<VulkanCore::Texture>(
+        context_, imageCreateInfo(resource.desc), memoryBlocks_[resource.memoryBlock],
+        resource.memoryOffset, resource.name);
+  }
+}
+
+void RenderGraph::addBarriers(uint32_t passIndex,
+                              std::vector<VkImageMemoryBarrier2>& barriers) {
+  for (const auto& access : passes_[passIndex].accesses) {
+    auto& resource = resources_[access.resource];
+    auto oldLayout = resource.texture->vkLayout();
+    VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+    bool needed = false;
+
+    if (passIndex == resource.firstPass && !resource.aliases.empty()) {
+      // Another texture used the memory since the last frame: its contents are gone, and
+      // its accesses must finish before this texture is written
+      oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+      srcStages = resource.writeStages | resource.readStages;
+      srcAccess = resource.writeAccess;
+      for (const auto alias : resource.aliases) {
+        srcStages |= resources_[alias].writeStages | resources_[alias].readStages;
+        srcAccess |= resources_[alias].writeAccess;
+      }
+      needed = true;
+    } else if (oldLayout != access.layout || access.write) {
+      // Layout transitions and writes wait for every access since the last write
+      srcStages = resource.writeStages | resource.readStages;
+      srcAccess = resource.writeAccess;
+      needed = oldLayout != access.layout || srcStages != VK_PIPELINE_STAGE_2_NONE;
+    } else {
+      // A read in the same layout only waits for the last write, once per stage
+      srcStages = resource.writeStages;
+      srcAccess = resource.writeAccess;
+      needed = srcStages != VK_PIPELINE_STAGE_2_NONE &&
+               (access.stages & ~resource.visibleStages) != 0;
+    }
+
+    if (needed) {
+      const auto& texture = resource.texture;
+      const VkImageAspectFlags aspectMask =
+          texture->isDepth()
+              ? VK_IMAGE_ASPECT_DEPTH_BIT |
+                    (texture->isStencil() ? VK_IMAGE_ASPECT_STENCIL_BIT : 0)
+              : VK_IMAGE_ASPECT_COLOR_BIT;
+      barriers.push_back(VkImageMemoryBarrier2{
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .srcStageMask = srcStages,
+          .srcAccessMask = srcAccess,
+          .dstStageMask = access.stages,
+          .dstAccessMask = access.access,
+          .oldLayout = oldLayout,
+          .newLayout = access.layout,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = texture->vkImage(),
+          .subresourceRange =
+              {
+                  .aspectMask = aspectMask,
+                  .baseMipLevel = 0,
+                  .levelCount = VK_REMAINING_MIP_LEVELS,
+                  .baseArrayLayer = 0,
+                  .layerCount = VK_REMAINING_ARRAY_LAYERS,
+              },
+      });
+      texture->setImageLayout(access.layout);
+    } else {
+      ++stats_.barriersSkipped;
+    }
+
+    if (access.write) {
+      resource.writeStages = access.stages;
+      resource.writeAccess = access.access & kWriteAccess;
+      resource.readStages = VK_PIPELINE_STAGE_2_NONE;
+      resource.visibleStages = VK_PIPELINE_STAGE_2_NONE;
+    } else if (needed && oldLayout != access.layout) {
+      // Later reads from other stages must wait for the layout transition
+      resource.writeStages = access.stages;
+      resource.writeAccess = VK_ACCESS_2_NONE;
+      resource.readStages = access.stages;
+      resource.visibleStages = access.stages;
+    } else {
+      resource.readStages |= access.stages;
+      if (needed) {
+        resource.visibleStages |= access.stages;
+      }
+    }
+  }
+}
+
+}  // namespace EngineCore
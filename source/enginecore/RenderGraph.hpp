@@ -0,0 +1,186 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vulkancore/Common.hpp"
+#include "vulkancore/Utility.hpp"
+#include "vk_mem_alloc.h"
+
+namespace VulkanCore {
+class Context;
+class Texture;
+}  // namespace VulkanCore
+
+namespace EngineCore {
+
+// Orders the passes of a frame and the textures they use. Each pass declares which
+// textures it reads and writes and how (as an attachment, sampled, as a storage image,
+// ...), and the graph:
+//  * culls the passes that don't contribute to an output,
+//  * emits, before each pass, one vkCmdPipelineBarrier2 with the layout transitions and
+//    hazards of all of its textures, skipping the ones that aren't needed (a read after a
+//    read in the same layout, for instance),
+//  * creates the transient textures (the ones only used during a frame) in a single
+//    allocation, and textures whose lifetimes don't overlap share the same memory.
+// Textures created elsewhere can be imported into the graph. The passes' own
+// transitionImageLayout calls become no-ops because the graph has already moved their
+// textures into the declared layouts and keeps the textures' layouts up to date
+class RenderGraph final {
+ public:
+  enum class Usage {
+    ColorAttachment,
+    DepthAttachment,     // depth/stencil attachment, read and written
+    DepthReadOnly,       // depth test without writes, or sampled depth
+    Sampled,             // shader read from a sampled image
+    StorageRead,         // shader read from a storage image
+    StorageWrite,        // shader write (and read) to a storage image
+    TransferSrc,
+    TransferDst,
+    Present,
+  };
+
+  using Resource = uint32_t;
+
+  struct TextureDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent = {};
+    VkImageUsageFlags usage = 0;
+    uint32_t mipLevels = 1;
+    uint32_t layerCount = 1;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+  };
+
+  // Declares the textures a pass uses. shaderStages tells which shader stages read or
+  // write sampled and storage images, it's ignored for the other usages
+  class PassBuilder {
+   public:
+    void read(Resource resource, Usage usage,
+              VkPipelineStageFlags2 shaderStages =
+                  VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+
+    void write(Resource resource, Usage usage,
+               VkPipelineStageFlags2 shaderStages =
+                   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+
+    // The pass has effects the graph can't see (it writes buffers, for instance), so it's
+    // never culled
+    void setSideEffects() { sideEffects_ = true; }
+
+   private:
+    friend class RenderGraph;
+    struct Access {
+      Resource resource = 0;
+      Usage usage = Usage::Sampled;
+      VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+      VkAccessFlags2 access = VK_ACCESS_2_NONE;
+      VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+      bool write = false;
+    };
+
+    void addAccess(Resource resource, Usage usage, VkPipelineStageFlags2 shaderStages,
+                   bool write);
+
+    std::vector<Access> accesses_;
+    bool sideEffects_ = false;
+  };
+
+  using SetupFunction = std::function<void(PassBuilder& builder)>;
+
+  using ExecuteFunction = std::function<void(VkCommandBuffer cmdBuffer)>;
+
+  struct Stats {
+    uint32_t passes = 0;
+    uint32_t culledPasses = 0;
+    uint32_t transientTextures = 0;
+    VkDeviceSize transientBytes = 0;  // what the transient textures would take unaliased
+    VkDeviceSize allocatedBytes = 0;  // what they take aliased
+    uint32_t barriers = 0;            // image barriers emitted in the last frame
+    uint32_t barrierBatches = 0;      // vkCmdPipelineBarrier2 calls in the last frame
+    uint32_t barriersSkipped = 0;     // accesses that didn't need a barrier
+  };
+
+  MOVABLE_ONLY(RenderGraph);
+
+  explicit RenderGraph(const VulkanCore::Context& context, const std::string& name = "");
+
+  // The GPU must be done with the graph's transient textures
+  ~RenderGraph();
+
+  // The texture is created by compile()
+  Resource createTexture(const std::string& name, const TextureDesc& desc);
+
+  Resource importTexture(const std::string& name,
+                         std::shared_ptr<VulkanCore::Texture> texture);
+
+  // Passes run in the order they are added
+  void addPass(const std::string& name, const SetupFunction& setup,
+               ExecuteFunction execute);
+
+  // The textures the frame produces, the passes that don't contribute to any of them
+  // are culled
+  void markOutput(Resource resource);
+
+  // Culls the passes, computes the lifetimes of the transient textures and creates them
+  void compile();
+
+  // Only valid after compile() for transient textures
+  std::shared_ptr<VulkanCore::Texture> texture(Resource resource) const;
+
+  // Records the passes that weren't culled, with their barriers
+  void execute(VkCommandBuffer cmdBuffer);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct ResourceNode {
+    std::string name;
+    TextureDesc desc;
+    std::shared_ptr<VulkanCore::Texture> texture;
+    bool imported = false;
+    bool output = false;
+
+    // Lifetime, as indices into passes_ (transient textures)
+    uint32_t firstPass = UINT32_MAX;
+    uint32_t lastPass = 0;
+    VkMemoryRequirements memoryRequirements = {};
+    uint32_t memoryBlock = UINT32_MAX;
+    VkDeviceSize memoryOffset = 0;
+    std::vector<Resource> aliases;  // transient textures that share some memory
+
+    // Accesses since the last write, carried over from frame to frame
+    VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+    VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;
+    VkPipelineStageFlags2 visibleStages = VK_PIPELINE_STAGE_2_NONE;
+  };
+
+  struct PassNode {
+    std::string name;
+    std::vector<PassBuilder::Access> accesses;
+    ExecuteFunction execute;
+    bool sideEffects = false;
+    bool culled = false;
+  };
+
+  void cullPasses();
+
+  void computeLifetimes();
+
+  void createTransientTextures();
+
+  void addBarriers(uint32_t passIndex, std::vector<VkImageMemoryBarrier2>& barriers);
+
+ private:
+  const VulkanCore::Context& context_;
+  std::string name_;
+  std::vector<ResourceNode> resources_;
+  std::vector<PassNode> passes_;
+  std::vector<VmaAllocation> memoryBlocks_;
+  bool compiled_ = false;
+  Stats stats_;
+};
+
+}  // namespace EngineCore
@@ -0,0 +1,141 @@
+#include "TextureCompression.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
+
+namespace {
+constexpr uint32_t kBlockSize = 4;  // texels, in x and y, of every format encoded here
+constexpr uint32_t kChannels = 4;
+
+// Copies the 4x4 block at blockX, blockY into rgba, repeating the last row and column
+// of images that don't cover the whole block
+void gatherBlock(const uint8_t* level, uint32_t width, uint32_t height, uint32_t blockX,
+                 uint32_t blockY, uint8_t* rgba) {
+  for (uint32_t y = 0; y < kBlockSize; ++y) {
+    const uint32_t srcY = std::min(blockY * kBlockSize + y, height - 1);
+    for (uint32_t x = 0; x < kBlockSize; ++x) {
+      const uint32_t srcX = std::min(blockX * kBlockSize + x, width - 1);
+      memcpy(rgba + (y * kBlockSize + x) * kChannels,
+             level + (size_t(srcY) * width + srcX) * kChannels, kChannels);
+    }
+  }
+}
+
+void encodeBlock(VkFormat format, const uint8_t* rgba, uint8_t* block) {
+  uint8_t channels[kBlockSize * kBlockSize * 2];
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+      stb_compress_dxt_block(block, rgba, 0, STB_DXT_HIGHQUAL);
+      break;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+      stb_compress_dxt_block(block, rgba, 1, STB_DXT_HIGHQUAL);
+      break;
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+      for (uint32_t i = 0; i < kBlockSize * kBlockSize; ++i) {
+        channels[i] = rgba[i * kChannels];
+      }
+      stb_compress_bc4_block(block, channels);
+      break;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      for (uint32_t i = 0; i < kBlockSize * kBlockSize; ++i) {
+        channels[i * 2] = rgba[i * kChannels];
+        channels[i * 2 + 1] = rgba[i * kChannels + 1];
+      }
+      stb_compress_bc5_block(block, channels);
+      break;
+    default:
+      ASSERT(false, "Unsupported compressed format");
+  }
+}
+}  // namespace
+
+namespace EngineCore {
+
+std::vector<TextureUsage> textureUsages(const Model& model) {
+  std::vector<TextureUsage> usages(model.textures.size(), TextureUsage::Color);
+  std::vector<bool> referenced(model.textures.size(), false);
+  auto use = [&](int textureId, TextureUsage usage) {
+    if (textureId < 0 || textureId >= static_cast<int>(usages.size())) {
+      return;
+    }
+    if (referenced[textureId] && usages[textureId] != usage) {
+      usages[textureId] = TextureUsage::Color;
+    } else if (!referenced[textureId]) {
+      usages[textureId] = usage;
+    }
+    referenced[textureId] = true;
+  };
+  for (const auto& material : model.materials) {
+    use(material.basecolorTextureId, TextureUsage::Color);
+    use(material.emissiveTextureId, TextureUsage::Color);
+    use(material.normalTextureTextureId, TextureUsage::Normal);
+    use(material.metallicRoughnessTextureId, TextureUsage::MetallicRoughness);
+  }
+  return usages;
+}
+
+VkFormat chooseCompressedFormat(TextureUsage usage, std::span<const uint8_t> rgba) {
+  switch (usage) {
+    case TextureUsage::Normal:
+      // z is rebuilt from x and y, so both get a block of their own
+      return VK_FORMAT_BC5_UNORM_BLOCK;
+    case TextureUsage::MetallicRoughness:
+      return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case TextureUsage::Color:
+      break;
+  }
+  for (size_t i = 3; i < rgba.size(); i += kChannels) {
+    if (rgba[i] != 255) {
+      return VK_FORMAT_BC3_UNORM_BLOCK;
+    }
+  }
+  return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+}
+
+uint64_t mipChainSizeInBytes(VkFormat format, uint32_t width, uint32_t height,
+                             uint32_t mipLevels) {
+  uint64_t size = 0;
+  for (uint32_t level = 0; level < mipLevels; ++level) {
+    const VkExtent3D extents = {
+        .width = std::max(1u, width >> level),
+        .height = std::max(1u, height >> level),
+        .depth = 1,
+    };
+    size += VulkanCore::imageSizeInBytes(format, extents);
+  }
+  return size;
+}
+
+std::vector<uint8_t> compressMipChain(std::span<const uint8_t> rgbaChain, uint32_t width,
+                                      uint32_t height, uint32_t mipLevels,
+                                      VkFormat format) {
+  ASSERT(rgbaChain.size() ==
+             mipChainSizeInBytes(VK_FORMAT_R8G8B8A8_UNORM, width, height, mipLevels),
+         "The RGBA8 mip chain is incomplete");
+  const uint32_t blockBytes = VulkanCore::bytesPerBlock(format);
+  std::vector<uint8_t> compressed(mipChainSizeInBytes(format, width, height, mipLevels));
+
+  const uint8_t* level = rgbaChain.data();
+  uint8_t* block = compressed.data();
+  uint8_t rgba[kBlockSize * kBlockSize * kChannels];
+  for (uint32_t mip = 0; mip < mipLevels; ++mip) {
+    const uint32_t levelWidth = std::max(1u, width >> mip);
+    const uint32_t levelHeight = std::max(1u, height >> mip);
+    const uint32_t blocksX = (levelWidth + kBlockSize - 1) / kBlockSize;
+    const uint32_t blocksY = (levelHeight + kBlockSize - 1) / kBlockSize;
+    for (uint32_t blockY = 0; blockY < blocksY; ++blockY) {
+      for (uint32_t blockX = 0; blockX < blocksX; ++blockX) {
+        gatherBlock(level, levelWidth, levelHeight, blockX, blockY, rgba);
+        encodeBlock(format, rgba, block);
+        block += blockBytes;
+      }
+    }
+    level += size_t(levelWidth) * levelHeight * kChannels;
+  }
+  return compressed;
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "Model.hpp"
+#include "vulkancore/Common.hpp"
+
+namespace EngineCore {
+
+/// @brief How the shaders sample a texture, which decides the block format it gets
+enum class TextureUsage {
+  Color,              // base color and emissive, or unknown
+  Normal,             // tangent space, only x and y are read
+  MetallicRoughness,  // glTF keeps roughness in g and metalness in b
+};
+
+/// @brief Usage of each texture of model, from the material slots that reference it.
+/// Textures referenced from slots of different usages are treated as Color
+std::vector<TextureUsage> textureUsages(const Model& model);
+
+/// @brief BC5 for normal maps, BC1 for metallic/roughness and opaque color and BC3 for
+/// color with alpha. rgba is level 0 of the texture
+VkFormat chooseCompressedFormat(TextureUsage usage, std::span<const uint8_t> rgba);
+
+/// @brief Size of mipLevels levels of format, tightly packed like
+/// Texture::uploadMipChain expects them
+uint64_t mipChainSizeInBytes(VkFormat format, uint32_t width, uint32_t height,
+                             uint32_t mipLevels);
+
+/// @brief Encodes an RGBA8 mip chain, level 0 first, into format level by level. The
+/// result has the same layout with blocks instead of texels. Supports BC1 (without
+/// alpha), BC3, BC4 (from r) and BC5 (from r and g)
+std::vector<uint8_t> compressMipChain(std::span<const uint8_t> rgbaChain, uint32_t width,
+                                      uint32_t height, uint32_t mipLevels,
+                                      VkFormat format);
+
+}  // namespace EngineCore
@@ -0,0 +1,362 @@
+#include "TextureStreamer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <tracy/Tracy.hpp>
+
+#include "TextureCompression.hpp"
+#include "vulkancore/Context.hpp"
+
+namespace EngineCore {
+
+TextureStreamer::TextureStreamer(
+    VulkanCore::Context& context, std::shared_ptr<BakedModel> model,
+    std::function<void(int, std::shared_ptr<VulkanCore::Texture>)> textureChanged,
+    const Settings& settings)
+    : context_(context),
+      model_(model),
+      textureChanged_(textureChanged),
+      settings_(settings) {}
+
+TextureStreamer::~TextureStreamer() {
+  // Its threads report to readyMutex_, which goes away before it otherwise
+  uploader_.reset();
+}
+
+void TextureStreamer::init(VulkanCore::CommandQueueManager& queueMgr,
+                           VkCommandBuffer commandBuffer,
+                           std::vector<std::shared_ptr<VulkanCore::Texture>>& textures,
+                           uint32_t framesInFlight) {
+  const auto records = model_->textures();
+  textures_.resize(records.size());
+  for (int index = 0; index < static_cast<int>(records.size()); ++index) {
+    const auto& record = records[index];
+    ASSERT(!VulkanCore::isBlockCompressed(static_cast<VkFormat>(record.format)) ||
+               context_.isTextureCompressionBCEnabled(),
+           "The model was baked with block compressed textures, which the device "
+           "doesn't support");
+
+    auto& state = textures_[index];
+    while (state.tailMip + 1 < record.mipLevels &&
+           (std::max(record.width, record.height) >> state.tailMip) >
+               settings_.mipTailSize) {
+      ++state.tailMip;
+    }
+    state.residentMip = state.tailMip;
+    state.wantedMip = state.tailMip;
+
+    mipTails_.push_back(createTexture(index, state.tailMip));
+    mipTails_.back()->uploadMipChain(queueMgr, commandBuffer,
+                                     levelData(index, state.tailMip));
+    resident_.push_back(mipTails_.back());
+    textures.push_back(mipTails_.back());
+
+    mipTailBytes_ += levelsSize(index, state.tailMip);
+    stats_.fullResolutionBytes += record.size;
+  }
+  stats_.textures = static_cast<uint32_t>(records.size());
+
+  feedbackBuffer_ = context_.createBuffer(
+      sizeof(uint32_t) * std::max<size_t>(records.size(), 1),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Texture feedback");
+  vkCmdFillBuffer(commandBuffer, feedbackBuffer_->vkBuffer(), 0, VK_WHOLE_SIZE, 0);
+  const VkMemoryBarrier afterFill{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &afterFill, 0,
+                       nullptr, 0, nullptr);
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    readbackBuffers_.push_back(context_.createBuffer(
+        feedbackBuffer_->size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_TO_CPU, "Texture feedback readback " + std::to_string(i)));
+  }
+  readbackPending_.resize(framesInFlight, false);
+
+  uploader_ = std::make_unique<AsyncDataUploader>(context_, [this](int index, int) {
+    std::lock_guard lock(readyMutex_);
+    readyTextures_.push_back(index);
+  });
+  uploader_->startProcessing();
+}
+
+void TextureStreamer::update(VulkanCore::CommandQueueManager& queueMgr,
+                             VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+  ZoneScoped;
+  ++frame_;
+  readFeedback(frameIndex);
+  swapStreamedTextures(queueMgr);
+  requestLevels(queueMgr);
+  recordFeedbackReadback(commandBuffer, frameIndex);
+
+  stats_.texturesAtFullResolution = 0;
+  stats_.texturesAtMipTail = 0;
+  stats_.texturesStreaming = 0;
+  for (const auto& state : textures_) {
+    stats_.texturesAtFullResolution += state.residentMip == 0;
+    stats_.texturesAtMipTail += state.residentMip == state.tailMip;
+    stats_.texturesStreaming += state.streaming != nullptr;
+  }
+  stats_.residentBytes = mipTailBytes_ + streamedBytes_;
+}
+
+std::shared_ptr<VulkanCore::Texture> TextureStreamer::createTexture(
+    int index, uint32_t firstMip) const {
+  const auto& record = model_->textures()[index];
+  return context_.createTexture(
+      VK_IMAGE_TYPE_2D, static_cast<VkFormat>(record.format), 0,
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      VkExtent3D{
+          .width = std::max(1u, record.width >> firstMip),
+          .height = std::max(1u, record.height >> firstMip),
+          .depth = 1u,
+      },
+      record.mipLevels - firstMip, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+      VK_SAMPLE_COUNT_1_BIT,
+      std::to_string(index) + " from mip " + std::to_string(firstMip));
+}
+
+const uint8_t* TextureStreamer::levelData(int index, uint32_t mip) const {
+  const auto& record = model_->textures()[index];
+  return model_->textureData(record).data() +
+         mipChainSizeInBytes(static_cast<VkFormat>(record.format), record.width,
+                             record.height, mip);
+}
+
+VkDeviceSize TextureStreamer::levelsSize(int index, uint32_t firstMip) const {
+  const auto& record = model_->textures()[index];
+  return record.size - mipChainSizeInBytes(static_cast<VkFormat>(record.format),
+                                           record.width, record.height, firstMip);
+}
+
+VkDeviceSize TextureStreamer::streamedSize(int index) const {
+  const auto& state = textures_[index];
+  return state.residentMip == state.tailMip ? 0 : levelsSize(index, state.residentMip);
+}
+
+VkDeviceSize TextureStreamer::budget() const {
+  std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> heapBudgets;
+  vmaGetHeapBudgets(context_.memoryAllocator(), heapBudgets.data());
+  const VkPhysicalDeviceMemoryProperties* memoryProperties = nullptr;
+  vmaGetMemoryProperties(context_.memoryAllocator(), &memoryProperties);
+
+  VkDeviceSize available = 0;
+  for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; ++heap) {
+    if ((memoryProperties->memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) &&
+        heapBudgets[heap].budget > heapBudgets[heap].usage) {
+      available += heapBudgets[heap].budget - heapBudgets[heap].usage;
+    }
+  }
+
+  // The streamed textures are part of the usage already, they may keep what they have
+  VkDeviceSize budget =
+      streamedBytes_ + bytesInFlight_ +
+      static_cast<VkDeviceSize>(available * double(settings_.budgetFraction));
+  if (settings_.budgetBytes > 0) {
+    budget = std::min(budget, settings_.budgetBytes > mipTailBytes_
+                                  ? settings_.budgetBytes - mipTailBytes_
+                                  : VkDeviceSize(0));
+  }
+  return budget;
+}
+
+void TextureStreamer::readFeedback(uint32_t frameIndex) {
+  if (!readbackPending_[frameIndex]) {
+    return;
+  }
+
+  const auto records = model_->textures();
+  const auto* requiredResolution =
+      reinterpret_cast<const uint32_t*>(readbackBuffers_[frameIndex]->mappedMemory());
+  for (size_t index = 0; index < textures_.size(); ++index) {
+    if (requiredResolution[index] == 0) {
+      continue;
+    }
+    // Level 0 of a full mip chain is 2^(mipLevels - 1) texels wide or high
+    const int finestMip = int(records[index].mipLevels) - int(requiredResolution[index]);
+    auto& state = textures_[index];
+    state.wantedMip = std::clamp(finestMip, 0, int(state.tailMip));
+    state.lastSeenFrame = frame_;
+  }
+  readbackPending_[frameIndex] = false;
+}
+
+void TextureStreamer::recordFeedbackReadback(VkCommandBuffer commandBuffer,
+                                             uint32_t frameIndex) {
+  // The feedback of the previous frame is copied out and the buffer cleared for this
+  // one, behind the fragment shaders that wrote it
+  const VkMemoryBarrier beforeCopy{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &beforeCopy, 0, nullptr, 0,
+                       nullptr);
+
+  const VkBufferCopy region{.size = feedbackBuffer_->size()};
+  vkCmdCopyBuffer(commandBuffer, feedbackBuffer_->vkBuffer(),
+                  readbackBuffers_[frameIndex]->vkBuffer(), 1, &region);
+
+  const VkMemoryBarrier transferToHost{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &transferToHost, 0, nullptr, 0,
+                       nullptr);
+
+  // The copy reads the buffer before it's cleared
+  const VkMemoryBarrier beforeClear{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = 0,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &beforeClear, 0, nullptr, 0,
+                       nullptr);
+
+  vkCmdFillBuffer(commandBuffer, feedbackBuffer_->vkBuffer(), 0, VK_WHOLE_SIZE, 0);
+
+  const VkMemoryBarrier afterClear{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &afterClear, 0,
+                       nullptr, 0, nullptr);
+
+  readbackPending_[frameIndex] = true;
+}
+
+void TextureStreamer::replaceTexture(VulkanCore::CommandQueueManager& queueMgr,
+                                     int index,
+                                     std::shared_ptr<VulkanCore::Texture> texture,
+                                     uint32_t firstMip) {
+  streamedBytes_ -= streamedSize(index);
+  textures_[index].residentMip = firstMip;
+  streamedBytes_ += streamedSize(index);
+
+  // The frames in flight may still sample the old one, the mip tails are kept anyway
+  auto old = resident_[index];
+  if (old != mipTails_[index]) {
+    queueMgr.disposeWhenSubmitCompletes([old]() {});
+  }
+  resident_[index] = texture;
+  textureChanged_(index, texture);
+}
+
+void TextureStreamer::swapStreamedTextures(VulkanCore::CommandQueueManager& queueMgr) {
+  std::vector<int> ready;
+  {
+    std::lock_guard lock(readyMutex_);
+    ready.swap(readyTextures_);
+  }
+  for (const int index : ready) {
+    auto& state = textures_[index];
+    const auto size = levelsSize(index, state.streamingMip);
+    bytesInFlight_ -= size;
+    stats_.bytesStreamed += size;
+    ++stats_.streamedIn;
+    replaceTexture(queueMgr, index, std::move(state.streaming), state.streamingMip);
+  }
+}
+
+void TextureStreamer::evict(VulkanCore::CommandQueueManager& queueMgr, int index) {
+  replaceTexture(queueMgr, index, mipTails_[index], textures_[index].tailMip);
+  ++stats_.evicted;
+}
+
+bool TextureStreamer::evictUntil(VulkanCore::CommandQueueManager& queueMgr,
+                                 VkDeviceSize bytes, uint64_t seenBefore) {
+  while (streamedBytes_ + bytesInFlight_ > bytes) {
+    int leastRecent = -1;
+    for (int index = 0; index < static_cast<int>(textures_.size()); ++index) {
+      const auto& state = textures_[index];
+      if (state.residentMip != state.tailMip && !state.streaming &&
+          state.lastSeenFrame < seenBefore &&
+          (leastRecent < 0 ||
+           state.lastSeenFrame < textures_[leastRecent].lastSeenFrame)) {
+        leastRecent = index;
+      }
+    }
+    if (leastRecent < 0) {
+      return false;
+    }
+    evict(queueMgr, leastRecent);
+    ++stats_.evictedOverBudget;
+  }
+  return true;
+}
+
+void TextureStreamer::stream(int index, uint32_t firstMip) {
+  auto& state = textures_[index];
+  state.streaming = createTexture(index, firstMip);
+  state.streamingMip = firstMip;
+  bytesInFlight_ += levelsSize(index, firstMip);
+  uploader_->queueTextureUploadTasks(AsyncDataUploader::TextureLoadTask{
+      .texture = state.streaming.get(),
+      .data = levelData(index, firstMip),
+      .index = index,
+      .modelIndex = 0,
+      .mipChain = true,
+  });
+}
+
+void TextureStreamer::requestLevels(VulkanCore::CommandQueueManager& queueMgr) {
+  for (int index = 0; index < static_cast<int>(textures_.size()); ++index) {
+    const auto& state = textures_[index];
+    if (state.residentMip != state.tailMip && !state.streaming &&
+        frame_ - state.lastSeenFrame > settings_.evictAfterFrames) {
+      evict(queueMgr, index);
+    }
+  }
+
+  // The budget may have shrunk, if other allocations grew
+  const VkDeviceSize bytes = budget();
+  stats_.budgetBytes = bytes + mipTailBytes_;
+  evictUntil(queueMgr, bytes, UINT64_MAX);
+
+  // The most blurry textures first, then the ones seen last
+  std::vector<int> wanted;
+  for (int index = 0; index < static_cast<int>(textures_.size()); ++index) {
+    const auto& state = textures_[index];
+    if (state.wantedMip < state.residentMip && !state.streaming &&
+        frame_ - state.lastSeenFrame <= settings_.evictAfterFrames) {
+      wanted.push_back(index);
+    }
+  }
+  std::sort(wanted.begin(), wanted.end(), [this](int a, int b) {
+    const auto& stateA = textures_[a];
+    const auto& stateB = textures_[b];
+    const auto missingA = stateA.residentMip - stateA.wantedMip;
+    const auto missingB = stateB.residentMip - stateB.wantedMip;
+    return missingA != missingB ? missingA > missingB
+                                : stateA.lastSeenFrame > stateB.lastSeenFrame;
+  });
+
+  for (const int index : wanted) {
+    if (bytesInFlight_ >= settings_.maxBytesInFlight) {
+      break;
+    }
+    const auto& state = textures_[index];
+    // The finest levels that fit, making room with textures that were seen less
+    // recently. Until the new texture is swapped in, the old one is resident too
+    for (uint32_t mip = state.wantedMip; mip < state.residentMip; ++mip) {
+      const auto size = levelsSize(index, mip);
+      if (size <= bytes && evictUntil(queueMgr, bytes - size, state.lastSeenFrame)) {
+        stream(index, mip);
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace EngineCore
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AsyncDataUploader.hpp"
+#include "BakedModel.hpp"
+#include "vulkancore/Buffer.hpp"
+#include "vulkancore/Texture.hpp"
+
+namespace EngineCore {
+
+/// @brief Keeps only the mip levels of the textures of a baked model that the last frames
+/// needed on the GPU. Every texture starts with its mip tail, the levels up to
+/// Settings::mipTailSize, so the model shows up right away. Fragment shaders record the
+/// finest level they sample of each texture in feedbackBuffer(), and from it finer levels
+/// are streamed in on the transfer queue through an AsyncDataUploader, straight from the
+/// mapped baked file. Textures that haven't been seen for a while are evicted back to
+/// their mip tail, and the least recently seen ones go first when the resident textures
+/// outgrow the budget. A texture with other levels resident is a new VulkanCore::Texture
+/// that replaces the old one, so no sparse residency is needed, and the mip tails are
+/// kept around so evicting doesn't upload anything
+class TextureStreamer {
+ public:
+  struct Settings {
+    // 0 to only go by the VMA heap budgets
+    VkDeviceSize budgetBytes = 0;
+    // Share of the device local memory left in the VMA heap budgets the textures may
+    // grow into
+    float budgetFraction = 0.8f;
+    // Levels up to this many texels wide and high are always resident
+    uint32_t mipTailSize = 64;
+    // Textures that take longer to be seen again are evicted down to their mip tail
+    uint32_t evictAfterFrames = 300;
+    // Limits the uploads in flight, so there's always memory left to evict into
+    VkDeviceSize maxBytesInFlight = 64 * 1024 * 1024;
+  };
+
+  struct Stats {
+    uint32_t textures = 0;
+    uint32_t texturesAtFullResolution = 0;
+    uint32_t texturesAtMipTail = 0;
+    uint32_t texturesStreaming = 0;
+    VkDeviceSize residentBytes = 0;
+    VkDeviceSize fullResolutionBytes = 0;  // with every texture fully resident
+    VkDeviceSize budgetBytes = 0;
+    uint64_t streamedIn = 0;  // textures that got finer levels
+    uint64_t evicted = 0;     // textures that lost levels, for any reason
+    uint64_t evictedOverBudget = 0;
+    uint64_t bytesStreamed = 0;
+  };
+
+  // textureChanged(index, texture) is called from update() when texture replaces the
+  // texture at index, which must be bound in its place. The old texture is released
+  // once the frame update() records into is done
+  TextureStreamer(VulkanCore::Context& context, std::shared_ptr<BakedModel> model,
+                  std::function<void(int, std::shared_ptr<VulkanCore::Texture>)>
+                      textureChanged,
+                  const Settings& settings = {});
+
+  ~TextureStreamer();
+
+  // Uploads the mip tail of every texture of the model in commandBuffer, adds them to
+  // textures in order and starts streaming. framesInFlight is the number of frames
+  // update() gets called with
+  void init(VulkanCore::CommandQueueManager& queueMgr, VkCommandBuffer commandBuffer,
+            std::vector<std::shared_ptr<VulkanCore::Texture>>& textures,
+            uint32_t framesInFlight);
+
+  // One uint per texture, written by the fragment shaders with atomicMax(): 0 if the
+  // texture wasn't sampled, 1 + log2 of the finest resolution that was sampled otherwise
+  std::shared_ptr<VulkanCore::Buffer> feedbackBuffer() const { return feedbackBuffer_; }
+
+  // Must be recorded outside of render passes, before the draws of the frame. The GPU
+  // must be done with the previous frame that used frameIndex, its feedback is read
+  // back here. Swaps in the textures that finished streaming, and streams or evicts
+  // levels following the feedback and the budget. queueMgr is the queue commandBuffer
+  // gets submitted to
+  void update(VulkanCore::CommandQueueManager& queueMgr, VkCommandBuffer commandBuffer,
+              uint32_t frameIndex);
+
+  Stats stats() const { return stats_; }
+
+ private:
+  struct TextureState {
+    uint32_t residentMip = 0;  // first resident level
+    uint32_t tailMip = 0;
+    uint32_t wantedMip = 0;  // from the feedback
+    uint64_t lastSeenFrame = 0;
+    // The texture with other levels resident that is being uploaded, if any
+    std::shared_ptr<VulkanCore::Texture> streaming;
+    uint32_t streamingMip = 0;
+  };
+
+  std::shared_ptr<VulkanCore::Texture> createTexture(int index, uint32_t firstMip) const;
+
+  const uint8_t* levelData(int index, uint32_t mip) const;
+
+  // Memory of levels firstMip and coarser, as laid out in the baked file
+  VkDeviceSize levelsSize(int index, uint32_t firstMip) const;
+
+  // What the texture takes on top of its mip tail
+  VkDeviceSize streamedSize(int index) const;
+
+  // Memory the streamed levels may take, given the device local heap budgets
+  VkDeviceSize budget() const;
+
+  void readFeedback(uint32_t frameIndex);
+
+  void recordFeedbackReadback(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+  void replaceTexture(VulkanCore::CommandQueueManager& queueMgr, int index,
+                      std::shared_ptr<VulkanCore::Texture> texture, uint32_t firstMip);
+
+  void swapStreamedTextures(VulkanCore::CommandQueueManager& queueMgr);
+
+  void evict(VulkanCore::CommandQueueManager& queueMgr, int index);
+
+  // Evicts the least recently seen textures not seen since seenBefore until the
+  // streamed levels take at most bytes, returns whether they do
+  bool evictUntil(VulkanCore::CommandQueueManager& queueMgr, VkDeviceSize bytes,
+                  uint64_t seenBefore);
+
+  void stream(int index, uint32_t firstMip);
+
+  void requestLevels(VulkanCore::CommandQueueManager& queueMgr);
+
+ private:
+  VulkanCore::Context& context_;
+  std::shared_ptr<BakedModel> model_;
+  std::function<void(int, std::shared_ptr<VulkanCore::Texture>)> textureChanged_;
+  Settings settings_;
+
+  std::vector<TextureState> textures_;
+  std::vector<std::shared_ptr<VulkanCore::Texture>> mipTails_;
+  std::vector<std::shared_ptr<VulkanCore::Texture>> resident_;  // bound right now
+  std::unique_ptr<AsyncDataUploader> uploader_;
+
+  std::shared_ptr<VulkanCore::Buffer> feedbackBuffer_;
+  // Per frame in flight
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> readbackBuffers_;
+  std::vector<bool> readbackPending_;
+
+  // Filled by the uploader's thread
+  std::mutex readyMutex_;
+  std::vector<int> readyTextures_;
+
+  uint64_t frame_ = 0;
+  VkDeviceSize mipTailBytes_ = 0;
+  VkDeviceSize streamedBytes_ = 0;  // resident on top of the mip tails
+  VkDeviceSize bytesInFlight_ = 0;
+  Stats stats_;
+};
+
+}  // namespace EngineCore
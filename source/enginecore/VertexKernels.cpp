@@ -0,0 +1,415 @@
+#include "VertexKernels.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
+
+#include "Model.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2/F16C instructions in functions that ask for them, so the
+// rest of the engine can still be built for the baseline instruction set
+#if defined(VERTEX_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#define TARGET_F16C __attribute__((target("f16c")))
+#else
+#define TARGET_AVX2
+#define TARGET_F16C
+#endif
+
+namespace {
+
+using EngineCore::Vertex16Bit;
+using EngineCore::VertexStreams;
+using EngineCore::VertexKernels::InstructionSet;
+
+constexpr size_t kHalfComponents = 14;
+static_assert(offsetof(Vertex16Bit, material) == kHalfComponents * sizeof(uint16_t),
+              "Vertex16Bit is expected to start with its 14 half components");
+
+struct CpuFeatures {
+  bool sse = false;
+  bool avx2 = false;
+  bool f16c = false;
+};
+
+CpuFeatures detectCpuFeatures() {
+  CpuFeatures features;
+#if defined(VERTEX_KERNELS_X86)
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int maxLeaf = info[0];
+  __cpuid(info, 1);
+  features.sse = (info[3] & (1 << 26)) != 0;  // SSE2
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+  // F16C and AVX2 are VEX encoded, the OS has to save the YMM registers
+  const bool ymmEnabled = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+  features.f16c = ymmEnabled && (info[2] & (1 << 29)) != 0;
+  if (maxLeaf >= 7) {
+    __cpuidex(info, 7, 0);
+    features.avx2 = avx && ymmEnabled && (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  features.sse = __builtin_cpu_supports("sse2");
+  features.avx2 = __builtin_cpu_supports("avx2");
+  features.f16c = __builtin_cpu_supports("f16c");
+#endif
+#endif
+  return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+  static const CpuFeatures features = detectCpuFeatures();
+  return features;
+}
+
+std::atomic<InstructionSet>& selectedInstructionSet() {
+  static std::atomic<InstructionSet> selected{
+      EngineCore::VertexKernels::supportedInstructionSet()};
+  return selected;
+}
+
+std::array<const float*, kHalfComponents> halfComponentStreams(
+    const VertexStreams& streams) {
+  // Same order as the members of Vertex16Bit
+  return {streams.posX,       streams.posY,       streams.posZ,      streams.normalX,
+          streams.normalY,    streams.normalZ,    streams.tangentX,  streams.tangentY,
+          streams.tangentZ,   streams.tangentW,   streams.texCoordU, streams.texCoordV,
+          streams.texCoord1U, streams.texCoord1V};
+}
+
+void transformDirection(const glm::mat3& n, float* x, float* y, float* z, size_t i) {
+  const float dx = x[i];
+  const float dy = y[i];
+  const float dz = z[i];
+  x[i] = n[0][0] * dx + n[1][0] * dy + n[2][0] * dz;
+  y[i] = n[0][1] * dx + n[1][1] * dy + n[2][1] * dz;
+  z[i] = n[0][2] * dx + n[1][2] * dy + n[2][2] * dz;
+}
+
+void transformScalar(const glm::mat4& m, const glm::mat3& n, const VertexStreams& s,
+                     size_t first, glm::vec3& minAABB, glm::vec3& maxAABB) {
+  for (size_t i = first; i < s.count; ++i) {
+    const float x = s.posX[i];
+    const float y = s.posY[i];
+    const float z = s.posZ[i];
+    s.posX[i] = m[0][0] * x + m[1][0] * y + m[2][0] * z + m[3][0];
+    s.posY[i] = m[0][1] * x + m[1][1] * y + m[2][1] * z + m[3][1];
+    s.posZ[i] = m[0][2] * x + m[1][2] * y + m[2][2] * z + m[3][2];
+
+    const glm::vec3 pos(s.posX[i], s.posY[i], s.posZ[i]);
+    minAABB = glm::min(minAABB, pos);
+    maxAABB = glm::max(maxAABB, pos);
+
+    transformDirection(n, s.normalX, s.normalY, s.normalZ, i);
+    transformDirection(n, s.tangentX, s.tangentY, s.tangentZ, i);
+  }
+}
+
+void packHalfScalar(const VertexStreams& s, uint32_t material, Vertex16Bit* out,
+                    size_t first) {
+  const auto streams = halfComponentStreams(s);
+  for (size_t i = first; i < s.count; ++i) {
+    uint16_t halves[kHalfComponents];
+    for (size_t c = 0; c < kHalfComponents; ++c) {
+      halves[c] = glm::packHalf1x16(streams[c][i]);
+    }
+    memcpy(&out[i], halves, sizeof(halves));
+    out[i].material = material;
+  }
+}
+
+#if defined(VERTEX_KERNELS_X86)
+
+float horizontalMin(__m128 v) {
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, v);
+  return std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+}
+
+float horizontalMax(__m128 v) {
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, v);
+  return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+void transformDirectionsSSE(const __m128 n[9], float* x, float* y, float* z, size_t i) {
+  const __m128 dx = _mm_loadu_ps(x + i);
+  const __m128 dy = _mm_loadu_ps(y + i);
+  const __m128 dz = _mm_loadu_ps(z + i);
+  _mm_storeu_ps(x + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], dx), _mm_mul_ps(n[3], dy)),
+                                  _mm_mul_ps(n[6], dz)));
+  _mm_storeu_ps(y + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[1], dx), _mm_mul_ps(n[4], dy)),
+                                  _mm_mul_ps(n[7], dz)));
+  _mm_storeu_ps(z + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[2], dx), _mm_mul_ps(n[5], dy)),
+                                  _mm_mul_ps(n[8], dz)));
+}
+
+void transformSSE(const glm::mat4& m, const glm::mat3& normalMatrix,
+                  const VertexStreams& s, glm::vec3& minAABB, glm::vec3& maxAABB) {
+  __m128 c[12];  // columns of m, without the projective row
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 3; ++row) {
+      c[col * 3 + row] = _mm_set1_ps(m[col][row]);
+    }
+  }
+  __m128 n[9];
+  for (int col = 0; col < 3; ++col) {
+    for (int row = 0; row < 3; ++row) {
+      n[col * 3 + row] = _mm_set1_ps(normalMatrix[col][row]);
+    }
+  }
+
+  __m128 minX = _mm_set1_ps(minAABB.x), minY = _mm_set1_ps(minAABB.y),
+         minZ = _mm_set1_ps(minAABB.z);
+  __m128 maxX = _mm_set1_ps(maxAABB.x), maxY = _mm_set1_ps(maxAABB.y),
+         maxZ = _mm_set1_ps(maxAABB.z);
+
+  size_t i = 0;
+  for (; i + 4 <= s.count; i += 4) {
+    const __m128 x = _mm_loadu_ps(s.posX + i);
+    const __m128 y = _mm_loadu_ps(s.posY + i);
+    const __m128 z = _mm_loadu_ps(s.posZ + i);
+    const __m128 tx = _mm_add_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], x), _mm_mul_ps(c[3], y)),
+                   _mm_mul_ps(c[6], z)),
+        c[9]);
+    const __m128 ty = _mm_add_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[1], x), _mm_mul_ps(c[4], y)),
+                   _mm_mul_ps(c[7], z)),
+        c[10]);
+    const __m128 tz = _mm_add_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[2], x), _mm_mul_ps(c[5], y)),
+                   _mm_mul_ps(c[8], z)),
+        c[11]);
+    _mm_storeu_ps(s.posX + i, tx);
+    _mm_storeu_ps(s.posY + i, ty);
+    _mm_storeu_ps(s.posZ + i, tz);
+
+    minX = _mm_min_ps(minX, tx);
+    minY = _mm_min_ps(minY, ty);
+    minZ = _mm_min_ps(minZ, tz);
+    maxX = _mm_max_ps(maxX, tx);
+    maxY = _mm_max_ps(maxY, ty);
+    maxZ = _mm_max_ps(maxZ, tz);
+
+    transformDirectionsSSE(n, s.normalX, s.normalY, s.normalZ, i);
+    transformDirectionsSSE(n, s.tangentX, s.tangentY, s.tangentZ, i);
+  }
+
+  minAABB = glm::vec3(horizontalMin(minX), horizontalMin(minY), horizontalMin(minZ));
+  maxAABB = glm::vec3(horizontalMax(maxX), horizontalMax(maxY), horizontalMax(maxZ));
+  transformScalar(m, normalMatrix, s, i, minAABB, maxAABB);
+}
+
+TARGET_AVX2 inline void transformDirectionsAVX2(const __m256 n[9], float* x, float* y,
+                                                float* z, size_t i) {
+  const __m256 dx = _mm256_loadu_ps(x + i);
+  const __m256 dy = _mm256_loadu_ps(y + i);
+  const __m256 dz = _mm256_loadu_ps(z + i);
+  _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], dx),
+                                                      _mm256_mul_ps(n[3], dy)),
+                                        _mm256_mul_ps(n[6], dz)));
+  _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[1], dx),
+                                                      _mm256_mul_ps(n[4], dy)),
+                                        _mm256_mul_ps(n[7], dz)));
+  _mm256_storeu_ps(z + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[2], dx),
+                                                      _mm256_mul_ps(n[5], dy)),
+                                        _mm256_mul_ps(n[8], dz)));
+}
+
+// Folds 8 lanes down to 4 so the SSE reduction can finish the job
+TARGET_AVX2 inline __m128 foldMin(__m256 v) {
+  return _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+TARGET_AVX2 inline __m128 foldMax(__m256 v) {
+  return _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+}
+
+TARGET_AVX2 void transformAVX2(const glm::mat4& m, const glm::mat3& normalMatrix,
+                               const VertexStreams& s, glm::vec3& minAABB,
+                               glm::vec3& maxAABB) {
+  __m256 c[12];  // columns of m, without the projective row
+  for (int col = 0; col < 4; ++col) {
+    for (int row = 0; row < 3; ++row) {
+      c[col * 3 + row] = _mm256_set1_ps(m[col][row]);
+    }
+  }
+  __m256 n[9];
+  for (int col = 0; col < 3; ++col) {
+    for (int row = 0; row < 3; ++row) {
+      n[col * 3 + row] = _mm256_set1_ps(normalMatrix[col][row]);
+    }
+  }
+
+  __m256 minX = _mm256_set1_ps(minAABB.x), minY = _mm256_set1_ps(minAABB.y),
+         minZ = _mm256_set1_ps(minAABB.z);
+  __m256 maxX = _mm256_set1_ps(maxAABB.x), maxY = _mm256_set1_ps(maxAABB.y),
+         maxZ = _mm256_set1_ps(maxAABB.z);
+
+  size_t i = 0;
+  for (; i + 8 <= s.count; i += 8) {
+    const __m256 x = _mm256_loadu_ps(s.posX + i);
+    const __m256 y = _mm256_loadu_ps(s.posY + i);
+    const __m256 z = _mm256_loadu_ps(s.posZ + i);
+    const __m256 tx = _mm256_add_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[0], x), _mm256_mul_ps(c[3], y)),
+                      _mm256_mul_ps(c[6], z)),
+        c[9]);
+    const __m256 ty = _mm256_add_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[1], x), _mm256_mul_ps(c[4], y)),
+                      _mm256_mul_ps(c[7], z)),
+        c[10]);
+    const __m256 tz = _mm256_add_ps(
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[2], x), _mm256_mul_ps(c[5], y)),
+                      _mm256_mul_ps(c[8], z)),
+        c[11]);
+    _mm256_storeu_ps(s.posX + i, tx);
+    _mm256_storeu_ps(s.posY + i, ty);
+    _mm256_storeu_ps(s.posZ + i, tz);
+
+    minX = _mm256_min_ps(minX, tx);
+    minY = _mm256_min_ps(minY, ty);
+    minZ = _mm256_min_ps(minZ, tz);
+    maxX = _mm256_max_ps(maxX, tx);
+    maxY = _mm256_max_ps(maxY, ty);
+    maxZ = _mm256_max_ps(maxZ, tz);
+
+    transformDirectionsAVX2(n, s.normalX, s.normalY, s.normalZ, i);
+    transformDirectionsAVX2(n, s.tangentX, s.tangentY, s.tangentZ, i);
+  }
+
+  minAABB = glm::vec3(horizontalMin(foldMin(minX)), horizontalMin(foldMin(minY)),
+                      horizontalMin(foldMin(minZ)));
+  maxAABB = glm::vec3(horizontalMax(foldMax(maxX)), horizontalMax(foldMax(maxY)),
+                      horizontalMax(foldMax(maxZ)));
+  transformScalar(m, normalMatrix, s, i, minAABB, maxAABB);
+}
+
+TARGET_F16C void packHalfF16C(const VertexStreams& s, uint32_t material,
+                              Vertex16Bit* out) {
+  const auto streams = halfComponentStreams(s);
+  alignas(16) uint16_t halves[kHalfComponents][4];
+  size_t i = 0;
+  for (; i + 4 <= s.count; i += 4) {
+    for (size_t c = 0; c < kHalfComponents; ++c) {
+      const __m128i packed =
+          _mm_cvtps_ph(_mm_loadu_ps(streams[c] + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(halves[c]), packed);
+    }
+    for (size_t v = 0; v < 4; ++v) {
+      uint16_t vertex[kHalfComponents];
+      for (size_t c = 0; c < kHalfComponents; ++c) {
+        vertex[c] = halves[c][v];
+      }
+      memcpy(&out[i + v], vertex, sizeof(vertex));
+      out[i + v].material = material;
+    }
+  }
+  packHalfScalar(s, material, out, i);
+}
+
+TARGET_AVX2 void packHalfAVX2(const VertexStreams& s, uint32_t material,
+                              Vertex16Bit* out) {
+  const auto streams = halfComponentStreams(s);
+  alignas(16) uint16_t halves[kHalfComponents][8];
+  size_t i = 0;
+  for (; i + 8 <= s.count; i += 8) {
+    for (size_t c = 0; c < kHalfComponents; ++c) {
+      const __m128i packed =
+          _mm256_cvtps_ph(_mm256_loadu_ps(streams[c] + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_store_si128(reinterpret_cast<__m128i*>(halves[c]), packed);
+    }
+    for (size_t v = 0; v < 8; ++v) {
+      uint16_t vertex[kHalfComponents];
+      for (size_t c = 0; c < kHalfComponents; ++c) {
+        vertex[c] = halves[c][v];
+      }
+      memcpy(&out[i + v], vertex, sizeof(vertex));
+      out[i + v].material = material;
+    }
+  }
+  packHalfScalar(s, material, out, i);
+}
+
+#endif
+
+}  // namespace
+
+namespace EngineCore::VertexKernels {
+
+InstructionSet supportedInstructionSet() {
+  const auto& features = cpuFeatures();
+  if (features.avx2 && features.f16c) {
+    return InstructionSet::AVX2;
+  }
+  if (features.sse) {
+    return InstructionSet::SSE;
+  }
+  return InstructionSet::Scalar;
+}
+
+InstructionSet instructionSet() { return selectedInstructionSet().load(); }
+
+void setInstructionSet(InstructionSet set) {
+  selectedInstructionSet().store(std::min(set, supportedInstructionSet()));
+}
+
+const char* instructionSetName(InstructionSet set) {
+  switch (set) {
+    case InstructionSet::AVX2:
+      return "AVX2";
+    case InstructionSet::SSE:
+      return "SSE";
+    default:
+      return "Scalar";
+  }
+}
+
+void transform(const glm::mat4& m, const glm::mat3& normalMatrix,
+               const VertexStreams& streams, glm::vec3& minAABB, glm::vec3& maxAABB) {
+#if defined(VERTEX_KERNELS_X86)
+  switch (instructionSet()) {
+    case InstructionSet::AVX2:
+      transformAVX2(m, normalMatrix, streams, minAABB, maxAABB);
+      return;
+    case InstructionSet::SSE:
+      transformSSE(m, normalMatrix, streams, minAABB, maxAABB);
+      return;
+    default:
+      break;
+  }
+#endif
+  transformScalar(m, normalMatrix, streams, 0, minAABB, maxAABB);
+}
+
+void packHalf(const VertexStreams& streams, uint32_t material, Vertex16Bit* out) {
+#if defined(VERTEX_KERNELS_X86)
+  const auto set = instructionSet();
+  if (set == InstructionSet::AVX2) {
+    packHalfAVX2(streams, material, out);
+    return;
+  }
+  if (set == InstructionSet::SSE && cpuFeatures().f16c) {
+    packHalfF16C(streams, material, out);
+    return;
+  }
+#endif
+  packHalfScalar(streams, material, out, 0);
+}
+
+}  // namespace EngineCore::VertexKernels
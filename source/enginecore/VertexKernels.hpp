@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+namespace EngineCore {
+
+struct Vertex16Bit;
+
+/// @brief Structure-of-arrays view over the attributes of a batch of vertices, every
+/// array holds count floats
+struct VertexStreams {
+  float* posX = nullptr;
+  float* posY = nullptr;
+  float* posZ = nullptr;
+  float* normalX = nullptr;
+  float* normalY = nullptr;
+  float* normalZ = nullptr;
+  float* tangentX = nullptr;
+  float* tangentY = nullptr;
+  float* tangentZ = nullptr;
+  float* tangentW = nullptr;
+  float* texCoordU = nullptr;
+  float* texCoordV = nullptr;
+  float* texCoord1U = nullptr;
+  float* texCoord1V = nullptr;
+  size_t count = 0;
+};
+
+/// @brief Batched vertex ingestion kernels. The instruction set is picked at runtime from
+/// what the CPU supports, the scalar versions are used on other architectures.
+namespace VertexKernels {
+
+enum class InstructionSet { Scalar, SSE, AVX2 };
+
+InstructionSet supportedInstructionSet();
+
+InstructionSet instructionSet();
+
+/// @brief Mostly useful for benchmarking, the set is clamped to what the CPU supports
+void setInstructionSet(InstructionSet set);
+
+const char* instructionSetName(InstructionSet set);
+
+/// @brief Transforms positions by m and normals and tangent directions by the normal
+/// matrix (tangent.w is kept), in place. The transformed positions grow minAABB/maxAABB.
+void transform(const glm::mat4& m, const glm::mat3& normalMatrix,
+               const VertexStreams& streams, glm::vec3& minAABB, glm::vec3& maxAABB);
+
+/// @brief Converts the streams to half floats and interleaves them into out
+void packHalf(const VertexStreams& streams, uint32_t material, Vertex16Bit* out);
+
+}  // namespace VertexKernels
+
+}  // namespace EngineCore
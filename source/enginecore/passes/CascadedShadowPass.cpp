@@ -0,0 +1,351 @@
+#include "CascadedShadowPass.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "vulkancore/Context.hpp"
+#include "vulkancore/DynamicRendering.hpp"
+
+constexpr uint32_t VERTEX_SET = 0;
+constexpr uint32_t CASCADE_SET = 1;
+constexpr uint32_t BINDING_0 = 0;
+
+// Per frame: culling start and end, rendering start and end
+constexpr uint32_t TIMESTAMPS_PER_FRAME = 4;
+
+struct CascadeBuffer {
+  glm::mat4 viewProjection[MAX_SHADOW_CASCADES];
+};
+
+struct CascadePushConstants {
+  uint32_t cascade;
+};
+
+CascadedShadowPass::~CascadedShadowPass() {
+  if (queryPool_ != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(context_->device(), queryPool_, nullptr);
+  }
+}
+
+void CascadedShadowPass::init(VulkanCore::Context* context, EngineCore::Camera* camera,
+                              const Settings& settings) {
+  ASSERT(context->isShaderOutputLayerEnabled(),
+         "cascadedshadow.vert selects the layer of each cascade with gl_Layer");
+  ASSERT(settings.cascadeCount > 0 && settings.cascadeCount <= MAX_SHADOW_CASCADES,
+         "Invalid number of shadow cascades");
+  context_ = context;
+  camera_ = camera;
+  settings_ = settings;
+
+  const uint32_t framesInFlight = context_->swapchain()->numberImages();
+
+  // Multiview textures have a 2D array view over all their layers
+  depthTexture_ = std::make_shared<VulkanCore::Texture>(
+      *context_, VK_IMAGE_TYPE_2D, VK_FORMAT_D32_SFLOAT, 0,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      VkExtent3D{
+          .width = settings_.resolution,
+          .height = settings_.resolution,
+          .depth = 1,
+      },
+      1, settings_.cascadeCount, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+      VK_SAMPLE_COUNT_1_BIT, "Shadow cascades", true);
+
+  cascadeBuffer_ = std::make_shared<EngineCore::RingBuffer>(
+      framesInFlight, *context_, sizeof(CascadeBuffer), "Shadow cascades");
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = TIMESTAMPS_PER_FRAME * framesInFlight,
+  };
+  VK_CHECK(vkCreateQueryPool(context_->device(), &queryPoolInfo, nullptr, &queryPool_));
+  timestampsPending_.resize(framesInFlight, false);
+
+  const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
+
+  auto vertexShader =
+      context_->createShaderModule((resourcesFolder / "cascadedshadow.vert").string(),
+                                   VK_SHADER_STAGE_VERTEX_BIT, "cascaded shadow vertex");
+  auto fragmentShader = context_->createShaderModule(
+      (resourcesFolder / "empty.frag").string(), VK_SHADER_STAGE_FRAGMENT_BIT,
+      "cascaded shadow fragment");
+
+  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+      {
+          .set_ = VERTEX_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_VERTEX_BIT},
+              },
+      },
+      {
+          .set_ = CASCADE_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+                                               VK_SHADER_STAGE_VERTEX_BIT},
+              },
+      },
+  };
+  const VulkanCore::Pipeline::GraphicsPipelineDescriptor gpDesc = {
+      .sets_ = setLayout,
+      .vertexShader_ = vertexShader,
+      .fragmentShader_ = fragmentShader,
+      .pushConstants_ = {VkPushConstantRange{
+          .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+          .offset = 0,
+          .size = sizeof(CascadePushConstants),
+      }},
+      .dynamicStates_ = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR},
+      .useDynamicRendering_ = true,
+      .colorTextureFormats = {},
+      .depthTextureFormat = depthTexture_->vkFormat(),
+      .sampleCount = VK_SAMPLE_COUNT_1_BIT,
+      .cullMode = VK_CULL_MODE_FRONT_BIT,
+      .viewport = VkExtent2D{settings_.resolution, settings_.resolution},
+      .depthTestEnable = true,
+      .depthWriteEnable = true,
+      .depthCompareOperation = VK_COMPARE_OP_LESS,
+  };
+
+  pipeline_ = context_->createGraphicsPipeline(gpDesc, VK_NULL_HANDLE,
+                                               "Cascaded shadow pipeline");
+
+  pipeline_->allocateDescriptors({
+      {.set_ = VERTEX_SET, .count_ = 1},
+      {.set_ = CASCADE_SET, .count_ = framesInFlight},
+  });
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    pipeline_->bindResource(CASCADE_SET, BINDING_0, i, cascadeBuffer_->buffer(i), 0,
+                            sizeof(CascadeBuffer), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  }
+}
+
+void CascadedShadowPass::setModel(
+    const EngineCore::Model& model, std::shared_ptr<VulkanCore::Buffer> vertexBuffer,
+    std::shared_ptr<VulkanCore::Buffer> indexBuffer,
+    std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer) {
+  vertexBuffer_ = vertexBuffer;
+  indexBuffer_ = indexBuffer;
+  drawCount_ = uint32_t(model.meshes.size());
+
+  for (uint32_t i = 0; i < settings_.cascadeCount; ++i) {
+    cullingPasses_[i].init(context_, camera_, model, inputIndirectBuffer);
+  }
+
+  pipeline_->bindResource(VERTEX_SET, BINDING_0, 0, vertexBuffer_, 0,
+                          vertexBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+}
+
+void CascadedShadowPass::upload(VulkanCore::CommandQueueManager& queueMgr) {
+  for (uint32_t i = 0; i < settings_.cascadeCount; ++i) {
+    cullingPasses_[i].upload(queueMgr);
+  }
+}
+
+void CascadedShadowPass::update(const glm::vec3& lightDirection, LightData& lightData) {
+  cascades_ = computeCascades(*camera_, lightDirection, settings_);
+
+  lightData.cascadeCount = uint32_t(cascades_.size());
+  for (uint32_t i = 0; i < cascades_.size(); ++i) {
+    lightData.cascadeSplits[i] = cascades_[i].splitDepth;
+    lightData.cascadeViewProjection[i] = cascades_[i].viewProjection;
+  }
+}
+
+std::vector<CascadedShadowPass::Cascade> CascadedShadowPass::computeCascades(
+    const EngineCore::Camera& camera, const glm::vec3& lightDirection,
+    const Settings& settings) {
+  const float nearDepth = camera.nearPlane();
+  const float farDepth = std::min(camera.farPlane(), settings.shadowDistance);
+
+  // See Camera::calculateFrustumPlanes()
+  const glm::vec3 forward = glm::normalize(glm::cross(camera.right(), camera.up()));
+  const float tanHalfFovY = std::tan(glm::radians(camera.fovY()) * 0.5f);
+  const glm::vec3 halfHeight = tanHalfFovY * camera.up();
+  const glm::vec3 halfWidth = tanHalfFovY * camera.aspectRatio() * camera.right();
+
+  const glm::vec3 direction = glm::normalize(lightDirection);
+  const glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f)
+                                                     : glm::vec3(0.0f, 1.0f, 0.0f);
+
+  std::vector<Cascade> cascades;
+  float sliceNear = nearDepth;
+  for (uint32_t i = 0; i < settings.cascadeCount; ++i) {
+    // Blend of logarithmic splits, which keep the texel density even in depth, and
+    // uniform ones, which don't spend most of the texels right in front of the camera
+    const float p = float(i + 1) / settings.cascadeCount;
+    const float logSplit = nearDepth * std::pow(farDepth / nearDepth, p);
+    const float uniformSplit = nearDepth + (farDepth - nearDepth) * p;
+    const float sliceFar = glm::mix(uniformSplit, logSplit, settings.splitLambda);
+
+    std::array<glm::vec3, 8> corners;
+    for (int j = 0; const float depth : {sliceNear, sliceFar}) {
+      const glm::vec3 center = camera.position() + forward * depth;
+      for (const float x : {-1.0f, 1.0f}) {
+        for (const float y : {-1.0f, 1.0f}) {
+          corners[j++] = center + (x * halfWidth + y * halfHeight) * depth;
+        }
+      }
+    }
+
+    // A bounding sphere keeps the size of the cascade constant as the camera rotates
+    glm::vec3 center(0.0f);
+    for (const auto& corner : corners) {
+      center += corner / float(corners.size());
+    }
+    float radius = 0.0f;
+    for (const auto& corner : corners) {
+      radius = std::max(radius, glm::length(corner - center));
+    }
+    radius = std::ceil(radius * 16.0f) / 16.0f;
+
+    const glm::mat4 view = glm::lookAt(
+        center - direction * (radius + settings.casterDistance), center, up);
+    glm::mat4 projection = glm::orthoRH_ZO(-radius, radius, -radius, radius, 0.0f,
+                                           2.0f * radius + settings.casterDistance);
+
+    // Moves the projection by less than a texel so the world origin lands on a texel:
+    // then the shadow map samples the same points of the scene from frame to frame
+    const float halfResolution = settings.resolution * 0.5f;
+    const glm::vec4 origin = projection * view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    const glm::vec2 originTexels = glm::vec2(origin) * halfResolution;
+    const glm::vec2 offset = (glm::round(originTexels) - originTexels) / halfResolution;
+    projection[3][0] += offset.x;
+    projection[3][1] += offset.y;
+
+    cascades.push_back({.viewProjection = projection * view, .splitDepth = sliceFar});
+    sliceNear = sliceFar;
+  }
+  return cascades;
+}
+
+void CascadedShadowPass::cull(VkCommandBuffer cmd, int frameIndex) {
+  ASSERT(!cascades_.empty(), "update() must be called before cull()");
+
+  readBackTimestamps(frameIndex);
+
+  const uint32_t firstQuery = TIMESTAMPS_PER_FRAME * frameIndex;
+  vkCmdResetQueryPool(cmd, queryPool_, firstQuery, TIMESTAMPS_PER_FRAME);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_, firstQuery);
+
+  context_->beginDebugUtilsLabel(cmd, "Shadow cascades culling",
+                                 {1.0f, 0.0f, 0.0f, 1.0f});
+  const auto graphicsFamilyIndex =
+      context_->physicalDevice().graphicsFamilyIndex().value();
+  for (uint32_t i = 0; i < settings_.cascadeCount; ++i) {
+    cullingPasses_[i].cull(cmd, frameIndex, cascades_[i].viewProjection);
+    cullingPasses_[i].addBarrierForCulledBuffers(cmd, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                                                 graphicsFamilyIndex,
+                                                 graphicsFamilyIndex);
+    stats_.draws[i] = cullingPasses_[i].stats().drawnFirstPhase;
+  }
+  context_->endDebugUtilsLabel(cmd);
+
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+                      firstQuery + 1);
+}
+
+void CascadedShadowPass::render(VkCommandBuffer cmd, int frameIndex) {
+  const uint32_t firstQuery = TIMESTAMPS_PER_FRAME * frameIndex;
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_,
+                      firstQuery + 2);
+
+  CascadeBuffer cascadeData;
+  for (uint32_t i = 0; i < cascades_.size(); ++i) {
+    cascadeData.viewProjection[i] = cascades_[i].viewProjection;
+  }
+  cascadeBuffer_->buffer(frameIndex)->copyDataToBuffer(&cascadeData,
+                                                       sizeof(CascadeBuffer));
+
+  context_->beginDebugUtilsLabel(cmd, "Shadow cascades", {0.0f, 1.0f, 0.0f, 1.0f});
+
+  depthTexture_->transitionImageLayout(cmd,
+                                       VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+  const VulkanCore::DynamicRendering::AttachmentDescription depthAttachmentDesc{
+      .imageView = depthTexture_->vkImageView(),
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .attachmentLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .attachmentStoreOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue = {.depthStencil = {1.0f}},
+  };
+
+  // All the layers are cleared, each draw writes the layer of its cascade
+  VulkanCore::DynamicRendering::beginRenderingCmd(
+      cmd, depthTexture_->vkImage(), 0,
+      {{0, 0}, {settings_.resolution, settings_.resolution}}, settings_.cascadeCount, 0,
+      {}, &depthAttachmentDesc, nullptr, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_UNDEFINED);
+
+  const VkViewport viewport = {
+      .x = 0.0f,
+      .y = static_cast<float>(settings_.resolution),
+      .width = static_cast<float>(settings_.resolution),
+      .height = -static_cast<float>(settings_.resolution),
+      .minDepth = 0.0f,
+      .maxDepth = 1.0f,
+  };
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  const VkRect2D scissor = {
+      .offset = {0, 0},
+      .extent = {settings_.resolution, settings_.resolution},
+  };
+  vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+  pipeline_->bind(cmd);
+  pipeline_->bindDescriptorSets(
+      cmd, {
+               {.set = VERTEX_SET, .bindIdx = 0},
+               {.set = CASCADE_SET, .bindIdx = uint32_t(frameIndex)},
+           });
+  pipeline_->updateDescriptorSets();
+
+  vkCmdBindIndexBuffer(cmd, indexBuffer_->vkBuffer(), 0, VK_INDEX_TYPE_UINT32);
+
+  for (uint32_t i = 0; i < settings_.cascadeCount; ++i) {
+    const CascadePushConstants pushConst{.cascade = i};
+    pipeline_->updatePushConstant(cmd, VK_SHADER_STAGE_VERTEX_BIT,
+                                  sizeof(CascadePushConstants), &pushConst);
+    vkCmdDrawIndexedIndirectCount(
+        cmd, cullingPasses_[i].culledIndirectDrawBuffer()->vkBuffer(), 0,
+        cullingPasses_[i].culledIndirectDrawCountBuffer()->vkBuffer(), 0, drawCount_,
+        sizeof(EngineCore::IndirectDrawCommandAndMeshData));
+  }
+
+  VulkanCore::DynamicRendering::endRenderingCmd(cmd, depthTexture_->vkImage(),
+                                                VK_IMAGE_LAYOUT_UNDEFINED,
+                                                VK_IMAGE_LAYOUT_UNDEFINED);
+
+  depthTexture_->transitionImageLayout(cmd, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  context_->endDebugUtilsLabel(cmd);
+
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+                      firstQuery + 3);
+  timestampsPending_[frameIndex] = true;
+}
+
+void CascadedShadowPass::readBackTimestamps(int frameIndex) {
+  if (!timestampsPending_[frameIndex]) {
+    return;
+  }
+
+  std::array<uint64_t, TIMESTAMPS_PER_FRAME> timestamps;
+  const auto result = vkGetQueryPoolResults(
+      context_->device(), queryPool_, TIMESTAMPS_PER_FRAME * frameIndex,
+      TIMESTAMPS_PER_FRAME, sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT);
+  if (result == VK_SUCCESS) {
+    const double msPerTick =
+        context_->physicalDevice().properties().properties.limits.timestampPeriod / 1e6;
+    stats_.cullingTimeMs = (timestamps[1] - timestamps[0]) * msPerTick;
+    stats_.renderTimeMs = (timestamps[3] - timestamps[2]) * msPerTick;
+  }
+  timestampsPending_[frameIndex] = false;
+}
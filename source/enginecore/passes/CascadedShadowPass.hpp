@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <glm/glm.hpp>
+
+#include "CullingComputePass.hpp"
+#include "LightData.hpp"
+#include "enginecore/Camera.hpp"
+#include "enginecore/Model.hpp"
+#include "enginecore/RingBuffer.hpp"
+#include "vulkancore/Pipeline.hpp"
+#include "vulkancore/Texture.hpp"
+
+// Shadows of a directional light over the view of the camera. The view frustum is split
+// in depth into cascades, each covered by an orthographic shadow map that's snapped to
+// its texels so shadows don't shimmer when the camera moves. The draws are culled
+// against each cascade, and the cascades are rendered into the layers of one depth
+// array in a single pass: every cascade draws its own culled draws and selects its
+// layer with gl_Layer. Needs Context::enableShaderOutputLayerFeature()
+class CascadedShadowPass {
+ public:
+  struct Settings {
+    uint32_t cascadeCount = MAX_SHADOW_CASCADES;
+    uint32_t resolution = 2048;
+    // Shadows end this far from the camera, or at its far plane if it's closer
+    float shadowDistance = 150.0f;
+    // 0 splits the depth range uniformly, 1 logarithmically
+    float splitLambda = 0.8f;
+    // How far behind a cascade, towards the light, shadow casters are kept
+    float casterDistance = 200.0f;
+  };
+
+  struct Cascade {
+    glm::mat4 viewProjection;
+    float splitDepth;  // view depth where the cascade ends
+  };
+
+  // Of the last frame that has been read back
+  struct Stats {
+    std::array<uint32_t, MAX_SHADOW_CASCADES> draws = {};
+    double cullingTimeMs = 0.0;
+    double renderTimeMs = 0.0;
+  };
+
+  CascadedShadowPass() = default;
+
+  ~CascadedShadowPass();
+
+  // Creates the shadow depth texture, so it can be handed to other passes before the
+  // model is loaded
+  void init(VulkanCore::Context* context, EngineCore::Camera* camera,
+            const Settings& settings = {});
+
+  // vertexBuffer, indexBuffer and inputIndirectBuffer are buffers 0, 1 and 3 of
+  // EngineCore::convertModel2OneBuffer()
+  void setModel(const EngineCore::Model& model,
+                std::shared_ptr<VulkanCore::Buffer> vertexBuffer,
+                std::shared_ptr<VulkanCore::Buffer> indexBuffer,
+                std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer);
+
+  // After setModel()
+  void upload(VulkanCore::CommandQueueManager& queueMgr);
+
+  // Fits the cascades to the camera for a light travelling along lightDirection, and
+  // stores them in lightData for the lighting pass
+  void update(const glm::vec3& lightDirection, LightData& lightData);
+
+  // Culls the draws against every cascade. The GPU must be done with the previous frame
+  // that used frameIndex, its stats are read back here
+  void cull(VkCommandBuffer cmd, int frameIndex);
+
+  void render(VkCommandBuffer cmd, int frameIndex);
+
+  std::shared_ptr<VulkanCore::Texture> shadowDepthTexture() const {
+    return depthTexture_;
+  }
+
+  const std::vector<Cascade>& cascades() const { return cascades_; }
+
+  const Stats& stats() const { return stats_; }
+
+  static std::vector<Cascade> computeCascades(const EngineCore::Camera& camera,
+                                              const glm::vec3& lightDirection,
+                                              const Settings& settings);
+
+ private:
+  void readBackTimestamps(int frameIndex);
+
+ private:
+  VulkanCore::Context* context_ = nullptr;
+  EngineCore::Camera* camera_ = nullptr;
+  Settings settings_;
+  std::shared_ptr<VulkanCore::Pipeline> pipeline_;
+  std::shared_ptr<VulkanCore::Texture> depthTexture_;
+  std::shared_ptr<EngineCore::RingBuffer> cascadeBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> vertexBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> indexBuffer_;
+  std::array<CullingComputePass, MAX_SHADOW_CASCADES> cullingPasses_;
+  uint32_t drawCount_ = 0;
+
+  // Per frame in flight, around the culling and the rendering
+  VkQueryPool queryPool_ = VK_NULL_HANDLE;
+  std::vector<bool> timestampsPending_;
+
+  std::vector<Cascade> cascades_;
+  Stats stats_;
+};
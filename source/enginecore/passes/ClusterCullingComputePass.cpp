@@ -0,0 +1,310 @@
+#include "ClusterCullingComputePass.hpp"
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+
+#include "vulkancore/Context.hpp"
+#include "vulkancore/Sampler.hpp"
+#include "vulkancore/Texture.hpp"
+
+constexpr uint32_t MESHLET_SET = 0;
+constexpr uint32_t INPUT_INDIRECT_BUFFER_SET = 1;
+constexpr uint32_t OUTPUT_INDIRECT_BUFFER_SET = 2;
+constexpr uint32_t VISIBLE_MESHLETS_SET = 3;
+constexpr uint32_t OUTPUT_COUNT_BUFFER_SET = 4;
+constexpr uint32_t CAMERA_FRUSTUM_SET = 5;
+constexpr uint32_t HIERARCHICAL_DEPTH_SET = 6;
+constexpr uint32_t CULLING_STATS_SET = 7;
+constexpr uint32_t BINDING_0 = 0;
+constexpr uint32_t WORKGROUP_SIZE = 256;
+
+// What gpuclusterculling.comp counts, followed by the draw count in the readback buffers
+struct GPUClusterCullingStats {
+  uint32_t frustumCulled;
+  uint32_t backfaceCulled;
+  uint32_t occlusionCulled;
+};
+struct StatsReadback {
+  GPUClusterCullingStats culled;
+  uint32_t drawn;
+};
+
+void ClusterCullingComputePass::init(
+    VulkanCore::Context* context, EngineCore::Camera* camera, uint32_t framesInFlight,
+    const EngineCore::Model& model, std::shared_ptr<VulkanCore::Buffer> meshletBuffer,
+    std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer,
+    std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture) {
+  ASSERT(context->physicalDevice().supportsSubgroupOperations(
+             VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT),
+         "gpuclusterculling.comp compacts its output with subgroup ballots");
+  ASSERT(!model.meshlets.empty(), "Call EngineCore::buildMeshlets() first");
+  context_ = context;
+  camera_ = camera;
+  meshletBuffer_ = meshletBuffer;
+  inputIndirectDrawBuffer_ = inputIndirectBuffer;
+  hierarchicalDepthTexture_ = hierarchicalDepthTexture;
+  meshletCount_ = uint32_t(model.meshlets.size());
+
+  camFrustumBuffer_ = std::make_shared<EngineCore::RingBuffer>(
+      framesInFlight, *context_, sizeof(ViewBuffer), "Cluster culling frustum");
+
+  outputIndirectDrawBuffer_ = context_->createBuffer(
+      inputIndirectDrawBuffer_->size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Meshlet IndirectDrawBuffer");
+
+  visibleMeshletBuffer_ = context_->createBuffer(
+      sizeof(uint32_t) * meshletCount_, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Visible meshlets");
+
+  outputCountBuffer_ = context_->createBuffer(
+      sizeof(OutputCount),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Meshlet IndirectDrawCountBuffer");
+
+  cullingStatsBuffer_ = context_->createBuffer(
+      sizeof(GPUClusterCullingStats),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Cluster culling stats");
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    statsReadbackBuffers_.push_back(context_->createBuffer(
+        sizeof(StatsReadback), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_TO_CPU,
+        "Cluster culling stats readback " + std::to_string(i)));
+  }
+  statsPending_.resize(statsReadbackBuffers_.size(), false);
+
+  const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
+
+  auto shader = context_->createShaderModule(
+      (resourcesFolder / "gpuclusterculling.comp").string(), VK_SHADER_STAGE_COMPUTE_BIT,
+      "cluster culling compute");
+
+  const auto singleBindingSet = [](uint32_t set, VkDescriptorType type) {
+    return VulkanCore::Pipeline::SetDescriptor{
+        .set_ = set,
+        .bindings_ =
+            {
+                VkDescriptorSetLayoutBinding{0, type, 1, VK_SHADER_STAGE_COMPUTE_BIT},
+            },
+    };
+  };
+  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+      singleBindingSet(MESHLET_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+      singleBindingSet(INPUT_INDIRECT_BUFFER_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+      singleBindingSet(OUTPUT_INDIRECT_BUFFER_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+      singleBindingSet(VISIBLE_MESHLETS_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+      singleBindingSet(OUTPUT_COUNT_BUFFER_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+      singleBindingSet(CAMERA_FRUSTUM_SET, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
+      // Not written without occlusion culling, the shader doesn't read it then
+      singleBindingSet(HIERARCHICAL_DEPTH_SET,
+                       VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+      singleBindingSet(CULLING_STATS_SET, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+  };
+  std::vector<VkPushConstantRange> pushConstants = {
+      VkPushConstantRange{
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+          .offset = 0,
+          .size = sizeof(ClusterCullingPushConstants),
+      },
+  };
+  const VulkanCore::Pipeline::ComputePipelineDescriptor desc = {
+      .sets_ = setLayout,
+      .computeShader_ = shader,
+      .pushConstants_ = pushConstants,
+  };
+  pipeline_ = context_->createComputePipeline(desc, "cluster culling");
+
+  pipeline_->allocateDescriptors({
+      {.set_ = MESHLET_SET, .count_ = 1},
+      {.set_ = INPUT_INDIRECT_BUFFER_SET, .count_ = 1},
+      {.set_ = OUTPUT_INDIRECT_BUFFER_SET, .count_ = 1},
+      {.set_ = VISIBLE_MESHLETS_SET, .count_ = 1},
+      {.set_ = OUTPUT_COUNT_BUFFER_SET, .count_ = 1},
+      {.set_ = CAMERA_FRUSTUM_SET, .count_ = framesInFlight},
+      {.set_ = HIERARCHICAL_DEPTH_SET, .count_ = 1},
+      {.set_ = CULLING_STATS_SET, .count_ = 1},
+  });
+
+  for (const auto& [set, buffer] :
+       {std::make_pair(MESHLET_SET, meshletBuffer_),
+        std::make_pair(INPUT_INDIRECT_BUFFER_SET, inputIndirectDrawBuffer_),
+        std::make_pair(OUTPUT_INDIRECT_BUFFER_SET, outputIndirectDrawBuffer_),
+        std::make_pair(VISIBLE_MESHLETS_SET, visibleMeshletBuffer_),
+        std::make_pair(OUTPUT_COUNT_BUFFER_SET, outputCountBuffer_),
+        std::make_pair(CULLING_STATS_SET, cullingStatsBuffer_)}) {
+    pipeline_->bindResource(set, BINDING_0, 0, buffer, 0, buffer->size(),
+                            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  }
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    pipeline_->bindResource(CAMERA_FRUSTUM_SET, BINDING_0, i,
+                            camFrustumBuffer_->buffer(i), 0,
+                            camFrustumBuffer_->buffer(i)->size(),
+                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  }
+
+  if (hierarchicalDepthTexture_) {
+    // Texels are fetched, the sampler isn't used for filtering
+    hierarchicalDepthSampler_ = context_->createSampler(
+        VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        100.0f, "hierarchical depth cluster culling sampler");
+    pipeline_->bindResource(HIERARCHICAL_DEPTH_SET, BINDING_0, 0,
+                            {&hierarchicalDepthTexture_, 1}, hierarchicalDepthSampler_);
+  }
+}
+
+void ClusterCullingComputePass::cull(VkCommandBuffer cmd, int frameIndex) {
+  if (statsPending_[frameIndex]) {
+    const auto* readback = reinterpret_cast<const StatsReadback*>(
+        statsReadbackBuffers_[frameIndex]->mappedMemory());
+    stats_ = {
+        .tested = meshletCount_,
+        .frustumCulled = readback->culled.frustumCulled,
+        .backfaceCulled = readback->culled.backfaceCulled,
+        .occlusionCulled = readback->culled.occlusionCulled,
+        .drawn = readback->drawn,
+    };
+    statsPending_[frameIndex] = false;
+  }
+
+  for (int i = 0; auto& plane : camera_->calculateFrustumPlanes()) {
+    frustum_.frustumPlanes[i] = plane;
+    ++i;
+  }
+  frustum_.viewProjection = camera_->getProjectMatrix() * camera_->viewMatrix();
+  frustum_.cameraPosition = glm::vec4(camera_->position(), 1.0f);
+  if (hierarchicalDepthTexture_) {
+    frustum_.hierarchicalDepthSize =
+        glm::vec4(hierarchicalDepthTexture_->vkExtents().width,
+                  hierarchicalDepthTexture_->vkExtents().height,
+                  hierarchicalDepthTexture_->numMipLevels(), 0.0f);
+  }
+  camFrustumBuffer_->buffer(frameIndex)->copyDataToBuffer(&frustum_, sizeof(ViewBuffer));
+
+  resetCounters(cmd);
+
+  context_->beginDebugUtilsLabel(cmd, "GPU Cluster Culling", {1.0f, 0.0f, 0.5f, 1.0f});
+
+  const ClusterCullingPushConstants pushConst{
+      .meshletCount = meshletCount_,
+      .occlusionCulling = hierarchicalDepthTexture_ ? 1u : 0u,
+  };
+
+  pipeline_->bind(cmd);
+  pipeline_->updatePushConstant(cmd, VK_SHADER_STAGE_COMPUTE_BIT,
+                                sizeof(ClusterCullingPushConstants), &pushConst);
+  pipeline_->bindDescriptorSets(
+      cmd, {
+               {.set = MESHLET_SET, .bindIdx = 0},
+               {.set = INPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
+               {.set = OUTPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
+               {.set = VISIBLE_MESHLETS_SET, .bindIdx = 0},
+               {.set = OUTPUT_COUNT_BUFFER_SET, .bindIdx = 0},
+               {.set = CAMERA_FRUSTUM_SET, .bindIdx = uint32_t(frameIndex)},
+               {.set = HIERARCHICAL_DEPTH_SET, .bindIdx = 0},
+               {.set = CULLING_STATS_SET, .bindIdx = 0},
+           });
+  pipeline_->updateDescriptorSets();
+
+  vkCmdDispatch(cmd, (meshletCount_ + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+  context_->endDebugUtilsLabel(cmd);
+
+  readBackStats(cmd, frameIndex);
+}
+
+void ClusterCullingComputePass::resetCounters(VkCommandBuffer cmd) {
+  // The previous frame may still read the count for its indirect draws
+  const VkMemoryBarrier before{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+                       VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &before, 0, nullptr, 0,
+                       nullptr);
+
+  // count = 0, groupCountY = groupCountZ = 1
+  vkCmdFillBuffer(cmd, outputCountBuffer_->vkBuffer(), 0, sizeof(uint32_t), 0);
+  vkCmdFillBuffer(cmd, outputCountBuffer_->vkBuffer(), offsetof(OutputCount, groupCountY),
+                  2 * sizeof(uint32_t), 1);
+  vkCmdFillBuffer(cmd, cullingStatsBuffer_->vkBuffer(), 0, VK_WHOLE_SIZE, 0);
+
+  const VkMemoryBarrier after{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &after, 0, nullptr, 0,
+                       nullptr);
+}
+
+void ClusterCullingComputePass::readBackStats(VkCommandBuffer cmd, int frameIndex) {
+  const VkMemoryBarrier shaderToTransfer{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &shaderToTransfer, 0,
+                       nullptr, 0, nullptr);
+
+  const auto readback = statsReadbackBuffers_[frameIndex]->vkBuffer();
+  const VkBufferCopy statsRegion{
+      .dstOffset = offsetof(StatsReadback, culled),
+      .size = sizeof(GPUClusterCullingStats),
+  };
+  vkCmdCopyBuffer(cmd, cullingStatsBuffer_->vkBuffer(), readback, 1, &statsRegion);
+  const VkBufferCopy drawnRegion{
+      .dstOffset = offsetof(StatsReadback, drawn),
+      .size = sizeof(uint32_t),
+  };
+  vkCmdCopyBuffer(cmd, outputCountBuffer_->vkBuffer(), readback, 1, &drawnRegion);
+
+  const VkMemoryBarrier transferToHost{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                       0, 1, &transferToHost, 0, nullptr, 0, nullptr);
+  statsPending_[frameIndex] = true;
+}
+
+void ClusterCullingComputePass::addBarrierForCulledBuffers(VkCommandBuffer cmd,
+                                                           VkPipelineStageFlags dstStage,
+                                                           uint32_t computeFamilyIndex,
+                                                           uint32_t graphicsFamilyIndex) {
+  const auto barrier = [&](const std::shared_ptr<VulkanCore::Buffer>& buffer,
+                           VkAccessFlags dstAccessMask) {
+    return VkBufferMemoryBarrier{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = dstAccessMask,
+        .srcQueueFamilyIndex = computeFamilyIndex,
+        .dstQueueFamilyIndex = graphicsFamilyIndex,
+        .buffer = buffer->vkBuffer(),
+        .size = buffer->size(),
+    };
+  };
+  const std::array<VkBufferMemoryBarrier, 3> barriers{
+      barrier(outputIndirectDrawBuffer_,
+              VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT),
+      barrier(outputCountBuffer_, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+      barrier(visibleMeshletBuffer_, VK_ACCESS_SHADER_READ_BIT),
+  };
+
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0, 0,
+                       nullptr, uint32_t(barriers.size()), barriers.data(), 0, nullptr);
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "enginecore/Camera.hpp"
+#include "enginecore/Model.hpp"
+#include "enginecore/RingBuffer.hpp"
+#include "vulkancore/Pipeline.hpp"
+
+// Culls the meshlets of a model, built with EngineCore::buildMeshlets(), against the
+// camera frustum, their normal cones and optionally a hierarchical depth texture. The
+// visible meshlets are output both as indexed draws, to draw with
+// vkCmdDrawIndexedIndirectCount, and as a list of meshlet indices with its
+// VkDrawMeshTasksIndirectCommandEXT, for mesh shaders.
+class ClusterCullingComputePass {
+ public:
+  struct ClusterCullingPushConstants {
+    uint32_t meshletCount;
+    uint32_t occlusionCulling;
+  };
+
+  struct ViewBuffer {
+    alignas(16) glm::vec4 frustumPlanes[6];
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPosition;
+    glm::vec4 hierarchicalDepthSize;  // width, height, mip levels
+  };
+
+  // The draw count, also the groupCountX of the mesh tasks command
+  struct OutputCount {
+    uint32_t count;
+    uint32_t groupCountY;
+    uint32_t groupCountZ;
+  };
+
+  // Counted on the GPU for each frame
+  struct Stats {
+    uint32_t tested = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t backfaceCulled = 0;
+    uint32_t occlusionCulled = 0;
+    uint32_t drawn = 0;
+  };
+
+  ClusterCullingComputePass() = default;
+
+  // meshletBuffer and inputIndirectBuffer are buffers 0 and 1 of
+  // EngineCore::convertMeshlets2Buffers(). Meshlets are tested against
+  // hierarchicalDepthTexture if it isn't null, it must hold the depth of what has
+  // already been drawn in the frame, see HierarchicalDepthBufferPass
+  void init(VulkanCore::Context* context, EngineCore::Camera* camera,
+            uint32_t framesInFlight, const EngineCore::Model& model,
+            std::shared_ptr<VulkanCore::Buffer> meshletBuffer,
+            std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer,
+            std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture = nullptr);
+
+  // The GPU must be done with the previous frame that used frameIndex, its stats are read
+  // back here
+  void cull(VkCommandBuffer cmd, int frameIndex);
+
+  // dstStage is where the outputs are read: DRAW_INDIRECT for indexed draws, plus
+  // MESH_SHADER_EXT for mesh shaders
+  void addBarrierForCulledBuffers(VkCommandBuffer cmd, VkPipelineStageFlags dstStage,
+                                  uint32_t computeFamilyIndex,
+                                  uint32_t graphicsFamilyIndex);
+
+  std::shared_ptr<VulkanCore::Buffer> culledIndirectDrawBuffer() {
+    return outputIndirectDrawBuffer_;
+  }
+
+  // OutputCount: the count of vkCmdDrawIndexedIndirectCount at offset 0, or the command
+  // of vkCmdDrawMeshTasksIndirectEXT
+  std::shared_ptr<VulkanCore::Buffer> culledIndirectDrawCountBuffer() {
+    return outputCountBuffer_;
+  }
+
+  // Indices of the visible meshlets, drawn by the mesh shader workgroup of the same index
+  std::shared_ptr<VulkanCore::Buffer> visibleMeshletBuffer() {
+    return visibleMeshletBuffer_;
+  }
+
+  uint32_t meshletCount() const { return meshletCount_; }
+
+  bool occlusionCullingEnabled() const { return hierarchicalDepthTexture_ != nullptr; }
+
+  // The stats of the last frame that has been read back
+  const Stats& stats() const { return stats_; }
+
+ private:
+  void resetCounters(VkCommandBuffer cmd);
+
+  void readBackStats(VkCommandBuffer cmd, int frameIndex);
+
+ private:
+  VulkanCore::Context* context_ = nullptr;
+  EngineCore::Camera* camera_ = nullptr;
+  std::shared_ptr<VulkanCore::Pipeline> pipeline_;
+  std::shared_ptr<EngineCore::RingBuffer> camFrustumBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> meshletBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> inputIndirectDrawBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> outputIndirectDrawBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> visibleMeshletBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> outputCountBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> cullingStatsBuffer_;
+  // Per frame in flight, the counters copied for the CPU
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> statsReadbackBuffers_;
+  std::vector<bool> statsPending_;
+  std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture_;
+  std::shared_ptr<VulkanCore::Sampler> hierarchicalDepthSampler_;
+
+  uint32_t meshletCount_ = 0;
+  ViewBuffer frustum_;
+  Stats stats_;
+};
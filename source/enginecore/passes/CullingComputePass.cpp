@@ -1,23 +1,63 @@
 #include "CullingComputePass.hpp"
 
+#include <algorithm>
+#include <cstddef>
 #include <filesystem>
+#include <glm/gtc/matrix_access.hpp>
 
 #include "vulkancore/Context.hpp"
+#include "vulkancore/Sampler.hpp"
+#include "vulkancore/Texture.hpp"
 
 constexpr uint32_t MESH_BBOX_SET = 0;
 constexpr uint32_t INPUT_INDIRECT_BUFFER_SET = 1;
 constexpr uint32_t OUTPUT_INDIRECT_BUFFER_SET = 2;
 constexpr uint32_t OUTPUT_INDIRECT_COUNT_BUFFER_SET = 3;
 constexpr uint32_t CAMERA_FRUSTUM_SET = 4;
+constexpr uint32_t VISIBILITY_SET = 5;
+constexpr uint32_t HIERARCHICAL_DEPTH_SET = 6;
+constexpr uint32_t CULLING_STATS_SET = 7;
 constexpr uint32_t BINDING_0 = 0;
+constexpr uint32_t BINDING_1 = 1;  // per-mesh LODs, next to the bounding boxes
+
+// Must match gpuculling.comp
+constexpr uint32_t PHASE_FRUSTUM_ONLY = 0;
+constexpr uint32_t PHASE_VISIBLE_LAST_FRAME = 1;
+constexpr uint32_t PHASE_OCCLUSION = 2;
+
+// Sets of the output buffers
+constexpr uint32_t FIRST_PHASE_OUTPUT = 0;
+constexpr uint32_t SECOND_PHASE_OUTPUT = 1;
+
+// What gpuculling.comp counts, followed by the draw counts of both phases in the
+// readback buffers
+struct GPUCullingStats {
+  uint32_t frustumCulled;
+  uint32_t occlusionCulled;
+  uint32_t trianglesFullDetail;
+  uint32_t trianglesSubmitted;
+};
+struct StatsReadback {
+  GPUCullingStats culled;
+  uint32_t drawnFirstPhase;
+  uint32_t drawnSecondPhase;
+};
 
 void CullingComputePass::init(
     VulkanCore::Context* context, EngineCore::Camera* camera,
     const EngineCore::Model& model,
-    std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer) {
+    std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer,
+    std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture) {
+  ASSERT(context->physicalDevice().supportsSubgroupOperations(
+             VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT),
+         "gpuculling.comp compacts its output with subgroup ballots");
+  ASSERT(model.instances.empty(),
+         "The bounds of instanced meshes are in object space, cull their instances "
+         "with InstanceCullingComputePass");
   context_ = context;
   camera_ = camera;
   inputIndirectDrawBuffer_ = inputIndirectBuffer;
+  hierarchicalDepthTexture_ = hierarchicalDepthTexture;
 
   camFrustumBuffer_ = std::make_shared<EngineCore::RingBuffer>(
       context_->swapchain()->numberImages(), *context_, sizeof(ViewBuffer));
@@ -27,6 +67,13 @@ void CullingComputePass::init(
         .centerPos = glm::vec4(mesh.center, 1.0),
         .extents = glm::vec4(mesh.extents, 1.0),
     });
+
+    // Meshes without LODs only have LOD 0
+    MeshLods lods{.lodCount = std::max<uint32_t>(mesh.lods.size(), 1)};
+    lods.lods[0] = {.firstIndex = 0, .indexCount = uint32_t(mesh.indices.size())};
+    std::copy(mesh.lods.begin(), mesh.lods.end(), lods.lods);
+    meshLods_.push_back(lods);
+    lodSelectionEnabled_ |= mesh.lods.size() > 1;
   }
 
   const auto totalSize = sizeof(MeshBBoxBuffer) * meshesBBoxData_.size();
@@ -46,9 +93,45 @@ void CullingComputePass::init(
   outputIndirectDrawCountBuffer_ = context->createBuffer(
       sizeof(IndirectDrawCount),
       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
       VMA_MEMORY_USAGE_GPU_ONLY, "Output IndirectDrawBuffer");
 
+  newlyVisibleIndirectDrawBuffer_ = context->createBuffer(
+      inputIndirectDrawBuffer_->size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Newly visible IndirectDrawBuffer");
+
+  newlyVisibleIndirectDrawCountBuffer_ = context->createBuffer(
+      sizeof(IndirectDrawCount),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Newly visible IndirectDrawCountBuffer");
+
+  meshLodBuffer_ = context_->createBuffer(
+      sizeof(MeshLods) * meshLods_.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "mesh LODs");
+
+  visibilityBuffer_ = context->createBuffer(
+      sizeof(uint32_t) * meshesBBoxData_.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Visibility buffer");
+
+  cullingStatsBuffer_ = context->createBuffer(
+      sizeof(GPUCullingStats),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Culling stats");
+
+  for (uint32_t i = 0; i < context_->swapchain()->numberImages(); ++i) {
+    statsReadbackBuffers_.push_back(context->createBuffer(
+        sizeof(StatsReadback), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_TO_CPU,
+        "Culling stats readback " + std::to_string(i)));
+  }
+  statsPending_.resize(statsReadbackBuffers_.size(), false);
+
   const auto resourcesFolder =
       std::filesystem::current_path() / "resources/shaders/";
 
@@ -64,6 +147,9 @@ void CullingComputePass::init(
                   VkDescriptorSetLayoutBinding{
                       0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
                       VK_SHADER_STAGE_COMPUTE_BIT},
+                  VkDescriptorSetLayoutBinding{
+                      1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                      VK_SHADER_STAGE_COMPUTE_BIT},
               },
       },
       {
@@ -102,6 +188,35 @@ void CullingComputePass::init(
                       VK_SHADER_STAGE_COMPUTE_BIT},
               },
       },
+      {
+          .set_ = VISIBILITY_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{
+                      0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                      VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+      {
+          // Not written when occlusion culling is disabled, the shader doesn't read
+          // it then
+          .set_ = HIERARCHICAL_DEPTH_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{
+                      0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+                      VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+      {
+          .set_ = CULLING_STATS_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{
+                      0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                      VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
   };
   std::vector<VkPushConstantRange> pushConstants = {
       VkPushConstantRange{
@@ -120,29 +235,69 @@ void CullingComputePass::init(
   pipeline_->allocateDescriptors({
       {.set_ = MESH_BBOX_SET, .count_ = 1},
       {.set_ = INPUT_INDIRECT_BUFFER_SET, .count_ = 1},
-      {.set_ = OUTPUT_INDIRECT_BUFFER_SET, .count_ = 1},
-      {.set_ = OUTPUT_INDIRECT_COUNT_BUFFER_SET, .count_ = 1},
+      {.set_ = OUTPUT_INDIRECT_BUFFER_SET, .count_ = 2},
+      {.set_ = OUTPUT_INDIRECT_COUNT_BUFFER_SET, .count_ = 2},
       {.set_ = CAMERA_FRUSTUM_SET,
        .count_ = context_->swapchain()->numberImages()},
+      {.set_ = VISIBILITY_SET, .count_ = 1},
+      {.set_ = HIERARCHICAL_DEPTH_SET, .count_ = 1},
+      {.set_ = CULLING_STATS_SET, .count_ = 1},
   });
 
   pipeline_->bindResource(MESH_BBOX_SET, BINDING_0, 0, meshBboxBuffer_, 0,
                           meshBboxBuffer_->size(),
                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 
+  pipeline_->bindResource(MESH_BBOX_SET, BINDING_1, 0, meshLodBuffer_, 0,
+                          meshLodBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
   pipeline_->bindResource(
       INPUT_INDIRECT_BUFFER_SET, BINDING_0, 0, inputIndirectDrawBuffer_, 0,
       inputIndirectDrawBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 
-  pipeline_->bindResource(
-      OUTPUT_INDIRECT_BUFFER_SET, BINDING_0, 0, outputIndirectDrawBuffer_, 0,
-      outputIndirectDrawBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  pipeline_->bindResource(OUTPUT_INDIRECT_BUFFER_SET, BINDING_0,
+                          FIRST_PHASE_OUTPUT, outputIndirectDrawBuffer_, 0,
+                          outputIndirectDrawBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 
-  pipeline_->bindResource(OUTPUT_INDIRECT_COUNT_BUFFER_SET, BINDING_0, 0,
-                          outputIndirectDrawCountBuffer_, 0,
+  pipeline_->bindResource(OUTPUT_INDIRECT_COUNT_BUFFER_SET, BINDING_0,
+                          FIRST_PHASE_OUTPUT, outputIndirectDrawCountBuffer_, 0,
                           outputIndirectDrawCountBuffer_->size(),
                           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
 
+  pipeline_->bindResource(OUTPUT_INDIRECT_BUFFER_SET, BINDING_0,
+                          SECOND_PHASE_OUTPUT, newlyVisibleIndirectDrawBuffer_, 0,
+                          newlyVisibleIndirectDrawBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+  pipeline_->bindResource(OUTPUT_INDIRECT_COUNT_BUFFER_SET, BINDING_0,
+                          SECOND_PHASE_OUTPUT,
+                          newlyVisibleIndirectDrawCountBuffer_, 0,
+                          newlyVisibleIndirectDrawCountBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+  pipeline_->bindResource(VISIBILITY_SET, BINDING_0, 0, visibilityBuffer_, 0,
+                          visibilityBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+  pipeline_->bindResource(CULLING_STATS_SET, BINDING_0, 0, cullingStatsBuffer_,
+                          0, cullingStatsBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+
+  if (hierarchicalDepthTexture_) {
+    // Texels are fetched, the sampler isn't used for filtering
+    hierarchicalDepthSampler_ = context_->createSampler(
+        VK_FILTER_NEAREST, VK_FILTER_NEAREST,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, 100.0f,
+        "hierarchical depth culling sampler");
+    pipeline_->bindResource(HIERARCHICAL_DEPTH_SET, BINDING_0, 0,
+                            {&hierarchicalDepthTexture_, 1},
+                            hierarchicalDepthSampler_);
+  }
+
   pipeline_->bindResource(
       CAMERA_FRUSTUM_SET, BINDING_0, 0, camFrustumBuffer_->buffer(0), 0,
       camFrustumBuffer_->buffer(0)->size(), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
@@ -162,6 +317,12 @@ void CullingComputePass::upload(VulkanCore::CommandQueueManager& commandMgr) {
       commandMgr, commandBuffer, meshBboxBuffer_.get(),
       reinterpret_cast<const void*>(meshesBBoxData_.data()),
       sizeof(MeshBBoxBuffer) * meshesBBoxData_.size());
+  context_->uploadToGPUBuffer(commandMgr, commandBuffer, meshLodBuffer_.get(),
+                              reinterpret_cast<const void*>(meshLods_.data()),
+                              sizeof(MeshLods) * meshLods_.size());
+  // Nothing was visible before the first frame
+  vkCmdFillBuffer(commandBuffer, visibilityBuffer_->vkBuffer(), 0,
+                  VK_WHOLE_SIZE, 0);
 
   commandMgr.endCmdBuffer(commandBuffer);
 
@@ -173,45 +334,199 @@ void CullingComputePass::upload(VulkanCore::CommandQueueManager& commandMgr) {
 }
 
 void CullingComputePass::cull(VkCommandBuffer cmd, int frameIndex) {
+  cullView(cmd, frameIndex, camera_->calculateFrustumPlanes(),
+           camera_->getProjectMatrix() * camera_->viewMatrix());
+}
+
+void CullingComputePass::cull(VkCommandBuffer cmd, int frameIndex,
+                              const glm::mat4& viewProjection) {
+  ASSERT(!hierarchicalDepthTexture_,
+         "The hierarchical depth texture only holds the camera's view");
+
+  // Planes from the rows of the matrix, with the normals pointing inside. Clip space z
+  // goes from 0 to 1
+  const auto row = [&viewProjection](int i) { return glm::row(viewProjection, i); };
+  std::array<glm::vec4, 6> planes = {
+      row(3) + row(0), row(3) + row(1), row(3) - row(0),
+      row(3) - row(1), row(2),          row(3) - row(2),
+  };
+  for (auto& plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  cullView(cmd, frameIndex, planes, viewProjection);
+}
+
+void CullingComputePass::cullView(VkCommandBuffer cmd, int frameIndex,
+                                  const std::array<glm::vec4, 6>& frustumPlanes,
+                                  const glm::mat4& viewProjection) {
+  if (statsPending_[frameIndex]) {
+    const auto* readback = reinterpret_cast<const StatsReadback*>(
+        statsReadbackBuffers_[frameIndex]->mappedMemory());
+    stats_ = {
+        .tested = uint32_t(meshesBBoxData_.size()),
+        .frustumCulled = readback->culled.frustumCulled,
+        .occlusionCulled = readback->culled.occlusionCulled,
+        .drawnFirstPhase = readback->drawnFirstPhase,
+        .drawnSecondPhase = readback->drawnSecondPhase,
+        .trianglesFullDetail = readback->culled.trianglesFullDetail,
+        .trianglesSubmitted = readback->culled.trianglesSubmitted,
+    };
+    statsPending_[frameIndex] = false;
+  }
+
+  std::copy(frustumPlanes.begin(), frustumPlanes.end(), frustum_.frustumPlanes);
+  frustum_.viewProjection = viewProjection;
+  const auto projection = camera_->getProjectMatrix();
+  frustum_.cameraPosition = glm::vec4(camera_->position(), 1.0f);
+  // projection[1][1] is 1 / tan(fovY / 2)
+  const float pixelsPerUnit =
+      0.5f * context_->swapchain()->extent().height * glm::abs(projection[1][1]);
+  frustum_.lodParams = glm::vec4(pixelsPerUnit, lodErrorThreshold_,
+                                 lodSelectionEnabled_ ? 1.0f : 0.0f, 0.0f);
+  if (hierarchicalDepthTexture_) {
+    frustum_.hierarchicalDepthSize =
+        glm::vec4(hierarchicalDepthTexture_->vkExtents().width,
+                  hierarchicalDepthTexture_->vkExtents().height,
+                  hierarchicalDepthTexture_->numMipLevels(), 0.0f);
+  }
+
+  // Both phases read the buffer of frameIndex
+  camFrustumBuffer_->buffer(frameIndex)->copyDataToBuffer(&frustum_,
+                                                          sizeof(ViewBuffer));
+
+  resetCounters(cmd);
+
   context_->beginDebugUtilsLabel(cmd, "GPU Culling", {1.0f, 0.0f, 0.0f, 1.0f});
+  dispatch(cmd, frameIndex,
+           hierarchicalDepthTexture_ ? PHASE_VISIBLE_LAST_FRAME
+                                     : PHASE_FRUSTUM_ONLY);
+  context_->endDebugUtilsLabel(cmd);
 
+  if (!hierarchicalDepthTexture_) {
+    readBackStats(cmd, frameIndex);
+  }
+}
+
+void CullingComputePass::cullOccluded(VkCommandBuffer cmd, int frameIndex) {
+  ASSERT(hierarchicalDepthTexture_,
+         "Occlusion culling needs a hierarchical depth texture");
+
+  context_->beginDebugUtilsLabel(cmd, "GPU Occlusion Culling",
+                                 {1.0f, 0.5f, 0.0f, 1.0f});
+  dispatch(cmd, frameIndex, PHASE_OCCLUSION);
+  context_->endDebugUtilsLabel(cmd);
+
+  readBackStats(cmd, frameIndex);
+}
+
+void CullingComputePass::dispatch(VkCommandBuffer cmd, int frameIndex,
+                                  uint32_t phase) {
   GPUCullingPassPushConstants pushConst{
       .drawCount = uint32_t(meshesBBoxData_.size()),
+      .phase = phase,
   };
 
   pipeline_->bind(cmd);
 
-  for (int i = 0; auto& plane : camera_->calculateFrustumPlanes()) {
-    frustum_.frustumPlanes[i] = plane;
-    ++i;
-  }
-
-  camFrustumBuffer_->buffer()->copyDataToBuffer(&frustum_, sizeof(ViewBuffer));
-
   pipeline_->updatePushConstant(cmd, VK_SHADER_STAGE_COMPUTE_BIT,
                                 sizeof(GPUCullingPassPushConstants),
                                 &pushConst);
 
+  const uint32_t output =
+      phase == PHASE_OCCLUSION ? SECOND_PHASE_OUTPUT : FIRST_PHASE_OUTPUT;
   pipeline_->bindDescriptorSets(
       cmd, {
                {.set = MESH_BBOX_SET, .bindIdx = 0},
                {.set = INPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
-               {.set = OUTPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
-               {.set = OUTPUT_INDIRECT_COUNT_BUFFER_SET, .bindIdx = 0},
+               {.set = OUTPUT_INDIRECT_BUFFER_SET, .bindIdx = output},
+               {.set = OUTPUT_INDIRECT_COUNT_BUFFER_SET, .bindIdx = output},
                {.set = CAMERA_FRUSTUM_SET, .bindIdx = uint32_t(frameIndex)},
+               {.set = VISIBILITY_SET, .bindIdx = 0},
+               {.set = HIERARCHICAL_DEPTH_SET, .bindIdx = 0},
+               {.set = CULLING_STATS_SET, .bindIdx = 0},
            });
   pipeline_->updateDescriptorSets();
 
   vkCmdDispatch(cmd, (pushConst.drawCount / 256) + 1, 1, 1);
+}
 
-  context_->endDebugUtilsLabel(cmd);
-  camFrustumBuffer_->moveToNextBuffer();
+void CullingComputePass::resetCounters(VkCommandBuffer cmd) {
+  // The previous frame may still read the counts for its indirect draws, and the
+  // visibility written by its second phase is read below
+  const VkMemoryBarrier before{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 1, &before, 0, nullptr, 0, nullptr);
+
+  for (const auto& buffer :
+       {outputIndirectDrawCountBuffer_, newlyVisibleIndirectDrawCountBuffer_,
+        cullingStatsBuffer_}) {
+    vkCmdFillBuffer(cmd, buffer->vkBuffer(), 0, VK_WHOLE_SIZE, 0);
+  }
+
+  const VkMemoryBarrier after{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &after, 0,
+                       nullptr, 0, nullptr);
+}
+
+void CullingComputePass::readBackStats(VkCommandBuffer cmd, int frameIndex) {
+  const VkMemoryBarrier shaderToTransfer{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &shaderToTransfer,
+                       0, nullptr, 0, nullptr);
+
+  const auto readback = statsReadbackBuffers_[frameIndex]->vkBuffer();
+  const VkBufferCopy statsRegion{
+      .dstOffset = offsetof(StatsReadback, culled),
+      .size = sizeof(GPUCullingStats),
+  };
+  vkCmdCopyBuffer(cmd, cullingStatsBuffer_->vkBuffer(), readback, 1,
+                  &statsRegion);
+  const VkBufferCopy firstPhaseRegion{
+      .dstOffset = offsetof(StatsReadback, drawnFirstPhase),
+      .size = sizeof(uint32_t),
+  };
+  vkCmdCopyBuffer(cmd, outputIndirectDrawCountBuffer_->vkBuffer(), readback, 1,
+                  &firstPhaseRegion);
+  const VkBufferCopy secondPhaseRegion{
+      .dstOffset = offsetof(StatsReadback, drawnSecondPhase),
+      .size = sizeof(uint32_t),
+  };
+  vkCmdCopyBuffer(cmd, newlyVisibleIndirectDrawCountBuffer_->vkBuffer(),
+                  readback, 1, &secondPhaseRegion);
+
+  const VkMemoryBarrier transferToHost{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &transferToHost, 0,
+                       nullptr, 0, nullptr);
+  statsPending_[frameIndex] = true;
 }
 
 void CullingComputePass::addBarrierForCulledBuffers(
     VkCommandBuffer cmd, VkPipelineStageFlags dstStage,
     uint32_t computeFamilyIndex, uint32_t graphicsFamilyIndex) {
-  std::array<VkBufferMemoryBarrier, 2> barriers{
+  std::array<VkBufferMemoryBarrier, 4> barriers{
       VkBufferMemoryBarrier{
           .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
           .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
@@ -232,6 +547,24 @@ void CullingComputePass::addBarrierForCulledBuffers(
           .buffer = outputIndirectDrawCountBuffer_->vkBuffer(),
           .size = outputIndirectDrawCountBuffer_->size(),
       },
+      VkBufferMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+          .srcQueueFamilyIndex = computeFamilyIndex,
+          .dstQueueFamilyIndex = graphicsFamilyIndex,
+          .buffer = newlyVisibleIndirectDrawBuffer_->vkBuffer(),
+          .size = newlyVisibleIndirectDrawBuffer_->size(),
+      },
+      VkBufferMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+          .srcQueueFamilyIndex = computeFamilyIndex,
+          .dstQueueFamilyIndex = graphicsFamilyIndex,
+          .buffer = newlyVisibleIndirectDrawCountBuffer_->vkBuffer(),
+          .size = newlyVisibleIndirectDrawCountBuffer_->size(),
+      },
   };
 
   vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0,
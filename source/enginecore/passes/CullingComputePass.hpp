@@ -4,6 +4,16 @@
 #include "enginecore/RingBuffer.hpp"
 #include "vulkancore/Pipeline.hpp"
 
+// Culls the draws of a model against the camera frustum. For models with LODs, see
+// EngineCore::buildLods(), each visible draw is switched to the coarsest LOD whose error
+// projected on screen stays under the LOD error threshold. With a hierarchical depth
+// texture it also does two phase occlusion culling:
+//  1. cull() outputs the draws that were visible in the previous frame, which are drawn
+//     first,
+//  2. the hierarchical depth buffer is built from their depth,
+//  3. cullOccluded() tests all the draws against it, outputs the ones that became
+//     visible, to be drawn on top, and records which draws are visible for the next
+//     frame.
 class CullingComputePass {
  public:
   struct MeshBBoxBuffer {
@@ -13,31 +23,74 @@ class CullingComputePass {
 
   struct GPUCullingPassPushConstants {
     uint32_t drawCount;
+    uint32_t phase;
   };
 
   struct ViewBuffer {
     alignas(16) glm::vec4 frustumPlanes[6];
+    glm::mat4 viewProjection;
+    glm::vec4 hierarchicalDepthSize;  // width, height, mip levels
+    glm::vec4 cameraPosition;
+    // Pixels covered by one world unit at a distance of 1, LOD error threshold in
+    // pixels, 1 if LODs are selected
+    glm::vec4 lodParams;
+  };
+
+  // The LODs of a draw
+  struct MeshLods {
+    uint32_t lodCount;
+    uint32_t padding[3] = {};
+    EngineCore::MeshLod lods[EngineCore::MAX_MESH_LODS];
   };
 
   struct IndirectDrawCount {
     uint32_t count;
   };
 
+  // Counted on the GPU for each frame
+  struct Stats {
+    uint32_t tested = 0;
+    uint32_t frustumCulled = 0;
+    uint32_t occlusionCulled = 0;
+    // Draws visible in the previous frame, or all the visible draws without occlusion
+    // culling
+    uint32_t drawnFirstPhase = 0;
+    uint32_t drawnSecondPhase = 0;  // draws that became visible
+    // Of the drawn meshes, at full detail and at the LODs that were picked
+    uint32_t trianglesFullDetail = 0;
+    uint32_t trianglesSubmitted = 0;
+  };
+
   CullingComputePass() = default;
 
+  // Occlusion culling is enabled if hierarchicalDepthTexture isn't null
   void init(VulkanCore::Context* context, EngineCore::Camera* camera,
             const EngineCore::Model& model,
-            std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer);
+            std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer,
+            std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture = nullptr);
 
   void upload(VulkanCore::CommandQueueManager& queueMgr);
 
+  // Frustum culling, or the first phase of occlusion culling. The GPU must be done with
+  // the previous frame that used frameIndex, its stats are read back here
   void cull(VkCommandBuffer cmd, int frameIndex);
 
+  // Frustum culling against the view of viewProjection instead of the camera's, for
+  // shadow cascades for instance. LODs are still picked for the camera. Not available
+  // with occlusion culling
+  void cull(VkCommandBuffer cmd, int frameIndex, const glm::mat4& viewProjection);
+
+  // Second phase of occlusion culling, once the hierarchical depth buffer has been built
+  // from the draws of the first phase
+  void cullOccluded(VkCommandBuffer cmd, int frameIndex);
+
   void addBarrierForCulledBuffers(VkCommandBuffer cmd,
                                   VkPipelineStageFlags dstStage,
                                   uint32_t computeFamilyIndex,
                                   uint32_t graphicsFamilyIndex);
 
+  bool occlusionCullingEnabled() const { return hierarchicalDepthTexture_ != nullptr; }
+
   std::shared_ptr<VulkanCore::Buffer> culledIndirectDrawBuffer() {
     return outputIndirectDrawBuffer_;
   }
@@ -46,16 +99,61 @@ class CullingComputePass {
     return outputIndirectDrawCountBuffer_;
   }
 
+  // Output of cullOccluded()
+  std::shared_ptr<VulkanCore::Buffer> newlyVisibleIndirectDrawBuffer() {
+    return newlyVisibleIndirectDrawBuffer_;
+  }
+
+  std::shared_ptr<VulkanCore::Buffer> newlyVisibleIndirectDrawCountBuffer() {
+    return newlyVisibleIndirectDrawCountBuffer_;
+  }
+
+  // The stats of the last frame that has been read back
+  const Stats& stats() const { return stats_; }
+
+  bool lodSelectionEnabled() const { return lodSelectionEnabled_; }
+
+  // How far in pixels the surface of a LOD may be from the full mesh on screen
+  void setLodErrorThreshold(float pixels) { lodErrorThreshold_ = pixels; }
+
+  float lodErrorThreshold() const { return lodErrorThreshold_; }
+
+ private:
+  void cullView(VkCommandBuffer cmd, int frameIndex,
+                const std::array<glm::vec4, 6>& frustumPlanes,
+                const glm::mat4& viewProjection);
+
+  void dispatch(VkCommandBuffer cmd, int frameIndex, uint32_t phase);
+
+  void resetCounters(VkCommandBuffer cmd);
+
+  void readBackStats(VkCommandBuffer cmd, int frameIndex);
+
  private:
   VulkanCore::Context* context_ = nullptr;
   EngineCore::Camera* camera_ = nullptr;
   std::shared_ptr<VulkanCore::Pipeline> pipeline_;
   std::shared_ptr<EngineCore::RingBuffer> camFrustumBuffer_;
   std::shared_ptr<VulkanCore::Buffer> meshBboxBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> meshLodBuffer_;
   std::shared_ptr<VulkanCore::Buffer> inputIndirectDrawBuffer_;
   std::shared_ptr<VulkanCore::Buffer> outputIndirectDrawBuffer_;
   std::shared_ptr<VulkanCore::Buffer> outputIndirectDrawCountBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> newlyVisibleIndirectDrawBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> newlyVisibleIndirectDrawCountBuffer_;
+  // One uint per draw, whether it was visible in the previous frame
+  std::shared_ptr<VulkanCore::Buffer> visibilityBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> cullingStatsBuffer_;
+  // Per frame in flight, the counters copied for the CPU
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> statsReadbackBuffers_;
+  std::vector<bool> statsPending_;
+  std::shared_ptr<VulkanCore::Texture> hierarchicalDepthTexture_;
+  std::shared_ptr<VulkanCore::Sampler> hierarchicalDepthSampler_;
 
   std::vector<MeshBBoxBuffer> meshesBBoxData_;
+  std::vector<MeshLods> meshLods_;
+  bool lodSelectionEnabled_ = false;
+  float lodErrorThreshold_ = 1.0f;
   ViewBuffer frustum_;
+  Stats stats_;
 };
@@ -19,6 +19,23 @@ constexpr uint32_t BINDING_TEMPCOLOR_DEPTH = 2;
 void DepthPeeling::draw(VkCommandBuffer commandBuffer, int index,
                         const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
                         uint32_t numMeshes) {
+  drawPeels(commandBuffer, buffers, numMeshes, nullptr, nullptr, nullptr);
+}
+
+void DepthPeeling::draw(VkCommandBuffer commandBuffer, int index,
+                        const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                        uint32_t numMeshes, VulkanCore::CommandQueueManager& queueMgr,
+                        VulkanCore::ParallelCommandRecorder& recorder,
+                        BS::thread_pool& pool) {
+  drawPeels(commandBuffer, buffers, numMeshes, &queueMgr, &recorder, &pool);
+}
+
+void DepthPeeling::drawPeels(
+    VkCommandBuffer commandBuffer,
+    const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers, uint32_t numMeshes,
+    VulkanCore::CommandQueueManager* queueMgr,
+    VulkanCore::ParallelCommandRecorder* recorder, BS::thread_pool* pool) {
+  const bool recordInParallel = recorder != nullptr;
   {
     // Clear Depth 1
     const VkClearDepthStencilValue clearDepth = {
@@ -115,7 +132,8 @@ void DepthPeeling::draw(VkCommandBuffer commandBuffer, int index,
                                    {1.0f, .55f, 0.0f, 1.0f});
 
     VulkanCore::DynamicRendering::beginRenderingCmd(
-        commandBuffer, colorTextures_[currentPeel % 2]->vkImage(), 0,
+        commandBuffer, colorTextures_[currentPeel % 2]->vkImage(),
+        recordInParallel ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0,
         {{0, 0},
          {colorTextures_[currentPeel % 2]->vkExtents().width,
           colorTextures_[currentPeel % 2]->vkExtents().height}},
@@ -123,33 +141,21 @@ void DepthPeeling::draw(VkCommandBuffer commandBuffer, int index,
         colorTextures_[currentPeel % 2]->vkLayout(),
         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport_);
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor_);
-
-    pipeline_->bind(commandBuffer);
-
-    // std::cerr << "Render" << std::endl;
-    for (uint32_t meshIdx = 0; meshIdx < numMeshes; ++meshIdx) {
-      const auto vertexbufferIndex = meshIdx * 2;
-      const auto indexbufferIndex = meshIdx * 2 + 1;
-
-      pipeline_->bindVertexBuffer(commandBuffer, buffers[vertexbufferIndex]->vkBuffer());
-      pipeline_->bindIndexBuffer(commandBuffer, buffers[indexbufferIndex]->vkBuffer());
-
-      pipeline_->bindDescriptorSets(
-          commandBuffer,
+    if (recordInParallel) {
+      // Descriptor sets can't be updated while the workers record commands that use them
+      pipeline_->updateDescriptorSets();
+      recorder->record(
+          *queueMgr, commandBuffer,
           {
-              {.set = CAMERA_SET,
-               .bindIdx = (uint32_t)context_->swapchain()->currentImageIndex()},
-              {.set = OBJECT_PROP_SET, .bindIdx = meshIdx},
-              {.set = DEPTH_ATTACHMENTS_SET, .bindIdx = (currentPeel % 2)},
+              .colorFormats = {colorTextures_[currentPeel % 2]->vkFormat()},
+              .depthFormat = depthTextures_[currentPeel % 2]->vkFormat(),
+          },
+          numMeshes, *pool,
+          [&](VkCommandBuffer secondaryCmdBuffer, uint32_t first, uint32_t count) {
+            recordMeshes(secondaryCmdBuffer, buffers, currentPeel, first, count);
           });
-
-      pipeline_->updateDescriptorSets();
-
-      const auto vertexCount = buffers[indexbufferIndex]->size() / sizeof(uint32_t);
-
-      vkCmdDrawIndexed(commandBuffer, vertexCount, 1, 0, 0, 0);
+    } else {
+      recordMeshes(commandBuffer, buffers, currentPeel, 0, numMeshes);
     }
 
     VulkanCore::DynamicRendering::endRenderingCmd(
@@ -174,6 +180,40 @@ void DepthPeeling::draw(VkCommandBuffer commandBuffer, int index,
   }
 }
 
+void DepthPeeling::recordMeshes(
+    VkCommandBuffer commandBuffer,
+    const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers, uint32_t currentPeel,
+    uint32_t firstMesh, uint32_t meshCount) {
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport_);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor_);
+
+  pipeline_->bind(commandBuffer);
+
+  // std::cerr << "Render" << std::endl;
+  for (uint32_t meshIdx = firstMesh; meshIdx < firstMesh + meshCount; ++meshIdx) {
+    const auto vertexbufferIndex = meshIdx * 2;
+    const auto indexbufferIndex = meshIdx * 2 + 1;
+
+    pipeline_->bindVertexBuffer(commandBuffer, buffers[vertexbufferIndex]->vkBuffer());
+    pipeline_->bindIndexBuffer(commandBuffer, buffers[indexbufferIndex]->vkBuffer());
+
+    pipeline_->bindDescriptorSets(
+        commandBuffer,
+        {
+            {.set = CAMERA_SET,
+             .bindIdx = (uint32_t)context_->swapchain()->currentImageIndex()},
+            {.set = OBJECT_PROP_SET, .bindIdx = meshIdx},
+            {.set = DEPTH_ATTACHMENTS_SET, .bindIdx = (currentPeel % 2)},
+        });
+
+    pipeline_->updateDescriptorSets();
+
+    const auto vertexCount = buffers[indexbufferIndex]->size() / sizeof(uint32_t);
+
+    vkCmdDrawIndexed(commandBuffer, vertexCount, 1, 0, 0, 0);
+  }
+}
+
 void DepthPeeling::init(
     uint32_t numMeshes, const VkVertexInputBindingDescription& vertexBindingDesc,
     const std::vector<VkVertexInputAttributeDescription>& vertexDescription) {
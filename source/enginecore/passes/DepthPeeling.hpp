@@ -1,8 +1,11 @@
 #pragma once
+#include "BS_thread_pool.hpp"
 #include "LightData.hpp"
 #include "enginecore/Camera.hpp"
 #include "enginecore/Model.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "vulkancore/CommandQueueManager.hpp"
+#include "vulkancore/ParallelCommandRecorder.hpp"
 #include "vulkancore/Pipeline.hpp"
 #include "vulkancore/Sampler.hpp"
 #include "vulkancore/Texture.hpp"
@@ -23,6 +26,13 @@ class DepthPeeling final {
             const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
             uint32_t numMeshes);
 
+  // The meshes of each peel are split in ranges recorded by the threads of pool into
+  // secondary command buffers
+  void draw(VkCommandBuffer cmd, int index,
+            const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+            uint32_t numMeshes, VulkanCore::CommandQueueManager& queueMgr,
+            VulkanCore::ParallelCommandRecorder& recorder, BS::thread_pool& pool);
+
   std::shared_ptr<VulkanCore::Pipeline> pipeline() const { return pipeline_; }
 
   std::shared_ptr<VulkanCore::Texture> colorTexture() const {
@@ -35,6 +45,16 @@ class DepthPeeling final {
   void initDepthTextures(VkFormat depthFormat);
   void initColorTextures(uint32_t numPeels, VkFormat colorTextureFormat);
 
+  // Records inline when recorder is null
+  void drawPeels(VkCommandBuffer cmd,
+                 const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                 uint32_t numMeshes, VulkanCore::CommandQueueManager* queueMgr,
+                 VulkanCore::ParallelCommandRecorder* recorder, BS::thread_pool* pool);
+
+  void recordMeshes(VkCommandBuffer cmd,
+                    const std::vector<std::shared_ptr<VulkanCore::Buffer>>& buffers,
+                    uint32_t currentPeel, uint32_t firstMesh, uint32_t meshCount);
+
  private:
   VulkanCore::Context* context_ = nullptr;
   uint32_t numPeels_ = 0;
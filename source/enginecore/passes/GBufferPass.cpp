@@ -144,6 +144,52 @@ void GBufferPass::render(
     const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
     VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, VkBuffer indirectDrawCountBuffer,
     uint32_t numMeshes, uint32_t bufferSize, bool applyJitter) {
+  context_->beginDebugUtilsLabel(commandBuffer, "GBuffer Pass", {0.0f, 1.0f, 0.0f, 1.0f});
+
+  beginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+  recordDraws(commandBuffer, sets, indexBuffer, indirectDrawBuffer,
+              indirectDrawCountBuffer, 0, numMeshes, bufferSize, applyJitter);
+  endRenderPass(commandBuffer);
+}
+
+void GBufferPass::render(
+    VkCommandBuffer commandBuffer, int frameIndex,
+    const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+    VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, VkBuffer indirectDrawCountBuffer,
+    uint32_t numMeshes, uint32_t bufferSize, VulkanCore::CommandQueueManager& queueMgr,
+    VulkanCore::ParallelCommandRecorder& recorder, BS::thread_pool& pool,
+    bool applyJitter) {
+  context_->beginDebugUtilsLabel(commandBuffer, "GBuffer Pass (parallel)",
+                                 {0.0f, 1.0f, 0.0f, 1.0f});
+
+  // Descriptor sets can't be updated while the workers record commands that use them
+  pipeline_->updateDescriptorSets();
+
+  // The number of draws in a count buffer is only known on the GPU, so that draw can't
+  // be split in ranges
+  const uint32_t numRanges = indirectDrawCountBuffer != VK_NULL_HANDLE ? 1 : numMeshes;
+
+  beginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  recorder.record(
+      queueMgr, commandBuffer,
+      {
+          .renderPass = renderPass_->vkRenderPass(),
+          .framebuffer = frameBuffer_->vkFramebuffer(),
+      },
+      numRanges, pool,
+      [&](VkCommandBuffer secondaryCmdBuffer, uint32_t first, uint32_t count) {
+        if (numRanges == 1) {
+          first = 0;
+          count = numMeshes;
+        }
+        recordDraws(secondaryCmdBuffer, sets, indexBuffer, indirectDrawBuffer,
+                    indirectDrawCountBuffer, first, count, bufferSize, applyJitter);
+      });
+  endRenderPass(commandBuffer);
+}
+
+void GBufferPass::beginRenderPass(VkCommandBuffer commandBuffer,
+                                  VkSubpassContents contents) {
   const std::array<VkClearValue, 7> clearValues = {
       VkClearValue{.color = {0.196f, 0.6f, 0.8f, 1.0f}},  // base color texture
       VkClearValue{.color = {0.0f, 0.0f, 0.0f, 1.0f}},    // normal texture
@@ -170,10 +216,14 @@ void GBufferPass::render(
       .pClearValues = clearValues.data(),
   };
 
-  context_->beginDebugUtilsLabel(commandBuffer, "GBuffer Pass", {0.0f, 1.0f, 0.0f, 1.0f});
-
-  vkCmdBeginRenderPass(commandBuffer, &renderpassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdBeginRenderPass(commandBuffer, &renderpassInfo, contents);
+}
 
+void GBufferPass::recordDraws(
+    VkCommandBuffer commandBuffer,
+    const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+    VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, VkBuffer indirectDrawCountBuffer,
+    uint32_t firstDraw, uint32_t drawCount, uint32_t bufferSize, bool applyJitter) {
   const VkViewport viewport = {
       .x = 0.0f,
       .y = static_cast<float>(gBufferBaseColorTexture_->vkExtents().height),
@@ -208,9 +258,17 @@ void GBufferPass::render(
 
   vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-  vkCmdDrawIndexedIndirectCount(commandBuffer, indirectDrawBuffer, 0,
-                                indirectDrawCountBuffer, 0, numMeshes, bufferSize);
+  if (indirectDrawCountBuffer != VK_NULL_HANDLE) {
+    vkCmdDrawIndexedIndirectCount(commandBuffer, indirectDrawBuffer,
+                                  VkDeviceSize(firstDraw) * bufferSize,
+                                  indirectDrawCountBuffer, 0, drawCount, bufferSize);
+  } else {
+    vkCmdDrawIndexedIndirect(commandBuffer, indirectDrawBuffer,
+                             VkDeviceSize(firstDraw) * bufferSize, drawCount, bufferSize);
+  }
+}
 
+void GBufferPass::endRenderPass(VkCommandBuffer commandBuffer) {
   vkCmdEndRenderPass(commandBuffer);
   context_->endDebugUtilsLabel(commandBuffer);
   gBufferBaseColorTexture_->setImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
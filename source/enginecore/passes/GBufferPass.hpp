@@ -1,8 +1,11 @@
 #pragma once
+#include "BS_thread_pool.hpp"
 #include "enginecore/Camera.hpp"
 #include "enginecore/Model.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "vulkancore/CommandQueueManager.hpp"
 #include "vulkancore/Framebuffer.hpp"
+#include "vulkancore/ParallelCommandRecorder.hpp"
 #include "vulkancore/Pipeline.hpp"
 #include "vulkancore/RenderPass.hpp"
 #include "vulkancore/Texture.hpp"
@@ -23,6 +26,17 @@ class GBufferPass {
               VkBuffer indirectDrawCountBuffer, uint32_t numMeshes, uint32_t bufferSize,
               bool applyJitter = false);
 
+  // Splits the indirect draws in ranges recorded by the threads of pool into secondary
+  // command buffers. indirectDrawCountBuffer may be VK_NULL_HANDLE to draw all numMeshes
+  // commands, with a count buffer the draw is recorded as a single range
+  void render(VkCommandBuffer cmd, int frameIndex,
+              const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+              VkBuffer indexBuffer, VkBuffer indirectDrawBuffer,
+              VkBuffer indirectDrawCountBuffer, uint32_t numMeshes, uint32_t bufferSize,
+              VulkanCore::CommandQueueManager& queueMgr,
+              VulkanCore::ParallelCommandRecorder& recorder, BS::thread_pool& pool,
+              bool applyJitter = false);
+
   std::shared_ptr<VulkanCore::Pipeline> pipeline() const { return pipeline_; }
 
   std::shared_ptr<VulkanCore::Texture> baseColorTexture() const {
@@ -55,6 +69,18 @@ class GBufferPass {
   void initTextures(VulkanCore::Context* context, unsigned int width,
                     unsigned int height);
 
+  void beginRenderPass(VkCommandBuffer cmd, VkSubpassContents contents);
+
+  // Draws [firstDraw, firstDraw + drawCount) of indirectDrawBuffer, or up to drawCount
+  // commands from firstDraw if there is a count buffer
+  void recordDraws(VkCommandBuffer cmd,
+                   const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+                   VkBuffer indexBuffer, VkBuffer indirectDrawBuffer,
+                   VkBuffer indirectDrawCountBuffer, uint32_t firstDraw,
+                   uint32_t drawCount, uint32_t bufferSize, bool applyJitter);
+
+  void endRenderPass(VkCommandBuffer cmd);
+
  private:
   VulkanCore::Context* context_ = nullptr;
   std::shared_ptr<VulkanCore::Texture> gBufferBaseColorTexture_;
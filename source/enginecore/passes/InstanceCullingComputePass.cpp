@@ -0,0 +1,264 @@
+#include "InstanceCullingComputePass.hpp"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "enginecore/GLBLoader.hpp"
+#include "vulkancore/Context.hpp"
+
+constexpr uint32_t INSTANCE_BOUNDS_SET = 0;
+constexpr uint32_t INPUT_INDIRECT_BUFFER_SET = 1;
+constexpr uint32_t OUTPUT_INDIRECT_BUFFER_SET = 2;
+constexpr uint32_t VISIBLE_INSTANCES_SET = 3;
+constexpr uint32_t CAMERA_FRUSTUM_SET = 4;
+constexpr uint32_t BINDING_0 = 0;
+
+// Must match gpuinstanceculling.comp
+constexpr uint32_t PHASE_RESET_DRAWS = 0;
+constexpr uint32_t PHASE_CULL_INSTANCES = 1;
+constexpr uint32_t WORKGROUP_SIZE = 256;
+
+namespace {
+// Same test as gpuinstanceculling.comp
+bool isInsideFrustum(const std::array<glm::vec4, 6>& frustumPlanes,
+                     const glm::vec3& center, const glm::vec3& extents) {
+  for (const auto& plane : frustumPlanes) {
+    const auto planeNormal = glm::vec3(plane);
+    const float distFromPlane = glm::dot(center, planeNormal);
+    const float absDiff = glm::dot(glm::abs(planeNormal), extents);
+    if (distFromPlane + absDiff + plane.w < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+void InstanceCullingComputePass::init(
+    VulkanCore::Context* context, uint32_t framesInFlight,
+    std::shared_ptr<VulkanCore::Buffer> instanceBoundsBuffer, uint32_t instanceCount,
+    std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer, uint32_t drawCount) {
+  ASSERT(context->physicalDevice().supportsSubgroupOperations(
+             VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT |
+             VK_SUBGROUP_FEATURE_ARITHMETIC_BIT),
+         "gpuinstanceculling.comp compacts its output with subgroup operations");
+  context_ = context;
+  instanceBoundsBuffer_ = instanceBoundsBuffer;
+  instanceCount_ = instanceCount;
+  inputIndirectDrawBuffer_ = inputIndirectBuffer;
+  drawCount_ = drawCount;
+
+  camFrustumBuffer_ = std::make_shared<EngineCore::RingBuffer>(
+      framesInFlight, *context_, sizeof(ViewBuffer), "Instance culling frustum");
+
+  outputIndirectDrawBuffer_ = context_->createBuffer(
+      sizeof(EngineCore::IndirectDrawCommandAndMeshData) * drawCount_,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Instanced IndirectDrawBuffer");
+
+  visibleInstanceBuffer_ = context_->createBuffer(
+      sizeof(uint32_t) * std::max(instanceCount_, 1u),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Visible instances");
+
+  const auto resourcesFolder =
+      std::filesystem::current_path() / "resources/shaders/";
+
+  auto shader = context_->createShaderModule(
+      (resourcesFolder / "gpuinstanceculling.comp").string(),
+      VK_SHADER_STAGE_COMPUTE_BIT, "instance culling compute");
+
+  const auto storageBufferSet = [](uint32_t set) {
+    return VulkanCore::Pipeline::SetDescriptor{
+        .set_ = set,
+        .bindings_ =
+            {
+                VkDescriptorSetLayoutBinding{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                             VK_SHADER_STAGE_COMPUTE_BIT},
+            },
+    };
+  };
+  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+      storageBufferSet(INSTANCE_BOUNDS_SET),
+      storageBufferSet(INPUT_INDIRECT_BUFFER_SET),
+      storageBufferSet(OUTPUT_INDIRECT_BUFFER_SET),
+      storageBufferSet(VISIBLE_INSTANCES_SET),
+      {
+          .set_ = CAMERA_FRUSTUM_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+  };
+  std::vector<VkPushConstantRange> pushConstants = {
+      VkPushConstantRange{
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+          .offset = 0,
+          .size = sizeof(InstanceCullingPushConstants),
+      },
+  };
+  const VulkanCore::Pipeline::ComputePipelineDescriptor desc = {
+      .sets_ = setLayout,
+      .computeShader_ = shader,
+      .pushConstants_ = pushConstants,
+  };
+  pipeline_ = context_->createComputePipeline(desc, "instance culling");
+
+  pipeline_->allocateDescriptors({
+      {.set_ = INSTANCE_BOUNDS_SET, .count_ = 1},
+      {.set_ = INPUT_INDIRECT_BUFFER_SET, .count_ = 1},
+      {.set_ = OUTPUT_INDIRECT_BUFFER_SET, .count_ = 1},
+      {.set_ = VISIBLE_INSTANCES_SET, .count_ = 1},
+      {.set_ = CAMERA_FRUSTUM_SET, .count_ = framesInFlight},
+  });
+
+  pipeline_->bindResource(INSTANCE_BOUNDS_SET, BINDING_0, 0, instanceBoundsBuffer_, 0,
+                          instanceBoundsBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  pipeline_->bindResource(INPUT_INDIRECT_BUFFER_SET, BINDING_0, 0,
+                          inputIndirectDrawBuffer_, 0, inputIndirectDrawBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  pipeline_->bindResource(OUTPUT_INDIRECT_BUFFER_SET, BINDING_0, 0,
+                          outputIndirectDrawBuffer_, 0,
+                          outputIndirectDrawBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  pipeline_->bindResource(VISIBLE_INSTANCES_SET, BINDING_0, 0, visibleInstanceBuffer_,
+                          0, visibleInstanceBuffer_->size(),
+                          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    pipeline_->bindResource(CAMERA_FRUSTUM_SET, BINDING_0, i,
+                            camFrustumBuffer_->buffer(i), 0,
+                            camFrustumBuffer_->buffer(i)->size(),
+                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+  }
+}
+
+void InstanceCullingComputePass::cull(VkCommandBuffer cmd, int frameIndex,
+                                      const std::array<glm::vec4, 6>& frustumPlanes) {
+  std::copy(frustumPlanes.begin(), frustumPlanes.end(), frustum_.frustumPlanes);
+  camFrustumBuffer_->buffer(frameIndex)->copyDataToBuffer(&frustum_,
+                                                          sizeof(ViewBuffer));
+
+  context_->beginDebugUtilsLabel(cmd, "GPU Instance Culling", {1.0f, 0.0f, 0.0f, 1.0f});
+
+  pipeline_->bind(cmd);
+  pipeline_->bindDescriptorSets(
+      cmd, {
+               {.set = INSTANCE_BOUNDS_SET, .bindIdx = 0},
+               {.set = INPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
+               {.set = OUTPUT_INDIRECT_BUFFER_SET, .bindIdx = 0},
+               {.set = VISIBLE_INSTANCES_SET, .bindIdx = 0},
+               {.set = CAMERA_FRUSTUM_SET, .bindIdx = uint32_t(frameIndex)},
+           });
+  pipeline_->updateDescriptorSets();
+
+  // The previous frame may still be drawing with the output draws
+  const VkMemoryBarrier drawsRead{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &drawsRead, 0,
+                       nullptr, 0, nullptr);
+
+  // The instance counts are cleared by a dispatch of their own, so that no workgroup of
+  // the culling dispatch can add to them before they are reset
+  dispatch(cmd, PHASE_RESET_DRAWS, drawCount_);
+
+  const VkMemoryBarrier countsReset{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &countsReset, 0,
+                       nullptr, 0, nullptr);
+
+  dispatch(cmd, PHASE_CULL_INSTANCES, instanceCount_);
+
+  context_->endDebugUtilsLabel(cmd);
+}
+
+void InstanceCullingComputePass::dispatch(VkCommandBuffer cmd, uint32_t phase,
+                                          uint32_t invocations) {
+  const InstanceCullingPushConstants pushConst{
+      .instanceCount = instanceCount_,
+      .drawCount = drawCount_,
+      .phase = phase,
+  };
+  pipeline_->updatePushConstant(cmd, VK_SHADER_STAGE_COMPUTE_BIT,
+                                sizeof(InstanceCullingPushConstants), &pushConst);
+
+  // Millions of instances need more workgroups than maxComputeWorkGroupCount[0]
+  const uint32_t groupCount = (invocations + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+  const uint32_t maxGroupCountX = context_->physicalDevice()
+                                      .properties()
+                                      .properties.limits.maxComputeWorkGroupCount[0];
+  const uint32_t groupCountX = std::min(std::max(groupCount, 1u), maxGroupCountX);
+  const uint32_t groupCountY = (groupCount + groupCountX - 1) / groupCountX;
+  vkCmdDispatch(cmd, groupCountX, std::max(groupCountY, 1u), 1);
+}
+
+void InstanceCullingComputePass::addBarrierForCulledBuffers(
+    VkCommandBuffer cmd, VkPipelineStageFlags dstStage, uint32_t computeFamilyIndex,
+    uint32_t graphicsFamilyIndex) {
+  const std::array<VkBufferMemoryBarrier, 2> barriers{
+      VkBufferMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+          .srcQueueFamilyIndex = computeFamilyIndex,
+          .dstQueueFamilyIndex = graphicsFamilyIndex,
+          .buffer = outputIndirectDrawBuffer_->vkBuffer(),
+          .size = outputIndirectDrawBuffer_->size(),
+      },
+      VkBufferMemoryBarrier{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+          .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+          .srcQueueFamilyIndex = computeFamilyIndex,
+          .dstQueueFamilyIndex = graphicsFamilyIndex,
+          .buffer = visibleInstanceBuffer_->vkBuffer(),
+          .size = visibleInstanceBuffer_->size(),
+      },
+  };
+
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0, 0,
+                       nullptr, (uint32_t)barriers.size(), barriers.data(), 0, nullptr);
+}
+
+std::vector<InstanceCullingComputePass::InstanceBounds>
+InstanceCullingComputePass::instanceBounds(const EngineCore::Model& model) {
+  std::vector<InstanceBounds> bounds;
+  bounds.reserve(model.instances.size());
+  for (const auto& instance : model.instances) {
+    const auto& mesh = model.meshes[instance.meshId];
+    // Box of the transformed box
+    const glm::mat3 m = glm::mat3(instance.transform);
+    const glm::mat3 absM = glm::mat3(glm::abs(m[0]), glm::abs(m[1]), glm::abs(m[2]));
+    bounds.push_back({
+        .center = glm::vec3(instance.transform * glm::vec4(mesh.center, 1.0f)),
+        .drawIndex = instance.meshId,
+        .extents = absM * mesh.extents,
+    });
+  }
+  return bounds;
+}
+
+std::vector<std::vector<uint32_t>> InstanceCullingComputePass::cullOnCPU(
+    const std::vector<InstanceBounds>& instances, uint32_t drawCount,
+    const std::array<glm::vec4, 6>& frustumPlanes) {
+  std::vector<std::vector<uint32_t>> visibleInstances(drawCount);
+  for (uint32_t i = 0; i < instances.size(); ++i) {
+    if (isInsideFrustum(frustumPlanes, instances[i].center, instances[i].extents)) {
+      visibleInstances[instances[i].drawIndex].push_back(i);
+    }
+  }
+  return visibleInstances;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <array>
+#include <glm/glm.hpp>
+
+#include "enginecore/Model.hpp"
+#include "enginecore/RingBuffer.hpp"
+#include "vulkancore/Pipeline.hpp"
+
+// Culls instances against the frustum, for scenes with many copies of the same meshes.
+// Instances are sorted by draw: the firstInstance of an input draw is the index of its
+// first instance and instanceCount how many it has. The output draws are the input draws
+// with the number of visible instances, whose indices are written from firstInstance in
+// visibleInstanceBuffer(), in no particular order.
+class InstanceCullingComputePass {
+ public:
+  struct InstanceBounds {
+    glm::vec3 center;
+    uint32_t drawIndex;
+    glm::vec3 extents;
+    uint32_t padding = 0;
+  };
+
+  struct InstanceCullingPushConstants {
+    uint32_t instanceCount;
+    uint32_t drawCount;
+    uint32_t phase;
+  };
+
+  struct ViewBuffer {
+    alignas(16) glm::vec4 frustumPlanes[6];
+  };
+
+  InstanceCullingComputePass() = default;
+
+  // instanceBoundsBuffer holds instanceCount InstanceBounds, inputIndirectBuffer
+  // drawCount EngineCore::IndirectDrawCommandAndMeshData
+  void init(VulkanCore::Context* context, uint32_t framesInFlight,
+            std::shared_ptr<VulkanCore::Buffer> instanceBoundsBuffer,
+            uint32_t instanceCount,
+            std::shared_ptr<VulkanCore::Buffer> inputIndirectBuffer, uint32_t drawCount);
+
+  void cull(VkCommandBuffer cmd, int frameIndex,
+            const std::array<glm::vec4, 6>& frustumPlanes);
+
+  void addBarrierForCulledBuffers(VkCommandBuffer cmd, VkPipelineStageFlags dstStage,
+                                  uint32_t computeFamilyIndex,
+                                  uint32_t graphicsFamilyIndex);
+
+  // Draw with vkCmdDrawIndexedIndirect and drawCount() draws, the ones without visible
+  // instances have an instanceCount of 0
+  std::shared_ptr<VulkanCore::Buffer> culledIndirectDrawBuffer() {
+    return outputIndirectDrawBuffer_;
+  }
+
+  std::shared_ptr<VulkanCore::Buffer> visibleInstanceBuffer() {
+    return visibleInstanceBuffer_;
+  }
+
+  uint32_t drawCount() const { return drawCount_; }
+
+  // World space bounds of the instances of a model loaded with instancing, its draws
+  // are its meshes
+  static std::vector<InstanceBounds> instanceBounds(const EngineCore::Model& model);
+
+  // What the pass computes, on the CPU: for each draw, the sorted indices of its visible
+  // instances
+  static std::vector<std::vector<uint32_t>> cullOnCPU(
+      const std::vector<InstanceBounds>& instances, uint32_t drawCount,
+      const std::array<glm::vec4, 6>& frustumPlanes);
+
+ private:
+  void dispatch(VkCommandBuffer cmd, uint32_t phase, uint32_t invocations);
+
+ private:
+  VulkanCore::Context* context_ = nullptr;
+  std::shared_ptr<VulkanCore::Pipeline> pipeline_;
+  std::shared_ptr<EngineCore::RingBuffer> camFrustumBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> instanceBoundsBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> inputIndirectDrawBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> outputIndirectDrawBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> visibleInstanceBuffer_;
+  uint32_t instanceCount_ = 0;
+  uint32_t drawCount_ = 0;
+  ViewBuffer frustum_;
+};
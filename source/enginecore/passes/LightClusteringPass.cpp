@@ -0,0 +1,293 @@
+#include "LightClusteringPass.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <random>
+
+#include "vulkancore/Context.hpp"
+#include "vulkancore/Sampler.hpp"
+
+constexpr uint32_t GBUFFER_SET = 0;
+constexpr uint32_t CLUSTERS_SET = 1;
+
+constexpr uint32_t BINDING_PARAMS = 0;
+constexpr uint32_t BINDING_LIGHTS = 1;
+constexpr uint32_t BINDING_CLUSTERS = 2;
+constexpr uint32_t BINDING_LIGHT_INDICES = 3;
+
+// Sizes lightIndices, the lights past it are dropped
+constexpr uint32_t AVERAGE_LIGHTS_PER_CLUSTER = 32;
+
+// Per frame: start and end of build()
+constexpr uint32_t TIMESTAMPS_PER_FRAME = 2;
+
+// ClusteredLights.glsl
+struct ClusterParams {
+  glm::mat4 view;
+  glm::uvec4 gridSize;
+  glm::vec4 depthSlicing;
+  glm::uvec4 counts;
+};
+
+LightClusteringPass::~LightClusteringPass() {
+  if (queryPool_ != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(context_->device(), queryPool_, nullptr);
+  }
+}
+
+void LightClusteringPass::init(VulkanCore::Context* context, EngineCore::Camera* camera,
+                               std::shared_ptr<VulkanCore::Texture> gBufferPosition) {
+  context_ = context;
+  camera_ = camera;
+  gBufferPosition_ = gBufferPosition;
+
+  const uint32_t framesInFlight = context_->swapchain()->numberImages();
+
+  tiles_ = {
+      (gBufferPosition_->vkExtents().width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+      (gBufferPosition_->vkExtents().height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE,
+  };
+  const uint32_t clusterCount = tiles_.x * tiles_.y * CLUSTER_DEPTH_SLICES;
+  lightIndexCapacity_ = clusterCount * AVERAGE_LIGHTS_PER_CLUSTER;
+  stats_.clusters = clusterCount;
+
+  paramsBuffer_ = std::make_shared<EngineCore::RingBuffer>(
+      framesInFlight, *context_, sizeof(ClusterParams), "Cluster params");
+
+  lightBuffer_ = context_->createPersistentBuffer(
+      sizeof(ClusteredLight) * MAX_CLUSTERED_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      "Clustered lights");
+
+  clusterBuffer_ = context_->createBuffer(sizeof(glm::uvec2) * clusterCount,
+                                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                          VMA_MEMORY_USAGE_GPU_ONLY, "Light clusters");
+
+  lightIndexBuffer_ = context_->createBuffer(
+      sizeof(uint32_t) * (1 + lightIndexCapacity_),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY, "Cluster light indices");
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    readbackBuffers_.push_back(context_->createBuffer(
+        sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU,
+        "Cluster light indices readback " + std::to_string(i)));
+  }
+  readbackPending_.resize(framesInFlight, false);
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = TIMESTAMPS_PER_FRAME * framesInFlight,
+  };
+  VK_CHECK(vkCreateQueryPool(context_->device(), &queryPoolInfo, nullptr, &queryPool_));
+
+  // Texels are fetched, the sampler isn't used for filtering
+  sampler_ = context_->createSampler(
+      VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, 1.0f,
+      "light clustering sampler");
+
+  const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
+
+  auto shader = context_->createShaderModule(
+      (resourcesFolder / "lightclustering.comp").string(), VK_SHADER_STAGE_COMPUTE_BIT,
+      "light clustering");
+
+  const std::vector<VulkanCore::Pipeline::SetDescriptor> setLayout = {
+      {
+          .set_ = GBUFFER_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{0,
+                                               VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                               1, VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+      {
+          .set_ = CLUSTERS_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{BINDING_PARAMS,
+                                               VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_LIGHTS,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_CLUSTERS,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_LIGHT_INDICES,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_COMPUTE_BIT},
+              },
+      },
+  };
+  const VulkanCore::Pipeline::ComputePipelineDescriptor desc = {
+      .sets_ = setLayout,
+      .computeShader_ = shader,
+  };
+  pipeline_ = context_->createComputePipeline(desc, "Light clustering pipeline");
+
+  pipeline_->allocateDescriptors({
+      {.set_ = GBUFFER_SET, .count_ = 1},
+      {.set_ = CLUSTERS_SET, .count_ = framesInFlight},
+  });
+
+  pipeline_->bindResource(GBUFFER_SET, 0, 0, {&gBufferPosition_, 1}, sampler_);
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    pipeline_->bindResource(CLUSTERS_SET, BINDING_PARAMS, i, paramsBuffer_->buffer(i), 0,
+                            sizeof(ClusterParams), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    pipeline_->bindResource(CLUSTERS_SET, BINDING_LIGHTS, i, lightBuffer_, 0,
+                            lightBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    pipeline_->bindResource(CLUSTERS_SET, BINDING_CLUSTERS, i, clusterBuffer_, 0,
+                            clusterBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    pipeline_->bindResource(CLUSTERS_SET, BINDING_LIGHT_INDICES, i, lightIndexBuffer_, 0,
+                            lightIndexBuffer_->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+  }
+}
+
+void LightClusteringPass::setLights(const std::vector<ClusteredLight>& lights) {
+  ASSERT(lights.size() <= MAX_CLUSTERED_LIGHTS, "Too many clustered lights");
+  lightCount_ = uint32_t(lights.size());
+  lightBuffer_->copyDataToBuffer(lights.data(), sizeof(ClusteredLight) * lightCount_);
+}
+
+void LightClusteringPass::build(VkCommandBuffer cmd, int frameIndex) {
+  readBack(frameIndex);
+
+  const float nearPlane = camera_->nearPlane();
+  const ClusterParams params = {
+      .view = camera_->viewMatrix(),
+      .gridSize = glm::uvec4(tiles_, CLUSTER_DEPTH_SLICES, CLUSTER_TILE_SIZE),
+      .depthSlicing = glm::vec4(
+          nearPlane, CLUSTER_DEPTH_SLICES / std::log(camera_->farPlane() / nearPlane),
+          0.0f, 0.0f),
+      .counts = glm::uvec4(lightCount_, lightIndexCapacity_, 0, 0),
+  };
+  paramsBuffer_->buffer(frameIndex)->copyDataToBuffer(&params, sizeof(ClusterParams));
+
+  const uint32_t firstQuery = TIMESTAMPS_PER_FRAME * frameIndex;
+  vkCmdResetQueryPool(cmd, queryPool_, firstQuery, TIMESTAMPS_PER_FRAME);
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_, firstQuery);
+
+  context_->beginDebugUtilsLabel(cmd, "Light clustering", {1.0f, 1.0f, 0.0f, 1.0f});
+
+  // The lighting of the previous frame may still read the clusters, and its readback
+  // the index count
+  const VkMemoryBarrier beforeReset{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(
+      cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+      &beforeReset, 0, nullptr, 0, nullptr);
+
+  vkCmdFillBuffer(cmd, lightIndexBuffer_->vkBuffer(), 0, sizeof(uint32_t), 0);
+
+  const VkMemoryBarrier afterReset{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &afterReset, 0,
+                       nullptr, 0, nullptr);
+
+  pipeline_->bind(cmd);
+  pipeline_->bindDescriptorSets(cmd, {
+                                         {.set = GBUFFER_SET, .bindIdx = 0},
+                                         {.set = CLUSTERS_SET,
+                                          .bindIdx = uint32_t(frameIndex)},
+                                     });
+  pipeline_->updateDescriptorSets();
+
+  vkCmdDispatch(cmd, tiles_.x, tiles_.y, 1);
+
+  const VkMemoryBarrier afterBuild{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+  };
+  vkCmdPipelineBarrier(
+      cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+      &afterBuild, 0, nullptr, 0, nullptr);
+
+  const VkBufferCopy region{.size = sizeof(uint32_t)};
+  vkCmdCopyBuffer(cmd, lightIndexBuffer_->vkBuffer(),
+                  readbackBuffers_[frameIndex]->vkBuffer(), 1, &region);
+
+  const VkMemoryBarrier transferToHost{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+  };
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                       0, 1, &transferToHost, 0, nullptr, 0, nullptr);
+
+  context_->endDebugUtilsLabel(cmd);
+
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+                      firstQuery + 1);
+  readbackPending_[frameIndex] = true;
+}
+
+void LightClusteringPass::readBack(int frameIndex) {
+  if (!readbackPending_[frameIndex]) {
+    return;
+  }
+
+  // Lights past the capacity were counted but dropped
+  const auto lightIndices =
+      *reinterpret_cast<const uint32_t*>(readbackBuffers_[frameIndex]->mappedMemory());
+  stats_.lightIndices = std::min(lightIndices, lightIndexCapacity_);
+
+  std::array<uint64_t, TIMESTAMPS_PER_FRAME> timestamps;
+  const auto result = vkGetQueryPoolResults(
+      context_->device(), queryPool_, TIMESTAMPS_PER_FRAME * frameIndex,
+      TIMESTAMPS_PER_FRAME, sizeof(timestamps), timestamps.data(), sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT);
+  if (result == VK_SUCCESS) {
+    const double msPerTick =
+        context_->physicalDevice().properties().properties.limits.timestampPeriod / 1e6;
+    stats_.buildTimeMs = (timestamps[1] - timestamps[0]) * msPerTick;
+  }
+  readbackPending_[frameIndex] = false;
+}
+
+std::vector<ClusteredLight> LightClusteringPass::randomLights(uint32_t count,
+                                                              const glm::vec3& boundsMin,
+                                                              const glm::vec3& boundsMax,
+                                                              uint32_t seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  const auto randomVec3 = [&]() {
+    const float x = unit(generator);
+    const float y = unit(generator);
+    const float z = unit(generator);
+    return glm::vec3(x, y, z);
+  };
+
+  std::vector<ClusteredLight> lights(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    const glm::vec3 position = glm::mix(boundsMin, boundsMax, randomVec3());
+    const float range = 2.0f + 6.0f * unit(generator);
+    const glm::vec3 color = 0.2f + 0.8f * randomVec3();
+    lights[i] = {
+        .positionRange = glm::vec4(position, range),
+        .colorIntensity = glm::vec4(color, 2.0f + 8.0f * unit(generator)),
+        .spotDirection = glm::vec4(0.0f, -1.0f, 0.0f, 0.0f),
+    };
+    if (i % 4 == 3) {
+      lights[i].spotCone =
+          glm::vec4(std::cos(glm::radians(20.0f)), std::cos(glm::radians(35.0f)), 0, 0);
+    }
+  }
+  return lights;
+}
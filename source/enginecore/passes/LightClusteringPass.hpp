@@ -0,0 +1,105 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "enginecore/Camera.hpp"
+#include "enginecore/RingBuffer.hpp"
+#include "vulkancore/Pipeline.hpp"
+#include "vulkancore/Texture.hpp"
+
+// Must match ClusteredLights.glsl
+constexpr uint32_t CLUSTER_TILE_SIZE = 32;  // pixels
+constexpr uint32_t CLUSTER_DEPTH_SLICES = 24;
+
+constexpr uint32_t MAX_CLUSTERED_LIGHTS = 16384;
+
+// A point light, or a spot light when spotCone.y is above -1
+struct ClusteredLight {
+  glm::vec4 positionRange;  // world position, distance where the light fades out
+  glm::vec4 colorIntensity;
+  glm::vec4 spotDirection;  // direction the light shines along
+  glm::vec4 spotCone = glm::vec4(-1.0f, -1.0f, 0.0f, 0.0f);  // cos inner, cos outer
+};
+
+// Sorts many point and spot lights into clusters for LightingPass, which then only
+// shades the lights of the cluster of each pixel. The screen is divided into tiles of
+// CLUSTER_TILE_SIZE pixels, and each tile into CLUSTER_DEPTH_SLICES slices that get
+// thicker with the distance. The bounds of a cluster are the ones of the G-buffer
+// positions that fall in it, so clusters without any surface get no lights and the
+// others only the lights that reach their surfaces
+class LightClusteringPass {
+ public:
+  // Of the last frame that has been read back
+  struct Stats {
+    uint32_t clusters = 0;
+    uint32_t lightIndices = 0;  // sum of the light counts of all the clusters
+    double buildTimeMs = 0.0;
+  };
+
+  LightClusteringPass() = default;
+
+  ~LightClusteringPass();
+
+  // gBufferPosition holds the world positions of the G-buffer, 0 where nothing was
+  // drawn
+  void init(VulkanCore::Context* context, EngineCore::Camera* camera,
+            std::shared_ptr<VulkanCore::Texture> gBufferPosition);
+
+  // At most MAX_CLUSTERED_LIGHTS. The GPU reads them from mapped memory, so lights
+  // that frames in flight use shouldn't change
+  void setLights(const std::vector<ClusteredLight>& lights);
+
+  uint32_t lightCount() const { return lightCount_; }
+
+  // Builds the light lists of the clusters from the G-buffer positions, and makes them
+  // visible to fragment shaders. The GPU must be done with the previous frame that
+  // used frameIndex, its stats are read back here
+  void build(VkCommandBuffer cmd, int frameIndex);
+
+  // Set 2 of lighting.frag, see ClusteredLights.glsl
+  std::shared_ptr<VulkanCore::Buffer> paramsBuffer(uint32_t frameIndex) const {
+    return paramsBuffer_->buffer(frameIndex);
+  }
+
+  std::shared_ptr<VulkanCore::Buffer> lightBuffer() const { return lightBuffer_; }
+
+  std::shared_ptr<VulkanCore::Buffer> clusterBuffer() const { return clusterBuffer_; }
+
+  std::shared_ptr<VulkanCore::Buffer> lightIndexBuffer() const {
+    return lightIndexBuffer_;
+  }
+
+  const Stats& stats() const { return stats_; }
+
+  // count lights at random positions in the box, with random colors and ranges, one
+  // in four being a spot light pointing down. To measure how lighting scales
+  static std::vector<ClusteredLight> randomLights(uint32_t count,
+                                                  const glm::vec3& boundsMin,
+                                                  const glm::vec3& boundsMax,
+                                                  uint32_t seed = 0);
+
+ private:
+  void readBack(int frameIndex);
+
+ private:
+  VulkanCore::Context* context_ = nullptr;
+  EngineCore::Camera* camera_ = nullptr;
+  std::shared_ptr<VulkanCore::Pipeline> pipeline_;
+  std::shared_ptr<VulkanCore::Texture> gBufferPosition_;
+  std::shared_ptr<VulkanCore::Sampler> sampler_;
+  std::shared_ptr<EngineCore::RingBuffer> paramsBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> lightBuffer_;
+  std::shared_ptr<VulkanCore::Buffer> clusterBuffer_;
+  // The number of indices written, followed by the indices
+  std::shared_ptr<VulkanCore::Buffer> lightIndexBuffer_;
+  uint32_t lightCount_ = 0;
+  glm::uvec2 tiles_ = {};
+  uint32_t lightIndexCapacity_ = 0;
+
+  // Per frame in flight, the number of indices and timestamps around build()
+  std::vector<std::shared_ptr<VulkanCore::Buffer>> readbackBuffers_;
+  VkQueryPool queryPool_ = VK_NULL_HANDLE;
+  std::vector<bool> readbackPending_;
+
+  Stats stats_;
+};
@@ -5,6 +5,8 @@
 
 #include "enginecore/Camera.hpp"
 
+constexpr uint32_t MAX_SHADOW_CASCADES = 4;
+
 struct LightData {
   void initCam() {
     lightCam = EngineCore::Camera(glm::vec3(lightPos.x, lightPos.y, lightPos.z));
@@ -51,5 +53,12 @@ struct LightData {
   glm::aligned_mat4 lightVP;
   float innerAngle = 0.523599f;  // 30 degree
   float outerAngle = 1.22173f;   // 70 degree
+  // Set by CascadedShadowPass for a directional light along lightDir, 0 for the spot
+  // light shadow map
+  uint32_t cascadeCount = 0;
+  glm::aligned_vec4 cascadeSplits = {};  // view depth where each cascade ends
+  glm::aligned_mat4 cascadeViewProjection[MAX_SHADOW_CASCADES];
+  // Set by LightingPass when it shades the lights of a LightClusteringPass
+  uint32_t clusteredLights = 0;
   EngineCore::Camera lightCam;
 };
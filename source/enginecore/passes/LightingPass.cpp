@@ -1,5 +1,6 @@
 #include "LightingPass.hpp"
 
+#include <array>
 #include <filesystem>
 
 constexpr uint32_t GBUFFERDATA_SET = 0;
@@ -11,11 +12,19 @@ constexpr uint32_t BINDING_DEPTH = 3;
 constexpr uint32_t BINDING_POSITION = 4;
 constexpr uint32_t BINDING_AMBIENTOCCLUSION = 5;
 constexpr uint32_t BINDING_SHADOWDEPTH = 6;
+constexpr uint32_t BINDING_CASCADEDSHADOWDEPTH = 7;
 
 constexpr uint32_t TRANSFORM_LIGHT_DATA_SET = 1;
 constexpr uint32_t BINDING_TRANSFORM = 0;
 constexpr uint32_t BINDING_LIGHT = 1;
 
+// ClusteredLights.glsl
+constexpr uint32_t CLUSTERED_LIGHTS_SET = 2;
+constexpr uint32_t BINDING_CLUSTER_PARAMS = 0;
+constexpr uint32_t BINDING_CLUSTERED_LIGHTS = 1;
+constexpr uint32_t BINDING_CLUSTERS = 2;
+constexpr uint32_t BINDING_CLUSTER_LIGHT_INDICES = 3;
+
 struct Transforms {
   glm::aligned_mat4 viewProj;
   glm::aligned_mat4 viewProjInv;
@@ -24,6 +33,12 @@ struct Transforms {
 
 LightingPass::LightingPass() {}
 
+LightingPass::~LightingPass() {
+  if (queryPool_ != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(context_->device(), queryPool_, nullptr);
+  }
+}
+
 void LightingPass::init(VulkanCore::Context* context,
                         std::shared_ptr<VulkanCore::Texture> gBufferNormal,
                         std::shared_ptr<VulkanCore::Texture> gBufferSpecular,
@@ -31,7 +46,10 @@ void LightingPass::init(VulkanCore::Context* context,
                         std::shared_ptr<VulkanCore::Texture> gBufferPosition,
                         std::shared_ptr<VulkanCore::Texture> gBufferDepth,
                         std::shared_ptr<VulkanCore::Texture> ambientOcclusion,
-                        std::shared_ptr<VulkanCore::Texture> shadowDepth) {
+                        std::shared_ptr<VulkanCore::Texture> shadowDepth,
+                        std::shared_ptr<VulkanCore::Texture> lightTexture,
+                        std::shared_ptr<VulkanCore::Texture> cascadedShadowDepth,
+                        const LightClusteringPass* lightClusters) {
   context_ = context;
   width_ = context->swapchain()->extent().width;
   height_ = context->swapchain()->extent().height;
@@ -42,6 +60,18 @@ void LightingPass::init(VulkanCore::Context* context,
   gBufferDepth_ = gBufferDepth;
   ambientOcclusion_ = ambientOcclusion;
   shadowDepth_ = shadowDepth;
+  cascadedShadowDepth_ = cascadedShadowDepth;
+  lightClusters_ = lightClusters;
+
+  const uint32_t framesInFlight = context_->swapchain()->numberImages();
+
+  const VkQueryPoolCreateInfo queryPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2 * framesInFlight,
+  };
+  VK_CHECK(vkCreateQueryPool(context_->device(), &queryPoolInfo, nullptr, &queryPool_));
+  timestampsPending_.resize(framesInFlight, false);
 
   sampler_ = context_->createSampler(
       VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
@@ -54,17 +84,21 @@ void LightingPass::init(VulkanCore::Context* context,
       1.0f,  // enable these parameter if using sampler2DShadow
       true, VK_COMPARE_OP_LESS, "lighting pass shadow sampler");
 
-  outLightingTexture_ =
-      context->createTexture(VK_IMAGE_TYPE_2D, VK_FORMAT_B8G8R8A8_UNORM, 0,
-                             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
-                                 VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-                             {
-                                 .width = context->swapchain()->extent().width,
-                                 .height = context->swapchain()->extent().height,
-                                 .depth = 1,
-                             },
-                             1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
-                             VK_SAMPLE_COUNT_1_BIT, "Lighting Pass HDR Buffer");
+  if (lightTexture) {
+    outLightingTexture_ = lightTexture;
+  } else {
+    outLightingTexture_ = context->createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_B8G8R8A8_UNORM, 0,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+            VK_IMAGE_USAGE_STORAGE_BIT,
+        {
+            .width = context->swapchain()->extent().width,
+            .height = context->swapchain()->extent().height,
+            .depth = 1,
+        },
+        1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, VK_SAMPLE_COUNT_1_BIT,
+        "Lighting Pass HDR Buffer");
+  }
 
   cameraBuffer_ = context_->createPersistentBuffer(
       sizeof(Transforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
@@ -121,6 +155,9 @@ void LightingPass::init(VulkanCore::Context* context,
                   VkDescriptorSetLayoutBinding{BINDING_SHADOWDEPTH,
                                                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                                                1, VK_SHADER_STAGE_FRAGMENT_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_CASCADEDSHADOWDEPTH,
+                                               VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                                               1, VK_SHADER_STAGE_FRAGMENT_BIT},
               },
       },
       {
@@ -136,6 +173,25 @@ void LightingPass::init(VulkanCore::Context* context,
                                                VK_SHADER_STAGE_FRAGMENT_BIT},
               },
       },
+      {
+          // Only written with clustered lights, the shader doesn't read it otherwise
+          .set_ = CLUSTERED_LIGHTS_SET,
+          .bindings_ =
+              {
+                  VkDescriptorSetLayoutBinding{BINDING_CLUSTER_PARAMS,
+                                               VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1,
+                                               VK_SHADER_STAGE_FRAGMENT_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_CLUSTERED_LIGHTS,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_FRAGMENT_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_CLUSTERS,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_FRAGMENT_BIT},
+                  VkDescriptorSetLayoutBinding{BINDING_CLUSTER_LIGHT_INDICES,
+                                               VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                               VK_SHADER_STAGE_FRAGMENT_BIT},
+              },
+      },
   };
   const VulkanCore::Pipeline::GraphicsPipelineDescriptor gpDesc = {
       .sets_ = setLayout,
@@ -158,6 +214,7 @@ void LightingPass::init(VulkanCore::Context* context,
   pipeline_->allocateDescriptors({
       {.set_ = GBUFFERDATA_SET, .count_ = 1},
       {.set_ = TRANSFORM_LIGHT_DATA_SET, .count_ = 1},
+      {.set_ = CLUSTERED_LIGHTS_SET, .count_ = framesInFlight},
   });
 
   pipeline_->bindResource(GBUFFERDATA_SET, BINDING_WORLDNORMAL, 0, gBufferNormal_,
@@ -181,14 +238,39 @@ void LightingPass::init(VulkanCore::Context* context,
   // USESAMPLERFORSHADOW line in lighting.frag shader
   const bool useSampler2DForShadows = false;
 
-  pipeline_->bindResource(GBUFFERDATA_SET, BINDING_SHADOWDEPTH, 0, shadowDepth_,
-                          useSampler2DForShadows ? sampler_ : samplerShadowMap_);
+  if (shadowDepth_) {
+    pipeline_->bindResource(GBUFFERDATA_SET, BINDING_SHADOWDEPTH, 0, shadowDepth_,
+                            useSampler2DForShadows ? sampler_ : samplerShadowMap_);
+  }
+
+  if (cascadedShadowDepth_) {
+    pipeline_->bindResource(GBUFFERDATA_SET, BINDING_CASCADEDSHADOWDEPTH, 0,
+                            cascadedShadowDepth_, samplerShadowMap_);
+  }
 
   pipeline_->bindResource(TRANSFORM_LIGHT_DATA_SET, BINDING_TRANSFORM, 0, cameraBuffer_,
                           0, sizeof(Transforms), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
   pipeline_->bindResource(TRANSFORM_LIGHT_DATA_SET, BINDING_LIGHT, 0, lightBuffer_, 0,
                           sizeof(LightData), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+  if (lightClusters_) {
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+      const auto params = lightClusters_->paramsBuffer(i);
+      pipeline_->bindResource(CLUSTERED_LIGHTS_SET, BINDING_CLUSTER_PARAMS, i, params, 0,
+                              params->size(), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+      const auto lights = lightClusters_->lightBuffer();
+      pipeline_->bindResource(CLUSTERED_LIGHTS_SET, BINDING_CLUSTERED_LIGHTS, i, lights,
+                              0, lights->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      const auto clusters = lightClusters_->clusterBuffer();
+      pipeline_->bindResource(CLUSTERED_LIGHTS_SET, BINDING_CLUSTERS, i, clusters, 0,
+                              clusters->size(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      const auto lightIndices = lightClusters_->lightIndexBuffer();
+      pipeline_->bindResource(CLUSTERED_LIGHTS_SET, BINDING_CLUSTER_LIGHT_INDICES, i,
+                              lightIndices, 0, lightIndices->size(),
+                              VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    }
+  }
 }
 
 void LightingPass::render(VkCommandBuffer commandBuffer, uint32_t index,
@@ -201,7 +283,24 @@ void LightingPass::render(VkCommandBuffer commandBuffer, uint32_t index,
   transform.viewInv = glm::inverse(viewMat);
   cameraBuffer_->copyDataToBuffer(&transform, sizeof(Transforms));
 
-  lightBuffer_->copyDataToBuffer(&data, sizeof(LightData));
+  if (timestampsPending_[index]) {
+    std::array<uint64_t, 2> timestamps;
+    const auto result = vkGetQueryPoolResults(
+        context_->device(), queryPool_, 2 * index, 2, sizeof(timestamps),
+        timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      const double msPerTick =
+          context_->physicalDevice().properties().properties.limits.timestampPeriod /
+          1e6;
+      renderTimeMs_ = (timestamps[1] - timestamps[0]) * msPerTick;
+    }
+    timestampsPending_[index] = false;
+  }
+
+  LightData lightData = data;
+  lightData.clusteredLights =
+      lightClusters_ && lightClusters_->lightCount() > 0 ? 1 : 0;
+  lightBuffer_->copyDataToBuffer(&lightData, sizeof(LightData));
 
   const std::array<VkClearValue, 1> clearValues = {
       VkClearValue{.color = {0.0, 1.0, 0.0, 0.0f}}};
@@ -224,6 +323,10 @@ void LightingPass::render(VkCommandBuffer commandBuffer, uint32_t index,
       .pClearValues = clearValues.data(),
   };
 
+  vkCmdResetQueryPool(commandBuffer, queryPool_, 2 * index, 2);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_,
+                      2 * index);
+
   context_->beginDebugUtilsLabel(commandBuffer, "Lighting Pass",
                                  {0.0f, 0.0f, 1.0f, 1.0f});
 
@@ -253,6 +356,7 @@ void LightingPass::render(VkCommandBuffer commandBuffer, uint32_t index,
       commandBuffer, {
                          {.set = GBUFFERDATA_SET, .bindIdx = (uint32_t)0},
                          {.set = TRANSFORM_LIGHT_DATA_SET, .bindIdx = (uint32_t)0},
+                         {.set = CLUSTERED_LIGHTS_SET, .bindIdx = index},
                      });
   pipeline_->updateDescriptorSets();
 
@@ -261,5 +365,9 @@ void LightingPass::render(VkCommandBuffer commandBuffer, uint32_t index,
   vkCmdEndRenderPass(commandBuffer);
   context_->endDebugUtilsLabel(commandBuffer);
 
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+                      2 * index + 1);
+  timestampsPending_[index] = true;
+
   outLightingTexture_->setImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
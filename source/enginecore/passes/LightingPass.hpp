@@ -3,6 +3,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/type_aligned.hpp>
 
+#include "LightClusteringPass.hpp"
 #include "LightData.hpp"
 #include "vulkancore/Context.hpp"
 #include "vulkancore/Framebuffer.hpp"
@@ -13,6 +14,13 @@
 class LightingPass {
  public:
   LightingPass();
+
+  ~LightingPass();
+  // Renders into lightTexture when it's given (B8G8R8A8_UNORM, the size of the
+  // swapchain) instead of a texture of its own. shadowDepth is the shadow map of the
+  // spot light, cascadedShadowDepth the one of CascadedShadowPass, which is used when
+  // LightData::cascadeCount isn't 0. Only the one in use has to be given. The lights of
+  // lightClusters are shaded on top of the one of LightData
   void init(VulkanCore::Context* context,
             std::shared_ptr<VulkanCore::Texture> gBufferNormal,
             std::shared_ptr<VulkanCore::Texture> gBufferSpecular,
@@ -20,7 +28,10 @@ class LightingPass {
             std::shared_ptr<VulkanCore::Texture> gBufferPosition,
             std::shared_ptr<VulkanCore::Texture> gBufferDepth,
             std::shared_ptr<VulkanCore::Texture> ambientOcclusion,
-            std::shared_ptr<VulkanCore::Texture> shadowDepth);
+            std::shared_ptr<VulkanCore::Texture> shadowDepth,
+            std::shared_ptr<VulkanCore::Texture> lightTexture = nullptr,
+            std::shared_ptr<VulkanCore::Texture> cascadedShadowDepth = nullptr,
+            const LightClusteringPass* lightClusters = nullptr);
   void render(VkCommandBuffer cmd, uint32_t index, const LightData& data,
               const glm::mat4& viewMat, const glm::mat4& projMat);
   std::shared_ptr<VulkanCore::Pipeline> pipeline() const { return pipeline_; }
@@ -31,6 +42,9 @@ class LightingPass {
     return outLightingTexture_;
   }
 
+  // GPU time of the last frame that has been read back
+  double renderTimeMs() const { return renderTimeMs_; }
+
  private:
   VulkanCore::Context* context_ = nullptr;
   std::shared_ptr<VulkanCore::RenderPass> renderPass_;
@@ -46,11 +60,18 @@ class LightingPass {
   std::shared_ptr<VulkanCore::Texture> gBufferPosition_;
   std::shared_ptr<VulkanCore::Texture> ambientOcclusion_;
   std::shared_ptr<VulkanCore::Texture> shadowDepth_;
+  std::shared_ptr<VulkanCore::Texture> cascadedShadowDepth_;
   std::shared_ptr<VulkanCore::Sampler> sampler_;
   std::shared_ptr<VulkanCore::Sampler> samplerShadowMap_;
 
   std::shared_ptr<VulkanCore::Buffer> cameraBuffer_;
   std::shared_ptr<VulkanCore::Buffer> lightBuffer_;
+  const LightClusteringPass* lightClusters_ = nullptr;
+
+  // Per frame in flight, around the rendering
+  VkQueryPool queryPool_ = VK_NULL_HANDLE;
+  std::vector<bool> timestampsPending_;
+  double renderTimeMs_ = 0.0;
 
   uint32_t width_ = 0;
   uint32_t height_ = 0;
@@ -27,8 +27,6 @@ uint32_t alignedSize(uint32_t value, uint32_t alignment) {
 }
 
 RayTraceShadowPass::~RayTraceShadowPass() {
-  vkDestroyAccelerationStructureKHR(context_->device(), tLAS_.handle, nullptr);
-
   for (auto& [id, accelStruct] : bLAS_) {
     vkDestroyAccelerationStructureKHR(context_->device(), accelStruct.handle, nullptr);
   }
@@ -128,7 +126,7 @@ void RayTraceShadowPass::init(VulkanCore::Context* context,
       VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, 10.0f, true,
       VK_COMPARE_OP_ALWAYS, "default sampler");
 
-  pipeline_->bindResource(MAIN_SET, BINDING_TLAS, 0, &tLAS_.handle);
+  pipeline_->bindResource(MAIN_SET, BINDING_TLAS, 0, tLAS_->vkHandle());
 
   pipeline_->bindResource(MAIN_SET, BINDING_OUTPUT_IMG, 0, rayTracedImage_,
                           VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
@@ -143,6 +141,11 @@ void RayTraceShadowPass::init(VulkanCore::Context* context,
                           sizeof(LightData), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 }
 
+void RayTraceShadowPass::setInstanceTransform(uint32_t meshIdx,
+                                              const glm::mat4& transform) {
+  tLAS_->setTransform(meshIdx, transform);
+}
+
 void RayTraceShadowPass::createShaderBindingTable() {
   const uint32_t handleSize =
       context_->physicalDevice().rayTracingProperties().shaderGroupHandleSize;
@@ -231,123 +234,10 @@ void RayTraceShadowPass::initRayTracedStorageImages() {
 void RayTraceShadowPass::initBottomLevelAccelStruct(
     std::shared_ptr<EngineCore::Model> model,
     std::vector<std::shared_ptr<VulkanCore::Buffer>> buffers) {
-  // buffers[0] - vertex, buffers[1] - index, buffers[3] - indirect, buffers[2] - material
-  for (int meshIdx = 0; meshIdx < model->meshes.size(); ++meshIdx) {
-    VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress{
-        .deviceAddress =
-            buffers[0]->vkDeviceAddress() +
-            model->indirectDrawDataSet[meshIdx].vertexOffset * sizeof(EngineCore::Vertex),
-    };
-    VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress{
-        .deviceAddress =
-            buffers[1]->vkDeviceAddress() +
-            model->indirectDrawDataSet[meshIdx].firstIndex * sizeof(uint32_t),
-    };
-
-    uint32_t numTriangles = model->meshes[meshIdx].indices.size() / 3;
-
-    uint32_t numVertices = model->meshes[meshIdx].vertices.size();
-
-    // Build
-    VkAccelerationStructureGeometryKHR accelerationStructureGeometry{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-        .geometry =
-            {
-                .triangles =
-                    {
-                        .sType =
-                            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
-                        .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-                        .vertexData = vertexBufferDeviceAddress,
-                        .vertexStride = sizeof(EngineCore::Vertex),
-                        .maxVertex = numVertices,
-                        .indexType = VK_INDEX_TYPE_UINT32,
-                        .indexData = indexBufferDeviceAddress,
-                        .transformData =
-                            {
-                                .hostAddress = nullptr,
-                            },
-                    },
-            },
-    };
-
-    VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-        .geometryCount = 1,
-        .pGeometries = &accelerationStructureGeometry,
-    };
-
-    VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-    };
-    vkGetAccelerationStructureBuildSizesKHR(
-        context_->device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-        &accelerationStructureBuildGeometryInfo, &numTriangles,
-        &accelerationStructureBuildSizesInfo);
-
-    bLAS_[meshIdx].buffer = context_->createBuffer(
-        accelerationStructureBuildSizesInfo.accelerationStructureSize,
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY, "Bottom Level accel struct buffer");
-
-    // Acceleration structure
-    VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-        .buffer = bLAS_[meshIdx].buffer->vkBuffer(),
-        .offset = 0,
-        .size = accelerationStructureBuildSizesInfo.accelerationStructureSize,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-
-    };
-
-    VK_CHECK(vkCreateAccelerationStructureKHR(context_->device(),
-                                              &accelerationStructureCreateInfo, nullptr,
-                                              &bLAS_[meshIdx].handle));
-
-    auto tempBuffer = context_->createBuffer(
-        accelerationStructureBuildSizesInfo.buildScratchSize,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY, "Temporary buffer for bLAS");
-
-    VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-        .dstAccelerationStructure = bLAS_[meshIdx].handle,
-        .geometryCount = 1,
-        .pGeometries = &accelerationStructureGeometry,
-        .scratchData =
-            {
-                .deviceAddress = tempBuffer->vkDeviceAddress(),
-            },
-    };
-
-    VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{};
-    accelerationStructureBuildRangeInfo.primitiveCount = numTriangles;
-    accelerationStructureBuildRangeInfo.primitiveOffset = 0;
-    accelerationStructureBuildRangeInfo.firstVertex = 0;
-    accelerationStructureBuildRangeInfo.transformOffset = 0;
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*>
-        accelerationBuildStructureRangeInfos = {&accelerationStructureBuildRangeInfo};
-
-    auto commandQueueMgr = context_->createGraphicsCommandQueue(
-        1, 1, "BLAS acceleration struct build command queue");
-
-    const auto commandBuffer = commandQueueMgr.getCmdBufferToBegin();
-    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &accelerationBuildGeometryInfo,
-                                        accelerationBuildStructureRangeInfos.data());
-    commandQueueMgr.endCmdBuffer(commandBuffer);
-
-    VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    const auto submitInfo =
-        context_->swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
-    commandQueueMgr.submit(&submitInfo);
-    commandQueueMgr.waitUntilSubmitIsComplete();
+  auto accelStructs = EngineCore::buildBottomLevelAccelStructs(*context_, *model, buffers,
+                                                               &blasBuildStats_);
+  for (uint32_t meshIdx = 0; meshIdx < accelStructs.size(); ++meshIdx) {
+    bLAS_[meshIdx] = std::move(accelStructs[meshIdx]);
   }
 }
 
@@ -356,6 +246,8 @@ void RayTraceShadowPass::initTopLevelAccelStruct(
     std::vector<std::shared_ptr<VulkanCore::Buffer>> buffers) {
   glm::mat4 identityMat = glm::identity<glm::mat4>();
 
+  std::vector<VkAccelerationStructureInstanceKHR> accelarationInstances;
+
   for (int meshIdx = 0; meshIdx < model->meshes.size(); ++meshIdx) {
     VkAccelerationStructureInstanceKHR instance{};
 
@@ -373,129 +265,22 @@ void RayTraceShadowPass::initTopLevelAccelStruct(
     instance.instanceShaderBindingTableRecordOffset =
         0;  // We will use the same hit group for all objects
     instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-    instance.accelerationStructureReference = bLAS_[meshIdx].buffer->vkDeviceAddress();
+    instance.accelerationStructureReference = bLAS_[meshIdx].deviceAddress;
 
-    accelarationInstances_.push_back(instance);
+    accelarationInstances.push_back(instance);
   }
 
-  auto instBuffer = context_->createBuffer(
-      sizeof(VkAccelerationStructureInstanceKHR) * accelarationInstances_.size(),
-      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-          VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-      VMA_MEMORY_USAGE_CPU_ONLY, "Top level accel struct instance buffer");
-
-  instBuffer->copyDataToBuffer(accelarationInstances_.data(), instBuffer->size());
-
-  VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress{
-      .deviceAddress = instBuffer->vkDeviceAddress(),
-  };
-
-  VkAccelerationStructureGeometryKHR accelerationStructureGeometry{
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
-      .geometry =
-          {
-              .instances =
-                  {
-                      .sType =
-                          VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
-                      .arrayOfPointers = VK_FALSE,
-                      .data = instanceDataDeviceAddress,
-                  },
-          },
-      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
-  };
-
-  VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo{
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
-               VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
-      .geometryCount = 1,
-      .pGeometries = &accelerationStructureGeometry,
-  };
-
-  uint32_t primitiveCount = static_cast<uint32_t>(accelarationInstances_.size());
-
-  VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo{
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
-  };
-  vkGetAccelerationStructureBuildSizesKHR(
-      context_->device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-      &accelerationStructureBuildGeometryInfo, &primitiveCount,
-      &accelerationStructureBuildSizesInfo);
-
-  tLAS_.buffer = context_->createBuffer(
-      accelerationStructureBuildSizesInfo.accelerationStructureSize,
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR |
-          VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-      VMA_MEMORY_USAGE_GPU_ONLY, "Top Level accel struct buffer");
-
-  // Acceleration structure
-  VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-      .buffer = tLAS_.buffer->vkBuffer(),
-      .offset = 0,
-      .size = accelerationStructureBuildSizesInfo.accelerationStructureSize,
-      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-
-  };
-
-  VK_CHECK(vkCreateAccelerationStructureKHR(
-      context_->device(), &accelerationStructureCreateInfo, nullptr, &tLAS_.handle));
-
-  auto tempBuffer = context_->createBuffer(
-      accelerationStructureBuildSizesInfo.buildScratchSize,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-      VMA_MEMORY_USAGE_GPU_ONLY, "Temporary buffer for bLAS");
-
-  VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo{
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
-               VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
-      .mode =
-          VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,  // use
-                                                           // VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
-                                                           // when updating
-      .srcAccelerationStructure = tLAS_.handle,
-      .dstAccelerationStructure = tLAS_.handle,
-      .geometryCount = 1,
-      .pGeometries = &accelerationStructureGeometry,
-      .scratchData =
-          {
-              .deviceAddress = tempBuffer->vkDeviceAddress(),
-          },
-  };
-
-  VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo{
-      .primitiveCount = static_cast<uint32_t>(accelarationInstances_.size()),
-      .primitiveOffset = 0,
-      .firstVertex = 0,
-      .transformOffset = 0,
-  };
-  std::vector<VkAccelerationStructureBuildRangeInfoKHR*>
-      accelerationBuildStructureRangeInfos = {&accelerationStructureBuildRangeInfo};
-
-  auto commandQueueMgr = context_->createGraphicsCommandQueue(
-      1, 1, "TLAS acceleration struct build command queue");
-
-  const auto commandBuffer = commandQueueMgr.getCmdBufferToBegin();
-  vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &accelerationBuildGeometryInfo,
-                                      accelerationBuildStructureRangeInfos.data());
-  commandQueueMgr.endCmdBuffer(commandBuffer);
-
-  VkPipelineStageFlags flags = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  const auto submitInfo =
-      context_->swapchain()->createSubmitInfo(&commandBuffer, &flags, false, false);
-  commandQueueMgr.submit(&submitInfo);
-  commandQueueMgr.waitUntilSubmitIsComplete();
+  tLAS_ = std::make_unique<EngineCore::TopLevelAccelStruct>(
+      *context_, std::move(accelarationInstances),
+      context_->swapchain()->numberImages());
 }
 
 void RayTraceShadowPass::execute(VkCommandBuffer commandBuffer, uint32_t swapchainIndex,
                                  const LightData& data) {
   lightBuffer_->copyDataToBuffer(&data, sizeof(LightData));
 
+  tLAS_->update(commandBuffer);
+
   pipeline_->bind(commandBuffer);
   pipeline_->bindDescriptorSets(commandBuffer,
                                 {
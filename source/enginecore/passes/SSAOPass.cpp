@@ -18,7 +18,8 @@ SSAOPass::SSAOPass() {}
 SSAOPass::~SSAOPass() {}
 
 void SSAOPass::init(VulkanCore::Context* context,
-                    std::shared_ptr<VulkanCore::Texture> gBufferDepth) {
+                    std::shared_ptr<VulkanCore::Texture> gBufferDepth,
+                    std::shared_ptr<VulkanCore::Texture> ssaoTexture) {
   context_ = context;
   gBufferDepth_ = gBufferDepth;
 
@@ -27,16 +28,20 @@ void SSAOPass::init(VulkanCore::Context* context,
       VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
       100.0f, "default sampler");
 
-  outSSAOTexture_ = context_->createTexture(
-      VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
-      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-      VkExtent3D{
-          .width = context_->swapchain()->extent().width,
-          .height = context_->swapchain()->extent().height,
-          .depth = 1u,
-      },
-                              1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
-                              VK_SAMPLE_COUNT_1_BIT, "SSAO texture");
+  if (ssaoTexture) {
+    outSSAOTexture_ = ssaoTexture;
+  } else {
+    outSSAOTexture_ = context_->createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, 0,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VkExtent3D{
+            .width = context_->swapchain()->extent().width,
+            .height = context_->swapchain()->extent().height,
+            .depth = 1u,
+        },
+        1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, VK_SAMPLE_COUNT_1_BIT,
+        "SSAO texture");
+  }
 
   const auto resourcesFolder = std::filesystem::current_path() / "resources/shaders/";
 
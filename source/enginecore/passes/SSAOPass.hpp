@@ -8,8 +8,11 @@ class SSAOPass {
  public:
   SSAOPass();
   ~SSAOPass();
+  // ssaoTexture, if any, is used as the output instead of a texture created by the pass.
+  // It must be a R8G8B8A8_UNORM storage image that can be sampled
   void init(VulkanCore::Context* context,
-            std::shared_ptr<VulkanCore::Texture> gBufferDepth);
+            std::shared_ptr<VulkanCore::Texture> gBufferDepth,
+            std::shared_ptr<VulkanCore::Texture> ssaoTexture = nullptr);
 
   void run(VkCommandBuffer cmd);
 
@@ -37,7 +37,8 @@ void SSRIntersectPass::init(VulkanCore::Context* context, EngineCore::Camera* ca
                             std::shared_ptr<VulkanCore::Texture> gBufferSpecular,
                             std::shared_ptr<VulkanCore::Texture> gBufferBaseColor,
                             std::shared_ptr<VulkanCore::Texture> hierarchicalDepth,
-                            std::shared_ptr<VulkanCore::Texture> noiseTexture) {
+                            std::shared_ptr<VulkanCore::Texture> noiseTexture,
+                            std::shared_ptr<VulkanCore::Texture> intersectTexture) {
   context_ = context;
   camera_ = camera;
   gBufferNormal_ = gBufferNormal;
@@ -51,16 +52,20 @@ void SSRIntersectPass::init(VulkanCore::Context* context, EngineCore::Camera* ca
       VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
       100.0f, "default sampler");
 
-  outSSRIntersectTexture_ = context_->createTexture(
-      VK_IMAGE_TYPE_2D, VK_FORMAT_R16G16B16A16_SFLOAT, 0,
-      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-      VkExtent3D{
-          .width = context_->swapchain()->extent().width,
-          .height = context_->swapchain()->extent().height,
-          .depth = 1u,
-      },
-                              1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true,
-                              VK_SAMPLE_COUNT_1_BIT, "SSR IntersectTexture");
+  if (intersectTexture) {
+    outSSRIntersectTexture_ = intersectTexture;
+  } else {
+    outSSRIntersectTexture_ = context_->createTexture(
+        VK_IMAGE_TYPE_2D, VK_FORMAT_R16G16B16A16_SFLOAT, 0,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        VkExtent3D{
+            .width = context_->swapchain()->extent().width,
+            .height = context_->swapchain()->extent().height,
+            .depth = 1u,
+        },
+        1, 1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, VK_SAMPLE_COUNT_1_BIT,
+        "SSR IntersectTexture");
+  }
 
   cameraBuffer_ = context_->createPersistentBuffer(sizeof(Transforms),
                                                    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
@@ -8,12 +8,15 @@ class SSRIntersectPass {
  public:
   SSRIntersectPass();
   ~SSRIntersectPass();
+  // The intersections are written to intersectTexture when it's given, a
+  // R16G16B16A16_SFLOAT storage image the size of the swapchain
   void init(VulkanCore::Context* context, EngineCore::Camera* camera,
             std::shared_ptr<VulkanCore::Texture> gBufferNormal,
             std::shared_ptr<VulkanCore::Texture> gBufferSpecular,
             std::shared_ptr<VulkanCore::Texture> gBufferBaseColor,
             std::shared_ptr<VulkanCore::Texture> hierarchicalDepth,
-            std::shared_ptr<VulkanCore::Texture> noiseTexture);
+            std::shared_ptr<VulkanCore::Texture> noiseTexture,
+            std::shared_ptr<VulkanCore::Texture> intersectTexture = nullptr);
 
   void run(VkCommandBuffer cmd);
 
@@ -16,9 +16,14 @@ constexpr uint32_t BINDING_3 = 3;
 
 ShadowPass::ShadowPass() {}
 
-void ShadowPass::init(VulkanCore::Context* context) {
+void ShadowPass::init(VulkanCore::Context* context,
+                      std::shared_ptr<VulkanCore::Texture> depthTexture) {
   context_ = context;
-  initTextures(context);
+  if (depthTexture) {
+    depthTexture_ = depthTexture;
+  } else {
+    initTextures(context);
+  }
   renderPass_ = context->createRenderPass(
       {depthTexture_}, {VK_ATTACHMENT_LOAD_OP_CLEAR}, {VK_ATTACHMENT_STORE_OP_STORE},
       // final layout for all attachments
@@ -109,6 +114,45 @@ void ShadowPass::render(VkCommandBuffer commandBuffer, int frameIndex,
                         const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
                         VkBuffer indexBuffer, VkBuffer indirectDrawBuffer,
                         uint32_t numMeshes, uint32_t bufferSize) {
+  context_->beginDebugUtilsLabel(commandBuffer, "ShadowMap Pass",
+                                 {0.0f, 1.0f, 0.0f, 1.0f});
+
+  beginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+  recordDraws(commandBuffer, sets, indexBuffer, indirectDrawBuffer, 0, numMeshes,
+              bufferSize);
+  endRenderPass(commandBuffer);
+}
+
+void ShadowPass::render(VkCommandBuffer commandBuffer, int frameIndex,
+                        const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+                        VkBuffer indexBuffer, VkBuffer indirectDrawBuffer,
+                        uint32_t numMeshes, uint32_t bufferSize,
+                        VulkanCore::CommandQueueManager& queueMgr,
+                        VulkanCore::ParallelCommandRecorder& recorder,
+                        BS::thread_pool& pool) {
+  context_->beginDebugUtilsLabel(commandBuffer, "ShadowMap Pass (parallel)",
+                                 {0.0f, 1.0f, 0.0f, 1.0f});
+
+  // Descriptor sets can't be updated while the workers record commands that use them
+  pipeline_->updateDescriptorSets();
+
+  beginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  recorder.record(
+      queueMgr, commandBuffer,
+      {
+          .renderPass = renderPass_->vkRenderPass(),
+          .framebuffer = frameBuffer_->vkFramebuffer(),
+      },
+      numMeshes, pool,
+      [&](VkCommandBuffer secondaryCmdBuffer, uint32_t first, uint32_t count) {
+        recordDraws(secondaryCmdBuffer, sets, indexBuffer, indirectDrawBuffer, first,
+                    count, bufferSize);
+      });
+  endRenderPass(commandBuffer);
+}
+
+void ShadowPass::beginRenderPass(VkCommandBuffer commandBuffer,
+                                 VkSubpassContents contents) {
   const std::array<VkClearValue, 1> clearValues = {VkClearValue{.depthStencil = {1.0f}}};
   const VkRenderPassBeginInfo renderpassInfo = {
       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -128,11 +172,14 @@ void ShadowPass::render(VkCommandBuffer commandBuffer, int frameIndex,
       .pClearValues = clearValues.data(),
   };
 
-  context_->beginDebugUtilsLabel(commandBuffer, "ShadowMap Pass",
-                                 {0.0f, 1.0f, 0.0f, 1.0f});
-
-  vkCmdBeginRenderPass(commandBuffer, &renderpassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  vkCmdBeginRenderPass(commandBuffer, &renderpassInfo, contents);
+}
 
+void ShadowPass::recordDraws(
+    VkCommandBuffer commandBuffer,
+    const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+    VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, uint32_t firstDraw,
+    uint32_t drawCount, uint32_t bufferSize) {
   const VkViewport viewport = {
       .x = 0.0f,
       .y = static_cast<float>(depthTexture_->vkExtents().height),
@@ -158,11 +205,14 @@ void ShadowPass::render(VkCommandBuffer commandBuffer, int frameIndex,
 
   vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-  vkCmdDrawIndexedIndirect(commandBuffer, indirectDrawBuffer, 0, numMeshes, bufferSize);
+  vkCmdDrawIndexedIndirect(commandBuffer, indirectDrawBuffer,
+                           VkDeviceSize(firstDraw) * bufferSize, drawCount, bufferSize);
+}
 
+void ShadowPass::endRenderPass(VkCommandBuffer commandBuffer) {
   vkCmdEndRenderPass(commandBuffer);
   context_->endDebugUtilsLabel(commandBuffer);
-  depthTexture_->setImageLayout(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  depthTexture_->setImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
 
 void ShadowPass::initTextures(VulkanCore::Context* context) {
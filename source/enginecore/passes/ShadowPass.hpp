@@ -1,9 +1,12 @@
 #pragma once
+#include "BS_thread_pool.hpp"
 #include "LightData.hpp"
 #include "enginecore/Camera.hpp"
 #include "enginecore/Model.hpp"
 #include "enginecore/RingBuffer.hpp"
+#include "vulkancore/CommandQueueManager.hpp"
 #include "vulkancore/Framebuffer.hpp"
+#include "vulkancore/ParallelCommandRecorder.hpp"
 #include "vulkancore/Pipeline.hpp"
 #include "vulkancore/RenderPass.hpp"
 #include "vulkancore/Texture.hpp"
@@ -12,13 +15,24 @@ class ShadowPass {
  public:
   ShadowPass();
 
-  void init(VulkanCore::Context* context);
+  // depthTexture replaces the shadow map the pass creates (a render graph texture, for
+  // instance), it must be a D24_UNORM_S8_UINT depth attachment that can be sampled
+  void init(VulkanCore::Context* context,
+            std::shared_ptr<VulkanCore::Texture> depthTexture = nullptr);
 
   void render(VkCommandBuffer cmd, int frameIndex,
               const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
               VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, uint32_t numMeshes,
               uint32_t bufferSize);
 
+  // Splits the indirect draws in ranges recorded by the threads of pool into secondary
+  // command buffers
+  void render(VkCommandBuffer cmd, int frameIndex,
+              const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+              VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, uint32_t numMeshes,
+              uint32_t bufferSize, VulkanCore::CommandQueueManager& queueMgr,
+              VulkanCore::ParallelCommandRecorder& recorder, BS::thread_pool& pool);
+
   std::shared_ptr<VulkanCore::Pipeline> pipeline() const { return pipeline_; }
 
   std::shared_ptr<VulkanCore::Texture> shadowDepthTexture() const {
@@ -28,6 +42,16 @@ class ShadowPass {
  private:
   void initTextures(VulkanCore::Context* context);
 
+  void beginRenderPass(VkCommandBuffer cmd, VkSubpassContents contents);
+
+  // Draws [firstDraw, firstDraw + drawCount) of indirectDrawBuffer
+  void recordDraws(VkCommandBuffer cmd,
+                   const std::vector<VulkanCore::Pipeline::SetAndBindingIndex>& sets,
+                   VkBuffer indexBuffer, VkBuffer indirectDrawBuffer, uint32_t firstDraw,
+                   uint32_t drawCount, uint32_t bufferSize);
+
+  void endRenderPass(VkCommandBuffer cmd);
+
  private:
   VulkanCore::Context* context_ = nullptr;
   std::shared_ptr<VulkanCore::Texture> depthTexture_;
@@ -0,0 +1,74 @@
+#ifndef SHADER_CLUSTERED_LIGHTS_GLSL
+#define SHADER_CLUSTERED_LIGHTS_GLSL
+
+// The lights sorted into clusters by lightclustering.comp, see LightClusteringPass.
+// CLUSTERED_LIGHTS_SET must be defined before including this file, and
+// CLUSTERED_LIGHTS_WRITER in lightclustering.comp, the only shader that writes them
+
+#ifdef CLUSTERED_LIGHTS_WRITER
+#define CLUSTERS_ACCESS
+#else
+#define CLUSTERS_ACCESS readonly
+#endif
+
+// LightClusteringPass.hpp
+const uint CLUSTER_TILE_SIZE = 32;
+const uint CLUSTER_DEPTH_SLICES = 24;
+
+struct ClusteredLight {
+  vec4 positionRange;   // world position, distance where the light fades out
+  vec4 colorIntensity;
+  vec4 spotDirection;   // direction the light shines along
+  vec4 spotCone;        // cosine of the inner and outer angles, -1 for point lights
+};
+
+layout(set = CLUSTERED_LIGHTS_SET, binding = 0) uniform ClusterParams {
+  mat4 view;
+  uvec4 gridSize;      // tiles in x and y, depth slices
+  vec4 depthSlicing;   // near plane, depth slices / log(far / near)
+  uvec4 counts;        // lights, capacity of lightIndices
+}
+clusterParams;
+
+layout(set = CLUSTERED_LIGHTS_SET, binding = 1) readonly buffer ClusteredLightBuffer {
+  ClusteredLight lights[];
+};
+
+// Offset in lightIndices and light count of each cluster
+layout(set = CLUSTERED_LIGHTS_SET, binding = 2) CLUSTERS_ACCESS buffer Clusters {
+  uvec2 clusters[];
+};
+
+layout(set = CLUSTERED_LIGHTS_SET, binding = 3) CLUSTERS_ACCESS buffer LightIndices {
+  uint lightIndexCount;
+  uint lightIndices[];
+};
+
+// The slices get thicker with the distance, like the perspective stretches them
+uint clusterSlice(float viewDepth) {
+  float nearPlane = clusterParams.depthSlicing.x;
+  float slice = log(max(viewDepth, nearPlane) / nearPlane) * clusterParams.depthSlicing.y;
+  return min(uint(slice), CLUSTER_DEPTH_SLICES - 1);
+}
+
+uint clusterIndex(uvec2 tile, uint slice) {
+  return (slice * clusterParams.gridSize.y + tile.y) * clusterParams.gridSize.x + tile.x;
+}
+
+// The light reaching worldPos, L is the direction towards the light
+vec3 clusteredLightRadiance(ClusteredLight light, vec3 worldPos, out vec3 L) {
+  vec3 toLight = light.positionRange.xyz - worldPos;
+  float lightDistance = length(toLight);
+  L = toLight / max(lightDistance, 1e-4);
+
+  // Inverse square falloff, windowed to reach 0 at the range of the light
+  float window = clamp(1.0 - pow(lightDistance / light.positionRange.w, 4.0), 0.0, 1.0);
+  float attenuation = window * window / (lightDistance * lightDistance + 1.0);
+  if (light.spotCone.y > -1.0) {
+    attenuation *= smoothstep(light.spotCone.y, light.spotCone.x,
+                              dot(-L, light.spotDirection.xyz));
+  }
+  return light.colorIntensity.rgb * light.colorIntensity.w * attenuation;
+}
+
+#endif
@@ -61,6 +61,81 @@ struct IndirectDrawCount {
 
 struct CullingPushConstants {
   uint count;
+  uint phase;
+};
+
+struct CullingStats {
+  uint frustumCulled;
+  uint occlusionCulled;
+  // Of the drawn meshes, at full detail and at the LODs that were picked
+  uint trianglesFullDetail;
+  uint trianglesSubmitted;
+};
+
+// EngineCore::MeshLod
+struct MeshLod {
+  uint firstIndex;
+  uint indexCount;
+  float error;
+  uint padding;
+};
+
+const uint MAX_MESH_LODS = 8;  // EngineCore::MAX_MESH_LODS
+
+struct MeshLods {
+  uint lodCount;
+  uint padding0;
+  uint padding1;
+  uint padding2;
+  MeshLod lods[MAX_MESH_LODS];
+};
+
+// World space bounding box of an instance and the draw it belongs to
+struct InstanceBounds {
+  vec3 center;
+  uint drawIndex;
+  vec3 extents;
+  uint padding;
+};
+
+// EngineCore::MeshInstance
+struct InstanceData {
+  mat4 transform;
+  uint meshId;
+  int materialIndex;
+  uint padding0;
+  uint padding1;
+};
+
+struct InstanceCullingPushConstants {
+  uint instanceCount;
+  uint drawCount;
+  uint phase;
+};
+
+// EngineCore::Meshlet
+struct Meshlet {
+  vec3 center;
+  float radius;
+  vec3 coneApex;
+  float coneCutoff;
+  vec3 coneAxis;
+  uint meshId;
+  uint vertexOffset;
+  uint triangleOffset;
+  uint vertexCount;
+  uint triangleCount;
+};
+
+struct ClusterCullingPushConstants {
+  uint meshletCount;
+  uint occlusionCulling;
+};
+
+struct ClusterCullingStats {
+  uint frustumCulled;
+  uint backfaceCulled;
+  uint occlusionCulled;
 };
 
 #endif
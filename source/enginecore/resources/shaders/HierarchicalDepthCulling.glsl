@@ -0,0 +1,53 @@
+#ifndef SHADER_HIERARCHICAL_DEPTH_CULLING_GLSL
+#define SHADER_HIERARCHICAL_DEPTH_CULLING_GLSL
+
+// Whether the box is hidden behind the depth of the hierarchical depth texture, whose .x
+// is 1 - the farthest depth of the texels covered. hierarchicalDepthSize is the width,
+// height and mip levels of the texture
+bool isBoxOccluded(sampler2D hierarchicalDepth, vec3 hierarchicalDepthSize,
+                   mat4 viewProjection, vec3 center, vec3 extents) {
+  vec2 uvMin = vec2(1.0);
+  vec2 uvMax = vec2(0.0);
+  float nearestDepth = 1.0;
+
+  for (int i = 0; i < 8; i++) {
+    vec3 corner = center + extents * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                          (i & 2) != 0 ? 1.0 : -1.0,
+                                          (i & 4) != 0 ? 1.0 : -1.0);
+    vec4 clip = viewProjection * vec4(corner, 1.0);
+    // Boxes crossing the near plane are kept
+    if (clip.w <= 0.0 || clip.z < 0.0) {
+      return false;
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    // The viewport is flipped vertically
+    vec2 uv = vec2(0.5 + 0.5 * ndc.x, 0.5 - 0.5 * ndc.y);
+    uvMin = min(uvMin, uv);
+    uvMax = max(uvMax, uv);
+    nearestDepth = min(nearestDepth, ndc.z);
+  }
+
+  uvMin = clamp(uvMin, 0.0, 1.0);
+  uvMax = clamp(uvMax, 0.0, 1.0);
+
+  // Pick the mip where the box covers at most 2x2 texels
+  vec2 sizeInPixels = (uvMax - uvMin) * hierarchicalDepthSize.xy;
+  int mipLevels = int(hierarchicalDepthSize.z);
+  int mip = clamp(int(ceil(log2(max(max(sizeInPixels.x, sizeInPixels.y), 1.0)))), 0,
+                  mipLevels - 1);
+
+  ivec2 mipSize = textureSize(hierarchicalDepth, mip);
+  ivec2 texelMin = clamp(ivec2(uvMin * vec2(mipSize)), ivec2(0), mipSize - 1);
+  ivec2 texelMax = clamp(ivec2(uvMax * vec2(mipSize)), ivec2(0), mipSize - 1);
+
+  float farthest = min(
+      min(texelFetch(hierarchicalDepth, texelMin, mip).x,
+          texelFetch(hierarchicalDepth, ivec2(texelMax.x, texelMin.y), mip).x),
+      min(texelFetch(hierarchicalDepth, ivec2(texelMin.x, texelMax.y), mip).x,
+          texelFetch(hierarchicalDepth, texelMax, mip).x));
+  float farthestDepth = 1.0 - farthest;
+
+  return nearestDepth > farthestDepth;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#version 460
+#extension GL_ARB_shader_viewport_layer_array : require
+#extension GL_GOOGLE_include_directive : require
+#include "CommonStructs.glsl"
+
+const uint MAX_SHADOW_CASCADES = 4;  // LightData.hpp
+
+layout(set = 0, binding = 0) readonly buffer VertexBuffer {
+  Vertex vertices[];
+};
+
+layout(set = 1, binding = 0) uniform CascadeBuffer {
+  mat4 cascadeViewProjection[MAX_SHADOW_CASCADES];
+};
+
+layout(push_constant) uniform constants {
+  uint cascade;
+};
+
+void main() {
+  Vertex vertex = vertices[gl_VertexIndex];
+  gl_Position =
+      cascadeViewProjection[cascade] * vec4(vertex.posX, vertex.posY, vertex.posZ, 1.0);
+  gl_Layer = int(cascade);
+}
@@ -17,6 +17,11 @@ layout(set = 0, binding = 6) uniform sampler2D shadowMap;
 layout(set = 0, binding = 6) uniform sampler2DShadow shadowMap;
 #endif
 
+// One layer per cascade, see CascadedShadowPass
+layout(set = 0, binding = 7) uniform sampler2DArrayShadow cascadedShadowMap;
+
+const uint MAX_SHADOW_CASCADES = 4;  // LightData.hpp
+
 layout(set = 1, binding = 0) uniform Transforms {
   mat4 viewProj;
   mat4 viewProjInv;
@@ -32,9 +37,17 @@ layout(set = 1, binding = 1) uniform Lights {
   mat4 lightVP;
   float innerConeAngle;
   float outerConeAngle;
+  // With cascades, the light is directional and shines along -lightDir
+  uint cascadeCount;
+  vec4 cascadeSplits;  // view depth where each cascade ends
+  mat4 cascadeViewProjection[MAX_SHADOW_CASCADES];
+  uint clusteredLights;  // whether the lights of ClusteredLights.glsl are shaded
 }
 lightData;
 
+#define CLUSTERED_LIGHTS_SET 2
+#include "ClusteredLights.glsl"
+
 layout(location = 0) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
@@ -103,6 +116,51 @@ float PCF(vec4 clipSpaceCoordWrtLight) {
   return result / 16.0;
 }
 
+// Diffuse and specular reflection of the light coming from L
+vec3 directLighting(vec3 N, vec3 V, vec3 L, vec3 basecolor, vec3 F0, float metallic,
+                    float roughness) {
+  vec3 H = normalize(V + L);
+  vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+  float D = distributionGGX(N, H, roughness);
+  float G = geometrySmith(N, V, L, roughness);
+  float NdotL = max(dot(N, L), 0.0);
+  vec3 specular = D * G * F / (4.0 * max(dot(N, V), 0.0) * NdotL + 0.001);
+  vec3 kD = (vec3(1.0) - F) * (1.0 - metallic);
+  return (kD * basecolor / 3.14159265359 + specular) * NdotL;
+}
+
+// 16 taps in the cascade that covers the view depth of worldPos, no shadow past the
+// last one
+float cascadedShadow(vec3 worldPos, vec3 camPos) {
+  vec3 forward = -cameraData.viewInv[2].xyz;
+  float viewDepth = dot(worldPos - camPos, forward);
+  uint cascade = 0;
+  while (cascade < lightData.cascadeCount &&
+         viewDepth > lightData.cascadeSplits[cascade]) {
+    ++cascade;
+  }
+  if (cascade == lightData.cascadeCount) {
+    return 1.0;
+  }
+
+  // Orthographic projection, w is 1
+  vec4 coordWrtLight = lightData.cascadeViewProjection[cascade] * vec4(worldPos, 1.0);
+  vec2 texCoord = coordWrtLight.xy * .5 + .5;
+  texCoord.y = 1.0 - texCoord.y;
+  const float depthBias = 0.0005;
+  float depth = coordWrtLight.z - depthBias;
+
+  vec2 texelSize = 1.0 / vec2(textureSize(cascadedShadowMap, 0).xy);
+  float result = 0.0;
+  for (float i = -1.5; i <= 1.5; i += 1.0) {
+    for (float j = -1.5; j <= 1.5; j += 1.0) {
+      result += texture(cascadedShadowMap,
+                        vec4(texCoord + vec2(i, j) * texelSize, float(cascade), depth));
+    }
+  }
+  return result / 16.0;
+}
+
 void main() {
   float depth = texture(gBufferDepth, fragTexCoord).r;
   vec4 worldPos = texture(gBufferPosition, fragTexCoord);
@@ -126,8 +184,10 @@ void main() {
 
   vec3 F0 = vec3(0.04);
   F0 = mix(F0, basecolor, metallic);
-  vec3 L = normalize(lightData.lightDir.xyz -
-                     worldPos.xyz);  // Using spotlight direction
+  const bool directional = lightData.cascadeCount > 0;
+  vec3 L = directional ? normalize(lightData.lightDir.xyz)
+                       : normalize(lightData.lightDir.xyz -
+                                   worldPos.xyz);  // Using spotlight direction
   vec3 H = normalize(V + L);
 
   vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
@@ -158,7 +218,8 @@ void main() {
   float spotAttenuation =
       smoothstep(lightData.outerConeAngle, lightData.innerConeAngle, cosTheta);
   vec3 lightIntensity =
-      spotAttenuation * attenuation * lightData.lightColor.rgb;
+      directional ? lightData.lightColor.rgb
+                  : spotAttenuation * attenuation * lightData.lightColor.rgb;
 
   // Final light contribution
   vec3 finalColor = (NdotL * (lightIntensity) * (diffuse + specular)) + ambient;
@@ -168,12 +229,37 @@ void main() {
 
   outColor = vec4(finalColor, 1.0);
 
-  vec4 clipSpaceCoordWrtLight = lightData.lightVP * vec4(worldPos.xyz, 1.0f);
-  float vis = PCF(clipSpaceCoordWrtLight);
+  float vis = 1.0;
+  if (directional) {
+    vis = cascadedShadow(worldPos.xyz, camPos);
+  } else {
+    vec4 clipSpaceCoordWrtLight = lightData.lightVP * vec4(worldPos.xyz, 1.0f);
+    vis = PCF(clipSpaceCoordWrtLight);
+  }
 
   if (vis <= .001) {
     vis = .3;
   }
 
   outColor.xyz *= vis;
+
+  // Only the lights of the cluster of the pixel, see lightclustering.comp, which reads
+  // the same texel of gBufferPosition
+  if (lightData.clusteredLights != 0) {
+    uvec2 tile = uvec2(fragTexCoord * vec2(textureSize(gBufferPosition, 0))) /
+                 CLUSTER_TILE_SIZE;
+    tile = min(tile, clusterParams.gridSize.xy - 1);
+    float viewDepth = -(clusterParams.view * vec4(worldPos.xyz, 1.0)).z;
+    uvec2 cluster = clusters[clusterIndex(tile, clusterSlice(viewDepth))];
+
+    vec3 clusteredColor = vec3(0.0);
+    for (uint i = 0; i < cluster.y; ++i) {
+      ClusteredLight light = lights[lightIndices[cluster.x + i]];
+      vec3 lightL;
+      vec3 radiance = clusteredLightRadiance(light, worldPos.xyz, lightL);
+      clusteredColor +=
+          radiance * directLighting(N, V, lightL, basecolor, F0, metallic, roughness);
+    }
+    outColor.xyz += clusteredColor * ao;
+  }
 }
@@ -88,10 +88,14 @@ void Buffer::uploadStagingBufferToGPU(const VkCommandBuffer& commandBuffer,
 }
 
 void Buffer::copyDataToBuffer(const void* data, size_t size) const {
+  memcpy(mappedMemory(), data, size);
+}
+
+void* Buffer::mappedMemory() const {
   if (!mappedMemory_) {
     VK_CHECK(vmaMapMemory(allocator_, allocation_, &mappedMemory_));
   }
-  memcpy(mappedMemory_, data, size);
+  return mappedMemory_;
 }
 
 VkDeviceAddress Buffer::vkDeviceAddress() const {
@@ -41,6 +41,9 @@ class Buffer final {
 
   void copyDataToBuffer(const void* data, size_t size) const;
 
+  // Maps the buffer on first use, it stays mapped until the buffer is destroyed
+  void* mappedMemory() const;
+
   VkBuffer vkBuffer() const { return buffer_; }
 
   VkDeviceAddress vkDeviceAddress() const;
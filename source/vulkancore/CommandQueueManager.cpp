@@ -12,13 +12,14 @@ CommandQueueManager::CommandQueueManager(const Context& context, VkDevice device
                                          uint32_t count, uint32_t concurrentNumCommands,
                                          uint32_t queueFamilyIndex, VkQueue queue,
                                          VkCommandPoolCreateFlags flags,
-                                         const std::string& name)
+                                         const std::string& name,
+                                         bool useTimelineSemaphore)
     : commandsInFlight_(concurrentNumCommands),
       queueFamilyIndex_(queueFamilyIndex),
       queue_(queue),
       device_(device) {
-  fences_.reserve(commandsInFlight_);
-  isSubmitted_.reserve(commandsInFlight_);
+  isSubmitted_.resize(commandsInFlight_, false);
+  submittedValues_.resize(commandsInFlight_, 0);
   bufferToDispose_.resize(commandsInFlight_);
   deallocators_.resize(commandsInFlight_);
 
@@ -46,6 +47,22 @@ CommandQueueManager::CommandQueueManager(const Context& context, VkDevice device
     commandBuffers_.push_back(cmdBuffer);
   }
 
+  if (useTimelineSemaphore) {
+    const VkSemaphoreTypeCreateInfo semaphoreTypeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    const VkSemaphoreCreateInfo semaphoreInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &semaphoreTypeInfo,
+    };
+    VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timelineSemaphore_));
+    context.setVkObjectname(timelineSemaphore_, VK_OBJECT_TYPE_SEMAPHORE,
+                            "Timeline semaphore: " + name);
+    return;
+  }
+
   for (size_t i = 0; i < commandsInFlight_; ++i) {
     VkFence fence;
     const VkFenceCreateInfo fenceInfo = {
@@ -55,16 +72,18 @@ CommandQueueManager::CommandQueueManager(const Context& context, VkDevice device
     VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &fence));
 
     fences_.push_back(std::move(fence));
-    isSubmitted_.push_back(false);
   }
 }
 
 CommandQueueManager::~CommandQueueManager() {
-  deallocateResources();
+  for (uint32_t i = 0; i < commandsInFlight_; ++i) {
+    releaseResources(i);
+  }
 
-  for (size_t i = 0; i < commandsInFlight_; ++i) {
-    vkDestroyFence(device_, fences_[i], nullptr);
+  for (auto fence : fences_) {
+    vkDestroyFence(device_, fence, nullptr);
   }
+  vkDestroySemaphore(device_, timelineSemaphore_, nullptr);
 
   for (size_t i = 0; i < commandBuffers_.size(); ++i) {
     vkFreeCommandBuffers(device_, commandPool_, 1, &commandBuffers_[i]);
@@ -73,11 +92,91 @@ CommandQueueManager::~CommandQueueManager() {
   vkDestroyCommandPool(device_, commandPool_, nullptr);
 }
 
-void CommandQueueManager::submit(const VkSubmitInfo* submitInfo) {
+uint64_t CommandQueueManager::submit(const VkSubmitInfo* submitInfo) {
   ZoneScopedN("CmdMgr: submit");
-  VK_CHECK(vkResetFences(device_, 1, &fences_[fenceCurrentIndex_]));
-  VK_CHECK(vkQueueSubmit(queue_, 1, submitInfo, fences_[fenceCurrentIndex_]));
+  if (!usesTimelineSemaphore()) {
+    VK_CHECK(vkResetFences(device_, 1, &fences_[fenceCurrentIndex_]));
+    VK_CHECK(vkQueueSubmit(queue_, 1, submitInfo, fences_[fenceCurrentIndex_]));
+    isSubmitted_[fenceCurrentIndex_] = true;
+    return 0;
+  }
+
+  // The caller's (binary) semaphores come first, they take a value of 0, followed by
+  // the waits on other queues and the signal of this queue's timeline
+  std::vector<VkSemaphore> waitSemaphores(
+      submitInfo->pWaitSemaphores,
+      submitInfo->pWaitSemaphores + submitInfo->waitSemaphoreCount);
+  std::vector<VkPipelineStageFlags> waitStages(
+      submitInfo->pWaitDstStageMask,
+      submitInfo->pWaitDstStageMask + submitInfo->waitSemaphoreCount);
+  std::vector<uint64_t> waitValues(submitInfo->waitSemaphoreCount, 0);
+  for (const auto& wait : pendingWaits_) {
+    waitSemaphores.push_back(wait.semaphore);
+    waitStages.push_back(wait.stageMask);
+    waitValues.push_back(wait.value);
+  }
+  pendingWaits_.clear();
+
+  const uint64_t value = lastSubmittedValue_ + 1;
+  std::vector<VkSemaphore> signalSemaphores(
+      submitInfo->pSignalSemaphores,
+      submitInfo->pSignalSemaphores + submitInfo->signalSemaphoreCount);
+  std::vector<uint64_t> signalValues(submitInfo->signalSemaphoreCount, 0);
+  signalSemaphores.push_back(timelineSemaphore_);
+  signalValues.push_back(value);
+
+  const VkTimelineSemaphoreSubmitInfo timelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+      .pNext = submitInfo->pNext,
+      .waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size()),
+      .pWaitSemaphoreValues = waitValues.data(),
+      .signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size()),
+      .pSignalSemaphoreValues = signalValues.data(),
+  };
+  VkSubmitInfo timelineSubmitInfo = *submitInfo;
+  timelineSubmitInfo.pNext = &timelineInfo;
+  timelineSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+  timelineSubmitInfo.pWaitSemaphores = waitSemaphores.data();
+  timelineSubmitInfo.pWaitDstStageMask = waitStages.data();
+  timelineSubmitInfo.signalSemaphoreCount =
+      static_cast<uint32_t>(signalSemaphores.size());
+  timelineSubmitInfo.pSignalSemaphores = signalSemaphores.data();
+
+  VK_CHECK(vkQueueSubmit(queue_, 1, &timelineSubmitInfo, VK_NULL_HANDLE));
+  lastSubmittedValue_ = value;
   isSubmitted_[fenceCurrentIndex_] = true;
+  submittedValues_[fenceCurrentIndex_] = value;
+  return value;
+}
+
+void CommandQueueManager::waitForSubmit(const CommandQueueManager& producer,
+                                        uint64_t value, VkPipelineStageFlags stageMask) {
+  ASSERT(usesTimelineSemaphore() && producer.usesTimelineSemaphore(),
+         "Waiting on a submission by value requires timeline semaphores on both queues");
+  pendingWaits_.push_back({producer.timelineSemaphore(), value, stageMask});
+}
+
+void CommandQueueManager::retireCompletedSubmits() {
+  ZoneScopedN("CmdMgr: retireCompletedSubmits");
+  const uint64_t completed = usesTimelineSemaphore() ? completedValue() : 0;
+  for (uint32_t index = 0; index < commandsInFlight_; ++index) {
+    if (!isSubmitted_[index]) {
+      continue;
+    }
+    const bool isComplete = usesTimelineSemaphore()
+                                ? submittedValues_[index] <= completed
+                                : vkGetFenceStatus(device_, fences_[index]) == VK_SUCCESS;
+    if (isComplete) {
+      isSubmitted_[index] = false;
+      releaseResources(index);
+    }
+  }
+}
+
+uint64_t CommandQueueManager::completedValue() const {
+  uint64_t value = 0;
+  VK_CHECK(vkGetSemaphoreCounterValue(device_, timelineSemaphore_, &value));
+  return value;
 }
 
 void CommandQueueManager::goToNextCmdBuffer() {
@@ -93,27 +192,28 @@ void CommandQueueManager::waitUntilSubmitIsComplete() {
     return;
   }
 
-  const auto result =
-      vkWaitForFences(device_, 1, &fences_[fenceCurrentIndex_], true, UINT32_MAX);
-  if (result == VK_TIMEOUT) {
+  if (waitForSlot(fenceCurrentIndex_) == VK_TIMEOUT) {
     std::cerr << "Timeout!" << std::endl;
     vkDeviceWaitIdle(device_);
   }
 
   isSubmitted_[fenceCurrentIndex_] = false;
-  bufferToDispose_[fenceCurrentIndex_].clear();
-  deallocateResources();
+  releaseResources(fenceCurrentIndex_);
 }
 
 void CommandQueueManager::waitUntilAllSubmitsAreComplete() {
   ZoneScopedN("CmdMgr: waitUntilAllSubmitIscomplete");
-  for (size_t index = 0; auto& fence : fences_) {
-    VK_CHECK(vkWaitForFences(device_, 1, &fence, true, UINT32_MAX));
-    VK_CHECK(vkResetFences(device_, 1, &fence));
-    isSubmitted_[index++] = false;
+  // Only submitted slots are waited on and released, fences that were never submitted
+  // must stay signaled for getCmdBufferToBegin(), and resources queued for the command
+  // buffer being recorded must outlive it
+  for (uint32_t index = 0; index < commandsInFlight_; ++index) {
+    if (!isSubmitted_[index]) {
+      continue;
+    }
+    VK_CHECK(waitForSlot(index));
+    isSubmitted_[index] = false;
+    releaseResources(index);
   }
-  bufferToDispose_.clear();
-  deallocateResources();
 }
 
 void CommandQueueManager::disposeWhenSubmitCompletes(std::shared_ptr<Buffer> buffer) {
@@ -129,7 +229,14 @@ void CommandQueueManager::disposeWhenSubmitCompletes(
 
 VkCommandBuffer CommandQueueManager::getCmdBufferToBegin() {
   ZoneScopedN("CmdMgr: getCmdBufferToBegin");
-  VK_CHECK(vkWaitForFences(device_, 1, &fences_[fenceCurrentIndex_], true, UINT32_MAX));
+  // The command buffer may only be reset once its previous submission is done, the
+  // other slots are retired only if they are already complete
+  VK_CHECK(waitForSlot(fenceCurrentIndex_));
+  if (isSubmitted_[fenceCurrentIndex_]) {
+    isSubmitted_[fenceCurrentIndex_] = false;
+    releaseResources(fenceCurrentIndex_);
+  }
+  retireCompletedSubmits();
   VK_CHECK(vkResetCommandBuffer(commandBuffers_[commandBufferCurrentIndex_],
                                 VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT));
 
@@ -161,11 +268,27 @@ void CommandQueueManager::endCmdBuffer(VkCommandBuffer cmdBuffer) {
   VK_CHECK(vkEndCommandBuffer(cmdBuffer));
 }
 
-void CommandQueueManager::deallocateResources() {
-  for (auto& deallocators : deallocators_) {
-    for (auto& deallocator : deallocators) {
-      deallocator();
-    }
+VkResult CommandQueueManager::waitForSlot(uint32_t fenceIndex) const {
+  if (!usesTimelineSemaphore()) {
+    return vkWaitForFences(device_, 1, &fences_[fenceIndex], true, UINT32_MAX);
+  }
+  if (!isSubmitted_[fenceIndex]) {
+    return VK_SUCCESS;
+  }
+  const VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &timelineSemaphore_,
+      .pValues = &submittedValues_[fenceIndex],
+  };
+  return vkWaitSemaphores(device_, &waitInfo, UINT32_MAX);
+}
+
+void CommandQueueManager::releaseResources(uint32_t fenceIndex) {
+  bufferToDispose_[fenceIndex].clear();
+  for (auto& deallocator : deallocators_[fenceIndex]) {
+    deallocator();
   }
+  deallocators_[fenceIndex].clear();
 }
 }  // namespace VulkanCore
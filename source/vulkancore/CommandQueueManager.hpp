@@ -27,11 +27,23 @@ class CommandQueueManager final {
       // to be able to
       // reset and record
       // over it
-      const std::string& name = "");
+      const std::string& name = "", bool useTimelineSemaphore = false);
 
   ~CommandQueueManager();
 
-  void submit(const VkSubmitInfo* submitInfo);
+  // In timeline semaphore mode each submission signals the next value of the queue's
+  // timeline, which is returned (0 otherwise). Submissions are tracked by that value
+  // instead of a fence per slot
+  uint64_t submit(const VkSubmitInfo* submitInfo);
+
+  // Timeline semaphore mode only: the next submit waits, on the GPU, for the submission
+  // of producer that returned value before executing stageMask
+  void waitForSubmit(const CommandQueueManager& producer, uint64_t value,
+                     VkPipelineStageFlags stageMask);
+
+  // Releases the resources of every submission that has already completed, without
+  // blocking
+  void retireCompletedSubmits();
 
   void goToNextCmdBuffer();
 
@@ -49,8 +61,20 @@ class CommandQueueManager final {
 
   uint32_t queueFamilyIndex() const { return queueFamilyIndex_; }
 
+  bool usesTimelineSemaphore() const { return timelineSemaphore_ != VK_NULL_HANDLE; }
+
+  VkSemaphore timelineSemaphore() const { return timelineSemaphore_; }
+
+  uint64_t lastSubmittedValue() const { return lastSubmittedValue_; }
+
+  uint64_t completedValue() const;
+
  private:
-  void deallocateResources();
+  VkResult waitForSlot(uint32_t fenceIndex) const;
+
+  // Releases the buffers and runs the deallocators queued for the submission that used
+  // the fence at fenceIndex. Must only be called once that submission has completed
+  void releaseResources(uint32_t fenceIndex);
 
  private:
   uint32_t commandsInFlight_ = 2;
@@ -59,8 +83,17 @@ class CommandQueueManager final {
   VkDevice device_ = VK_NULL_HANDLE;
   VkCommandPool commandPool_ = VK_NULL_HANDLE;
   std::vector<VkCommandBuffer> commandBuffers_;
-  std::vector<VkFence> fences_;
+  std::vector<VkFence> fences_;  // empty in timeline semaphore mode
   std::vector<bool> isSubmitted_;
+  VkSemaphore timelineSemaphore_ = VK_NULL_HANDLE;
+  uint64_t lastSubmittedValue_ = 0;
+  std::vector<uint64_t> submittedValues_;  // per fence index
+  struct TimelineWait {
+    VkSemaphore semaphore;
+    uint64_t value;
+    VkPipelineStageFlags stageMask;
+  };
+  std::vector<TimelineWait> pendingWaits_;
   uint32_t fenceCurrentIndex_ = 0;
   uint32_t commandBufferCurrentIndex_ = 0;
   std::vector<std::vector<std::shared_ptr<Buffer>>>
@@ -413,4 +413,74 @@ uint32_t bytesPerPixel(VkFormat format) {
   return result;
 }
 
+VkExtent2D blockExtent(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ASTC_4x4_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_4x4_SRGB_BLOCK:
+      return {4, 4};
+    case VK_FORMAT_ASTC_5x5_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_5x5_SRGB_BLOCK:
+      return {5, 5};
+    case VK_FORMAT_ASTC_6x6_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_6x6_SRGB_BLOCK:
+      return {6, 6};
+    case VK_FORMAT_ASTC_8x8_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_8x8_SRGB_BLOCK:
+      return {8, 8};
+    case VK_FORMAT_ASTC_10x10_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_10x10_SRGB_BLOCK:
+      return {10, 10};
+    case VK_FORMAT_ASTC_12x12_UNORM_BLOCK:
+    case VK_FORMAT_ASTC_12x12_SRGB_BLOCK:
+      return {12, 12};
+    default:
+      break;
+  }
+  return {1, 1};
+}
+
+bool isBlockCompressed(VkFormat format) {
+  const VkExtent2D extent = blockExtent(format);
+  return extent.width > 1 || extent.height > 1;
+}
+
+uint32_t bytesPerBlock(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+      return 8;
+    default:
+      break;
+  }
+  // The other BC formats and every ASTC block size take 16 bytes
+  return isBlockCompressed(format) ? 16 : bytesPerPixel(format);
+}
+
+VkDeviceSize imageSizeInBytes(VkFormat format, VkExtent3D extents) {
+  const VkExtent2D block = blockExtent(format);
+  const VkDeviceSize blocksX = (extents.width + block.width - 1) / block.width;
+  const VkDeviceSize blocksY = (extents.height + block.height - 1) / block.height;
+  return blocksX * blocksY * extents.depth * bytesPerBlock(format);
+}
+
 }  // namespace VulkanCore
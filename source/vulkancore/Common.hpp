@@ -67,4 +67,15 @@ VkImageViewType imageTypeToImageViewType(VkImageType imageType, VkImageCreateFla
 
 uint32_t bytesPerPixel(VkFormat format);
 
+bool isBlockCompressed(VkFormat format);
+
+// Texels covered by a block of a compressed format, 1x1 for the others
+VkExtent2D blockExtent(VkFormat format);
+
+// Bytes of a block of a compressed format, of a texel for the others
+uint32_t bytesPerBlock(VkFormat format);
+
+// Blocks that are only partially covered by the image still take their full size
+VkDeviceSize imageSizeInBytes(VkFormat format, VkExtent3D extents);
+
 }  // namespace VulkanCore
@@ -3,9 +3,12 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <map>
+#include <thread>
 
 #include "Framebuffer.hpp"
 #include "RenderPass.hpp"
@@ -87,6 +90,14 @@ VkPhysicalDeviceFragmentDensityMapOffsetFeaturesQCOM
             VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_OFFSET_FEATURES_QCOM,
 };
 
+VkPhysicalDeviceDescriptorBufferFeaturesEXT Context::descriptorBufferFeatures_ = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+};
+
+VkPhysicalDeviceMeshShaderFeaturesEXT Context::meshShaderFeatures_ = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+};
+
 bool Context::enableMultiViewFlag_ = false;
 
 Context::Context(void* window, const std::vector<std::string>& requestedLayers,
@@ -263,6 +274,8 @@ Context::Context(void* window, const std::vector<std::string>& requestedLayers,
       ++index;
     }
 
+    clampTextureCompressionFeatures();
+
     const VkPhysicalDeviceFeatures2 deviceFeatures = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
         .features = physicalDeviceFeatures_,
@@ -294,6 +307,24 @@ Context::Context(void* window, const std::vector<std::string>& requestedLayers,
       featureChain.pushBack(fragmentDensityMapOffsetFeatures_);
     }
 
+    if (physicalDevice_.isDescriptorBufferSupported() &&
+        descriptorBufferFeatures_.descriptorBuffer) {
+      featureChain.pushBack(descriptorBufferFeatures_);
+      descriptorBufferEnabled_ = true;
+    }
+
+    if (physicalDevice_.isMeshShaderSupported() && meshShaderFeatures_.meshShader) {
+      featureChain.pushBack(meshShaderFeatures_);
+      meshShaderEnabled_ = true;
+    }
+
+    if (enable12Features_.shaderOutputLayer &&
+        !physicalDevice_.isShaderOutputLayerSupported()) {
+      enable12Features_.shaderOutputViewportIndex = VK_FALSE;
+      enable12Features_.shaderOutputLayer = VK_FALSE;
+    }
+    shaderOutputLayerEnabled_ = enable12Features_.shaderOutputLayer == VK_TRUE;
+
     const VkDeviceCreateInfo dci = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = featureChain.firstNextPtr(),
@@ -359,6 +390,8 @@ Context::Context(void* window, const std::vector<std::string>& requestedLayers,
   // Create the allocator
   createMemoryAllocator();
 
+  createPipelineCache({});
+
   // Naming objects created before we had a device
   setVkObjectname(surface_, VK_OBJECT_TYPE_SURFACE_KHR, "Surface: " + name);
 }  // namespace VulkanCore
@@ -478,6 +511,8 @@ void Context::createVkDevice(VkPhysicalDevice vkPhysicalDevice,
       ++index;
     }
 
+    clampTextureCompressionFeatures();
+
     VkPhysicalDeviceFeatures2 deviceFeatures = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
         .features = physicalDeviceFeatures_,
@@ -520,6 +555,24 @@ void Context::createVkDevice(VkPhysicalDevice vkPhysicalDevice,
       featureChain.pushBack(fragmentDensityMapOffsetFeatures_);
     }
 
+    if (physicalDevice_.isDescriptorBufferSupported() &&
+        descriptorBufferFeatures_.descriptorBuffer) {
+      featureChain.pushBack(descriptorBufferFeatures_);
+      descriptorBufferEnabled_ = true;
+    }
+
+    if (physicalDevice_.isMeshShaderSupported() && meshShaderFeatures_.meshShader) {
+      featureChain.pushBack(meshShaderFeatures_);
+      meshShaderEnabled_ = true;
+    }
+
+    if (enable12Features_.shaderOutputLayer &&
+        !physicalDevice_.isShaderOutputLayerSupported()) {
+      enable12Features_.shaderOutputViewportIndex = VK_FALSE;
+      enable12Features_.shaderOutputLayer = VK_FALSE;
+    }
+    shaderOutputLayerEnabled_ = enable12Features_.shaderOutputLayer == VK_TRUE;
+
     std::vector<const char*> instanceLayers(enabledLayers_.size());
     std::transform(enabledLayers_.begin(), enabledLayers_.end(), instanceLayers.begin(),
                    std::mem_fn(&std::string::c_str));
@@ -589,6 +642,8 @@ void Context::createVkDevice(VkPhysicalDevice vkPhysicalDevice,
   // Create the allocator
   createMemoryAllocator();
 
+  createPipelineCache({});
+
   setVkObjectname(device_, VK_OBJECT_TYPE_DEVICE, "Device: " + name);
 
   setVkObjectname(instance_, VK_OBJECT_TYPE_INSTANCE, "Instance: " + name);
@@ -598,6 +653,11 @@ Context::~Context() {
   vkDeviceWaitIdle(device_);
 
   swapchain_.reset();
+  stagingArena_.reset();
+  if (!pipelineCacheFilePath_.empty()) {
+    savePipelineCache();
+  }
+  vkDestroyPipelineCache(device_, pipelineCache_, nullptr);
   vmaDestroyAllocator(allocator_);
   vkDestroyDevice(device_, nullptr);
   if (surface_ != VK_NULL_HANDLE) {
@@ -626,6 +686,7 @@ void Context::enableDefaultFeatures() {
   enable12Features_.descriptorBindingVariableDescriptorCount = VK_TRUE;
   enable12Features_.descriptorIndexing = VK_TRUE;
   enable12Features_.runtimeDescriptorArray = VK_TRUE;
+  enableTimelineSemaphoreFeature();
 }
 
 void Context::enableScalarLayoutFeatures() {
@@ -663,6 +724,10 @@ void Context::enableSynchronization2Feature() {
   enable13Features_.synchronization2 = VK_TRUE;
 }
 
+void Context::enableTimelineSemaphoreFeature() {
+  enable12Features_.timelineSemaphore = VK_TRUE;
+}
+
 void Context::enableRayTracingFeatures() {
   accelStructFeatures_.accelerationStructure = VK_TRUE;
   rayTracingPipelineFeatures_.rayTracingPipeline = VK_TRUE;
@@ -681,6 +746,27 @@ void Context::enableFragmentDensityMapOffsetFeatures() {
   fragmentDensityMapOffsetFeatures_.fragmentDensityMapOffset = VK_TRUE;
 }
 
+void Context::enableDescriptorBufferFeature() {
+  descriptorBufferFeatures_.descriptorBuffer = VK_TRUE;
+  enableBufferDeviceAddressFeature();
+}
+
+void Context::enableMeshShaderFeature() {
+  meshShaderFeatures_.taskShader = VK_TRUE;
+  meshShaderFeatures_.meshShader = VK_TRUE;
+}
+
+void Context::enableTextureCompressionFeatures() {
+  physicalDeviceFeatures_.textureCompressionBC = VK_TRUE;
+  physicalDeviceFeatures_.textureCompressionASTC_LDR = VK_TRUE;
+}
+
+void Context::enableShaderOutputLayerFeature() {
+  // GL_ARB_shader_viewport_layer_array needs both
+  enable12Features_.shaderOutputViewportIndex = VK_TRUE;
+  enable12Features_.shaderOutputLayer = VK_TRUE;
+}
+
 const PhysicalDevice& Context::physicalDevice() const { return physicalDevice_; }
 
 void Context::createSwapchain(VkFormat format, VkColorSpaceKHR colorSpace,
@@ -764,17 +850,19 @@ std::shared_ptr<Buffer> Context::createStagingBuffer(VkDeviceSize size,
                                   name);
 }
 
-// creates staging buffer & upload data to gpubuffer
+// copies data into the staging arena & uploads it to gpubuffer
 void Context::uploadToGPUBuffer(VulkanCore::CommandQueueManager& queueMgr,
                                 VkCommandBuffer commandBuffer,
                                 VulkanCore::Buffer* gpuBuffer, const void* data,
                                 long totalSize, uint64_t gpuBufferOffset) const {
-  auto stagingBuffer = createStagingBuffer(totalSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                                           gpuBuffer, "staging buffer");
-  stagingBuffer->copyDataToBuffer(data, totalSize);
+  const auto staging = stagingArena_->stage(queueMgr, data, totalSize);
 
-  stagingBuffer->uploadStagingBufferToGPU(commandBuffer, 0, gpuBufferOffset);
-  queueMgr.disposeWhenSubmitCompletes(std::move(stagingBuffer));
+  const VkBufferCopy region = {
+      .srcOffset = staging.offset,
+      .dstOffset = gpuBufferOffset,
+      .size = staging.size,
+  };
+  vkCmdCopyBuffer(commandBuffer, staging.buffer, gpuBuffer->vkBuffer(), 1, &region);
 }
 
 std::shared_ptr<Texture> Context::createTexture(
@@ -809,7 +897,8 @@ std::shared_ptr<VulkanCore::Sampler> Context::createSampler(
 CommandQueueManager Context::createGraphicsCommandQueue(uint32_t count,
                                                         uint32_t concurrentNumCommands,
                                                         const std::string& name,
-                                                        int graphicsQueueIndex) {
+                                                        int graphicsQueueIndex,
+                                                        bool useTimelineSemaphore) {
   if (graphicsQueueIndex != -1) {
     ASSERT(graphicsQueueIndex < graphicsQueues_.size(),
            "Don't have enough graphics queue, specify smaller queue index");
@@ -818,12 +907,12 @@ CommandQueueManager Context::createGraphicsCommandQueue(uint32_t count,
       *this, device_, count, concurrentNumCommands,
       physicalDevice_.graphicsFamilyIndex().value(),
       graphicsQueueIndex != -1 ? graphicsQueues_[graphicsQueueIndex] : graphicsQueues_[0],
-      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, name);
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, name, useTimelineSemaphore);
 }
 
 VulkanCore::CommandQueueManager Context::createTransferCommandQueue(
     uint32_t count, uint32_t concurrentNumCommands, const std::string& name,
-    int transferQueueIndex) {
+    int transferQueueIndex, bool useTimelineSemaphore) {
   if (transferQueueIndex != -1) {
     ASSERT(transferQueueIndex < transferQueues_.size(),
            "Don't have enough transfer queue, specify smaller queue index");
@@ -832,7 +921,22 @@ VulkanCore::CommandQueueManager Context::createTransferCommandQueue(
       *this, device_, count, concurrentNumCommands,
       physicalDevice_.transferFamilyIndex().value(),
       transferQueueIndex != -1 ? transferQueues_[transferQueueIndex] : transferQueues_[0],
-      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, name);
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, name, useTimelineSemaphore);
+}
+
+VulkanCore::CommandQueueManager Context::createComputeCommandQueue(
+    uint32_t count, uint32_t concurrentNumCommands, const std::string& name,
+    int computeQueueIndex, bool useTimelineSemaphore) {
+  ASSERT(!computeQueues_.empty(), "No compute queue, request VK_QUEUE_COMPUTE_BIT");
+  if (computeQueueIndex != -1) {
+    ASSERT(computeQueueIndex < computeQueues_.size(),
+           "Don't have enough compute queue, specify smaller queue index");
+  }
+  return CommandQueueManager(
+      *this, device_, count, concurrentNumCommands,
+      physicalDevice_.computeFamilyIndex().value(),
+      computeQueueIndex != -1 ? computeQueues_[computeQueueIndex] : computeQueues_[0],
+      VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, name, useTimelineSemaphore);
 }
 
 std::shared_ptr<ShaderModule> Context::createShaderModule(const std::string& filePath,
@@ -872,6 +976,150 @@ std::shared_ptr<VulkanCore::Pipeline> Context::createRayTracingPipeline(
   return std::make_shared<Pipeline>(this, desc, name);
 }
 
+namespace {
+// Runs create(i) for every index on numThreads threads. Shader modules and pipelines
+// can be created concurrently, and the pipeline cache is internally synchronized
+template <typename T>
+std::vector<std::shared_ptr<T>> createInParallel(
+    size_t count, uint32_t numThreads,
+    const std::function<std::shared_ptr<T>(size_t)>& create) {
+  std::vector<std::shared_ptr<T>> objects(count);
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  numThreads = std::min(numThreads, static_cast<uint32_t>(count));
+
+  std::atomic<size_t> nextIndex = 0;
+  const auto worker = [&]() {
+    for (size_t index = nextIndex++; index < count; index = nextIndex++) {
+      objects[index] = create(index);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < numThreads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return objects;
+}
+}  // namespace
+
+std::vector<std::shared_ptr<ShaderModule>> Context::createShaderModules(
+    const std::vector<ShaderModuleRequest>& requests, uint32_t numThreads) {
+  return createInParallel<ShaderModule>(
+      requests.size(), numThreads, [&](size_t index) {
+        const auto& request = requests[index];
+        return std::make_shared<ShaderModule>(this, request.filePath, request.entryPoint,
+                                              request.stages, request.name);
+      });
+}
+
+std::vector<std::shared_ptr<Pipeline>> Context::createGraphicsPipelines(
+    const std::vector<GraphicsPipelineRequest>& requests, uint32_t numThreads) {
+  return createInParallel<Pipeline>(requests.size(), numThreads, [&](size_t index) {
+    const auto& request = requests[index];
+    return std::make_shared<Pipeline>(this, request.desc, request.renderPass,
+                                      request.name);
+  });
+}
+
+std::vector<std::shared_ptr<Pipeline>> Context::createComputePipelines(
+    const std::vector<ComputePipelineRequest>& requests, uint32_t numThreads) {
+  return createInParallel<Pipeline>(requests.size(), numThreads, [&](size_t index) {
+    return std::make_shared<Pipeline>(this, requests[index].desc, requests[index].name);
+  });
+}
+
+bool Context::loadPipelineCache(const std::string& filePath) {
+  pipelineCacheFilePath_ = filePath;
+
+  std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), data.size());
+  if (!file || !isPipelineCacheCompatible(data)) {
+    std::cerr << "Ignoring pipeline cache " << filePath
+              << ", it was written for another device or driver" << std::endl;
+    return false;
+  }
+
+  // Keeps what has been compiled so far
+  const VkPipelineCache previousCache = pipelineCache_;
+  createPipelineCache(data);
+  VK_CHECK(vkMergePipelineCaches(device_, pipelineCache_, 1, &previousCache));
+  vkDestroyPipelineCache(device_, previousCache, nullptr);
+  return true;
+}
+
+bool Context::savePipelineCache() const {
+  ASSERT(!pipelineCacheFilePath_.empty(),
+         "loadPipelineCache() sets where the pipeline cache is saved");
+  size_t size = 0;
+  VK_CHECK(vkGetPipelineCacheData(device_, pipelineCache_, &size, nullptr));
+  std::vector<char> data(size);
+  VK_CHECK(vkGetPipelineCacheData(device_, pipelineCache_, &size, data.data()));
+
+  // Written next to the destination first so a crash can't leave a truncated cache
+  const std::string tempFilePath = pipelineCacheFilePath_ + ".tmp";
+  {
+    std::ofstream file(tempFilePath, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), size);
+    if (!file) {
+      std::cerr << "Unable to write the pipeline cache to " << tempFilePath
+                << std::endl;
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempFilePath, pipelineCacheFilePath_, error);
+  return !error;
+}
+
+void Context::createPipelineCache(std::span<const uint8_t> initialData) {
+  const VkPipelineCacheCreateInfo createInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = initialData.size(),
+      .pInitialData = initialData.data(),
+  };
+  VK_CHECK(vkCreatePipelineCache(device_, &createInfo, nullptr, &pipelineCache_));
+  setVkObjectname(pipelineCache_, VK_OBJECT_TYPE_PIPELINE_CACHE, "Pipeline cache");
+}
+
+void Context::clampTextureCompressionFeatures() {
+  const VkPhysicalDeviceFeatures& supported = physicalDevice_.features().features;
+  if (!supported.textureCompressionBC) {
+    physicalDeviceFeatures_.textureCompressionBC = VK_FALSE;
+  }
+  if (!supported.textureCompressionASTC_LDR) {
+    physicalDeviceFeatures_.textureCompressionASTC_LDR = VK_FALSE;
+  }
+  textureCompressionBCEnabled_ = physicalDeviceFeatures_.textureCompressionBC;
+  textureCompressionASTCEnabled_ = physicalDeviceFeatures_.textureCompressionASTC_LDR;
+}
+
+bool Context::isPipelineCacheCompatible(std::span<const uint8_t> data) const {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+
+  const auto& properties = physicalDevice_.properties().properties;
+  return header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) ==
+             0;
+}
+
 std::shared_ptr<RenderPass> Context::createRenderPass(
     const std::vector<std::shared_ptr<Texture>>& attachments,
     const std::vector<VkAttachmentLoadOp>& loadOp,
@@ -944,10 +1192,16 @@ void Context::createMemoryAllocator() {
 #endif
   };
 
-  const VmaAllocatorCreateInfo allocInfo = {
+  VmaAllocatorCreateFlags flags = 0;
 #if defined(VK_KHR_buffer_device_address) && defined(_WIN32)
-    .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+  flags |= VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
 #endif
+  if (physicalDevice_.isMemoryBudgetSupported()) {
+    flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+  }
+
+  const VmaAllocatorCreateInfo allocInfo = {
+    .flags = flags,
     .physicalDevice = physicalDevice_.vkPhysicalDevice(),
     .device = device_,
     .pVulkanFunctions = &vulkanFunctions,
@@ -955,6 +1209,8 @@ void Context::createMemoryAllocator() {
     .vulkanApiVersion = applicationInfo_.apiVersion,
   };
   vmaCreateAllocator(&allocInfo, &allocator_);
+
+  stagingArena_ = std::make_unique<StagingArena>(*this, 64 * 1024 * 1024, 4, "Context");
 }
 
 void Context::dumpMemoryStats(const std::string& fileName) const {
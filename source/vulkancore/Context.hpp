@@ -4,6 +4,7 @@
 #include <array>
 #include <glm/glm.hpp>
 #include <memory>
+#include <span>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -14,6 +15,7 @@
 #include "PhysicalDevice.hpp"
 #include "Pipeline.hpp"
 #include "ShaderModule.hpp"
+#include "StagingArena.hpp"
 #include "Swapchain.hpp"
 #include "Utility.hpp"
 #include "vk_mem_alloc.h"
@@ -25,7 +27,7 @@ class RenderPass;
 class Sampler;
 class Texture;
 
-template <size_t CHAIN_SIZE = 10>
+template <size_t CHAIN_SIZE = 12>
 class VulkanFeatureChain {
  public:
   VulkanFeatureChain() = default;
@@ -91,6 +93,9 @@ class Context final {
 
   static void enableSynchronization2Feature();
 
+  // Also enabled by enableDefaultFeatures(), timeline semaphores are core in 1.2
+  static void enableTimelineSemaphoreFeature();
+
   static void enableRayTracingFeatures();
 
   static bool enableMultiViewFlag_;
@@ -102,6 +107,31 @@ class Context final {
 
   static void enableFragmentDensityMapOffsetFeatures();
 
+  // Also enables buffer device addresses. Only takes effect if the device supports it
+  // and VK_EXT_descriptor_buffer is among the requested device extensions
+  static void enableDescriptorBufferFeature();
+
+  bool isDescriptorBufferEnabled() const { return descriptorBufferEnabled_; }
+
+  // Task and mesh shaders. Only takes effect if the device supports them and
+  // VK_EXT_mesh_shader is among the requested device extensions
+  static void enableMeshShaderFeature();
+
+  bool isMeshShaderEnabled() const { return meshShaderEnabled_; }
+
+  // Lets vertex shaders write gl_Layer, to render to several layers of an image in one
+  // pass. Only takes effect if the device supports it
+  static void enableShaderOutputLayerFeature();
+
+  bool isShaderOutputLayerEnabled() const { return shaderOutputLayerEnabled_; }
+
+  // BC and ASTC LDR block formats, each only enabled if the device supports it
+  static void enableTextureCompressionFeatures();
+
+  bool isTextureCompressionBCEnabled() const { return textureCompressionBCEnabled_; }
+
+  bool isTextureCompressionASTCEnabled() const { return textureCompressionASTCEnabled_; }
+
   VkDevice device() const { return device_; }
 
   VkInstance instance() const { return instance_; }
@@ -131,6 +161,9 @@ class Context final {
                                               Buffer* actualBuffer,
                                               const std::string& name = "") const;
 
+  // Staging memory shared by uploadToGPUBuffer() and the texture uploads
+  StagingArena& stagingArena() const { return *stagingArena_; }
+
   void uploadToGPUBuffer(VulkanCore::CommandQueueManager& queueMgr,
                          VkCommandBuffer commandBuffer, VulkanCore::Buffer* gpuBuffer,
                          const void* data, long totalSize,
@@ -160,7 +193,8 @@ class Context final {
                                                  uint32_t concurrentNumCommands,
 
                                                  const std::string& name = "",
-                                                 int graphicsQueueIndex = -1);
+                                                 int graphicsQueueIndex = -1,
+                                                 bool useTimelineSemaphore = false);
 
   std::shared_ptr<ShaderModule> createShaderModule(const std::string& filePath,
                                                    VkShaderStageFlagBits stages,
@@ -174,6 +208,19 @@ class Context final {
                                                    VkShaderStageFlagBits stages,
                                                    const std::string& name = "");
 
+  struct ShaderModuleRequest {
+    std::string filePath;
+    std::string entryPoint = "main";
+    VkShaderStageFlagBits stages;
+    std::string name;
+  };
+
+  // Compiles (or reads from the SPIR-V cache, see ShaderModule::setSpirvCacheDirectory)
+  // the shaders on numThreads worker threads (0 means one per hardware thread), the
+  // results are in the same order as the requests
+  std::vector<std::shared_ptr<ShaderModule>> createShaderModules(
+      const std::vector<ShaderModuleRequest>& requests, uint32_t numThreads = 0);
+
   std::shared_ptr<Pipeline> createGraphicsPipeline(
       const Pipeline::GraphicsPipelineDescriptor& desc, VkRenderPass renderPass,
       const std::string& name = "");
@@ -184,10 +231,50 @@ class Context final {
   std::shared_ptr<Pipeline> createRayTracingPipeline(
       const Pipeline::RayTracingPipelineDescriptor& desc, const std::string& name = "");
 
+  struct GraphicsPipelineRequest {
+    Pipeline::GraphicsPipelineDescriptor desc;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::string name;
+  };
+
+  struct ComputePipelineRequest {
+    Pipeline::ComputePipelineDescriptor desc;
+    std::string name;
+  };
+
+  // Creates the pipelines on numThreads worker threads (0 means one per hardware
+  // thread), the results are in the same order as the requests
+  std::vector<std::shared_ptr<Pipeline>> createGraphicsPipelines(
+      const std::vector<GraphicsPipelineRequest>& requests, uint32_t numThreads = 0);
+
+  std::vector<std::shared_ptr<Pipeline>> createComputePipelines(
+      const std::vector<ComputePipelineRequest>& requests, uint32_t numThreads = 0);
+
+  // Every pipeline is created through this cache. It starts out empty unless
+  // loadPipelineCache() is called
+  VkPipelineCache pipelineCache() const { return pipelineCache_; }
+
+  // Seeds the pipeline cache with the contents of filePath, which are only used if they
+  // were written for this device by this driver (the header's vendor & device ids and
+  // pipeline cache UUID match). The cache is saved back to filePath when the context
+  // is destroyed. Returns whether the file was used
+  bool loadPipelineCache(const std::string& filePath);
+
+  bool savePipelineCache() const;
+
   CommandQueueManager createTransferCommandQueue(uint32_t count,
                                                  uint32_t concurrentNumCommands,
                                                  const std::string& name,
-                                                 int transferQueueIndex = -1);
+                                                 int transferQueueIndex = -1,
+                                                 bool useTimelineSemaphore = false);
+
+  // Needs VK_QUEUE_COMPUTE_BIT in the requested queue types. The compute family is never
+  // the graphics one, so its resources need queue family ownership transfers
+  CommandQueueManager createComputeCommandQueue(uint32_t count,
+                                                uint32_t concurrentNumCommands,
+                                                const std::string& name,
+                                                int computeQueueIndex = -1,
+                                                bool useTimelineSemaphore = false);
 
   std::shared_ptr<RenderPass> createRenderPass(
       const std::vector<std::shared_ptr<Texture>>& attachments,
@@ -240,6 +327,14 @@ class Context final {
  private:
   void createMemoryAllocator();
 
+  void createPipelineCache(std::span<const uint8_t> initialData);
+
+  bool isPipelineCacheCompatible(std::span<const uint8_t> data) const;
+
+  // Turns off the texture compression features the physical device doesn't support, so
+  // requesting them never fails device creation
+  void clampTextureCompressionFeatures();
+
   [[nodiscard]] static std::vector<std::string> enumerateInstanceLayers(
       bool printEnumerations_ = false);
 
@@ -263,6 +358,9 @@ class Context final {
   PhysicalDevice physicalDevice_;
   VkDevice device_ = VK_NULL_HANDLE;
   VmaAllocator allocator_ = nullptr;
+  std::unique_ptr<StagingArena> stagingArena_;
+  VkPipelineCache pipelineCache_ = VK_NULL_HANDLE;
+  std::string pipelineCacheFilePath_;
   bool printEnumerations_ = false;
   VkSurfaceKHR surface_ = VK_NULL_HANDLE;
   std::vector<VkSurfaceFormatKHR> surfaceFormats_;
@@ -282,6 +380,13 @@ class Context final {
   static VkPhysicalDeviceFragmentDensityMapFeaturesEXT fragmentDensityMapFeatures_;
   static VkPhysicalDeviceFragmentDensityMapOffsetFeaturesQCOM
       fragmentDensityMapOffsetFeatures_;
+  static VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures_;
+  bool descriptorBufferEnabled_ = false;
+  static VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures_;
+  bool meshShaderEnabled_ = false;
+  bool shaderOutputLayerEnabled_ = false;
+  bool textureCompressionBCEnabled_ = false;
+  bool textureCompressionASTCEnabled_ = false;
 
   // these are extra queues which can be used for any other async stuff if
   // required, these won't contain above queues
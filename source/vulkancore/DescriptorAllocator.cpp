@@ -0,0 +1,110 @@
+#include "DescriptorAllocator.hpp"
+
+#include <algorithm>
+#include <map>
+
+#include "Context.hpp"
+
+namespace VulkanCore {
+
+DescriptorAllocator::DescriptorAllocator(const Context& context,
+                                         VkDescriptorPoolCreateFlags flags,
+                                         const std::string& name)
+    : context_(context), flags_(flags), name_(name) {}
+
+DescriptorAllocator::~DescriptorAllocator() {
+  for (auto pool : pools_) {
+    vkDestroyDescriptorPool(context_.device(), pool, nullptr);
+  }
+}
+
+std::vector<VkDescriptorSet> DescriptorAllocator::allocate(
+    const std::vector<Request>& requests) {
+  std::vector<VkDescriptorSet> descriptorSets;
+  const auto pool = createPool(requests);
+  if (pool == VK_NULL_HANDLE) {
+    return descriptorSets;
+  }
+
+  for (const auto& request : requests) {
+    const std::vector<VkDescriptorSetLayout> layouts(request.count, request.layout);
+    std::vector<VkDescriptorSet> sets(request.count, VK_NULL_HANDLE);
+    const VkDescriptorSetAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pool,
+        .descriptorSetCount = request.count,
+        .pSetLayouts = layouts.data(),
+    };
+    if (request.count > 0) {
+      VK_CHECK(vkAllocateDescriptorSets(context_.device(), &allocInfo, sets.data()));
+    }
+    descriptorSets.insert(descriptorSets.end(), sets.begin(), sets.end());
+  }
+
+  stats_.setsAllocated += static_cast<uint32_t>(descriptorSets.size());
+  return descriptorSets;
+}
+
+VkDescriptorSet DescriptorAllocator::allocateOne(
+    VkDescriptorSetLayout layout,
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+  auto& spareSets = spareSets_[layout];
+  if (spareSets.empty()) {
+    // Doubles the number of sets of this layout, so a layout with n sets has only
+    // log(n) pools
+    auto& allocated = setsAllocatedOneByOne_[layout];
+    const uint32_t count = std::max(4u, allocated);
+    spareSets = allocate({{.layout = layout, .bindings = bindings, .count = count}});
+    stats_.setsAllocated -= count;
+    allocated += count;
+    std::reverse(spareSets.begin(), spareSets.end());
+  }
+
+  const auto descriptorSet = spareSets.back();
+  spareSets.pop_back();
+  ++stats_.setsAllocated;
+  return descriptorSet;
+}
+
+VkDescriptorPool DescriptorAllocator::createPool(const std::vector<Request>& requests) {
+  std::map<VkDescriptorType, uint32_t> descriptorCounts;
+  uint32_t maxSets = 0;
+  for (const auto& request : requests) {
+    maxSets += request.count;
+    for (const auto& binding : request.bindings) {
+      descriptorCounts[binding.descriptorType] += binding.descriptorCount * request.count;
+    }
+  }
+  if (maxSets == 0) {
+    return VK_NULL_HANDLE;
+  }
+
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  for (const auto& [type, count] : descriptorCounts) {
+    if (count > 0) {
+      poolSizes.push_back({type, count});
+      stats_.descriptorsReserved += count;
+    }
+  }
+
+  const VkDescriptorPoolCreateInfo descriptorPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .flags = flags_,
+      .maxSets = maxSets,
+      .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
+      .pPoolSizes = poolSizes.data(),
+  };
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  VK_CHECK(
+      vkCreateDescriptorPool(context_.device(), &descriptorPoolInfo, nullptr, &pool));
+  context_.setVkObjectname(pool, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+                           "Descriptor pool " + std::to_string(pools_.size()) + ": " +
+                               name_);
+  pools_.push_back(pool);
+
+  ++stats_.pools;
+  stats_.setsReserved += maxSets;
+  return pool;
+}
+
+}  // namespace VulkanCore
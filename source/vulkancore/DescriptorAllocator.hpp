@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.hpp"
+#include "Utility.hpp"
+
+namespace VulkanCore {
+
+class Context;
+
+// Allocates descriptor sets from pools sized for what is actually requested, instead of
+// reserving thousands of descriptors of every type up front. allocate() creates one pool
+// that holds exactly the sets of a request, while allocateOne() serves sets allocated
+// one at a time from pools that double in size for each layout. Sets are never freed
+// individually, they go away with the allocator
+class DescriptorAllocator final {
+ public:
+  struct Request {
+    VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    uint32_t count = 0;
+  };
+
+  struct Stats {
+    uint32_t pools = 0;
+    uint32_t setsAllocated = 0;  // handed out
+    uint32_t setsReserved = 0;   // the pools can hold
+    uint64_t descriptorsReserved = 0;
+  };
+
+  MOVABLE_ONLY(DescriptorAllocator);
+
+  explicit DescriptorAllocator(const Context& context, VkDescriptorPoolCreateFlags flags,
+                               const std::string& name = "");
+
+  ~DescriptorAllocator();
+
+  // Returns the sets of all the requests, in order
+  std::vector<VkDescriptorSet> allocate(const std::vector<Request>& requests);
+
+  VkDescriptorSet allocateOne(VkDescriptorSetLayout layout,
+                              const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  VkDescriptorPool createPool(const std::vector<Request>& requests);
+
+ private:
+  const Context& context_;
+  VkDescriptorPoolCreateFlags flags_ = 0;
+  std::string name_;
+  std::vector<VkDescriptorPool> pools_;
+  // Sets allocated by allocateOne() that haven't been handed out yet, per layout
+  std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>> spareSets_;
+  std::unordered_map<VkDescriptorSetLayout, uint32_t> setsAllocatedOneByOne_;
+  Stats stats_;
+};
+
+}  // namespace VulkanCore
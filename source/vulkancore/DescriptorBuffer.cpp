@@ -0,0 +1,139 @@
+#include "DescriptorBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "Buffer.hpp"
+#include "Context.hpp"
+
+namespace VulkanCore {
+
+DescriptorBuffer::DescriptorBuffer(const Context& context, VkDeviceSize initialSize,
+                                   const std::string& name)
+    : context_(context),
+      name_(name),
+      properties_(context.physicalDevice().descriptorBufferProperties()) {
+  ASSERT(context_.isDescriptorBufferEnabled(),
+         "VK_EXT_descriptor_buffer must be enabled to use descriptor buffers");
+  buffer_ = createBuffer(initialSize);
+}
+
+DescriptorBuffer::~DescriptorBuffer() = default;
+
+VkDeviceSize DescriptorBuffer::allocate(VkDescriptorSetLayout layout) {
+  const auto alignment = properties_.descriptorBufferOffsetAlignment;
+  const auto offset = (stats_.usedBytes + alignment - 1) / alignment * alignment;
+  const auto size = layoutSize(layout);
+
+  if (offset + size > stats_.reservedBytes) {
+    auto newSize = std::max<VkDeviceSize>(stats_.reservedBytes, 1);
+    while (offset + size > newSize) {
+      newSize *= 2;
+    }
+    auto oldBuffer = std::exchange(buffer_, nullptr);
+    const auto* oldMemory = mappedMemory_;
+    buffer_ = createBuffer(newSize);
+    memcpy(mappedMemory_, oldMemory, stats_.usedBytes);
+    retiredBuffers_.push_back(std::move(oldBuffer));
+    ++stats_.grows;
+  }
+
+  // Descriptors that are never written stay zeroed
+  memset(mappedMemory_ + offset, 0, size);
+  stats_.usedBytes = offset + size;
+  ++stats_.sets;
+  return offset;
+}
+
+void DescriptorBuffer::write(VkDeviceSize setOffset, VkDescriptorSetLayout layout,
+                             uint32_t binding, uint32_t arrayElement,
+                             const VkDescriptorGetInfoEXT& info) {
+  VkDeviceSize bindingOffset = 0;
+  vkGetDescriptorSetLayoutBindingOffsetEXT(context_.device(), layout, binding,
+                                           &bindingOffset);
+  const auto size = descriptorSize(info.type);
+  const auto offset = setOffset + bindingOffset + arrayElement * size;
+  ASSERT(offset + size <= stats_.usedBytes, "Descriptor is outside of its set");
+  vkGetDescriptorEXT(context_.device(), &info, size, mappedMemory_ + offset);
+}
+
+void DescriptorBuffer::bind(VkCommandBuffer commandBuffer) const {
+  const VkDescriptorBufferBindingInfoEXT bindingInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+      .address = address_,
+      .usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+               VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT,
+  };
+  vkCmdBindDescriptorBuffersEXT(commandBuffer, 1, &bindingInfo);
+}
+
+size_t DescriptorBuffer::descriptorSize(VkDescriptorType type) const {
+  switch (type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+      return properties_.samplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+      return properties_.combinedImageSamplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+      return properties_.sampledImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+      return properties_.storageImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+      return properties_.uniformTexelBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+      return properties_.storageTexelBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+      return properties_.uniformBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+      return properties_.storageBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+      return properties_.inputAttachmentDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+      return properties_.accelerationStructureDescriptorSize;
+    default:
+      ASSERT(false, "Descriptor type not supported by descriptor buffers");
+      return 0;
+  }
+}
+
+std::shared_ptr<Buffer> DescriptorBuffer::createBuffer(VkDeviceSize size) {
+  auto buffer = std::make_shared<Buffer>(
+      &context_, context_.memoryAllocator(),
+      VkBufferCreateInfo{
+          .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+          .size = size,
+          .usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+                   VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT |
+                   VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      },
+      VmaAllocationCreateInfo{
+          .flags = VMA_ALLOCATION_CREATE_MAPPED_BIT |
+                   VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+          .usage = VMA_MEMORY_USAGE_AUTO,
+          .requiredFlags =
+              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      },
+      "Descriptor buffer " + std::to_string(retiredBuffers_.size()) + ": " + name_);
+
+  const VkBufferDeviceAddressInfo addressInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = buffer->vkBuffer(),
+  };
+  address_ = vkGetBufferDeviceAddress(context_.device(), &addressInfo);
+  mappedMemory_ = static_cast<uint8_t*>(buffer->mappedMemory());
+  stats_.reservedBytes = size;
+  return buffer;
+}
+
+VkDeviceSize DescriptorBuffer::layoutSize(VkDescriptorSetLayout layout) {
+  auto itr = layoutSizes_.find(layout);
+  if (itr == layoutSizes_.end()) {
+    VkDeviceSize size = 0;
+    vkGetDescriptorSetLayoutSizeEXT(context_.device(), layout, &size);
+    itr = layoutSizes_.emplace(layout, size).first;
+  }
+  return itr->second;
+}
+
+}  // namespace VulkanCore
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.hpp"
+#include "Utility.hpp"
+
+namespace VulkanCore {
+
+class Buffer;
+class Context;
+
+// Holds descriptor sets in a persistently mapped buffer (VK_EXT_descriptor_buffer).
+// Descriptors are written with a memcpy from the CPU, there are no pools to size and no
+// vkUpdateDescriptorSets calls, and sets are bound by their offset in the buffer. The
+// buffer doubles its size when it's full, the sets keep their offsets. Sets are never
+// freed individually, they go away with the buffer
+class DescriptorBuffer final {
+ public:
+  struct Stats {
+    uint32_t sets = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize reservedBytes = 0;
+    uint32_t grows = 0;
+  };
+
+  MOVABLE_ONLY(DescriptorBuffer);
+
+  explicit DescriptorBuffer(const Context& context, VkDeviceSize initialSize = 64 * 1024,
+                            const std::string& name = "");
+
+  ~DescriptorBuffer();
+
+  // Returns the offset of the set in the buffer
+  VkDeviceSize allocate(VkDescriptorSetLayout layout);
+
+  // Writes one descriptor of a set allocated with layout
+  void write(VkDeviceSize setOffset, VkDescriptorSetLayout layout, uint32_t binding,
+             uint32_t arrayElement, const VkDescriptorGetInfoEXT& info);
+
+  // Binds the buffer as descriptor buffer 0. Command buffers recorded before the buffer
+  // grows keep using the old buffer, which doesn't see later writes
+  void bind(VkCommandBuffer commandBuffer) const;
+
+  size_t descriptorSize(VkDescriptorType type) const;
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  std::shared_ptr<Buffer> createBuffer(VkDeviceSize size);
+
+  VkDeviceSize layoutSize(VkDescriptorSetLayout layout);
+
+ private:
+  const Context& context_;
+  std::string name_;
+  const VkPhysicalDeviceDescriptorBufferPropertiesEXT& properties_;
+  std::shared_ptr<Buffer> buffer_;
+  VkDeviceAddress address_ = 0;
+  uint8_t* mappedMemory_ = nullptr;
+  // Buffers replaced by bigger ones, command buffers in flight may still use them
+  std::vector<std::shared_ptr<Buffer>> retiredBuffers_;
+  std::unordered_map<VkDescriptorSetLayout, VkDeviceSize> layoutSizes_;
+  Stats stats_;
+};
+
+}  // namespace VulkanCore
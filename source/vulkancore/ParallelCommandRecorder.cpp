@@ -0,0 +1,159 @@
+#include "ParallelCommandRecorder.hpp"
+
+#include <algorithm>
+#include <future>
+#include <tracy/Tracy.hpp>
+
+#include "CommandQueueManager.hpp"
+#include "Context.hpp"
+
+namespace VulkanCore {
+
+ParallelCommandRecorder::CommandPoolSet::~CommandPoolSet() {
+  for (auto commandPool : commandPools) {
+    // Destroying the pool frees its command buffers
+    vkDestroyCommandPool(device, commandPool, nullptr);
+  }
+}
+
+ParallelCommandRecorder::ParallelCommandRecorder(const Context& context,
+                                                 uint32_t queueFamilyIndex,
+                                                 uint32_t maxThreads,
+                                                 const std::string& name)
+    : context_(context),
+      queueFamilyIndex_(queueFamilyIndex),
+      maxThreads_(std::max(maxThreads, 1u)),
+      name_(name) {}
+
+ParallelCommandRecorder::~ParallelCommandRecorder() {
+  // Recordings still queued on a queue manager only hold weak references to their set,
+  // so they don't touch the pools once they are gone
+  sets_.clear();
+}
+
+void ParallelCommandRecorder::record(CommandQueueManager& queueMgr,
+                                     VkCommandBuffer primaryCmdBuffer,
+                                     const Inheritance& inheritance, uint32_t itemCount,
+                                     BS::thread_pool& pool,
+                                     const RecordFunction& recordFunction,
+                                     uint32_t numThreads) {
+  ZoneScopedN("ParallelCommandRecorder: record");
+  if (itemCount == 0) {
+    return;
+  }
+
+  if (numThreads == 0) {
+    numThreads = pool.get_thread_count() + 1;
+  }
+  const uint32_t numChunks = std::min({numThreads, maxThreads_, itemCount});
+
+  auto set = acquireSet();
+  queueMgr.disposeWhenSubmitCompletes([weakSet = std::weak_ptr(set)]() {
+    if (auto poolSet = weakSet.lock()) {
+      for (auto commandPool : poolSet->commandPools) {
+        VK_CHECK(vkResetCommandPool(poolSet->device, commandPool, 0));
+      }
+      poolSet->inUse = false;
+    }
+  });
+
+  const VkCommandBufferInheritanceRenderingInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+      .viewMask = inheritance.viewMask,
+      .colorAttachmentCount = static_cast<uint32_t>(inheritance.colorFormats.size()),
+      .pColorAttachmentFormats = inheritance.colorFormats.data(),
+      .depthAttachmentFormat = inheritance.depthFormat,
+      .stencilAttachmentFormat = inheritance.stencilFormat,
+      .rasterizationSamples = inheritance.samples,
+  };
+  const VkCommandBufferInheritanceInfo inheritanceInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+      .pNext = inheritance.renderPass == VK_NULL_HANDLE ? &renderingInfo : nullptr,
+      .renderPass = inheritance.renderPass,
+      .subpass = inheritance.subpass,
+      .framebuffer = inheritance.framebuffer,
+  };
+  const VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+               VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+      .pInheritanceInfo = &inheritanceInfo,
+  };
+
+  // Chunks differ by one item at most
+  const auto recordChunk = [&](uint32_t chunk) {
+    ZoneScopedN("ParallelCommandRecorder: record chunk");
+    const uint32_t first = static_cast<uint64_t>(itemCount) * chunk / numChunks;
+    const uint32_t last = static_cast<uint64_t>(itemCount) * (chunk + 1) / numChunks;
+    const auto cmdBuffer = set->commandBuffers[chunk];
+    VK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
+    recordFunction(cmdBuffer, first, last - first);
+    VK_CHECK(vkEndCommandBuffer(cmdBuffer));
+  };
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(numChunks - 1);
+  for (uint32_t chunk = 1; chunk < numChunks; ++chunk) {
+    futures.push_back(pool.submit(recordChunk, chunk));
+  }
+  recordChunk(0);
+  for (auto& future : futures) {
+    future.get();
+  }
+
+  vkCmdExecuteCommands(primaryCmdBuffer, numChunks, set->commandBuffers.data());
+}
+
+std::shared_ptr<ParallelCommandRecorder::CommandPoolSet>
+ParallelCommandRecorder::acquireSet() {
+  std::lock_guard lock(mutex_);
+  for (const auto& set : sets_) {
+    bool expected = false;
+    if (set->inUse.compare_exchange_strong(expected, true)) {
+      return set;
+    }
+  }
+  auto set = createSet();
+  set->inUse = true;
+  sets_.push_back(set);
+  return set;
+}
+
+std::shared_ptr<ParallelCommandRecorder::CommandPoolSet>
+ParallelCommandRecorder::createSet() {
+  ZoneScopedN("ParallelCommandRecorder: createSet");
+  auto set = std::make_shared<CommandPoolSet>();
+  set->device = context_.device();
+
+  const VkCommandPoolCreateInfo commandPoolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = queueFamilyIndex_,
+  };
+  const auto setName = name_ + " " + std::to_string(sets_.size());
+  for (uint32_t thread = 0; thread < maxThreads_; ++thread) {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateCommandPool(set->device, &commandPoolInfo, nullptr, &commandPool));
+    set->commandPools.push_back(commandPool);
+    context_.setVkObjectname(commandPool, VK_OBJECT_TYPE_COMMAND_POOL,
+                             "Parallel command pool: " + setName + " thread " +
+                                 std::to_string(thread));
+
+    const VkCommandBufferAllocateInfo commandBufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = commandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VK_CHECK(vkAllocateCommandBuffers(set->device, &commandBufferInfo, &cmdBuffer));
+    set->commandBuffers.push_back(cmdBuffer);
+    context_.setVkObjectname(cmdBuffer, VK_OBJECT_TYPE_COMMAND_BUFFER,
+                             "Secondary command buffer: " + setName + " thread " +
+                                 std::to_string(thread));
+  }
+
+  return set;
+}
+
+}  // namespace VulkanCore
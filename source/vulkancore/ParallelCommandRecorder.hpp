@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BS_thread_pool.hpp"
+#include "Common.hpp"
+#include "Utility.hpp"
+
+namespace VulkanCore {
+
+class CommandQueueManager;
+class Context;
+
+// Records the commands of a pass from several threads. A recording splits a range of
+// items (draws, meshes) into contiguous chunks and records each chunk into a secondary
+// command buffer allocated from a command pool that no other chunk uses, so a command
+// pool is never accessed by two threads at the same time. The calling thread records the
+// first chunk while the thread pool records the others, and the secondary command
+// buffers are then executed in order on the primary command buffer.
+// Each recording takes a set of command pools, which is reset and recycled when the
+// submission of the queue manager it was recorded for completes, so recording never
+// waits on the GPU
+class ParallelCommandRecorder final {
+ public:
+  // What the secondary command buffers inherit from the primary command buffer. With a
+  // render pass, the primary command buffer must have begun it with
+  // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. Without one dynamic rendering is
+  // assumed, begun with VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT
+  struct Inheritance {
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    std::vector<VkFormat> colorFormats;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    VkFormat stencilFormat = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    uint32_t viewMask = 0;
+  };
+
+  // Records the items [first, first + count) into cmdBuffer, which doesn't inherit any
+  // state but the render pass: pipelines, descriptor sets, viewports and scissors must
+  // be set again. It runs on several threads at once, so it must only read shared data
+  using RecordFunction =
+      std::function<void(VkCommandBuffer cmdBuffer, uint32_t first, uint32_t count)>;
+
+  MOVABLE_ONLY(ParallelCommandRecorder);
+
+  // maxThreads is the largest number of chunks a recording is split into
+  explicit ParallelCommandRecorder(const Context& context, uint32_t queueFamilyIndex,
+                                   uint32_t maxThreads, const std::string& name = "");
+
+  // The GPU must be done with all the recordings
+  ~ParallelCommandRecorder();
+
+  // Splits itemCount items into at most numThreads chunks (0 uses every thread of pool
+  // plus the calling one), records them and executes them on primaryCmdBuffer. Pending
+  // descriptor set updates must be flushed before, on the calling thread
+  void record(CommandQueueManager& queueMgr, VkCommandBuffer primaryCmdBuffer,
+              const Inheritance& inheritance, uint32_t itemCount, BS::thread_pool& pool,
+              const RecordFunction& recordFunction, uint32_t numThreads = 0);
+
+  uint32_t maxThreads() const { return maxThreads_; }
+
+ private:
+  struct CommandPoolSet {
+    VkDevice device = VK_NULL_HANDLE;
+    std::vector<VkCommandPool> commandPools;
+    std::vector<VkCommandBuffer> commandBuffers;  // one per command pool
+    std::atomic_bool inUse = false;
+
+    ~CommandPoolSet();
+  };
+
+  std::shared_ptr<CommandPoolSet> acquireSet();
+
+  std::shared_ptr<CommandPoolSet> createSet();
+
+ private:
+  const Context& context_;
+  uint32_t queueFamilyIndex_ = 0;
+  uint32_t maxThreads_ = 1;
+  std::string name_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<CommandPoolSet>> sets_;
+};
+
+}  // namespace VulkanCore
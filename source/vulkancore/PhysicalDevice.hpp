@@ -61,6 +61,11 @@ class PhysicalDevice final {
     return rayTracingPipelineProperties_;
   }
 
+  const VkPhysicalDeviceAccelerationStructurePropertiesKHR&
+  accelerationStructureProperties() const {
+    return accelStructProperties_;
+  }
+
   const VkPhysicalDeviceFragmentDensityMapPropertiesEXT& fragmentDensityMapProperties()
       const {
     return fragmentDensityMapProperties_;
@@ -83,6 +88,47 @@ class PhysicalDevice final {
     return fragmentDensityMapOffsetFeature_.fragmentDensityMapOffset == VK_TRUE;
   }
 
+  // The extension must have been requested too
+  bool isDescriptorBufferSupported() const {
+    return descriptorBufferFeature_.descriptorBuffer == VK_TRUE &&
+           enabledExtensions_.contains(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+  }
+
+  const VkPhysicalDeviceDescriptorBufferPropertiesEXT& descriptorBufferProperties() const {
+    return descriptorBufferProperties_;
+  }
+
+  // The extension must have been requested too
+  bool isMeshShaderSupported() const {
+    return meshShaderFeatureEXT_.meshShader == VK_TRUE &&
+           enabledExtensions_.contains(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+  }
+
+  // Only tells whether VMA reads the heap budgets from the driver, they are estimated
+  // without it
+  bool isMemoryBudgetSupported() const {
+    return enabledExtensions_.contains(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+
+  const VkPhysicalDeviceMeshShaderPropertiesEXT& meshShaderProperties() const {
+    return meshShaderProperties_;
+  }
+
+  bool isShaderOutputLayerSupported() const {
+    return features12_.shaderOutputLayer == VK_TRUE &&
+           features12_.shaderOutputViewportIndex == VK_TRUE;
+  }
+
+  const VkPhysicalDeviceSubgroupProperties& subgroupProperties() const {
+    return subgroupProperties_;
+  }
+
+  // Whether compute shaders can use the subgroup operations in operations
+  bool supportsSubgroupOperations(VkSubgroupFeatureFlags operations) const {
+    return (subgroupProperties_.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+           (subgroupProperties_.supportedOperations & operations) == operations;
+  }
+
  private:
   void enumerateSurfaceFormats(VkSurfaceKHR surface);
   void enumerateSurfaceCapabilities(VkSurfaceKHR surface);
@@ -99,32 +145,62 @@ class PhysicalDevice final {
           .pNext = nullptr,
       };
 
+  VkPhysicalDeviceMeshShaderPropertiesEXT meshShaderProperties_{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_EXT,
+      .pNext = &fragmentDensityMapOffsetProperties_,
+  };
+
+  VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties_{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT,
+      .pNext = &meshShaderProperties_,
+  };
+
   VkPhysicalDeviceFragmentDensityMapPropertiesEXT fragmentDensityMapProperties_{
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_PROPERTIES_EXT,
-      .pNext = &fragmentDensityMapOffsetProperties_,
+      .pNext = &descriptorBufferProperties_,
+  };
+
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR accelStructProperties_{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR,
+      .pNext = &fragmentDensityMapProperties_,
   };
 
   VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipelineProperties_{
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
-      .pNext = &fragmentDensityMapProperties_,
+      .pNext = &accelStructProperties_,
+  };
+
+  VkPhysicalDeviceSubgroupProperties subgroupProperties_{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+      .pNext = &rayTracingPipelineProperties_,
   };
 
   VkPhysicalDeviceProperties2 properties_ = {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-      .pNext = &rayTracingPipelineProperties_,
+      .pNext = &subgroupProperties_,
   };
 
   // Features
+  VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatureEXT_ = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+      .pNext = nullptr,
+  };
+
   VkPhysicalDeviceFragmentDensityMapOffsetFeaturesQCOM fragmentDensityMapOffsetFeature_ =
       {
           .sType =
               VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_OFFSET_FEATURES_QCOM,
-          .pNext = nullptr,
+          .pNext = &meshShaderFeatureEXT_,
+  };
+
+  VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeature_ = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+      .pNext = &fragmentDensityMapOffsetFeature_,
   };
 
   VkPhysicalDeviceFragmentDensityMapFeaturesEXT fragmentDensityMapFeature_ = {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_DENSITY_MAP_FEATURES_EXT,
-      .pNext = &fragmentDensityMapOffsetFeature_,
+      .pNext = &descriptorBufferFeature_,
   };
 
   VkPhysicalDeviceMultiviewFeatures multiviewFeature_ = {
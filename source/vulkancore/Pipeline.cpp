@@ -1,14 +1,24 @@
 #include "Pipeline.hpp"
 
+#include <algorithm>
+
 #include "Buffer.hpp"
 #include "Context.hpp"
+#include "DescriptorAllocator.hpp"
+#include "DescriptorBuffer.hpp"
 #include "RenderPass.hpp"
 #include "Sampler.hpp"
 #include "Texture.hpp"
 
 namespace VulkanCore {
 
-static constexpr int MAX_DESCRIPTOR_SETS = 4096 * 3;
+namespace {
+// Non-dispatchable handles are pointers or 64-bit integers depending on the platform
+template <typename T>
+uint64_t handleValue(T handle) {
+  return (uint64_t)handle;
+}
+}  // namespace
 
 Pipeline::Pipeline(const Context* context, const GraphicsPipelineDescriptor& desc,
                    VkRenderPass renderPass, const std::string& name)
@@ -17,6 +27,8 @@ Pipeline::Pipeline(const Context* context, const GraphicsPipelineDescriptor& des
       bindPoint_(VK_PIPELINE_BIND_POINT_GRAPHICS),
       vkRenderPass_(renderPass),
       name_{name} {
+  descriptorBufferMode_ =
+      desc.useDescriptorBuffer_ && context_->isDescriptorBufferEnabled();
   createGraphicsPipeline();
 }
 
@@ -26,6 +38,8 @@ Pipeline::Pipeline(const Context* context, const ComputePipelineDescriptor& desc
       computePipelineDesc_(desc),
       bindPoint_(VK_PIPELINE_BIND_POINT_COMPUTE),
       name_{name} {
+  descriptorBufferMode_ =
+      desc.useDescriptorBuffer_ && context_->isDescriptorBufferEnabled();
   createComputePipeline();
 }
 
@@ -43,7 +57,8 @@ Pipeline::~Pipeline() {
 
   vkDestroyPipeline(device, vkPipeline_, nullptr);
   vkDestroyPipelineLayout(device, vkPipelineLayout_, nullptr);
-  vkDestroyDescriptorPool(device, vkDescriptorPool_, nullptr);
+  descriptorAllocator_.reset();
+  descriptorBuffer_.reset();
 
   for (const auto& set : descriptorSets_) {
     vkDestroyDescriptorSetLayout(device, set.second.vkLayout_, nullptr);
@@ -66,24 +81,36 @@ void Pipeline::bind(VkCommandBuffer commandBuffer) {
 }
 
 void Pipeline::allocateDescriptors(const std::vector<SetAndCount>& setAndCount) {
-  if (vkDescriptorPool_ == VK_NULL_HANDLE) {
-    initDescriptorPool();
+  if (descriptorBufferMode_) {
+    std::unique_lock<std::mutex> mlock(mutex_);
+    for (const auto& set : setAndCount) {
+      ASSERT(descriptorSets_.contains(set.set_),
+             "This pipeline doesn't have a set with index " + std::to_string(set.set_));
+      auto& descriptorSet = descriptorSets_[set.set_];
+      for (size_t i = 0; i < set.count_; ++i) {
+        descriptorSet.bufferOffsets_.push_back(
+            descriptorBuffer().allocate(descriptorSet.vkLayout_));
+      }
+    }
+    return;
   }
 
-  for (auto set : setAndCount) {
+  std::vector<DescriptorAllocator::Request> requests;
+  for (const auto& set : setAndCount) {
     ASSERT(descriptorSets_.contains(set.set_),
            "This pipeline doesn't have a set with index " + std::to_string(set.set_));
+    requests.push_back({
+        .layout = descriptorSets_[set.set_].vkLayout_,
+        .bindings = descriptorSets_[set.set_].bindings_,
+        .count = set.count_,
+    });
+  }
 
-    const VkDescriptorSetAllocateInfo allocInfo = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = vkDescriptorPool_,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &descriptorSets_[set.set_].vkLayout_,
-    };
+  const auto descriptorSets = descriptorAllocator().allocate(requests);
 
+  for (size_t setIndex = 0; const auto& set : setAndCount) {
     for (size_t i = 0; i < set.count_; ++i) {
-      VkDescriptorSet descriptorSet{VK_NULL_HANDLE};
-      VK_CHECK(vkAllocateDescriptorSets(context_->device(), &allocInfo, &descriptorSet));
+      const auto descriptorSet = descriptorSets[setIndex++];
       descriptorSets_[set.set_].vkSets_.push_back(descriptorSet);
 
       context_->setVkObjectname(descriptorSet, VK_OBJECT_TYPE_DESCRIPTOR_SET,
@@ -94,20 +121,154 @@ void Pipeline::allocateDescriptors(const std::vector<SetAndCount>& setAndCount)
 
 void Pipeline::bindDescriptorSets(VkCommandBuffer commandBuffer,
                                   const std::vector<SetAndBindingIndex>& sets) {
+  // at() doesn't modify the map, command buffers are recorded from several threads
+  if (descriptorBufferMode_) {
+    descriptorBuffer_->bind(commandBuffer);
+    // One call per run of consecutive set numbers
+    std::vector<uint32_t> bufferIndices;
+    std::vector<VkDeviceSize> offsets;
+    for (size_t i = 0; i < sets.size(); ++i) {
+      offsets.push_back(descriptorSets_.at(sets[i].set).bufferOffsets_[sets[i].bindIdx]);
+      bufferIndices.push_back(0);
+      if (i + 1 == sets.size() || sets[i + 1].set != sets[i].set + 1) {
+        const auto firstSet = sets[i].set + 1 - static_cast<uint32_t>(offsets.size());
+        vkCmdSetDescriptorBufferOffsetsEXT(
+            commandBuffer, bindPoint_, vkPipelineLayout_, firstSet,
+            static_cast<uint32_t>(offsets.size()), bufferIndices.data(), offsets.data());
+        bufferIndices.clear();
+        offsets.clear();
+      }
+    }
+    return;
+  }
+
   for (const auto& set : sets) {
     vkCmdBindDescriptorSets(commandBuffer, bindPoint_, vkPipelineLayout_, set.set, 1u,
-                            &descriptorSets_[set.set].vkSets_[set.bindIdx], 0, nullptr);
+                            &descriptorSets_.at(set.set).vkSets_[set.bindIdx], 0,
+                            nullptr);
+  }
+}
+
+uint32_t Pipeline::descriptorSetFor(uint32_t set,
+                                    const std::vector<SetBindings>& bindings) {
+  ASSERT(descriptorSets_.contains(set),
+         "This pipeline doesn't have a set with index " + std::to_string(set));
+
+  std::vector<uint64_t> contents;
+  std::vector<std::weak_ptr<const void>> owners;
+  for (const auto& binding : bindings) {
+    contents.insert(contents.end(), {
+                                        binding.binding_,
+                                        binding.index_,
+                                        binding.offset_,
+                                        binding.bufferBytes,
+                                        static_cast<uint64_t>(binding.type_),
+                                        binding.textures_.size(),
+                                        binding.samplers_.size(),
+                                    });
+    if (binding.buffer) {
+      contents.push_back(handleValue(binding.buffer->vkBuffer()));
+      owners.push_back(binding.buffer);
+    }
+    for (const auto& texture : binding.textures_) {
+      contents.push_back(texture ? handleValue(texture->vkImageView()) : 0);
+      if (texture) {
+        owners.push_back(texture);
+      }
+    }
+    for (const auto& sampler : binding.samplers_) {
+      contents.push_back(handleValue(sampler->vkSampler()));
+      owners.push_back(sampler);
+    }
+  }
+
+  size_t hash = 0;
+  for (const auto value : contents) {
+    util::hash_combine(hash, value);
+  }
+
+  auto& cachedSets = cachedSets_[set];
+  const auto [first, last] = cachedSets.equal_range(hash);
+  for (auto itr = first; itr != last; ++itr) {
+    auto& cachedSet = itr->second;
+    if (cachedSet.contents != contents) {
+      continue;
+    }
+    const bool stale =
+        std::any_of(cachedSet.owners.begin(), cachedSet.owners.end(),
+                    [](const auto& owner) { return owner.expired(); });
+    if (stale) {
+      // Same handles, but some belong to new objects now
+      bindResources(set, cachedSet.index, bindings);
+      cachedSet.owners = std::move(owners);
+    } else {
+      std::unique_lock<std::mutex> mlock(mutex_);
+      ++descriptorStats_.cachedSetHits;
+    }
+    return cachedSet.index;
+  }
+
+  auto& descriptorSet = descriptorSets_[set];
+  uint32_t index = 0;
+  if (descriptorBufferMode_) {
+    std::unique_lock<std::mutex> mlock(mutex_);
+    descriptorSet.bufferOffsets_.push_back(
+        descriptorBuffer().allocate(descriptorSet.vkLayout_));
+    index = static_cast<uint32_t>(descriptorSet.bufferOffsets_.size() - 1);
+  } else {
+    descriptorSet.vkSets_.push_back(descriptorAllocator().allocateOne(
+        descriptorSet.vkLayout_, descriptorSet.bindings_));
+    index = static_cast<uint32_t>(descriptorSet.vkSets_.size() - 1);
+    context_->setVkObjectname(descriptorSet.vkSets_.back(),
+                              VK_OBJECT_TYPE_DESCRIPTOR_SET,
+                              "Descriptor set: cached " + std::to_string(set) + " " +
+                                  std::to_string(index) + " " + name_);
+  }
+
+  bindResources(set, index, bindings);
+  cachedSets.emplace(hash, CachedSet{
+                               .index = index,
+                               .contents = std::move(contents),
+                               .owners = std::move(owners),
+                           });
+  return index;
+}
+
+void Pipeline::bindResources(uint32_t set, uint32_t index,
+                             const std::vector<SetBindings>& bindings) {
+  for (const auto& binding : bindings) {
+    if (binding.buffer) {
+      bindResource(set, binding.binding_, index, binding.buffer, binding.offset_,
+                   static_cast<uint32_t>(binding.bufferBytes),
+                   binding.type_ != VK_DESCRIPTOR_TYPE_MAX_ENUM
+                       ? binding.type_
+                       : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    } else if (binding.type_ == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE) {
+      ASSERT(binding.textures_.size() == 1, "Only one storage image per binding");
+      bindResource(set, binding.binding_, index, binding.textures_[0], binding.type_);
+    } else if (!binding.textures_.empty()) {
+      ASSERT(binding.samplers_.size() <= 1,
+             "Textures can only be combined with a single sampler");
+      bindResource(set, binding.binding_, index, binding.textures_,
+                   binding.samplers_.empty() ? nullptr : binding.samplers_[0],
+                   binding.index_);
+    } else if (!binding.samplers_.empty()) {
+      bindResource(set, binding.binding_, index, binding.samplers_);
+    }
   }
 }
 
 void Pipeline::updateSamplersDescriptorSets(uint32_t set, uint32_t index,
                                             const std::vector<SetBindings>& bindings) {
+  ASSERT(!descriptorBufferMode_, "Use bindResource with a descriptor buffer");
   ASSERT(!bindings.empty(), "bindings are empty");
   std::vector<std::vector<VkDescriptorImageInfo>> samplerInfo(bindings.size());
 
   std::vector<VkWriteDescriptorSet> writeDescSets;
   writeDescSets.reserve(bindings.size());
 
+  std::unique_lock<std::mutex> mlock(mutex_);
+
   for (size_t idx = 0; auto& binding : bindings) {
     samplerInfo[idx].reserve(binding.samplers_.size());
     for (const auto& sampler : binding.samplers_) {
@@ -125,6 +286,7 @@ void Pipeline::updateSamplersDescriptorSets(uint32_t set, uint32_t index,
         .pImageInfo = samplerInfo[idx].data(),
         .pBufferInfo = nullptr,
     };
+    forgetDescriptors(handleValue(writeDescSet.dstSet), writeDescSet.dstBinding);
 
     writeDescSets.emplace_back(std::move(writeDescSet));
     ++idx;
@@ -132,16 +294,22 @@ void Pipeline::updateSamplersDescriptorSets(uint32_t set, uint32_t index,
 
   vkUpdateDescriptorSets(context_->device(), writeDescSets.size(), writeDescSets.data(),
                          0, nullptr);
+  descriptorStats_.writesRequested += writeDescSets.size();
+  descriptorStats_.writesIssued += writeDescSets.size();
+  ++descriptorStats_.updateCalls;
 }
 
 void Pipeline::updateTexturesDescriptorSets(uint32_t set, uint32_t index,
                                             const std::vector<SetBindings>& bindings) {
+  ASSERT(!descriptorBufferMode_, "Use bindResource with a descriptor buffer");
   ASSERT(!bindings.empty(), "bindings are empty");
   std::vector<std::vector<VkDescriptorImageInfo>> imageInfo(bindings.size());
 
   std::vector<VkWriteDescriptorSet> writeDescSets;
   writeDescSets.reserve(bindings.size());
 
+  std::unique_lock<std::mutex> mlock(mutex_);
+
   for (size_t idx = 0; auto& binding : bindings) {
     imageInfo[idx].reserve(binding.textures_.size());
     for (const auto& texture : binding.textures_) {
@@ -160,6 +328,7 @@ void Pipeline::updateTexturesDescriptorSets(uint32_t set, uint32_t index,
         .pImageInfo = imageInfo[idx].data(),
         .pBufferInfo = nullptr,
     };
+    forgetDescriptors(handleValue(writeDescSet.dstSet), writeDescSet.dstBinding);
 
     writeDescSets.emplace_back(std::move(writeDescSet));
     ++idx;
@@ -167,17 +336,23 @@ void Pipeline::updateTexturesDescriptorSets(uint32_t set, uint32_t index,
 
   vkUpdateDescriptorSets(context_->device(), writeDescSets.size(), writeDescSets.data(),
                          0, nullptr);
+  descriptorStats_.writesRequested += writeDescSets.size();
+  descriptorStats_.writesIssued += writeDescSets.size();
+  ++descriptorStats_.updateCalls;
 }
 
 void Pipeline::updateBuffersDescriptorSets(uint32_t set, uint32_t index,
                                            VkDescriptorType type,
                                            const std::vector<SetBindings>& bindings) {
+  ASSERT(!descriptorBufferMode_, "Use bindResource with a descriptor buffer");
   ASSERT(!bindings.empty(), "bindings are empty");
   std::vector<VkDescriptorBufferInfo> bufferInfo;
   bufferInfo.reserve(bindings.size());
   std::vector<VkWriteDescriptorSet> writeDescSets;
   writeDescSets.reserve(bindings.size());
 
+  std::unique_lock<std::mutex> mlock(mutex_);
+
   for (auto& binding : bindings) {
     bufferInfo.emplace_back(VkDescriptorBufferInfo{
         .buffer = binding.buffer->vkBuffer(), .offset = 0, .range = binding.bufferBytes});
@@ -192,62 +367,296 @@ void Pipeline::updateBuffersDescriptorSets(uint32_t set, uint32_t index,
         .pImageInfo = nullptr,
         .pBufferInfo = &bufferInfo.back(),
     };
+    forgetDescriptors(handleValue(writeDescSet.dstSet), writeDescSet.dstBinding);
 
     writeDescSets.emplace_back(writeDescSet);
   }
 
   vkUpdateDescriptorSets(context_->device(), writeDescSets.size(), writeDescSets.data(),
                          0, nullptr);
+  descriptorStats_.writesRequested += writeDescSets.size();
+  descriptorStats_.writesIssued += writeDescSets.size();
+  ++descriptorStats_.updateCalls;
 }
 
 void Pipeline::updateDescriptorSets() {
+  // Most binds have nothing to write, they don't need the lock
+  if (!hasPendingWrites_.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> mlock(mutex_);
+  // Superseded writes have no set
+  std::erase_if(writeDescSets_, [](const VkWriteDescriptorSet& writeDescSet) {
+    return writeDescSet.dstSet == VK_NULL_HANDLE;
+  });
   if (!writeDescSets_.empty()) {
-    std::unique_lock<std::mutex> mlock(mutex_);
     vkUpdateDescriptorSets(context_->device(), writeDescSets_.size(),
                            writeDescSets_.data(), 0, nullptr);
-    writeDescSets_.clear();
-    bufferInfo_.clear();
+    descriptorStats_.writesIssued += writeDescSets_.size();
+    ++descriptorStats_.updateCalls;
+  }
+  writeDescSets_.clear();
+  bufferInfo_.clear();
+
+  bufferViewInfo_.clear();
+  imageInfo_.clear();
+  accelerationStructInfo_.clear();
 
+  ++writeGeneration_;
+  hasPendingWrites_.store(false, std::memory_order_release);
+}
+
+Pipeline::DescriptorStats Pipeline::descriptorStats() const {
+  std::unique_lock<std::mutex> mlock(mutex_);
+  auto stats = descriptorStats_;
+  if (descriptorAllocator_) {
+    const auto& allocatorStats = descriptorAllocator_->stats();
+    stats.descriptorSets = allocatorStats.setsAllocated;
+    stats.descriptorPools = allocatorStats.pools;
+    stats.poolDescriptors = allocatorStats.descriptorsReserved;
+  }
+  if (descriptorBuffer_) {
+    stats.descriptorSets = descriptorBuffer_->stats().sets;
+    stats.descriptorBufferBytes = descriptorBuffer_->stats().usedBytes;
+  }
+  return stats;
+}
+
+void Pipeline::resetDescriptorStats() {
+  std::unique_lock<std::mutex> mlock(mutex_);
+  descriptorStats_ = {};
+}
+
+size_t Pipeline::BindingKeyHash::operator()(const BindingKey& key) const {
+  size_t hash = 0;
+  util::hash_combine(hash, key.set, key.binding);
+  return hash;
+}
+
+Pipeline::BoundResources* Pipeline::needsWrite(
+    uint64_t dstSet, uint32_t binding, uint32_t arrayElement, uint32_t count,
+    VkDescriptorType type, std::vector<uint64_t>&& handles,
+    std::vector<std::weak_ptr<const void>>&& owners) {
+  ++descriptorStats_.writesRequested;
+
+  auto& ranges = boundResources_[{dstSet, binding}];
+  const auto itr = ranges.find(arrayElement);
+  if (itr != ranges.end()) {
+    const auto& bound = itr->second;
+    const bool stale = std::any_of(bound.owners.begin(), bound.owners.end(),
+                                   [](const auto& owner) { return owner.expired(); });
+    if (!stale && bound.type == type && bound.count == count &&
+        bound.handles == handles) {
+      ++descriptorStats_.writesSkipped;
+      return nullptr;
+    }
+    // A later write that overlapped the pending one would have removed it from ranges,
+    // so the pending write can be dropped without reordering anything
+    if (bound.count == count && bound.writeGeneration == writeGeneration_) {
+      writeDescSets_[bound.pendingWrite].dstSet = VK_NULL_HANDLE;
+      ++descriptorStats_.writesCoalesced;
+    }
+  }
+
+  auto first = ranges.lower_bound(arrayElement);
+  if (first != ranges.begin()) {
+    const auto previous = std::prev(first);
+    if (previous->first + previous->second.count > arrayElement) {
+      first = previous;
+    }
+  }
+  ranges.erase(first, ranges.lower_bound(arrayElement + count));
+
+  auto& bound = ranges[arrayElement];
+  bound.type = type;
+  bound.count = count;
+  bound.handles = std::move(handles);
+  bound.owners = std::move(owners);
+  return &bound;
+}
+
+void Pipeline::forgetDescriptors(uint64_t dstSet, uint32_t binding) {
+  boundResources_.erase({dstSet, binding});
+}
+
+void Pipeline::issueWrite(const VkWriteDescriptorSet& writeDescSet,
+                          const WriteTarget& target, BoundResources* bound,
+                          VkFormat texelFormat) {
+  if (descriptorBufferMode_) {
+    writeToDescriptorBuffer(writeDescSet, target, texelFormat);
+    ++descriptorStats_.writesIssued;
+    // The descriptors have been copied, the infos aren't needed anymore
+    bufferInfo_.clear();
     bufferViewInfo_.clear();
     imageInfo_.clear();
     accelerationStructInfo_.clear();
+    return;
+  }
+
+  if (bound) {
+    bound->pendingWrite = writeDescSets_.size();
+    bound->writeGeneration = writeGeneration_;
   }
+  writeDescSets_.emplace_back(writeDescSet);
+  hasPendingWrites_.store(true, std::memory_order_release);
+}
+
+void Pipeline::writeToDescriptorBuffer(const VkWriteDescriptorSet& writeDescSet,
+                                       const WriteTarget& target, VkFormat texelFormat) {
+  const auto& descriptorSet = descriptorSets_.at(target.set);
+  const auto setOffset = descriptorSet.bufferOffsets_[target.index];
+  const auto device = context_->device();
+
+  const auto bufferAddress = [device](const VkDescriptorBufferInfo& bufferInfo) {
+    const VkBufferDeviceAddressInfo addressInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = bufferInfo.buffer,
+    };
+    return VkDescriptorAddressInfoEXT{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT,
+        .address = vkGetBufferDeviceAddress(device, &addressInfo) + bufferInfo.offset,
+        .range = bufferInfo.range,
+    };
+  };
+
+  for (uint32_t i = 0; i < writeDescSet.descriptorCount; ++i) {
+    VkDescriptorGetInfoEXT info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+        .type = writeDescSet.descriptorType,
+    };
+    VkDescriptorAddressInfoEXT addressInfo;
+    switch (writeDescSet.descriptorType) {
+      case VK_DESCRIPTOR_TYPE_SAMPLER:
+        info.data.pSampler = &writeDescSet.pImageInfo[i].sampler;
+        break;
+      case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+        info.data.pCombinedImageSampler = &writeDescSet.pImageInfo[i];
+        break;
+      case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        info.data.pSampledImage = &writeDescSet.pImageInfo[i];
+        break;
+      case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+        info.data.pStorageImage = &writeDescSet.pImageInfo[i];
+        break;
+      case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+        addressInfo = bufferAddress(writeDescSet.pBufferInfo[i]);
+        info.data.pUniformBuffer = &addressInfo;
+        break;
+      case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+        addressInfo = bufferAddress(writeDescSet.pBufferInfo[i]);
+        info.data.pStorageBuffer = &addressInfo;
+        break;
+      case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+        addressInfo = bufferAddress(writeDescSet.pBufferInfo[i]);
+        addressInfo.format = texelFormat;
+        info.data.pUniformTexelBuffer = &addressInfo;
+        break;
+      case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        addressInfo = bufferAddress(writeDescSet.pBufferInfo[i]);
+        addressInfo.format = texelFormat;
+        info.data.pStorageTexelBuffer = &addressInfo;
+        break;
+      case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR: {
+        const auto* accelStructInfo =
+            static_cast<const VkWriteDescriptorSetAccelerationStructureKHR*>(
+                writeDescSet.pNext);
+        const VkAccelerationStructureDeviceAddressInfoKHR accelAddressInfo = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+            .accelerationStructure = accelStructInfo->pAccelerationStructures[i],
+        };
+        info.data.accelerationStructure =
+            vkGetAccelerationStructureDeviceAddressKHR(device, &accelAddressInfo);
+        break;
+      }
+      default:
+        ASSERT(false, "Descriptor type not supported by descriptor buffers");
+        return;
+    }
+    descriptorBuffer_->write(setOffset, descriptorSet.vkLayout_, writeDescSet.dstBinding,
+                             writeDescSet.dstArrayElement + i, info);
+  }
+}
+
+DescriptorAllocator& Pipeline::descriptorAllocator() {
+  if (!descriptorAllocator_) {
+    descriptorAllocator_ = std::make_unique<DescriptorAllocator>(
+        *context_, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT, name_);
+  }
+  return *descriptorAllocator_;
+}
+
+DescriptorBuffer& Pipeline::descriptorBuffer() {
+  if (!descriptorBuffer_) {
+    descriptorBuffer_ = std::make_unique<DescriptorBuffer>(*context_, 64 * 1024, name_);
+  }
+  return *descriptorBuffer_;
+}
+
+Pipeline::WriteTarget Pipeline::writeTarget(uint32_t set, uint32_t index) {
+  const auto& descriptorSet = descriptorSets_[set];
+  if (descriptorBufferMode_) {
+    ASSERT(index < descriptorSet.bufferOffsets_.size(),
+           "Did you allocate the descriptor set before binding to it?");
+    return {
+        .set = set,
+        .index = index,
+        .key = descriptorSet.bufferOffsets_[index],
+    };
+  }
+  ASSERT(index < descriptorSet.vkSets_.size() &&
+             descriptorSet.vkSets_[index] != VK_NULL_HANDLE,
+         "Did you allocate the descriptor set before binding to it?");
+  return {
+      .set = set,
+      .index = index,
+      .vkSet = descriptorSet.vkSets_[index],
+      .key = handleValue(descriptorSet.vkSets_[index]),
+  };
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::shared_ptr<Buffer> buffer, uint32_t offset,
                             uint32_t size, VkDescriptorType type, VkFormat format) {
+  const bool texelBuffer = type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER ||
+                           type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+  ASSERT(!texelBuffer || format != VK_FORMAT_UNDEFINED, "format must be specified");
+
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  const auto bufferView =
+      texelBuffer ? buffer->requestBufferView(format) : VK_NULL_HANDLE;
+  auto* bound = needsWrite(target.key, binding, 0, 1, type,
+                           {handleValue(buffer->vkBuffer()), offset, size,
+                            handleValue(bufferView)},
+                           {buffer});
+  if (!bound) {
+    return;
+  }
+
   bufferInfo_.emplace_back(std::vector<VkDescriptorBufferInfo>{VkDescriptorBufferInfo{
       .buffer = buffer->vkBuffer(), .offset = offset, .range = size}});
 
-  if (type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER ||
-      type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER) {
-    ASSERT(format != VK_FORMAT_UNDEFINED, "format must be specified");
-    bufferViewInfo_.emplace_back(buffer->requestBufferView(format));
+  if (texelBuffer) {
+    bufferViewInfo_.emplace_back(bufferView);
   }
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = 1,
       .descriptorType = type,
       .pImageInfo = nullptr,
-      .pBufferInfo = (type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER ||
-                      type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER)
-                         ? VK_NULL_HANDLE
-                         : bufferInfo_.back().data(),
-      .pTexelBufferView = (type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER ||
-                           type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER)
-                              ? &bufferViewInfo_.back()
-                              : VK_NULL_HANDLE,
+      // Ignored for texel buffers, but a descriptor buffer needs their address
+      .pBufferInfo = bufferInfo_.back().data(),
+      .pTexelBufferView = texelBuffer ? &bufferViewInfo_.back() : nullptr,
   };
 
-  writeDescSets_.emplace_back(std::move(writeDescSet));
+  issueWrite(writeDescSet, target, bound, format);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
@@ -259,42 +668,76 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
 
   std::unique_lock<std::mutex> mlock(mutex_);
 
-  imageInfo_.push_back(std::vector<VkDescriptorImageInfo>());
-  imageInfo_.back().reserve(textures.size());
+  std::vector<VkDescriptorImageInfo> imageInfo;
+  imageInfo.reserve(textures.size());
+  std::vector<uint64_t> handles;
+  std::vector<std::weak_ptr<const void>> owners;
+  if (sampler) {
+    owners.push_back(sampler);
+  }
   for (const auto& texture : textures) {
     if (texture) {
-      imageInfo_.back().emplace_back(VkDescriptorImageInfo{
+      imageInfo.emplace_back(VkDescriptorImageInfo{
           .sampler = sampler ? sampler->vkSampler() : VK_NULL_HANDLE,
           .imageView = texture->vkImageView(),
           .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
       });
+      handles.push_back(handleValue(imageInfo.back().sampler));
+      handles.push_back(handleValue(imageInfo.back().imageView));
+      owners.push_back(texture);
     }
   }
 
-  if (imageInfo_.back().size() == 0) {
+  if (imageInfo.size() == 0) {
     return;
   }
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
+  const auto target = writeTarget(set, index);
+
+  const auto type = sampler ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                            : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  auto* bound = needsWrite(target.key, binding, dstArrayElement,
+                           static_cast<uint32_t>(imageInfo.size()), type,
+                           std::move(handles), std::move(owners));
+  if (!bound) {
+    return;
+  }
+
+  imageInfo_.push_back(std::move(imageInfo));
 
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = dstArrayElement,
       .descriptorCount = static_cast<uint32_t>(imageInfo_.back().size()),
-      .descriptorType = sampler ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
-                                : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+      .descriptorType = type,
       .pImageInfo = imageInfo_.back().data(),
       .pBufferInfo = nullptr,
   };
 
-  writeDescSets_.emplace_back(std::move(writeDescSet));
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::span<std::shared_ptr<Sampler>> samplers) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  std::vector<uint64_t> handles;
+  std::vector<std::weak_ptr<const void>> owners;
+  for (const auto& sampler : samplers) {
+    handles.push_back(handleValue(sampler->vkSampler()));
+    owners.push_back(sampler);
+  }
+  auto* bound = needsWrite(target.key, binding, 0, static_cast<uint32_t>(samplers.size()),
+                           VK_DESCRIPTOR_TYPE_SAMPLER, std::move(handles),
+                           std::move(owners));
+  if (!bound) {
+    return;
+  }
+
   imageInfo_.push_back(std::vector<VkDescriptorImageInfo>());
   imageInfo_.back().reserve(samplers.size());
   for (const auto& sampler : samplers) {
@@ -303,12 +746,9 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
     });
   }
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = static_cast<uint32_t>(imageInfo_.back().size()),
@@ -317,55 +757,74 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
       .pBufferInfo = nullptr,
   };
 
-  writeDescSets_.emplace_back(writeDescSet);
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::vector<std::shared_ptr<Buffer>> buffers,
                             VkDescriptorType type) {
-  std::vector<VkDescriptorBufferInfo> bufferInfos;
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
 
+  std::vector<VkDescriptorBufferInfo> bufferInfos;
+  std::vector<uint64_t> handles;
+  std::vector<std::weak_ptr<const void>> owners;
   for (auto& buffer : buffers) {
     bufferInfos.emplace_back(VkDescriptorBufferInfo{
         .buffer = buffer->vkBuffer(),
         .offset = 0,
         .range = buffer->size(),
     });
+    handles.push_back(handleValue(buffer->vkBuffer()));
+    handles.push_back(buffer->size());
+    owners.push_back(buffer);
   }
 
-  bufferInfo_.emplace_back(bufferInfos);
+  auto* bound =
+      needsWrite(target.key, binding, 0, static_cast<uint32_t>(bufferInfos.size()), type,
+                 std::move(handles), std::move(owners));
+  if (!bound) {
+    return;
+  }
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
+  bufferInfo_.emplace_back(std::move(bufferInfos));
 
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
-      .descriptorCount = uint32_t(bufferInfos.size()),
+      .descriptorCount = uint32_t(bufferInfo_.back().size()),
       .descriptorType = type,
       .pImageInfo = nullptr,
       .pBufferInfo = bufferInfo_.back().data(),
   };
 
-  writeDescSets_.emplace_back(std::move(writeDescSet));
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::shared_ptr<Texture> texture, VkDescriptorType type) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  auto* bound = needsWrite(target.key, binding, 0, 1, type,
+                           {handleValue(texture->vkImageView())}, {texture});
+  if (!bound) {
+    return;
+  }
+
   imageInfo_.push_back(std::vector<VkDescriptorImageInfo>());
   imageInfo_.back().push_back(VkDescriptorImageInfo{
       .imageView = texture->vkImageView(),
       .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
   });
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = static_cast<uint32_t>(imageInfo_.back().size()),
@@ -374,12 +833,29 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
       .pBufferInfo = nullptr,
   };
 
-  writeDescSets_.emplace_back(writeDescSet);
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::span<std::shared_ptr<VkImageView>> imageViews,
                             VkDescriptorType type) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  std::vector<uint64_t> handles;
+  std::vector<std::weak_ptr<const void>> owners;
+  for (const auto& imview : imageViews) {
+    handles.push_back(handleValue(*imview));
+    owners.push_back(imview);
+  }
+  auto* bound =
+      needsWrite(target.key, binding, 0, static_cast<uint32_t>(imageViews.size()), type,
+                 std::move(handles), std::move(owners));
+  if (!bound) {
+    return;
+  }
+
   imageInfo_.push_back(std::vector<VkDescriptorImageInfo>());
   imageInfo_.back().reserve(imageViews.size());
   for (const auto& imview : imageViews) {
@@ -389,12 +865,9 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
     });
   }
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = static_cast<uint32_t>(imageInfo_.back().size()),
@@ -403,12 +876,24 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
       .pBufferInfo = nullptr,
   };
 
-  writeDescSets_.emplace_back(writeDescSet);
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             std::shared_ptr<Texture> texture,
                             std::shared_ptr<Sampler> sampler, VkDescriptorType type) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  auto* bound = needsWrite(
+      target.key, binding, 0, 1, type,
+      {handleValue(sampler->vkSampler()), handleValue(texture->vkImageView())},
+      {sampler, texture});
+  if (!bound) {
+    return;
+  }
+
   imageInfo_.push_back(std::vector<VkDescriptorImageInfo>());
   imageInfo_.back().push_back(VkDescriptorImageInfo{
       .sampler = sampler->vkSampler(),
@@ -416,12 +901,9 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
       .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
   });
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = static_cast<uint32_t>(imageInfo_.back().size()),
@@ -430,31 +912,36 @@ void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
       .pBufferInfo = nullptr,
   };
 
-  writeDescSets_.emplace_back(writeDescSet);
+  issueWrite(writeDescSet, target, bound);
 }
 
 void Pipeline::bindResource(uint32_t set, uint32_t binding, uint32_t index,
                             VkAccelerationStructureKHR* accelStructHandle) {
+  std::unique_lock<std::mutex> mlock(mutex_);
+
+  const auto target = writeTarget(set, index);
+
+  // Acceleration structures are rebuilt in place, the write is always issued
+  ++descriptorStats_.writesRequested;
+  forgetDescriptors(target.key, binding);
+
   accelerationStructInfo_.push_back(VkWriteDescriptorSetAccelerationStructureKHR{
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR,
       .accelerationStructureCount = 1,
       .pAccelerationStructures = accelStructHandle,
   });
 
-  ASSERT(descriptorSets_[set].vkSets_[index] != VK_NULL_HANDLE,
-         "Did you allocate the descriptor set before binding to it?");
-
   const VkWriteDescriptorSet writeDescSet = {
       .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
       .pNext = &accelerationStructInfo_.back(),
-      .dstSet = descriptorSets_[set].vkSets_[index],
+      .dstSet = target.vkSet,
       .dstBinding = binding,
       .dstArrayElement = 0,
       .descriptorCount = 1u,
       .descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR,
   };
 
-  writeDescSets_.emplace_back(writeDescSet);
+  issueWrite(writeDescSet, target, nullptr);
 }
 
 void Pipeline::bindVertexBuffer(VkCommandBuffer commandBuffer, VkBuffer vertexBuffer) {
@@ -490,35 +977,47 @@ void Pipeline::createGraphicsPipeline() {
       .pData = graphicsPipelineDesc_.fragmentSpecializationData,
   };
 
-  const auto vertShader = graphicsPipelineDesc_.vertexShader_.lock();
-  ASSERT(vertShader,
-         "Vertex's ShaderModule has been destroyed before being used to create "
-         "a pipeline");
+  const auto shaderStage = [](const std::shared_ptr<ShaderModule>& shader,
+                               const VkSpecializationInfo* specializationInfo) {
+    return VkPipelineShaderStageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = shader->vkShaderStageFlags(),
+        .module = shader->vkShaderModule(),
+        .pName = shader->entryPoint().c_str(),
+        .pSpecializationInfo = specializationInfo,
+    };
+  };
+  const auto* vertexSpecialization = !graphicsPipelineDesc_.vertexSpecConstants_.empty()
+                                         ? &vertexSpecializationInfo
+                                         : nullptr;
+
+  std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+  const bool useMeshShader = !graphicsPipelineDesc_.meshShader_.expired();
+  if (useMeshShader) {
+    ASSERT(context_->isMeshShaderEnabled(),
+           "Mesh shaders need VK_EXT_mesh_shader and enableMeshShaderFeature()");
+    if (const auto taskShader = graphicsPipelineDesc_.taskShader_.lock()) {
+      shaderStages.push_back(shaderStage(taskShader, nullptr));
+    }
+    // The vertex specialization constants go to the mesh shader
+    shaderStages.push_back(
+        shaderStage(graphicsPipelineDesc_.meshShader_.lock(), vertexSpecialization));
+  } else {
+    const auto vertShader = graphicsPipelineDesc_.vertexShader_.lock();
+    ASSERT(vertShader,
+           "Vertex's ShaderModule has been destroyed before being used to create "
+           "a pipeline");
+    shaderStages.push_back(shaderStage(vertShader, vertexSpecialization));
+  }
+
   const auto fragShader = graphicsPipelineDesc_.fragmentShader_.lock();
   ASSERT(fragShader,
-         "Vertex's ShaderModule has been destroyed before being used to create "
+         "Fragment's ShaderModule has been destroyed before being used to create "
          "a pipeline");
-  std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
-
-      VkPipelineShaderStageCreateInfo{
-          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-          .stage = vertShader->vkShaderStageFlags(),
-          .module = vertShader->vkShaderModule(),
-          .pName = vertShader->entryPoint().c_str(),
-          .pSpecializationInfo = !graphicsPipelineDesc_.vertexSpecConstants_.empty()
-                                     ? &vertexSpecializationInfo
-                                     : nullptr,
-      },
-      VkPipelineShaderStageCreateInfo{
-          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-          .stage = fragShader->vkShaderStageFlags(),
-          .module = fragShader->vkShaderModule(),
-          .pName = fragShader->entryPoint().c_str(),
-          .pSpecializationInfo = !graphicsPipelineDesc_.fragmentSpecConstants_.empty()
-                                     ? &fragmentSpecializationInfo
-                                     : nullptr,
-      },
-  };
+  shaderStages.push_back(shaderStage(
+      fragShader, !graphicsPipelineDesc_.fragmentSpecConstants_.empty()
+                      ? &fragmentSpecializationInfo
+                      : nullptr));
 
   const VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
@@ -655,10 +1154,13 @@ void Pipeline::createGraphicsPipeline() {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
       .pNext = graphicsPipelineDesc_.useDynamicRendering_ ? &pipelineRenderingCreateInfo
                                                           : nullptr,
+      .flags = descriptorBufferMode_ ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
       .stageCount = uint32_t(shaderStages.size()),
       .pStages = shaderStages.data(),
-      .pVertexInputState = &graphicsPipelineDesc_.vertexInputCreateInfo,
-      .pInputAssemblyState = &inputAssembly,
+      // Mesh shaders produce their own primitives
+      .pVertexInputState =
+          useMeshShader ? nullptr : &graphicsPipelineDesc_.vertexInputCreateInfo,
+      .pInputAssemblyState = useMeshShader ? nullptr : &inputAssembly,
       .pViewportState = &viewportState,
       .pRasterizationState = &rasterizer,
       .pMultisampleState = &multisampling,
@@ -671,8 +1173,8 @@ void Pipeline::createGraphicsPipeline() {
       .basePipelineIndex = -1,               // Optional
   };
 
-  VK_CHECK(vkCreateGraphicsPipelines(context_->device(), VK_NULL_HANDLE, 1, &pipelineInfo,
-                                     nullptr, &vkPipeline_));
+  VK_CHECK(vkCreateGraphicsPipelines(context_->device(), context_->pipelineCache(), 1,
+                                     &pipelineInfo, nullptr, &vkPipeline_));
 
   context_->setVkObjectname(vkPipeline_, VK_OBJECT_TYPE_PIPELINE,
                             "Graphics pipeline: " + name_);
@@ -714,11 +1216,11 @@ void Pipeline::createComputePipeline() {
 
   VkComputePipelineCreateInfo computePipelineCreateInfo{
       .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-      .flags = 0,
+      .flags = descriptorBufferMode_ ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0u,
       .stage = shaderStage,
       .layout = vkPipelineLayout_,
   };
-  VK_CHECK(vkCreateComputePipelines(context_->device(), VK_NULL_HANDLE, 1,
+  VK_CHECK(vkCreateComputePipelines(context_->device(), context_->pipelineCache(), 1,
                                     &computePipelineCreateInfo, VK_NULL_HANDLE,
                                     &vkPipeline_));
   context_->setVkObjectname(vkPipeline_, VK_OBJECT_TYPE_PIPELINE,
@@ -820,8 +1322,8 @@ void Pipeline::createRayTracingPipeline() {
       .layout = vkPipelineLayout_,
   };
   VK_CHECK(vkCreateRayTracingPipelinesKHR(context_->device(), VK_NULL_HANDLE,
-                                          VK_NULL_HANDLE, 1, &rayTracingPipelineInfo,
-                                          nullptr, &vkPipeline_));
+                                          context_->pipelineCache(), 1,
+                                          &rayTracingPipelineInfo, nullptr, &vkPipeline_));
 
   context_->setVkObjectname(vkPipeline_, VK_OBJECT_TYPE_PIPELINE,
                             "RayTracing pipeline: " + name_);
@@ -848,38 +1350,6 @@ VkPipelineLayout Pipeline::createPipelineLayout(
   return pipelineLayout;
 }
 
-void Pipeline::initDescriptorPool() {
-  std::vector<SetDescriptor> sets;
-
-  if (bindPoint_ == VK_PIPELINE_BIND_POINT_GRAPHICS) {
-    sets = graphicsPipelineDesc_.sets_;
-  } else if (bindPoint_ == VK_PIPELINE_BIND_POINT_COMPUTE) {
-    sets = computePipelineDesc_.sets_;
-  } else if (bindPoint_ == VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR) {
-    sets = rayTracingPipelineDesc_.sets_;
-  }
-
-  std::vector<VkDescriptorPoolSize> poolSizes;
-  for (size_t setIndex = 0; const auto& set : sets) {
-    for (const auto& binding : set.bindings_) {
-      poolSizes.push_back({binding.descriptorType, MAX_DESCRIPTOR_SETS});
-    }
-  }
-
-  const VkDescriptorPoolCreateInfo descriptorPoolInfo = {
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-      .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT |
-               VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
-      .maxSets = MAX_DESCRIPTOR_SETS,
-      .poolSizeCount = static_cast<uint32_t>(poolSizes.size()),
-      .pPoolSizes = poolSizes.data(),
-  };
-  VK_CHECK(vkCreateDescriptorPool(context_->device(), &descriptorPoolInfo, nullptr,
-                                  &vkDescriptorPool_));
-  context_->setVkObjectname(vkDescriptorPool_, VK_OBJECT_TYPE_DESCRIPTOR_POOL,
-                            "Graphics pipeline descriptor pool: " + name_);
-}
-
 void Pipeline::initDescriptorLayout() {
   std::vector<SetDescriptor> sets;
 
@@ -898,7 +1368,11 @@ void Pipeline::initDescriptorLayout() {
                                                         // is disabled. See
                                                         // Context::createDefaultFeatureChain
   for (size_t setIndex = 0; const auto& set : sets) {
-    std::vector<VkDescriptorBindingFlags> bindFlags(set.bindings_.size(), flagsToEnable);
+    // Descriptor buffers have no update after bind flags, they are written with memcpy
+    std::vector<VkDescriptorBindingFlags> bindFlags(
+        set.bindings_.size(), descriptorBufferMode_
+                                  ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+                                  : flagsToEnable);
     /* this won't work for android */
     const VkDescriptorSetLayoutBindingFlagsCreateInfo extendedInfo{
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
@@ -919,14 +1393,23 @@ void Pipeline::initDescriptorLayout() {
       .bindingCount = static_cast<uint32_t>(set.bindings_.size()),
       .pBindings = !set.bindings_.empty() ? set.bindings_.data() : nullptr,
     };
+    const VkDescriptorSetLayoutCreateInfo descriptorBufferDslci = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &extendedInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT,
+        .bindingCount = dslci.bindingCount,
+        .pBindings = dslci.pBindings,
+    };
 
     VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
-    VK_CHECK(vkCreateDescriptorSetLayout(context_->device(), &dslci, nullptr,
-                                         &descriptorSetLayout));
+    VK_CHECK(vkCreateDescriptorSetLayout(
+        context_->device(), descriptorBufferMode_ ? &descriptorBufferDslci : &dslci,
+        nullptr, &descriptorSetLayout));
     context_->setVkObjectname(descriptorSetLayout, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
                               "Graphics pipeline descriptor set " +
                                   std::to_string(setIndex++) + " layout: " + name_);
     descriptorSets_[set.set_].vkLayout_ = descriptorSetLayout;
+    descriptorSets_[set.set_].bindings_ = set.bindings_;
   }
 }
 
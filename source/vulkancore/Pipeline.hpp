@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <span>
@@ -13,6 +15,8 @@ namespace VulkanCore {
 
 class Context;
 class Buffer;
+class DescriptorAllocator;
+class DescriptorBuffer;
 class RenderPass;
 class Sampler;
 class ShaderModule;
@@ -70,6 +74,10 @@ class Pipeline final {
     std::vector<SetDescriptor> sets_;
     std::weak_ptr<ShaderModule> vertexShader_;
     std::weak_ptr<ShaderModule> fragmentShader_;
+    // With a mesh shader the vertex shader, vertex input and topology are ignored. The
+    // task shader is optional. Needs Context::enableMeshShaderFeature()
+    std::weak_ptr<ShaderModule> taskShader_;
+    std::weak_ptr<ShaderModule> meshShader_;
     std::vector<VkPushConstantRange> pushConstants_;
     std::vector<VkDynamicState> dynamicStates_;
     bool useDynamicRendering_ = false;
@@ -100,6 +108,10 @@ class Pipeline final {
     void* fragmentSpecializationData = nullptr;
 
     std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates_;
+
+    // Keeps the descriptors in a descriptor buffer instead of descriptor sets, if
+    // VK_EXT_descriptor_buffer is enabled
+    bool useDescriptorBuffer_ = false;
   };
 
   struct ComputePipelineDescriptor {
@@ -108,6 +120,7 @@ class Pipeline final {
     std::vector<VkPushConstantRange> pushConstants_;
     std::vector<VkSpecializationMapEntry> specializationConsts_;
     void* specializationData_ = nullptr;
+    bool useDescriptorBuffer_ = false;
   };
 
   struct RayTracingPipelineDescriptor {
@@ -137,6 +150,10 @@ class Pipeline final {
 
   VkPipelineLayout vkPipelineLayout() const;
 
+  // Sets and bindResource work the same in both modes, but descriptors written to a
+  // descriptor buffer are visible right away, updateDescriptorSets has nothing to do
+  bool usesDescriptorBuffer() const { return descriptorBufferMode_; }
+
   void updatePushConstant(VkCommandBuffer commandBuffer, VkShaderStageFlags flags,
                           uint32_t size, const void* data);
 
@@ -151,6 +168,8 @@ class Pipeline final {
     uint32_t count_;
     std::string name_;
   };
+  // Pools are sized for exactly the requested sets. With a descriptor buffer the sets
+  // are appended to the buffer
   void allocateDescriptors(const std::vector<SetAndCount>& setAndCount);
 
   struct SetAndBindingIndex {
@@ -169,18 +188,51 @@ class Pipeline final {
     uint32_t index_ = 0;
     uint32_t offset_ = 0;
     VkDeviceSize bufferBytes = 0;
+    // VK_DESCRIPTOR_TYPE_MAX_ENUM: uniform buffer, sampled image, combined image sampler
+    // (textures with one sampler) or sampler, depending on the resources
+    VkDescriptorType type_ = VK_DESCRIPTOR_TYPE_MAX_ENUM;
   };
 
+  // Returns the index of a set that holds the bindings, to use with bindDescriptorSets.
+  // Identical bindings share the same set, which is allocated and written only the first
+  // time they are requested. index_ is used as the first array element of textures.
+  // Don't bind other resources to the returned sets. Allocating a set modifies the set
+  // list, so don't call it while command buffers are recorded in parallel
+  uint32_t descriptorSetFor(uint32_t set, const std::vector<SetBindings>& bindings);
+
   // void updateDescriptorSets(uint32_t set, uint32_t index,
   //                           const std::vector<SetBindings>& bindings);
+  // These write descriptor sets directly, they can't be used with a descriptor buffer
   void updateSamplersDescriptorSets(uint32_t set, uint32_t index,
                                     const std::vector<SetBindings>& bindings);
   void updateTexturesDescriptorSets(uint32_t set, uint32_t index,
                                     const std::vector<SetBindings>& bindings);
   void updateBuffersDescriptorSets(uint32_t set, uint32_t index, VkDescriptorType type,
                                    const std::vector<SetBindings>& bindings);
+  // Issues the writes of the bindResource calls since the last update, in a single
+  // vkUpdateDescriptorSets
   void updateDescriptorSets();
 
+  // bindResource only queues a write when the descriptors don't already hold the
+  // resources, and a second write to the same descriptors before the update replaces the
+  // first one
+  struct DescriptorStats {
+    uint64_t writesRequested = 0;
+    uint64_t writesSkipped = 0;    // the descriptors already held the resources
+    uint64_t writesCoalesced = 0;  // replaced by a later write before the update
+    uint64_t writesIssued = 0;     // VkWriteDescriptorSets passed to the driver
+    uint64_t updateCalls = 0;      // vkUpdateDescriptorSets calls
+    uint64_t cachedSetHits = 0;    // descriptorSetFor calls served by an existing set
+    uint32_t descriptorSets = 0;
+    uint32_t descriptorPools = 0;
+    uint64_t poolDescriptors = 0;  // descriptors the pools were created with
+    VkDeviceSize descriptorBufferBytes = 0;  // used by the descriptor buffer's sets
+  };
+  DescriptorStats descriptorStats() const;
+
+  // Resets the write counters, to measure them per frame
+  void resetDescriptorStats();
+
   /// @brief Assigns the resource to a position in the resource array specific
   /// to te resource's type
   void bindResource(uint32_t set, uint32_t binding, uint32_t index,
@@ -212,6 +264,33 @@ class Pipeline final {
                     VkAccelerationStructureKHR* accelStructHandle);
 
  private:
+  // The set a write goes to. key identifies its descriptors: the set's handle, or its
+  // offset in the descriptor buffer
+  struct WriteTarget {
+    uint32_t set = 0;
+    uint32_t index = 0;
+    VkDescriptorSet vkSet = VK_NULL_HANDLE;  // null with a descriptor buffer
+    uint64_t key = 0;
+  };
+  struct BindingKey {
+    uint64_t set = 0;
+    uint32_t binding = 0;
+    bool operator==(const BindingKey&) const = default;
+  };
+  struct BindingKeyHash {
+    size_t operator()(const BindingKey& key) const;
+  };
+  struct BoundResources {
+    VkDescriptorType type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+    uint32_t count = 0;
+    std::vector<uint64_t> handles;
+    std::vector<std::weak_ptr<const void>> owners;
+    // Index in writeDescSets_ of the write that hasn't been issued yet, valid while
+    // writeGeneration matches the pipeline's
+    size_t pendingWrite = 0;
+    uint64_t writeGeneration = UINT64_MAX;
+  };
+
   void createGraphicsPipeline();
 
   void createComputePipeline();
@@ -222,9 +301,37 @@ class Pipeline final {
       const std::vector<VkDescriptorSetLayout>& descLayouts,
       const std::vector<VkPushConstantRange>& pushConsts) const;
 
-  void initDescriptorPool();
   void initDescriptorLayout();
 
+  DescriptorAllocator& descriptorAllocator();
+
+  DescriptorBuffer& descriptorBuffer();
+
+  WriteTarget writeTarget(uint32_t set, uint32_t index);
+
+  void bindResources(uint32_t set, uint32_t index,
+                     const std::vector<SetBindings>& bindings);
+
+  // Returns null when the descriptors already hold the resources. Otherwise remembers
+  // them, forgets the descriptors the range overlaps and marks a pending write to the
+  // same descriptors as superseded. Owners are the objects the handles come from, a
+  // destroyed owner means its handle may have been reused by a new object
+  BoundResources* needsWrite(uint64_t dstSet, uint32_t binding,
+                             uint32_t arrayElement, uint32_t count, VkDescriptorType type,
+                             std::vector<uint64_t>&& handles,
+                             std::vector<std::weak_ptr<const void>>&& owners);
+
+  void forgetDescriptors(uint64_t dstSet, uint32_t binding);
+
+  // Queues the write for the next updateDescriptorSets, or writes the descriptors into
+  // the descriptor buffer. bound is what needsWrite returned, null for writes that
+  // aren't tracked. Texel buffers need their format with a descriptor buffer
+  void issueWrite(const VkWriteDescriptorSet& writeDescSet, const WriteTarget& target,
+                  BoundResources* bound, VkFormat texelFormat = VK_FORMAT_UNDEFINED);
+
+  void writeToDescriptorBuffer(const VkWriteDescriptorSet& writeDescSet,
+                               const WriteTarget& target, VkFormat texelFormat);
+
  private:
   const Context* context_ = nullptr;
   std::string name_;
@@ -235,21 +342,40 @@ class Pipeline final {
   VkPipeline vkPipeline_ = VK_NULL_HANDLE;
   VkPipelineLayout vkPipelineLayout_ = VK_NULL_HANDLE;
   VkRenderPass vkRenderPass_ = VK_NULL_HANDLE;
+  bool descriptorBufferMode_ = false;
 
   struct DescriptorSet {
     std::vector<VkDescriptorSet> vkSets_;
     VkDescriptorSetLayout vkLayout_ = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSetLayoutBinding> bindings_;
+    std::vector<VkDeviceSize> bufferOffsets_;  // used instead of vkSets_
   };
   std::unordered_map<uint32_t, DescriptorSet> descriptorSets_;
-  VkDescriptorPool vkDescriptorPool_ = VK_NULL_HANDLE;
+  std::unique_ptr<DescriptorAllocator> descriptorAllocator_;
+  std::unique_ptr<DescriptorBuffer> descriptorBuffer_;
   std::vector<VkPushConstantRange> pushConsts_;  // IDK
 
   std::list<std::vector<VkDescriptorBufferInfo>> bufferInfo_;
   std::list<VkBufferView> bufferViewInfo_;
   std::list<std::vector<VkDescriptorImageInfo>> imageInfo_;
-  std::vector<VkWriteDescriptorSetAccelerationStructureKHR> accelerationStructInfo_;
+  std::list<VkWriteDescriptorSetAccelerationStructureKHR> accelerationStructInfo_;
   std::vector<VkWriteDescriptorSet> writeDescSets_;
-  std::mutex mutex_;
+  std::atomic_bool hasPendingWrites_ = false;
+  mutable std::mutex mutex_;
+
+  // What the descriptors of each binding hold, by first array element
+  std::unordered_map<BindingKey, std::map<uint32_t, BoundResources>, BindingKeyHash>
+      boundResources_;
+  uint64_t writeGeneration_ = 0;  // incremented by each updateDescriptorSets
+
+  struct CachedSet {
+    uint32_t index = 0;
+    std::vector<uint64_t> contents;
+    std::vector<std::weak_ptr<const void>> owners;
+  };
+  // Sets created by descriptorSetFor, by set and hash of their contents
+  std::unordered_map<uint32_t, std::unordered_multimap<size_t, CachedSet>> cachedSets_;
+  DescriptorStats descriptorStats_;
 };
 
 }  // namespace VulkanCore
@@ -6,11 +6,15 @@
 #include <spirv_reflect.h>  // comes from spirv-reflect
 #endif
 
+#include <chrono>
 #include <cmath>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include "Context.hpp"
 
@@ -60,9 +64,74 @@ class CustomIncluder final : public glslang::TShader::Includer {
  private:
   std::string shaderDirectory;
 };
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                   start)
+      .count();
+}
+
+// Bump when anything that changes the generated SPIR-V but isn't part of the key changes
+constexpr uint64_t SPIRV_CACHE_VERSION = 1;
+
+uint64_t hashCombine(uint64_t hash, const void* data, size_t size) {
+  // 64 bit FNV-1a
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string spirvCacheFilePath(const std::string& directory, uint64_t key) {
+  std::ostringstream fileName;
+  fileName << std::hex << std::setw(16) << std::setfill('0') << key << ".spv";
+  return (std::filesystem::path(directory) / fileName.str()).string();
+}
+
+std::vector<char> readCachedSpirv(const std::string& filePath) {
+  std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return {};
+  }
+  std::vector<char> spirv(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(spirv.data(), spirv.size());
+
+  constexpr uint32_t spirvMagic = 0x07230203;
+  uint32_t magic = 0;
+  if (!file || spirv.size() < sizeof(magic) || spirv.size() % sizeof(uint32_t) != 0) {
+    return {};
+  }
+  std::memcpy(&magic, spirv.data(), sizeof(magic));
+  return magic == spirvMagic ? spirv : std::vector<char>();
+}
+
+void writeCachedSpirv(const std::string& filePath, const std::vector<char>& spirv) {
+  // Several threads may compile the same source, each one writes its own file and the
+  // last rename wins
+  const std::string tempFilePath =
+      filePath + "." +
+      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+  {
+    std::ofstream file(tempFilePath, std::ios::binary | std::ios::trunc);
+    file.write(spirv.data(), spirv.size());
+    if (!file) {
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempFilePath, filePath, error);
+}
 }  // namespace
 #endif
 
+namespace {
+std::mutex compileStatsMutex;
+VulkanCore::ShaderModule::CompileStats accumulatedCompileStats;
+std::string spirvCacheDirectory;
+}  // namespace
+
 namespace VulkanCore {
 
 ShaderModule::ShaderModule(const Context* context, const std::string& filePath,
@@ -93,6 +162,24 @@ VkShaderStageFlagBits ShaderModule::vkShaderStageFlags() const { return vkStageF
 
 const std::string& ShaderModule::entryPoint() const { return entryPoint_; }
 
+void ShaderModule::setSpirvCacheDirectory(const std::string& directory) {
+  std::lock_guard lock(compileStatsMutex);
+  spirvCacheDirectory = directory;
+  if (!directory.empty()) {
+    std::filesystem::create_directories(directory);
+  }
+}
+
+ShaderModule::CompileStats ShaderModule::compileStats() {
+  std::lock_guard lock(compileStatsMutex);
+  return accumulatedCompileStats;
+}
+
+void ShaderModule::resetCompileStats() {
+  std::lock_guard lock(compileStatsMutex);
+  accumulatedCompileStats = {};
+}
+
 static constexpr uint32_t MAX_RESOURCES_COUNT = 1000;
 
 #ifdef _WIN32
@@ -111,6 +198,10 @@ EShLanguage ShaderModule::shaderStageFromFileName(const char* fileName) {
     return EShLangClosestHit;
   } else if (util::endsWith(fileName, ".rahit")) {
     return EShLangAnyHit;
+  } else if (util::endsWith(fileName, ".task")) {
+    return EShLangTask;
+  } else if (util::endsWith(fileName, ".mesh")) {
+    return EShLangMesh;
   } else {
     ASSERT(false, "Add if/else for GLSL stage");
   }
@@ -164,12 +255,11 @@ std::vector<char> ShaderModule::glslToSpirv(const std::vector<char>& data,
                                             EShLanguage shaderStage,
                                             const std::string& shaderDir,
                                             const char* entryPoint) {
-  static bool glslangInitialized = false;
+  // glslang is safe to use from several threads once the process is initialized
+  static std::once_flag glslangInitialized;
+  std::call_once(glslangInitialized, []() { glslang::InitializeProcess(); });
 
-  if (!glslangInitialized) {
-    glslang::InitializeProcess();
-    glslangInitialized = true;
-  }
+  const auto preprocessStart = std::chrono::steady_clock::now();
 
   glslang::TShader tshadertemp(shaderStage);
   const char* glslCStr = data.data();
@@ -179,8 +269,12 @@ std::vector<char> ShaderModule::glslToSpirv(const std::vector<char>& data,
   glslang::EShTargetLanguageVersion langVersion = glslang::EShTargetSpv_1_0;
 
   if (shaderStage == EShLangRayGen || shaderStage == EShLangAnyHit ||
-      shaderStage == EShLangClosestHit || shaderStage == EShLangMiss) {
+      shaderStage == EShLangClosestHit || shaderStage == EShLangMiss ||
+      shaderStage == EShLangTask || shaderStage == EShLangMesh) {
     langVersion = glslang::EShTargetSpv_1_4;
+  } else if (shaderStage == EShLangCompute) {
+    // Subgroup operations need SPIR-V 1.3
+    langVersion = glslang::EShTargetSpv_1_3;
   }
 
   tshadertemp.setEnvInput(glslang::EShSourceGlsl, shaderStage, glslang::EShClientVulkan,
@@ -223,6 +317,40 @@ std::vector<char> ShaderModule::glslToSpirv(const std::vector<char>& data,
   // through shader correctly
   preprocessedGLSL = removeUnnecessaryLines(preprocessedGLSL);
 
+#ifdef _DEBUG
+  constexpr bool debugInfo = true;
+#else
+  constexpr bool debugInfo = false;
+#endif
+  uint64_t cacheKey = 0xcbf29ce484222325ull;
+  cacheKey = hashCombine(cacheKey, &SPIRV_CACHE_VERSION, sizeof(SPIRV_CACHE_VERSION));
+  cacheKey = hashCombine(cacheKey, preprocessedGLSL.data(), preprocessedGLSL.size());
+  cacheKey = hashCombine(cacheKey, &shaderStage, sizeof(shaderStage));
+  cacheKey = hashCombine(cacheKey, &clientVersion, sizeof(clientVersion));
+  cacheKey = hashCombine(cacheKey, &langVersion, sizeof(langVersion));
+  cacheKey = hashCombine(cacheKey, entryPoint, strlen(entryPoint));
+  cacheKey = hashCombine(cacheKey, &debugInfo, sizeof(debugInfo));
+
+  std::string cacheFilePath;
+  {
+    std::lock_guard lock(compileStatsMutex);
+    accumulatedCompileStats.preprocessMs += elapsedMs(preprocessStart);
+    if (!spirvCacheDirectory.empty()) {
+      cacheFilePath = spirvCacheFilePath(spirvCacheDirectory, cacheKey);
+    }
+  }
+
+  if (!cacheFilePath.empty()) {
+    auto cachedSpirv = readCachedSpirv(cacheFilePath);
+    if (!cachedSpirv.empty()) {
+      std::lock_guard lock(compileStatsMutex);
+      ++accumulatedCompileStats.cacheHits;
+      return cachedSpirv;
+    }
+  }
+
+  const auto compileStart = std::chrono::steady_clock::now();
+
   const char* preprocessedGLSLStr = preprocessedGLSL.c_str();
   tshader.setStrings(&preprocessedGLSLStr, 1);
 
@@ -272,6 +400,16 @@ std::vector<char> ShaderModule::glslToSpirv(const std::vector<char>& data,
   byteCode.resize(spirvData.size() * (sizeof(uint32_t) / sizeof(char)));
   std::memcpy(byteCode.data(), spirvData.data(), byteCode.size());
 
+  {
+    std::lock_guard lock(compileStatsMutex);
+    ++accumulatedCompileStats.cacheMisses;
+    accumulatedCompileStats.compileMs += elapsedMs(compileStart);
+  }
+
+  if (!cacheFilePath.empty()) {
+    writeCachedSpirv(cacheFilePath, byteCode);
+  }
+
   return byteCode;
 }
 #endif
@@ -16,6 +16,13 @@ class Context;
 
 class ShaderModule final {
  public:
+  struct CompileStats {
+    uint32_t cacheHits = 0;
+    uint32_t cacheMisses = 0;
+    double preprocessMs = 0.0;
+    double compileMs = 0.0;  // parse, link & SPIR-V generation of the cache misses
+  };
+
   explicit ShaderModule(const Context* context, const std::string& filePath,
                         const std::string& entryPoint,
                         VkShaderStageFlagBits stages, const std::string& name);
@@ -33,6 +40,16 @@ class ShaderModule final {
 
   const std::string& entryPoint() const;
 
+  // GLSL sources are looked up in, and added to, a SPIR-V cache in directory. Entries
+  // are keyed by a hash of the preprocessed source (which covers included files), the
+  // stage, target environment, entry point and compile options. Disabled when empty
+  static void setSpirvCacheDirectory(const std::string& directory);
+
+  // Accumulated over every GLSL ShaderModule, which can be created on several threads
+  static CompileStats compileStats();
+
+  static void resetCompileStats();
+
  private:
 #ifdef _WIN32
   EShLanguage shaderStageFromFileName(const char* fileName);
@@ -0,0 +1,174 @@
+#include "StagingArena.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+#include "Buffer.hpp"
+#include "CommandQueueManager.hpp"
+#include "Context.hpp"
+
+namespace VulkanCore {
+
+namespace {
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+StagingArena::StagingArena(const Context& context, VkDeviceSize blockSize,
+                           uint32_t maxBlocks, const std::string& name)
+    : context_(context), blockSize_(blockSize), maxBlocks_(maxBlocks), name_(name) {
+  ASSERT(blockSize_ > 0 && maxBlocks_ > 0, "Staging arena must have some capacity");
+}
+
+StagingArena::~StagingArena() {
+  for (const auto& block : blocks_) {
+    ASSERT(block->pendingAllocations == 0,
+           "Staging arena destroyed while some of its memory is in use");
+  }
+}
+
+StagingArena::Allocation StagingArena::allocate(CommandQueueManager& queueMgr,
+                                                VkDeviceSize size,
+                                                VkDeviceSize alignment) {
+  ZoneScopedN("StagingArena: allocate");
+  ASSERT(size > 0, "Can't allocate 0 bytes of staging memory");
+
+  std::unique_lock lock(mutex_);
+
+  Block* block = nullptr;
+  VkDeviceSize offset = 0;
+  if (size > blockSize_) {
+    block = createBlock(size, true);
+    ++stats_.dedicatedAllocations;
+  } else {
+    if (currentBlock_) {
+      offset = alignUp(currentBlock_->head, alignment);
+      if (offset + size > currentBlock_->size) {
+        currentBlock_ = nullptr;
+      }
+    }
+    if (!currentBlock_) {
+      currentBlock_ = acquireBlock(queueMgr, lock);
+      offset = 0;
+    }
+    block = currentBlock_;
+  }
+
+  block->head = offset + size;
+  ++block->pendingAllocations;
+
+  ++stats_.allocations;
+  stats_.bytesStaged += size;
+  stats_.bytesInFlight += size;
+  stats_.highWaterMark = std::max(stats_.highWaterMark, stats_.bytesInFlight);
+
+  queueMgr.disposeWhenSubmitCompletes([this, block, size]() { release(block, size); });
+
+  return Allocation{
+      .buffer = block->buffer->vkBuffer(),
+      .offset = offset,
+      .size = size,
+      .data = block->data + offset,
+  };
+}
+
+StagingArena::Allocation StagingArena::stage(CommandQueueManager& queueMgr,
+                                             const void* data, VkDeviceSize size,
+                                             VkDeviceSize alignment) {
+  const auto allocation = allocate(queueMgr, size, alignment);
+  memcpy(allocation.data, data, size);
+  return allocation;
+}
+
+StagingArena::Stats StagingArena::stats() const {
+  std::lock_guard lock(mutex_);
+  return stats_;
+}
+
+void StagingArena::resetStats() {
+  std::lock_guard lock(mutex_);
+  stats_ = Stats{
+      .bytesInFlight = stats_.bytesInFlight,
+      .highWaterMark = stats_.bytesInFlight,
+      .capacity = stats_.capacity,
+  };
+}
+
+StagingArena::Block* StagingArena::createBlock(VkDeviceSize size, bool dedicated) {
+  ZoneScopedN("StagingArena: createBlock");
+  auto block = std::make_unique<Block>();
+  block->buffer = context_.createStagingBuffer(
+      size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      "Staging arena " + name_ + (dedicated ? " dedicated block" : " block"));
+  block->data = static_cast<uint8_t*>(block->buffer->mappedMemory());
+  block->size = size;
+  block->dedicated = dedicated;
+
+  ++stats_.blocksCreated;
+  stats_.capacity += size;
+
+  blocks_.push_back(std::move(block));
+  return blocks_.back().get();
+}
+
+StagingArena::Block* StagingArena::findIdleBlock() {
+  for (const auto& block : blocks_) {
+    if (!block->dedicated && block->pendingAllocations == 0 &&
+        block.get() != currentBlock_) {
+      block->head = 0;
+      return block.get();
+    }
+  }
+  return nullptr;
+}
+
+StagingArena::Block* StagingArena::acquireBlock(CommandQueueManager& queueMgr,
+                                                std::unique_lock<std::mutex>& lock) {
+  if (auto* block = findIdleBlock()) {
+    return block;
+  }
+
+  if (sharedBlockCount() >= maxBlocks_) {
+    // The allocations are handed back by the queue manager, which calls release()
+    ZoneScopedN("StagingArena: stall");
+    ++stats_.stalls;
+    lock.unlock();
+    queueMgr.waitUntilAllSubmitsAreComplete();
+    lock.lock();
+    if (auto* block = findIdleBlock()) {
+      return block;
+    }
+    // Everything left is used by work that hasn't been submitted yet, so the arena
+    // grows past its budget until that work completes
+  }
+
+  return createBlock(blockSize_, false);
+}
+
+void StagingArena::release(Block* block, VkDeviceSize size) {
+  std::lock_guard lock(mutex_);
+  stats_.bytesInFlight -= size;
+  if (--block->pendingAllocations > 0) {
+    return;
+  }
+
+  if (block->dedicated || sharedBlockCount() > maxBlocks_) {
+    if (block == currentBlock_) {
+      currentBlock_ = nullptr;
+    }
+    stats_.capacity -= block->size;
+    std::erase_if(blocks_, [block](const auto& b) { return b.get() == block; });
+  } else if (block == currentBlock_) {
+    block->head = 0;
+  }
+}
+
+uint32_t StagingArena::sharedBlockCount() const {
+  return static_cast<uint32_t>(
+      std::count_if(blocks_.begin(), blocks_.end(),
+                    [](const auto& block) { return !block->dedicated; }));
+}
+
+}  // namespace VulkanCore
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Common.hpp"
+#include "Utility.hpp"
+
+namespace VulkanCore {
+
+class Buffer;
+class CommandQueueManager;
+class Context;
+
+// Sub-allocates staging memory for uploads from a few large, persistently mapped
+// buffers instead of creating (and mapping) one buffer per upload. Each allocation is
+// handed back to the arena when the submission of the command queue manager it was
+// allocated for completes, and a block is reused once all of its allocations are back.
+// Requests larger than a block get a dedicated buffer that is destroyed after use.
+// When maxBlocks blocks are in use the arena waits for the queue manager's submitted
+// work before growing past that (a stall), and blocks above the budget are destroyed as
+// soon as they become idle again
+class StagingArena final {
+ public:
+  struct Allocation {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* data = nullptr;  // mapped pointer to offset
+  };
+
+  struct Stats {
+    uint64_t bytesStaged = 0;
+    uint64_t allocations = 0;
+    uint64_t dedicatedAllocations = 0;
+    uint64_t blocksCreated = 0;
+    uint64_t stalls = 0;
+    VkDeviceSize bytesInFlight = 0;
+    VkDeviceSize highWaterMark = 0;  // of bytesInFlight
+    VkDeviceSize capacity = 0;       // of all the blocks currently alive
+  };
+
+  MOVABLE_ONLY(StagingArena);
+
+  explicit StagingArena(const Context& context, VkDeviceSize blockSize = 64 * 1024 * 1024,
+                        uint32_t maxBlocks = 4, const std::string& name = "");
+
+  ~StagingArena();
+
+  // The memory stays valid until the submission of queueMgr's current command buffer
+  // completes. alignment doesn't need to be a power of two (texel sizes of 12 bytes)
+  Allocation allocate(CommandQueueManager& queueMgr, VkDeviceSize size,
+                      VkDeviceSize alignment = 16);
+
+  // Allocates and copies data into the allocation
+  Allocation stage(CommandQueueManager& queueMgr, const void* data, VkDeviceSize size,
+                   VkDeviceSize alignment = 16);
+
+  Stats stats() const;
+
+  void resetStats();
+
+ private:
+  struct Block {
+    std::shared_ptr<Buffer> buffer;
+    uint8_t* data = nullptr;
+    VkDeviceSize size = 0;
+    VkDeviceSize head = 0;
+    uint32_t pendingAllocations = 0;
+    bool dedicated = false;
+  };
+
+  Block* createBlock(VkDeviceSize size, bool dedicated);
+
+  Block* findIdleBlock();
+
+  Block* acquireBlock(CommandQueueManager& queueMgr, std::unique_lock<std::mutex>& lock);
+
+  void release(Block* block, VkDeviceSize size);
+
+  uint32_t sharedBlockCount() const;
+
+ private:
+  const Context& context_;
+  VkDeviceSize blockSize_ = 0;
+  uint32_t maxBlocks_ = 0;
+  std::string name_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Block>> blocks_;
+  Block* currentBlock_ = nullptr;
+  Stats stats_;
+};
+
+}  // namespace VulkanCore
@@ -1,5 +1,7 @@
 #include "Texture.hpp"
 
+#include <numeric>
+
 #ifdef _WIN32
 #include <vulkan/vk_enum_string_helper.h>
 #endif
@@ -102,6 +104,41 @@ Texture::Texture(const Context& context, VkDevice device, VkImage image, VkForma
       1, layerCount_, name);
 }
 
+Texture::Texture(const Context& context, const VkImageCreateInfo& imageInfo,
+                 VmaAllocation memory, VkDeviceSize offset, const std::string& name)
+    : context_{context},
+      vmaAllocator_{context.memoryAllocator()},
+      usageFlags_{imageInfo.usage},
+      flags_{imageInfo.flags},
+      type_{imageInfo.imageType},
+      format_{imageInfo.format},
+      extents_{imageInfo.extent},
+      ownsVkImage_{true},
+      mipLevels_(imageInfo.mipLevels),
+      layerCount_(imageInfo.arrayLayers),
+      msaaSamples_(imageInfo.samples),
+      imageTiling_(imageInfo.tiling),
+      debugName_(name) {
+  ASSERT(imageInfo.initialLayout == VK_IMAGE_LAYOUT_UNDEFINED,
+         "Aliased images must start in VK_IMAGE_LAYOUT_UNDEFINED");
+
+  VK_CHECK(vkCreateImage(context.device(), &imageInfo, nullptr, &image_));
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(context.device(), image_, &memoryRequirements);
+  deviceSize_ = memoryRequirements.size;
+
+  // vmaAllocation_ stays null, the memory isn't ours to free
+  VK_CHECK(vmaBindImageMemory2(vmaAllocator_, memory, offset, image_, nullptr));
+
+  context.setVkObjectname(image_, VK_OBJECT_TYPE_IMAGE, "Image: " + name);
+
+  viewType_ = VulkanCore::imageTypeToImageViewType(type_, flags_, multiview_);
+
+  imageView_ =
+      createImageView(context, viewType_, format_, mipLevels_, layerCount_, name);
+}
+
 Texture::~Texture() {
   for (const auto imageView : imageViewFramebuffers_) {
     vkDestroyImageView(context_.device(), imageView.second, nullptr);
@@ -110,7 +147,11 @@ Texture::~Texture() {
   vkDestroyImageView(context_.device(), imageView_, nullptr);
 
   if (ownsVkImage_) {
-    vmaDestroyImage(vmaAllocator_, image_, vmaAllocation_);
+    if (vmaAllocation_ != nullptr) {
+      vmaDestroyImage(vmaAllocator_, image_, vmaAllocation_);
+    } else {
+      vkDestroyImage(context_.device(), image_, nullptr);
+    }
   }
 }
 
@@ -136,23 +177,51 @@ VkImageView Texture::vkImageView(uint32_t mipLevel) {
 void Texture::uploadAndGenMips(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
                                void* data) {
   uploadOnly(cmdBuffer, stagingBuffer, data);
-  context_.beginDebugUtilsLabel(cmdBuffer,
-                                "Transition to Shader_Read_Only & Generate mips",
-                                {1.0f, 0.0f, 0.0f, 1.0f});
-  generateMips(cmdBuffer);
-  if (layout_ != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    transitionImageLayout(cmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-  }
+  generateMipsForShaderRead(cmdBuffer);
+}
 
-  context_.endDebugUtilsLabel(cmdBuffer);
+void Texture::uploadAndGenMips(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                               const void* data) {
+  uploadOnly(queueMgr, cmdBuffer, data);
+  generateMipsForShaderRead(cmdBuffer);
 }
 
 void Texture::uploadOnly(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
                          void* data, uint32_t layer) {
-  context_.beginDebugUtilsLabel(cmdBuffer, "Uploading image", {1.0f, 0.0f, 0.0f, 1.0f});
+  stagingBuffer->copyDataToBuffer(data, layerSizeInBytes());
+  copyBufferToImage(cmdBuffer, stagingBuffer->vkBuffer(), 0, layer);
+}
 
-  stagingBuffer->copyDataToBuffer(
-      data, pixelSizeInBytes() * extents_.width * extents_.height * extents_.depth);
+void Texture::uploadOnly(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                         const void* data, uint32_t layer) {
+  const auto staging = context_.stagingArena().stage(queueMgr, data, layerSizeInBytes(),
+                                                     stagingAlignment());
+  copyBufferToImage(cmdBuffer, staging.buffer, staging.offset, layer);
+}
+
+void Texture::uploadMipChain(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
+                             const void* data) {
+  stagingBuffer->copyDataToBuffer(data, mipChainSizeInBytes());
+  copyBufferToMipChain(cmdBuffer, stagingBuffer->vkBuffer(), 0, true);
+}
+
+void Texture::uploadMipChain(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                             const void* data) {
+  const auto staging = context_.stagingArena().stage(
+      queueMgr, data, mipChainSizeInBytes(), stagingAlignment());
+  copyBufferToMipChain(cmdBuffer, staging.buffer, staging.offset, true);
+}
+
+void Texture::uploadMipChainOnly(CommandQueueManager& queueMgr,
+                                 VkCommandBuffer cmdBuffer, const void* data) {
+  const auto staging = context_.stagingArena().stage(
+      queueMgr, data, mipChainSizeInBytes(), stagingAlignment());
+  copyBufferToMipChain(cmdBuffer, staging.buffer, staging.offset, false);
+}
+
+void Texture::copyBufferToImage(VkCommandBuffer cmdBuffer, VkBuffer buffer,
+                                VkDeviceSize bufferOffset, uint32_t layer) {
+  context_.beginDebugUtilsLabel(cmdBuffer, "Uploading image", {1.0f, 0.0f, 0.0f, 1.0f});
 
   if (layout_ == VK_IMAGE_LAYOUT_UNDEFINED) {
     transitionImageLayout(cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
@@ -163,7 +232,7 @@ void Texture::uploadOnly(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
                               : VK_IMAGE_ASPECT_DEPTH_BIT
                 : VK_IMAGE_ASPECT_COLOR_BIT;
   const VkBufferImageCopy bufCopy = {
-      .bufferOffset = 0,
+      .bufferOffset = bufferOffset,
       .imageSubresource =
           {
               .aspectMask = aspectMask,
@@ -179,11 +248,86 @@ void Texture::uploadOnly(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
           },
       .imageExtent = extents_,
   };
-  vkCmdCopyBufferToImage(cmdBuffer, stagingBuffer->vkBuffer(), image_,
-                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufCopy);
+  vkCmdCopyBufferToImage(cmdBuffer, buffer, image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         1, &bufCopy);
   context_.endDebugUtilsLabel(cmdBuffer);
 }
 
+void Texture::copyBufferToMipChain(VkCommandBuffer cmdBuffer, VkBuffer buffer,
+                                   VkDeviceSize bufferOffset,
+                                   bool transitionToShaderRead) {
+  context_.beginDebugUtilsLabel(cmdBuffer, "Uploading mip chain",
+                                {1.0f, 0.0f, 0.0f, 1.0f});
+
+  if (layout_ != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    transitionImageLayout(cmdBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  }
+
+  std::vector<VkBufferImageCopy> copies;
+  copies.reserve(mipLevels_);
+  VkDeviceSize offset = bufferOffset;
+  for (uint32_t level = 0; level < mipLevels_; ++level) {
+    const VkExtent3D extents = {
+        .width = std::max(1u, extents_.width >> level),
+        .height = std::max(1u, extents_.height >> level),
+        .depth = std::max(1u, extents_.depth >> level),
+    };
+    copies.push_back(VkBufferImageCopy{
+        .bufferOffset = offset,
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = level,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageExtent = extents,
+    });
+    offset += imageSizeInBytes(format_, extents);
+  }
+  vkCmdCopyBufferToImage(cmdBuffer, buffer, image_, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(copies.size()), copies.data());
+
+  if (transitionToShaderRead) {
+    transitionImageLayout(cmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+  context_.endDebugUtilsLabel(cmdBuffer);
+}
+
+void Texture::generateMipsForShaderRead(VkCommandBuffer cmdBuffer) {
+  context_.beginDebugUtilsLabel(cmdBuffer,
+                                "Transition to Shader_Read_Only & Generate mips",
+                                {1.0f, 0.0f, 0.0f, 1.0f});
+  generateMips(cmdBuffer);
+  if (layout_ != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+    transitionImageLayout(cmdBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+
+  context_.endDebugUtilsLabel(cmdBuffer);
+}
+
+VkDeviceSize Texture::layerSizeInBytes() const {
+  return imageSizeInBytes(format_, extents_);
+}
+
+VkDeviceSize Texture::stagingAlignment() const {
+  // bufferOffset must be a multiple of the texel (or block) size and of 4
+  return std::lcm(VkDeviceSize(16), VkDeviceSize(bytesPerBlock(format_)));
+}
+
+VkDeviceSize Texture::mipChainSizeInBytes() const {
+  VkDeviceSize size = 0;
+  for (uint32_t level = 0; level < mipLevels_; ++level) {
+    const VkExtent3D extents = {
+        .width = std::max(1u, extents_.width >> level),
+        .height = std::max(1u, extents_.height >> level),
+        .depth = std::max(1u, extents_.depth >> level),
+    };
+    size += imageSizeInBytes(format_, extents);
+  }
+  return size;
+}
+
 void Texture::addReleaseBarrier(VkCommandBuffer cmdBuffer, uint32_t srcQueueFamilyIndex,
                                 uint32_t dstQueueFamilyIndex) {
   VkImageMemoryBarrier2 releaseBarrier = {
@@ -403,6 +547,9 @@ void Texture::generateMips(VkCommandBuffer cmdBuffer) {
   if (!generateMips_) {
     return;
   }
+  ASSERT(!isBlockCompressed(format_),
+         "Block compressed textures can't be blitted, upload their mips with "
+         "uploadMipChain");
   context_.beginDebugUtilsLabel(cmdBuffer, "Generate Mips", {0.0f, 1.0f, 0.0f, 1.0f});
   VkFormatProperties formatProperties;
   vkGetPhysicalDeviceFormatProperties(context_.physicalDevice().vkPhysicalDevice(),
@@ -521,7 +668,8 @@ void Texture::generateMips(VkCommandBuffer cmdBuffer) {
   context_.endDebugUtilsLabel(cmdBuffer);
 }
 
-std::vector<std::shared_ptr<VkImageView>> Texture::generateViewForEachMips() {
+std::vector<std::shared_ptr<VkImageView>> Texture::generateViewForEachMips(
+    VkFormat format) {
   std::vector<std::shared_ptr<VkImageView>> output;
   output.reserve(mipLevels_);
 
@@ -534,7 +682,7 @@ std::vector<std::shared_ptr<VkImageView>> Texture::generateViewForEachMips() {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = image_,
         .viewType = viewType_,
-        .format = format_,
+        .format = format == VK_FORMAT_UNDEFINED ? format_ : format,
         .components =
             {
                 .r = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -9,6 +9,7 @@
 namespace VulkanCore {
 
 class Buffer;
+class CommandQueueManager;
 class Context;
 
 class Texture final {
@@ -30,10 +31,20 @@ class Texture final {
                    VkFormat format, VkExtent3D extents, uint32_t numlayers = 1,
                    bool multiview = false, const std::string& name = "");
 
+  // Creates the image in memory that belongs to someone else, offset bytes into memory,
+  // so several textures can alias the same memory. The memory must outlive the texture
+  explicit Texture(const Context& context, const VkImageCreateInfo& imageInfo,
+                   VmaAllocation memory, VkDeviceSize offset,
+                   const std::string& name = "");
+
   ~Texture();
 
   VkFormat vkFormat() const { return format_; }
 
+  VkImageUsageFlags vkUsageFlags() const { return usageFlags_; }
+
+  VkImageCreateFlags vkCreateFlags() const { return flags_; }
+
   VkImageView vkImageView(uint32_t mipLevel = UINT32_MAX);
 
   VkImage vkImage() const { return image_; }
@@ -49,9 +60,32 @@ class Texture final {
   void uploadAndGenMips(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
                         void* data);
 
+  // Stages data in the context's staging arena, which recycles the memory when the
+  // submission of queueMgr's current command buffer completes
+  void uploadAndGenMips(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                        const void* data);
+
   void uploadOnly(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
                   void* data, uint32_t layer = 0);
 
+  void uploadOnly(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                  const void* data, uint32_t layer = 0);
+
+  // Uploads a complete mip chain, data holds every level tightly packed starting with
+  // level 0. The texture ends up in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+  void uploadMipChain(VkCommandBuffer cmdBuffer, const Buffer* stagingBuffer,
+                      const void* data);
+
+  void uploadMipChain(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                      const void* data);
+
+  // Like uploadMipChain, but leaves the texture in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+  // for transfer queues that can't transition it to a shader layout
+  void uploadMipChainOnly(CommandQueueManager& queueMgr, VkCommandBuffer cmdBuffer,
+                          const void* data);
+
+  VkDeviceSize mipChainSizeInBytes() const;
+
   void addReleaseBarrier(VkCommandBuffer cmdBuffer,
                          uint32_t srcQueueFamilyIndex,
                          uint32_t dstQueueFamilyIndex);
@@ -71,15 +105,32 @@ class Texture final {
 
   uint32_t numMipLevels() const;
 
+  // Whether the texture was created to have its mips generated from level 0
+  bool generatesMips() const { return generateMips_; }
+
   void generateMips(VkCommandBuffer cmdBuffer);
 
-  std::vector<std::shared_ptr<VkImageView>> generateViewForEachMips();
+  // format reinterprets the levels, for mutable format textures
+  std::vector<std::shared_ptr<VkImageView>> generateViewForEachMips(
+      VkFormat format = VK_FORMAT_UNDEFINED);
 
   VkSampleCountFlagBits VkSampleCount() const;
 
  private:
   uint32_t getMipLevelsCount(uint32_t texWidth, uint32_t texHeight) const;
 
+  void copyBufferToImage(VkCommandBuffer cmdBuffer, VkBuffer buffer,
+                         VkDeviceSize bufferOffset, uint32_t layer);
+
+  void copyBufferToMipChain(VkCommandBuffer cmdBuffer, VkBuffer buffer,
+                            VkDeviceSize bufferOffset, bool transitionToShaderRead);
+
+  void generateMipsForShaderRead(VkCommandBuffer cmdBuffer);
+
+  VkDeviceSize layerSizeInBytes() const;
+
+  VkDeviceSize stagingAlignment() const;
+
   VkImageView createImageView(const Context& context, VkImageViewType viewType,
                               VkFormat format, uint32_t numMipLevels,
                               uint32_t layers, const std::string& name = "");